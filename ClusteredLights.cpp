@@ -0,0 +1,370 @@
+#include "ClusteredLights.h"
+#include "CommandBuffer.h"
+#include "FrameArena.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "Parallel.h"
+#include "Scene.h"
+#include "ShaderSource.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+PointLights  pointLights;
+
+const int  NumLightArrays = 7;
+
+namespace {
+
+GLuint   program = 0;
+GLuint   buffers[3];          // lights, clusters, light indices
+GLuint   textures[3];
+GLint    samplers[3];
+GLint    projectionLoc, dimsLoc, viewportLoc, depthLoc;
+unsigned locationGeneration = 0;     // shaderGeneration() of the locations above
+
+mat4     clusterProjection = Ortho(-6.0, 6.0, -6.0, 6.0, 0.5, 3.0);
+GLfloat  nearPlane = 0.5;
+GLfloat  sliceScale = ClusterZ / log(3.0 / 0.5);
+int      viewportWidth = 1, viewportHeight = 1;
+
+// Inclusive cluster ranges touched by one light; empty when x0 > x1
+struct LightBounds {
+	short  x0, x1, y0, y1, z0, z1;
+};
+
+std::vector<GLfloat>      lightData;       // 8 floats per light
+std::vector<LightBounds>  lightBounds;
+std::vector<GLuint>       clusterData;     // first index and count per cluster
+std::vector<GLuint>       lightIndices;
+
+int
+tileOf(GLfloat ndc, int tiles)
+{
+	int t = (int)floor((0.5 * ndc + 0.5) * tiles);
+	return std::min(std::max(t, 0), tiles - 1);
+}
+
+int
+sliceOf(GLfloat depth)
+{
+	int s = (int)floor(log(depth / nearPlane) * sliceScale);
+	return std::min(std::max(s, 0), ClusterZ - 1);
+}
+
+// Eye space light i into `data` and its cluster range into `b`
+void
+boundLight(const PointLights& pl, const mat4& view, int i, GLfloat* data, LightBounds* b)
+{
+	vec4 p = view * vec4(pl.x[i], pl.y[i], pl.z[i], 1.0);
+	GLfloat r = pl.radius[i];
+
+	data[0] = p.x; data[1] = p.y; data[2] = p.z; data[3] = r;
+	data[4] = pl.r[i]; data[5] = pl.g[i]; data[6] = pl.b[i]; data[7] = 0.0;
+
+	b->x0 = 1; b->x1 = 0;
+
+	GLfloat farPlane = nearPlane * exp(ClusterZ / sliceScale);
+	GLfloat dmin = std::max(-p.z - r, nearPlane);
+	GLfloat dmax = std::min(-p.z + r, farPlane);
+	if (dmin > dmax) { return; }
+
+	// The projection of the eye space box around the sphere, cut to the
+	//   visible depths, covers the projection of the sphere.
+	GLfloat lo[2] = { 1e30f, 1e30f }, hi[2] = { -1e30f, -1e30f };
+	for (int c = 0; c < 8; c++) {
+		vec4 q = clusterProjection * vec4((c & 1) ? p.x + r : p.x - r,
+			(c & 2) ? p.y + r : p.y - r, (c & 4) ? -dmax : -dmin, 1.0);
+		for (int k = 0; k < 2; k++) {
+			GLfloat ndc = q[k] / q.w;
+			lo[k] = std::min(lo[k], ndc);
+			hi[k] = std::max(hi[k], ndc);
+		}
+	}
+	if (hi[0] < -1.0 || lo[0] > 1.0 || hi[1] < -1.0 || lo[1] > 1.0) { return; }
+
+	b->x0 = tileOf(lo[0], ClusterX); b->x1 = tileOf(hi[0], ClusterX);
+	b->y0 = tileOf(lo[1], ClusterY); b->y1 = tileOf(hi[1], ClusterY);
+	b->z0 = sliceOf(dmin); b->z1 = sliceOf(dmax);
+}
+
+// Counts (fill == false) or writes (fill == true) the lists of one slice
+void
+binSlice(int z, int numLights, bool fill)
+{
+	GLuint* cluster = &clusterData[2 * z * ClusterX * ClusterY];
+	GLuint  cursor[ClusterX * ClusterY];
+
+	for (int c = 0; c < ClusterX * ClusterY; c++) {
+		if (fill) { cursor[c] = cluster[2 * c]; }
+		else { cluster[2 * c + 1] = 0; }
+	}
+
+	for (int i = 0; i < numLights; i++) {
+		const LightBounds& b = lightBounds[i];
+		if (b.x0 > b.x1 || z < b.z0 || z > b.z1) { continue; }
+
+		for (int y = b.y0; y <= b.y1; y++) {
+			for (int x = b.x0; x <= b.x1; x++) {
+				int c = y * ClusterX + x;
+				if (fill) { lightIndices[cursor[c]++] = i; }
+				else { cluster[2 * c + 1]++; }
+			}
+		}
+	}
+}
+
+// Orphans the buffer and fills it; never leaves it empty
+template <typename T>
+void
+uploadBuffer(GLuint buffer, const std::vector<T>& data)
+{
+	size_t bytes = data.size() * sizeof(T);
+	stateBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, (size_t)16), NULL, GL_STREAM_DRAW);
+	if (bytes > 0) {
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data.data());
+	}
+}
+
+// A reloaded shader may have moved its uniforms
+void
+lookUpLocations()
+{
+	projectionLoc = glGetUniformLocation(program, "Projection");
+	dimsLoc = glGetUniformLocation(program, "ClusterDims");
+	viewportLoc = glGetUniformLocation(program, "ViewportSize");
+	depthLoc = glGetUniformLocation(program, "ClusterDepth");
+	samplers[0] = glGetUniformLocation(program, "Lights");
+	samplers[1] = glGetUniformLocation(program, "Clusters");
+	samplers[2] = glGetUniformLocation(program, "LightIndices");
+	locationGeneration = shaderGeneration();
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+initPointLights(PointLights* pl, int capacity)
+{
+	memset(pl, 0, sizeof(*pl));
+	pl->capacity = capacity;
+
+	float* block = new float[NumLightArrays * std::max(capacity, 1)];
+	float** arrays[NumLightArrays] = {
+		&pl->x, &pl->y, &pl->z, &pl->radius, &pl->r, &pl->g, &pl->b
+	};
+	for (int i = 0; i < NumLightArrays; i++) {
+		*arrays[i] = block + i * capacity;
+	}
+}
+
+void
+freePointLights(PointLights* pl)
+{
+	delete [] pl->x;
+	memset(pl, 0, sizeof(*pl));
+}
+
+int
+addPointLight(PointLights* pl, const vec3& position, const vec3& color, float radius)
+{
+	if (pl->count >= pl->capacity) { return -1; }
+
+	int i = pl->count++;
+	pl->x[i] = position.x; pl->y[i] = position.y; pl->z[i] = position.z;
+	pl->radius[i] = radius;
+	pl->r[i] = color.x; pl->g[i] = color.y; pl->b[i] = color.z;
+
+	return i;
+}
+
+void
+addRandomPointLights(PointLights* pl, int count, GLfloat extent, unsigned seed)
+{
+	srand(seed);
+	for (int i = 0; i < count; i++) {
+		vec3 pos(extent * (2.0 * rand() / RAND_MAX - 1.0),
+			extent * (2.0 * rand() / RAND_MAX - 1.0), 2.0 * rand() / RAND_MAX - 1.0);
+		vec3 color(1.0 * rand() / RAND_MAX, 1.0 * rand() / RAND_MAX, 1.0 * rand() / RAND_MAX);
+		addPointLight(pl, pos, color, 0.3 + 0.7 * rand() / RAND_MAX);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+GLuint
+initClusteredLighting()
+{
+	if (program != 0) { return program; }
+
+	program = InitShader("vcluster.glsl", "fcluster.glsl");
+	followShaderProgram(&program);
+	lookUpLocations();
+
+	const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	glGenBuffers(3, buffers);
+	glGenTextures(3, textures);
+	for (int k = 0; k < 3; k++) {
+		stateBindBuffer(GL_TEXTURE_BUFFER, buffers[k]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		stateBindTexture(1 + k, GL_TEXTURE_BUFFER, textures[k]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[k], buffers[k]);
+	}
+
+	clusterData.assign(2 * NumClusters, 0);
+
+	return program;
+}
+
+void
+setClusterProjection(const mat4& projection, GLfloat zNear, GLfloat zFar,
+	int width, int height)
+{
+	clusterProjection = projection;
+	nearPlane = zNear;
+	sliceScale = ClusterZ / log(zFar / zNear);
+	viewportWidth = std::max(width, 1);
+	viewportHeight = std::max(height, 1);
+}
+
+//----------------------------------------------------------------------------
+
+void
+binLights(const PointLights& pl, const mat4& view)
+{
+	double t = timeNow();
+	int n = pl.count;
+
+	lightData.resize(8 * n);
+	lightBounds.resize(n);
+	clusterData.resize(2 * NumClusters);
+
+	parallelFor(n, std::max(evenGrain(n), 256), [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			boundLight(pl, view, i, &lightData[8 * i], &lightBounds[i]);
+		}
+	});
+
+	// Slices are independent: count, lay the lists out, then fill them
+	parallelFor(ClusterZ, 1, [&](int begin, int end, int) {
+		for (int z = begin; z < end; z++) { binSlice(z, n, false); }
+	});
+
+	GLuint total = 0, most = 0;
+	for (int c = 0; c < NumClusters; c++) {
+		clusterData[2 * c] = total;
+		total += clusterData[2 * c + 1];
+		most = std::max(most, clusterData[2 * c + 1]);
+	}
+	lightIndices.resize(total);
+
+	parallelFor(ClusterZ, 1, [&](int begin, int end, int) {
+		for (int z = begin; z < end; z++) { binSlice(z, n, true); }
+	});
+
+	uploadBuffer(buffers[0], lightData);
+	uploadBuffer(buffers[1], clusterData);
+	uploadBuffer(buffers[2], lightIndices);
+
+	frameStats.numLights += n;
+	frameStats.lightIndices += total;
+	frameStats.maxClusterLights = std::max(frameStats.maxClusterLights, (int)most);
+	frameStats.clusterMs += (timeNow() - t) * 1000.0;
+}
+
+void
+bindClusteredLighting()
+{
+	if (locationGeneration != shaderGeneration()) {
+		lookUpLocations();
+	}
+	stateUseProgram(program);
+	glUniformMatrix4fv(projectionLoc, 1, GL_TRUE, clusterProjection);
+	glUniform3i(dimsLoc, ClusterX, ClusterY, ClusterZ);
+	glUniform2f(viewportLoc, viewportWidth, viewportHeight);
+	glUniform2f(depthLoc, nearPlane, sliceScale);
+
+	for (int k = 0; k < 3; k++) {
+		stateBindTexture(1 + k, GL_TEXTURE_BUFFER, textures[k]);
+		glUniform1i(samplers[k], 1 + k);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+void
+lightingBenchmark(int maxLights, int frames)
+{
+	const int width = 1024, height = 1024;
+	GLuint clusterProgram = initClusteredLighting();
+
+	// Small objects in front of a backdrop that covers the whole view, so
+	//   every pixel runs the lighting loop
+	Scene s;
+	initScene(&s, 2048, 32);
+	int backdrop = addMaterial(&s, color4(0.2, 0.2, 0.2, 1.0), color4(0.8, 0.8, 0.8, 1.0),
+		color4(0.0, 1.0, 0.0, 1.0), 100.0);
+	addNode(&s, Translate(0.0, 0.0, -0.5) * Scale(12.0, 12.0, 0.1), CubeMesh, backdrop,
+		GL_TRIANGLES, 0);
+	addRandomNodes(&s, 2000, 5.0, 1);
+
+	Light light;
+	light.position = point4(0.0, 0.0, -1.0, 0.0);
+	light.ambient = color4(0.5, 0.5, 0.5, 1.0);
+	light.diffuse = color4(1.0, 1.0, 1.0, 1.0);
+	light.specular = color4(0.0, 1.0, 0.0, 1.0);
+
+	mat4 view = Translate(0.0, 0.0, -2.0);
+	stateViewport(0, 0, width, height);
+	setClusterProjection(Ortho(-6.0, 6.0, -6.0, 6.0, 0.5, 3.0), 0.5, 3.0, width, height);
+	stateEnable(GL_DEPTH_TEST);
+
+	PointLights pl;
+	initPointLights(&pl, maxLights);
+
+	std::cout << "lighting: " << s.count << " objects, " << width << "x" << height << ", "
+	          << ClusterX << "x" << ClusterY << "x" << ClusterZ << " clusters, "
+	          << workerCount() << " threads on " << glGetString(GL_RENDERER) << std::endl
+	          << "  lights   bin ms  frame ms  avg/cluster  max/cluster" << std::endl;
+
+	for (int n = 0; ; n = (n == 0) ? 16 : std::min(2 * n, maxLights)) {
+		pl.count = 0;
+		addRandomPointLights(&pl, n, 6.0, 1);
+
+		double bin = 0.0, frame = 0.0;
+		for (int f = 0; f <= frames; f++) {
+			beginFrameStats();
+			resetFrameArena();
+			glFinish();
+			double t = timeNow();
+
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			binLights(pl, view);
+			recordScene(s, view, light);
+			bindClusteredLighting();
+			submitCommands(clusterProgram, light);
+			glFinish();
+
+			// The first frame warms up the buffers
+			if (f > 0) {
+				bin += frameStats.clusterMs;
+				frame += (timeNow() - t) * 1000.0;
+			}
+		}
+
+		std::cout << "  " << n << "\t" << bin / frames << "\t" << frame / frames << "\t"
+		          << double(frameStats.lightIndices) / NumClusters << "\t"
+		          << frameStats.maxClusterLights << std::endl;
+
+		if (n >= maxLights) { break; }
+	}
+
+	freePointLights(&pl);
+	freeScene(&s);
+}
@@ -0,0 +1,70 @@
+#ifndef __CLUSTEREDLIGHTS_H__
+#define __CLUSTEREDLIGHTS_H__
+
+#include "Angel.h"
+
+//----------------------------------------------------------------------------
+//
+//  Clustered forward shading for many point lights.
+//
+//  The view volume is cut into ClusterX x ClusterY screen tiles and
+//    ClusterZ depth slices, spaced exponentially between the near and far
+//    planes.  binLights() moves the lights into eye space and, on the
+//    worker pool, builds the list of lights whose sphere of influence
+//    touches each cluster.  The light data, one (first, count) pair per
+//    cluster and the packed index lists are uploaded to three buffer
+//    textures.  The fragment shader finds its own cluster and loops over
+//    that list only, so its cost follows the lights near the pixel rather
+//    than the total number of lights.
+//
+//  The point lights shade with the material products of the main light
+//    (AmbientProduct, DiffuseProduct, SpecularProduct), tinted by the
+//    color of each light.
+//
+
+const int  ClusterX = 16;
+const int  ClusterY = 16;
+const int  ClusterZ = 24;
+const int  NumClusters = ClusterX * ClusterY * ClusterZ;
+
+// World space point lights, structure-of-arrays
+struct PointLights {
+	int     count;
+	int     capacity;
+	float*  x;  float* y;  float* z;
+	float*  radius;                      // influence ends here
+	float*  r;  float* g;  float* b;
+};
+
+extern PointLights  pointLights;
+
+void initPointLights(PointLights* pl, int capacity);
+void freePointLights(PointLights* pl);
+
+// Returns the index of the new light, or -1 when the set is full
+int  addPointLight(PointLights* pl, const vec3& position, const vec3& color,
+                   float radius);
+
+// Scatters `count` lights through [-extent, extent]^2 x [-1, 1]; the same
+//   seed gives the same lights.
+void addRandomPointLights(PointLights* pl, int count, GLfloat extent, unsigned seed);
+
+// Builds the clustered shading program and its buffers; returns the program
+GLuint initClusteredLighting();
+
+// Call whenever the projection or the viewport changes
+void setClusterProjection(const mat4& projection, GLfloat zNear, GLfloat zFar,
+                          int width, int height);
+
+// Assigns the lights to clusters for this frame's view and uploads the lists
+void binLights(const PointLights& pl, const mat4& view);
+
+// Makes the clustered program current with its buffer textures bound
+void bindClusteredLighting();
+
+// Renders a fixed set of objects with 0 up to `maxLights` lights (doubling
+//   each time) and reports binning and frame times.  Needs a current GL
+//   context.
+void lightingBenchmark(int maxLights, int frames);
+
+#endif // __CLUSTEREDLIGHTS_H__
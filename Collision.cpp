@@ -0,0 +1,501 @@
+#include "Collision.h"
+#include "Parallel.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+struct StaticBox {
+	vec3   center;
+	vec3   axis[3];      // unit length
+	vec3   half;         // half extent along each axis
+	vec3   lo, hi;       // world-space bounds for early rejection
+};
+
+struct StaticSphere {
+	vec3   center;
+	float  radius;
+};
+
+struct ContactPair {
+	int    a, b;
+};
+
+std::vector<StaticBox>     staticBoxes;
+std::vector<StaticSphere>  staticSpheres;
+
+bool  boundsEnabled = false;
+vec3  boundsLo, boundsHi;
+
+// Uniform grid over the bodies.  Cells map to buckets either directly
+//   (dense grid covering the bodies' bounds) or through a hash.
+struct SpatialGrid {
+	vec3      origin;
+	float     invCell;
+	int       dims[3];
+	bool      hashed;
+	unsigned  mask;
+	int       numBuckets;
+
+	int bucket(int x, int y, int z) const
+	{
+		if (hashed) {
+			// Unsigned before multiplying, so the products wrap
+			return (int)((((unsigned)x * 73856093u) ^ ((unsigned)y * 19349663u)
+				^ ((unsigned)z * 83492791u)) & mask);
+		}
+		if (x < 0 || y < 0 || z < 0 || x >= dims[0] || y >= dims[1] || z >= dims[2]) {
+			return -1;
+		}
+		return x + dims[0] * (y + dims[1] * z);
+	}
+};
+
+// Grid scratch, reused from step to step
+std::vector<int>    bodyCellX, bodyCellY, bodyCellZ, bodyBucket;
+std::vector<int>    bucketStart, bucketCursor;
+
+// Bodies sorted by bucket, with copies of what the pair search reads
+std::vector<int>    sortedBody;
+std::vector<float>  sortedX, sortedY, sortedZ, sortedR;
+std::vector<int>    cellX, cellY, cellZ;
+
+// Results of each parallel chunk, merged in chunk order
+std::vector< std::vector<ContactPair> >  chunkContacts;
+std::vector<int>                         chunkCandidates;
+std::vector<int>                         chunkStatic;
+std::vector<vec4>                        chunkLo, chunkHi;
+
+inline vec3
+column(const mat4& m, int k)
+{
+	return vec3(m[0][k], m[1][k], m[2][k]);
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+addStaticBox(const mat4& model)
+{
+	StaticBox b;
+	b.center = vec3(model[0][3], model[1][3], model[2][3]);
+
+	vec3 extent(0.0);
+	for (int k = 0; k < 3; k++) {
+		vec3 a = column(model, k);
+		GLfloat len = length(a);
+		b.axis[k] = a / len;
+		b.half[k] = 0.5 * len;
+		// world-space extent of the box along x, y and z
+		extent += vec3(fabs(a.x), fabs(a.y), fabs(a.z)) * 0.5;
+	}
+	b.lo = b.center - extent;
+	b.hi = b.center + extent;
+
+	staticBoxes.push_back(b);
+}
+
+// A uniformly scaled sphere stays a sphere; anything else is approximated
+//   by its bounding box (the unit sphere fits the cube of side 2).
+void
+addStaticSphere(const mat4& model)
+{
+	GLfloat sx = length(column(model, 0));
+	GLfloat sy = length(column(model, 1));
+	GLfloat sz = length(column(model, 2));
+
+	if (fabs(sx - sy) < 1.0e-4 && fabs(sy - sz) < 1.0e-4) {
+		StaticSphere s;
+		s.center = vec3(model[0][3], model[1][3], model[2][3]);
+		s.radius = sx;
+		staticSpheres.push_back(s);
+	}
+	else {
+		addStaticBox(model * Scale(2.0, 2.0, 2.0));
+	}
+}
+
+void
+clearStaticColliders()
+{
+	staticBoxes.clear();
+	staticSpheres.clear();
+}
+
+void
+setCollisionBounds(const vec3& lo, const vec3& hi)
+{
+	boundsEnabled = true;
+	boundsLo = lo;
+	boundsHi = hi;
+}
+
+//----------------------------------------------------------------------------
+// Push body i out along n by depth and remove the approaching part of its
+//   velocity (scaled by the restitution).
+
+static inline void
+pushOut(ParticleSystem* ps, int i, const vec3& n, float depth, float restitution)
+{
+	ps->px[i] += n.x * depth;
+	ps->py[i] += n.y * depth;
+	ps->pz[i] += n.z * depth;
+
+	float vn = ps->vx[i] * n.x + ps->vy[i] * n.y + ps->vz[i] * n.z;
+	if (vn < 0.0) {
+		float j = (1.0 + restitution) * vn;
+		ps->vx[i] -= n.x * j;
+		ps->vy[i] -= n.y * j;
+		ps->vz[i] -= n.z * j;
+	}
+}
+
+// Static scene and walls for bodies [begin, end); each body only touches
+//   its own slots, so chunks can run concurrently.
+static int
+collideStatic(ParticleSystem* ps, int begin, int end, float restitution)
+{
+	int contacts = 0;
+
+	for (int i = begin; i < end; i++) {
+		float r = ps->radius[i];
+
+		for (size_t s = 0; s < staticSpheres.size(); s++) {
+			const StaticSphere& sph = staticSpheres[s];
+			vec3 d = particlePosition(*ps, i) - sph.center;
+			float dist2 = dot(d, d);
+			float reach = r + sph.radius;
+			if (dist2 >= reach * reach) { continue; }
+
+			float dist = sqrt(dist2);
+			vec3 n = dist > 1.0e-6 ? d / dist : vec3(0.0, 1.0, 0.0);
+			pushOut(ps, i, n, reach - dist, restitution);
+			contacts++;
+		}
+
+		for (size_t b = 0; b < staticBoxes.size(); b++) {
+			const StaticBox& box = staticBoxes[b];
+			vec3 p = particlePosition(*ps, i);
+			if (p.x + r <= box.lo.x || p.x - r >= box.hi.x ||
+			    p.y + r <= box.lo.y || p.y - r >= box.hi.y ||
+			    p.z + r <= box.lo.z || p.z - r >= box.hi.z) {
+				continue;
+			}
+
+			// Closest point of the box in its local frame
+			vec3 d = p - box.center;
+			vec3 local, closest;
+			bool inside = true;
+			for (int k = 0; k < 3; k++) {
+				local[k] = dot(d, box.axis[k]);
+				closest[k] = std::max(-box.half[k], std::min(box.half[k], local[k]));
+				if (closest[k] != local[k]) inside = false;
+			}
+
+			if (inside) {
+				// Center inside the box: leave through the nearest face
+				int axis = 0;
+				float best = box.half[0] - fabs(local[0]);
+				for (int k = 1; k < 3; k++) {
+					float gap = box.half[k] - fabs(local[k]);
+					if (gap < best) { best = gap; axis = k; }
+				}
+				vec3 n = box.axis[axis] * (local[axis] < 0.0 ? -1.0 : 1.0);
+				pushOut(ps, i, n, best + r, restitution);
+				contacts++;
+				continue;
+			}
+
+			vec3 delta = (local - closest);
+			float dist2 = dot(delta, delta);
+			if (dist2 >= r * r) { continue; }
+
+			float dist = sqrt(dist2);
+			vec3 n = (box.axis[0] * delta.x + box.axis[1] * delta.y + box.axis[2] * delta.z) / dist;
+			pushOut(ps, i, n, r - dist, restitution);
+			contacts++;
+		}
+
+		if (boundsEnabled) {
+			float* p[3] = { &ps->px[i], &ps->py[i], &ps->pz[i] };
+			float* v[3] = { &ps->vx[i], &ps->vy[i], &ps->vz[i] };
+			for (int k = 0; k < 3; k++) {
+				if (*p[k] - r < boundsLo[k]) {
+					*p[k] = boundsLo[k] + r;
+					if (*v[k] < 0.0) *v[k] = -*v[k] * restitution;
+				}
+				else if (*p[k] + r > boundsHi[k]) {
+					*p[k] = boundsHi[k] - r;
+					if (*v[k] > 0.0) *v[k] = -*v[k] * restitution;
+				}
+			}
+		}
+	}
+
+	return contacts;
+}
+
+//----------------------------------------------------------------------------
+// Candidate pairs for sorted bodies [begin, end).  Each body looks at its
+//   own cell (partners later in the sorted order) and at the 13 cells of
+//   the "forward" half of its neighbourhood (all partners), so every pair
+//   is seen exactly once.
+
+static const int  forwardCells[14][3] = {
+	{ 0, 0, 0 },
+	{ 1, 0, 0 }, { -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+	{ -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 },
+	{ -1, 0, 1 }, { 0, 0, 1 }, { 1, 0, 1 },
+	{ -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
+};
+
+static int
+findPairs(const SpatialGrid& grid, int begin, int end, std::vector<ContactPair>& contacts)
+{
+	int candidates = 0;
+
+	for (int i = begin; i < end; i++) {
+		float xi = sortedX[i], yi = sortedY[i], zi = sortedZ[i], ri = sortedR[i];
+
+		for (int c = 0; c < 14; c++) {
+			int cx = cellX[i] + forwardCells[c][0];
+			int cy = cellY[i] + forwardCells[c][1];
+			int cz = cellZ[i] + forwardCells[c][2];
+			int bucket = grid.bucket(cx, cy, cz);
+			if (bucket < 0) { continue; }
+
+			int first = (c == 0) ? i + 1 : bucketStart[bucket];
+			for (int j = first; j < bucketStart[bucket + 1]; j++) {
+				// Skip other cells that share a hashed bucket
+				if (grid.hashed && (cellX[j] != cx || cellY[j] != cy || cellZ[j] != cz)) {
+					continue;
+				}
+
+				float reach = ri + sortedR[j];
+				float dx = sortedX[j] - xi, dy = sortedY[j] - yi, dz = sortedZ[j] - zi;
+				if (fabs(dx) >= reach || fabs(dy) >= reach || fabs(dz) >= reach) {
+					continue;
+				}
+				candidates++;
+
+				if (dx * dx + dy * dy + dz * dz < reach * reach) {
+					ContactPair pair = { sortedBody[i], sortedBody[j] };
+					contacts.push_back(pair);
+				}
+			}
+		}
+	}
+
+	return candidates;
+}
+
+// Separate two overlapping bodies and exchange the normal impulse
+static void
+resolvePair(ParticleSystem* ps, int i, int j, float restitution)
+{
+	vec3 d = particlePosition(*ps, j) - particlePosition(*ps, i);
+	float reach = ps->radius[i] + ps->radius[j];
+	float dist2 = dot(d, d);
+	if (dist2 >= reach * reach) { return; }   // separated by an earlier pair
+
+	float dist = sqrt(dist2);
+	vec3 n = dist > 1.0e-6 ? d / dist : vec3(0.0, 1.0, 0.0);
+	float wi = ps->invMass[i], wj = ps->invMass[j];
+	float w = wi + wj;
+	if (w <= 0.0) { return; }
+
+	float depth = (reach - dist) / w;
+	ps->px[i] -= n.x * depth * wi; ps->py[i] -= n.y * depth * wi; ps->pz[i] -= n.z * depth * wi;
+	ps->px[j] += n.x * depth * wj; ps->py[j] += n.y * depth * wj; ps->pz[j] += n.z * depth * wj;
+
+	float vn = (ps->vx[j] - ps->vx[i]) * n.x + (ps->vy[j] - ps->vy[i]) * n.y + (ps->vz[j] - ps->vz[i]) * n.z;
+	if (vn >= 0.0) { return; }
+
+	float impulse = -(1.0 + restitution) * vn / w;
+	ps->vx[i] -= n.x * impulse * wi; ps->vy[i] -= n.y * impulse * wi; ps->vz[i] -= n.z * impulse * wi;
+	ps->vx[j] += n.x * impulse * wj; ps->vy[j] += n.y * impulse * wj; ps->vz[j] += n.z * impulse * wj;
+}
+
+//----------------------------------------------------------------------------
+
+void
+collideParticles(ParticleSystem* ps, float restitution)
+{
+	int count = ps->count;
+	frameStats.numBodies += count;
+	if (count == 0) { return; }
+
+	double t0 = timeNow();
+
+	int grain = evenGrain(count);
+	int chunks = (count + grain - 1) / grain;
+	chunkContacts.resize(chunks);
+	chunkCandidates.assign(chunks, 0);
+	chunkStatic.assign(chunks, 0);
+	chunkLo.resize(chunks);
+	chunkHi.resize(chunks);
+
+	// Bounds of all bodies and the largest radius
+	parallelFor(count, grain, [&](int begin, int end, int) {
+		vec4 lo(ps->px[begin], ps->py[begin], ps->pz[begin], 0.0);
+		vec4 hi = lo;
+		for (int i = begin; i < end; i++) {
+			lo.x = std::min(lo.x, ps->px[i]); hi.x = std::max(hi.x, ps->px[i]);
+			lo.y = std::min(lo.y, ps->py[i]); hi.y = std::max(hi.y, ps->py[i]);
+			lo.z = std::min(lo.z, ps->pz[i]); hi.z = std::max(hi.z, ps->pz[i]);
+			hi.w = std::max(hi.w, ps->radius[i]);
+		}
+		chunkLo[begin / grain] = lo;
+		chunkHi[begin / grain] = hi;
+	});
+	vec4 lo = chunkLo[0], hi = chunkHi[0];
+	for (int c = 1; c < chunks; c++) {
+		for (int k = 0; k < 4; k++) {
+			lo[k] = std::min(lo[k], chunkLo[c][k]);
+			hi[k] = std::max(hi[k], chunkHi[c][k]);
+		}
+	}
+
+	// Cell size: the largest diameter, so touching bodies are always in
+	//   neighbouring cells.  A dense grid is used while it needs no more
+	//   than 32 cells per body, a hashed one once bodies are spread out.
+	SpatialGrid grid;
+	grid.invCell = 1.0 / std::max(2.0f * hi.w, 1.0e-6f);
+	grid.origin = vec3(lo.x, lo.y, lo.z);
+	double cells = 1.0;
+	for (int k = 0; k < 3; k++) {
+		grid.dims[k] = (int)((hi[k] - lo[k]) * grid.invCell) + 1;
+		cells *= grid.dims[k];
+	}
+	grid.hashed = cells > 32.0 * count + 64.0;
+	if (grid.hashed) {
+		unsigned tableSize = 64;
+		while (tableSize < 2 * (unsigned)count) tableSize *= 2;
+		grid.mask = tableSize - 1;
+		grid.numBuckets = (int)tableSize;
+	}
+	else {
+		grid.numBuckets = (int)cells;
+	}
+
+	bodyCellX.resize(count); bodyCellY.resize(count); bodyCellZ.resize(count);
+	bodyBucket.resize(count);
+	parallelFor(count, grain, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			bodyCellX[i] = (int)floor((ps->px[i] - grid.origin.x) * grid.invCell);
+			bodyCellY[i] = (int)floor((ps->py[i] - grid.origin.y) * grid.invCell);
+			bodyCellZ[i] = (int)floor((ps->pz[i] - grid.origin.z) * grid.invCell);
+			bodyBucket[i] = grid.bucket(bodyCellX[i], bodyCellY[i], bodyCellZ[i]);
+		}
+	});
+
+	// Counting sort by bucket; the sorted copies keep each cell's bodies
+	//   contiguous for the pair search.
+	bucketStart.assign(grid.numBuckets + 1, 0);
+	for (int i = 0; i < count; i++) {
+		bucketStart[bodyBucket[i] + 1]++;
+	}
+	for (int b = 0; b < grid.numBuckets; b++) {
+		bucketStart[b + 1] += bucketStart[b];
+	}
+	bucketCursor.assign(bucketStart.begin(), bucketStart.end() - 1);
+
+	sortedBody.resize(count);
+	sortedX.resize(count); sortedY.resize(count); sortedZ.resize(count); sortedR.resize(count);
+	cellX.resize(count); cellY.resize(count); cellZ.resize(count);
+	for (int i = 0; i < count; i++) {
+		int k = bucketCursor[bodyBucket[i]]++;
+		sortedBody[k] = i;
+		sortedX[k] = ps->px[i]; sortedY[k] = ps->py[i]; sortedZ[k] = ps->pz[i];
+		sortedR[k] = ps->radius[i];
+		cellX[k] = bodyCellX[i]; cellY[k] = bodyCellY[i]; cellZ[k] = bodyCellZ[i];
+	}
+
+	parallelFor(count, grain, [&](int begin, int end, int) {
+		std::vector<ContactPair>& contacts = chunkContacts[begin / grain];
+		contacts.clear();
+		chunkCandidates[begin / grain] = findPairs(grid, begin, end, contacts);
+	});
+
+	double t1 = timeNow();
+
+	int contacts = 0, candidates = 0;
+	for (int c = 0; c < chunks; c++) {
+		for (size_t k = 0; k < chunkContacts[c].size(); k++) {
+			resolvePair(ps, chunkContacts[c][k].a, chunkContacts[c][k].b, restitution);
+		}
+		contacts += (int)chunkContacts[c].size();
+		candidates += chunkCandidates[c];
+	}
+
+	parallelFor(count, grain, [&](int begin, int end, int) {
+		chunkStatic[begin / grain] = collideStatic(ps, begin, end, restitution);
+	});
+
+	int staticContacts = 0;
+	for (int c = 0; c < chunks; c++) {
+		staticContacts += chunkStatic[c];
+	}
+
+	double t2 = timeNow();
+
+	frameStats.broadPhasePairs += candidates;
+	frameStats.contactPairs += contacts;
+	frameStats.staticContacts += staticContacts;
+	frameStats.broadPhaseMs += (t1 - t0) * 1000.0;
+	frameStats.narrowPhaseMs += (t2 - t1) * 1000.0;
+}
+
+//----------------------------------------------------------------------------
+
+void
+collisionBenchmark(int bodies, int frames)
+{
+	const float radius = 0.05;
+	const float side = cbrt((float)bodies) * 4.0 * radius;
+
+	ParticleSystem ps;
+	initParticles(&ps, bodies);
+
+	srand(1);
+	for (int i = 0; i < bodies; i++) {
+		vec3 pos(side * rand() / RAND_MAX, side * rand() / RAND_MAX, side * rand() / RAND_MAX);
+		vec3 vel(2.0 * rand() / RAND_MAX - 1.0, 2.0 * rand() / RAND_MAX - 1.0, 2.0 * rand() / RAND_MAX - 1.0);
+		addParticle(&ps, pos, vel, vec3(0.0, -9.8, 0.0), radius, 1.0 / 60.0);
+	}
+
+	bool hadBounds = boundsEnabled;
+	vec3 lo = boundsLo, hi = boundsHi;
+	setCollisionBounds(vec3(0.0), vec3(side));
+
+	double integrate = 0.0, broad = 0.0, narrow = 0.0;
+	long pairs = 0, contacts = 0;
+	for (int f = 0; f < frames; f++) {
+		beginFrameStats();
+		double t = timeNow();
+		integrateParticles(&ps);
+		integrate += timeNow() - t;
+		collideParticles(&ps, 0.5);
+		broad += frameStats.broadPhaseMs;
+		narrow += frameStats.narrowPhaseMs;
+		pairs += frameStats.broadPhasePairs;
+		contacts += frameStats.contactPairs;
+	}
+
+	std::cout << "collision: " << bodies << " bodies, " << frames << " steps, "
+	          << workerCount() << " threads" << std::endl
+	          << "  candidate pairs/step " << pairs / frames
+	          << ", contacts/step " << contacts / frames << std::endl
+	          << "  integrate " << integrate * 1000.0 / frames << " ms, broad phase "
+	          << broad / frames << " ms, narrow phase " << narrow / frames << " ms" << std::endl;
+
+	boundsEnabled = hadBounds;
+	boundsLo = lo;
+	boundsHi = hi;
+	freeParticles(&ps);
+}
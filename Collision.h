@@ -0,0 +1,36 @@
+#ifndef __COLLISION_H__
+#define __COLLISION_H__
+
+#include "Angel.h"
+#include "Particles.h"
+
+//----------------------------------------------------------------------------
+//
+//  Sphere-sphere and sphere-box collision for a ParticleSystem.
+//
+//  Dynamic pairs come from a uniform grid rebuilt every step: each body is
+//    binned by the cell that holds its center (cell size is the largest
+//    diameter), bodies are counting-sorted by cell and each body tests its
+//    own cell and half of the surrounding ones.  The grid is dense while
+//    the bodies are packed and falls back to a spatial hash when they
+//    spread out.  Static pieces of the scene are registered once as
+//    oriented boxes or spheres in model coordinates.
+//
+//  Timings and pair counts are written to frameStats.
+//
+
+// Unit cube / unit sphere drawn with the given model transform
+void addStaticBox(const mat4& model);
+void addStaticSphere(const mat4& model);
+void clearStaticColliders();
+
+// Optional axis-aligned walls that keep bodies inside [lo, hi]
+void setCollisionBounds(const vec3& lo, const vec3& hi);
+
+void collideParticles(ParticleSystem* ps, float restitution);
+
+// Runs the integrator and collision on `bodies` random spheres and prints
+//   the average cost per step.  Needs no GL context.
+void collisionBenchmark(int bodies, int frames);
+
+#endif // __COLLISION_H__
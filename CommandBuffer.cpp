@@ -0,0 +1,231 @@
+#include "CommandBuffer.h"
+#include "FrameArena.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "Parallel.h"
+#include "ProceduralMesh.h"
+#include "ShaderSource.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// One buffer per parallel block of the frame, replayed in order
+CommandBuffer*  frameBuffers = NULL;
+int             numFrameBuffers = 0;
+
+// setLodSelection()
+float  lodPixelsPerUnit = 0.0;
+float  lodMaxPixels = 0.0;
+
+inline void
+copyColor(GLfloat* dst, const color4& a, const color4& b)
+{
+	dst[0] = a.x * b.x; dst[1] = a.y * b.y; dst[2] = a.z * b.z; dst[3] = a.w * b.w;
+}
+
+void
+recordRange(const Scene& s, const mat4& view, const Light& light,
+	int begin, int end, CommandBuffer* cb)
+{
+	for (int i = begin; i < end; i++) {
+		if (s.flags[i] & (NodeHidden | NodeCulled)) { continue; }
+
+		DrawCommand* cmd = newCommand(cb);
+		if (cmd == NULL) { break; }
+
+		mat4 mv = view * s.transform[i];
+		memcpy(cmd->modelView, (const GLfloat*)mv, sizeof(cmd->modelView));
+
+		const Material& m = s.materials[s.material[i]];
+		copyColor(cmd->ambient, light.ambient, m.ambient);
+		copyColor(cmd->diffuse, light.diffuse, m.diffuse);
+		copyColor(cmd->specular, light.specular, m.specular);
+		cmd->shininess = m.shininess;
+		cmd->mesh = s.mesh[i];
+		cmd->mode = s.mode[i];
+		cmd->node = (GLuint)i;
+
+		// The node's largest scale decides how big its mesh looks
+		cmd->lod = 0;
+		if (lodMaxPixels > 0.0) {
+			float scale = 0.0;
+			for (int c = 0; c < 3; c++) {
+				scale = std::max(scale, mv[0][c] * mv[0][c] + mv[1][c] * mv[1][c] + mv[2][c] * mv[2][c]);
+			}
+			cmd->lod = selectMeshLod(meshes[cmd->mesh], sqrt(scale) * lodPixelsPerUnit, lodMaxPixels);
+		}
+	}
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+recordScene(const Scene& s, const mat4& view, const Light& light)
+{
+	double t = timeNow();
+
+	// Every block gets a buffer large enough for all of its nodes
+	int grain = evenGrain(s.count);
+	numFrameBuffers = (s.count + grain - 1) / grain;
+	frameBuffers = frameArray<CommandBuffer>(numFrameBuffers);
+	for (int b = 0; b < numFrameBuffers; b++) {
+		frameBuffers[b].commands = frameArray<DrawCommand>(grain);
+		frameBuffers[b].count = 0;
+		frameBuffers[b].capacity = grain;
+	}
+
+	const Scene* sp = &s;
+	parallelFor(s.count, grain, [&](int begin, int end, int) {
+		recordRange(*sp, view, light, begin, end, &frameBuffers[begin / grain]);
+	});
+
+	frameStats.recordMs += (timeNow() - t) * 1000.0;
+}
+
+//----------------------------------------------------------------------------
+
+void
+submitCommands(GLuint program, const Light& light, int instances, const GLuint* nodeMasks)
+{
+	static GLuint  cachedProgram = 0;
+	static unsigned  cachedGeneration = 0;
+	static GLint   vPosition, vNormal;
+	static GLint   ambient, diffuse, specular, lightPosition, shininess, modelView, viewMask;
+
+	double t = timeNow();
+
+	// A reloaded shader may have moved its uniforms
+	if (program != cachedProgram || shaderGeneration() != cachedGeneration) {
+		vPosition = glGetAttribLocation(program, "vPosition");
+		vNormal = glGetAttribLocation(program, "vNormal");
+		ambient = glGetUniformLocation(program, "AmbientProduct");
+		diffuse = glGetUniformLocation(program, "DiffuseProduct");
+		specular = glGetUniformLocation(program, "SpecularProduct");
+		lightPosition = glGetUniformLocation(program, "LightPosition");
+		shininess = glGetUniformLocation(program, "Shininess");
+		modelView = glGetUniformLocation(program, "ModelView");
+		viewMask = glGetUniformLocation(program, "ViewMask");
+		cachedProgram = program;
+		cachedGeneration = shaderGeneration();
+	}
+
+	// A program without vertex inputs pulls the primitives from gl_VertexID
+	bool pulling = vPosition < 0;
+	GLuint vao = stateCurrentVertexArray();
+
+	stateUseProgram(program);
+	if (pulling) {
+		stateBindVertexArray(proceduralVertexArray());
+	}
+	else {
+		stateBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+		stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshIndexBuffer);
+		glEnableVertexAttribArray(vPosition);
+		// An unlit shader may have dropped its normals
+		if (vNormal >= 0) {
+			glEnableVertexAttribArray(vNormal);
+		}
+	}
+	glUniform4fv(lightPosition, 1, light.position);
+
+	GLuint boundMesh = NumMeshes;
+
+	for (int b = 0; b < numFrameBuffers; b++) {
+		const CommandBuffer& cb = frameBuffers[b];
+		for (int c = 0; c < cb.count; c++) {
+			const DrawCommand& cmd = cb.commands[c];
+			const Mesh& mesh = meshes[cmd.mesh];
+
+			if (!pulling && cmd.mesh != boundMesh) {
+				glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(mesh.pointsOffset));
+				if (vNormal >= 0) {
+					glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(mesh.normalsOffset));
+				}
+				boundMesh = cmd.mesh;
+			}
+
+			glUniform4fv(ambient, 1, cmd.ambient);
+			glUniform4fv(diffuse, 1, cmd.diffuse);
+			glUniform4fv(specular, 1, cmd.specular);
+			glUniform1f(shininess, cmd.shininess);
+			glUniformMatrix4fv(modelView, 1, GL_TRUE, cmd.modelView);
+			if (nodeMasks != NULL && viewMask >= 0) {
+				glUniform1i(viewMask, (GLint)nodeMasks[cmd.node]);
+			}
+
+			if (pulling) {
+				drawProceduralMesh(program, cmd.mesh, cmd.mode);
+			}
+			else {
+				drawMesh(mesh, cmd.mode, instances, cmd.lod);
+			}
+		}
+	}
+
+	stateBindVertexArray(vao);
+
+	frameStats.submitMs += (timeNow() - t) * 1000.0;
+}
+
+void
+setLodSelection(float pixelsPerUnit, float maxPixels)
+{
+	lodPixelsPerUnit = pixelsPerUnit;
+	lodMaxPixels = maxPixels;
+}
+
+const CommandBuffer*
+recordedCommands(int* numBuffers)
+{
+	*numBuffers = numFrameBuffers;
+	return frameBuffers;
+}
+
+//----------------------------------------------------------------------------
+
+void
+commandBenchmark(int nodes, int frames)
+{
+	Scene s;
+	initScene(&s, nodes, 16);
+
+	addRandomNodes(&s, nodes, 10.0, 1);
+
+	Light light;
+	light.position = point4(0.0, 0.0, -1.0, 0.0);
+	light.ambient = light.diffuse = light.specular = color4(1.0, 1.0, 1.0, 1.0);
+	mat4 view = Translate(0.0, 0.0, -2.0) * RotateX(30.0);
+
+	// Single block: the serial cost of preparing the frame
+	resetFrameArena();
+	CommandBuffer single = { frameArray<DrawCommand>(nodes), 0, nodes };
+	double t = timeNow();
+	for (int f = 0; f < frames; f++) {
+		single.count = 0;
+		recordRange(s, view, light, 0, s.count, &single);
+	}
+	double serial = (timeNow() - t) * 1000.0 / frames;
+
+	// The arena was sized by the single block, so no allocation is timed here
+	resetFrameArena();
+	t = timeNow();
+	for (int f = 0; f < frames; f++) {
+		resetFrameArena();
+		recordScene(s, view, light);
+	}
+	double parallel = (timeNow() - t) * 1000.0 / frames;
+
+	std::cout << "commands: " << nodes << " nodes, " << sizeof(DrawCommand) << " bytes per command" << std::endl
+	          << "  1 thread   " << serial << " ms/frame" << std::endl
+	          << "  " << workerCount() << " threads  " << parallel << " ms/frame ("
+	          << serial / parallel << "x)" << std::endl;
+
+	freeScene(&s);
+}
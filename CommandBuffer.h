@@ -0,0 +1,69 @@
+#ifndef __COMMANDBUFFER_H__
+#define __COMMANDBUFFER_H__
+
+#include "Angel.h"
+#include "Scene.h"
+
+//----------------------------------------------------------------------------
+//
+//  Draw commands recorded off the GL thread.
+//
+//  recordScene() splits the scene into one contiguous block of nodes per
+//    worker.  Each worker composes the model-view matrices and lighting
+//    products of its block and appends fixed-size DrawCommands to its own
+//    linear buffer.  The buffers are sized before recording starts and
+//    come from the frame arena (FrameArena.h), so recording never touches
+//    the heap and the commands stay valid until the arena is reset at the
+//    start of the next frame.  submitCommands() then replays
+//    the buffers in block order on the thread that owns the GL context,
+//    which only has to issue the uniform updates and draw calls.
+//
+
+struct DrawCommand {
+	GLfloat  modelView[16];     // row-major, uploaded with transpose
+	GLfloat  ambient[4];        // light * material products
+	GLfloat  diffuse[4];
+	GLfloat  specular[4];
+	GLfloat  shininess;
+	GLuint   mesh;
+	GLuint   lod;
+	GLenum   mode;
+	GLuint   node;
+};
+
+struct CommandBuffer {
+	DrawCommand*  commands;
+	int           count;
+	int           capacity;
+};
+
+inline DrawCommand*
+newCommand(CommandBuffer* cb)
+{
+	return (cb->count < cb->capacity) ? &cb->commands[cb->count++] : NULL;
+}
+
+// Fill the frame's command buffers from the visible nodes of the scene
+void recordScene(const Scene& s, const mat4& view, const Light& light);
+
+// Lets recordScene() draw each node at the coarsest level of its mesh that
+//   is off by at most maxPixels, for an orthographic projection with
+//   pixelsPerUnit pixels per unit of eye space.  0 draws full detail.
+void setLodSelection(float pixelsPerUnit, float maxPixels);
+
+// Issue the recorded draws with the given program (GL thread only).  A
+//   program without a vPosition input draws the primitives by vertex
+//   pulling (ProceduralMesh.h) instead of from the mesh buffer.  Each
+//   draw has `instances` instances; with nodeMasks, the mask of the
+//   command's node goes to the program's ViewMask (MultiView.h).
+void submitCommands(GLuint program, const Light& light, int instances = 1,
+                    const GLuint* nodeMasks = NULL);
+
+// The buffers filled by the last recordScene(), in submission order
+const CommandBuffer* recordedCommands(int* numBuffers);
+
+// Times recordScene() on `nodes` random objects, on one thread and on the
+//   whole pool.  Needs no GL context.
+void commandBenchmark(int nodes, int frames);
+
+#endif // __COMMANDBUFFER_H__
@@ -0,0 +1,250 @@
+#include "DynamicResolution.h"
+#include "Angel.h"
+#include "GLState.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const double  MinScale = 0.25;
+const double  ScaleStep = 1.0 / 16.0;
+const double  LowWater = 0.75;      // of the budget: room to grow below this
+const int     DropAfter = 3;        // frames over the budget
+const int     RaiseAfter = 30;      // frames under LowWater
+const int     SettleFrames = 10;    // samples ignored after a change
+const int     NumQueries = 4;
+
+double  budget = 0.0;               // ms; 0 when the mode is off
+double  scale = 1.0;
+double  gpuMs = -1.0;               // smoothed, -1 before the first sample
+int     overFrames = 0, underFrames = 0, settle = 0;
+
+int     windowWidth = 1, windowHeight = 1;
+GLuint  fbo = 0, colorBuffer = 0, depthBuffer = 0;
+GLuint  target = 0;                 // framebuffer to upsample into
+
+bool    timerQueries = false;
+GLuint  queries[NumQueries];
+bool    pending[NumQueries];
+int     nextQuery = 0;
+bool    timing = false;             // a query runs for this frame
+double  frameStart = 0.0;
+
+void
+setScale(double s)
+{
+	s = std::min(1.0, std::max(MinScale, s));
+	if (s == scale) { return; }
+
+	scale = s;
+	gpuMs = -1.0;
+	overFrames = underFrames = 0;
+	settle = SettleFrames;
+}
+
+void
+addSample(double ms)
+{
+	// Queries still in flight at a change measured the old scale
+	if (settle > 0) {
+		settle--;
+		return;
+	}
+
+	gpuMs = (gpuMs < 0.0) ? ms : 0.8 * gpuMs + 0.2 * ms;
+
+	if (gpuMs > budget) {
+		underFrames = 0;
+		if (++overFrames >= DropAfter) {
+			// GPU time follows the pixel count; aim inside the band
+			double fit = scale * sqrt(0.5 * (1.0 + LowWater) * budget / gpuMs);
+			setScale(floor(fit / ScaleStep) * ScaleStep);
+		}
+	}
+	else if (gpuMs < LowWater * budget) {
+		// Only climb when the next step up is expected to fit as well
+		double grow = (scale + ScaleStep) / scale;
+		if (scale >= 1.0 || gpuMs * grow * grow >= budget) {
+			overFrames = underFrames = 0;
+			return;
+		}
+
+		overFrames = 0;
+		if (++underFrames >= RaiseAfter) {
+			setScale(scale + ScaleStep);
+		}
+	}
+	else {
+		overFrames = underFrames = 0;
+	}
+}
+
+// Reads every finished query, oldest first, without waiting for the GPU
+void
+collectQueries()
+{
+	for (int k = 0; k < NumQueries; k++) {
+		int q = (nextQuery + k) % NumQueries;
+		if (!pending[q]) { continue; }
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) { break; }
+
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(queries[q], GL_QUERY_RESULT, &ns);
+		pending[q] = false;
+		addSample(ns / 1.0e6);
+	}
+}
+
+void
+allocateTarget()
+{
+	if (fbo == 0) {
+		glGenFramebuffers(1, &fbo);
+		glGenRenderbuffers(1, &colorBuffer);
+		glGenRenderbuffers(1, &depthBuffer);
+	}
+
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, windowWidth, windowHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, windowWidth, windowHeight);
+
+	GLuint previous = stateCurrentFramebuffer();
+	stateBindFramebuffer(fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	stateBindFramebuffer(previous);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "Dynamic resolution target is incomplete (0x" << std::hex << status
+		          << std::dec << "); rendering at full size" << std::endl;
+		budget = 0.0;
+	}
+}
+
+bool
+softwareRenderer()
+{
+	const char* names[] = { "llvmpipe", "softpipe", "SwiftShader", "Software Rasterizer" };
+	const char* renderer = (const char*)glGetString(GL_RENDERER);
+
+	for (int i = 0; renderer != NULL && i < 4; i++) {
+		if (strstr(renderer, names[i]) != NULL) { return true; }
+	}
+	return false;
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+initDynamicResolution(double budgetMs)
+{
+	budget = std::max(budgetMs, 0.0);
+	if (budget == 0.0) { return; }
+
+	// A software rasterizer draws on the CPU after the commands were
+	//   queued, so its timer queries only see the queueing
+	timerQueries = (GLEW_VERSION_3_3 || GLEW_ARB_timer_query) && !softwareRenderer();
+	if (timerQueries) {
+		glGenQueries(NumQueries, queries);
+	}
+	else {
+		std::cerr << "Dynamic resolution times frames on the CPU" << std::endl;
+	}
+	std::fill(pending, pending + NumQueries, false);
+
+	// The first frames compile shaders and fill caches
+	settle = SettleFrames;
+
+	allocateTarget();
+}
+
+void
+resizeDynamicResolution(int width, int height)
+{
+	windowWidth = std::max(width, 1);
+	windowHeight = std::max(height, 1);
+
+	if (budget > 0.0) {
+		allocateTarget();
+	}
+}
+
+int
+renderWidth()
+{
+	return (budget > 0.0) ? std::max(1, (int)(windowWidth * scale + 0.5)) : windowWidth;
+}
+
+int
+renderHeight()
+{
+	return (budget > 0.0) ? std::max(1, (int)(windowHeight * scale + 0.5)) : windowHeight;
+}
+
+//----------------------------------------------------------------------------
+
+void
+beginScaledFrame()
+{
+	if (budget == 0.0) { return; }
+
+	if (timerQueries) {
+		collectQueries();
+	}
+
+	target = stateCurrentFramebuffer();
+	stateBindFramebuffer(fbo);
+
+	// The clear has to stay inside the scaled part as well
+	int w = renderWidth(), h = renderHeight();
+	stateViewport(0, 0, w, h);
+	stateEnable(GL_SCISSOR_TEST);
+	glScissor(0, 0, w, h);
+
+	// With every query still in flight this frame goes untimed
+	timing = timerQueries && !pending[nextQuery];
+	if (timing) {
+		glBeginQuery(GL_TIME_ELAPSED, queries[nextQuery]);
+	}
+	frameStart = timeNow();
+}
+
+void
+endScaledFrame()
+{
+	frameStats.resolutionScale = (budget > 0.0) ? scale : 1.0;
+	if (budget == 0.0) { return; }
+
+	int w = renderWidth(), h = renderHeight();
+	if (timing) {
+		glEndQuery(GL_TIME_ELAPSED);
+		pending[nextQuery] = true;
+		nextQuery = (nextQuery + 1) % NumQueries;
+	}
+	else if (!timerQueries) {
+		glFinish();
+		addSample((timeNow() - frameStart) * 1000.0);
+	}
+
+	stateDisable(GL_SCISSOR_TEST);
+
+	// Stretch the scaled part over the window
+	stateBindFramebuffer(target);
+	stateBindReadFramebuffer(fbo);
+	glBlitFramebuffer(0, 0, w, h, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+		(w == windowWidth && h == windowHeight) ? GL_NEAREST : GL_LINEAR);
+	stateBindReadFramebuffer(target);
+	stateViewport(0, 0, windowWidth, windowHeight);
+
+	frameStats.gpuMs = std::max(gpuMs, 0.0);
+}
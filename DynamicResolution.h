@@ -0,0 +1,41 @@
+#ifndef __DYNAMICRESOLUTION_H__
+#define __DYNAMICRESOLUTION_H__
+
+//----------------------------------------------------------------------------
+//
+//  Dynamic resolution: render into an offscreen target at a fraction of
+//    the window size, chosen to keep the GPU time of a frame within a
+//    budget, and stretch the result over the window.
+//
+//  The target is allocated at the full window size and the frame uses
+//    only its lower-left scale x scale part, so changing the scale never
+//    reallocates anything.  GPU time is measured with timer queries read
+//    a few frames late, so the controller never waits on the GPU.  Without
+//    ARB_timer_query, and on software rasterizers whose queries only see
+//    the commands being queued, the frame is finished and timed on the
+//    CPU instead.
+//
+//  The scale moves with hysteresis.  It drops after a few frames over the
+//    budget, straight to the scale expected to fit.  It only climbs, one
+//    step at a time, after a long run of frames well under the budget,
+//    and only when the larger step is expected to stay under it.
+//    After every change it holds still while the measurements settle.
+//
+
+// Turns the mode on; budgetMs <= 0 leaves it off
+void initDynamicResolution(double budgetMs);
+
+// Call from reshape(), also when the mode is off
+void resizeDynamicResolution(int width, int height);
+
+// Size the scene is rendered at this frame (the window size when off)
+int  renderWidth();
+int  renderHeight();
+
+// Bracket the scene: rendering in between goes to the scaled target,
+//   which endScaledFrame() upsamples into the framebuffer that was bound
+//   at beginScaledFrame().  Both do nothing when the mode is off.
+void beginScaledFrame();
+void endScaledFrame();
+
+#endif // __DYNAMICRESOLUTION_H__
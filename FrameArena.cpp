@@ -0,0 +1,116 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace {
+
+std::atomic<unsigned long>  allocationCount(0);
+
+char*                block = NULL;       // aligned start of the frame block
+void*                blockStorage = NULL;
+size_t               blockSize = 0;
+std::atomic<size_t>  blockUsed(0);
+std::atomic<size_t>  frameUsed(0);       // including overflow
+
+std::mutex           overflowMutex;
+std::vector<void*>   overflowBlocks;
+
+inline size_t
+alignUp(size_t n, size_t align)
+{
+	return (n + align - 1) & ~(align - 1);
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+resetFrameArena()
+{
+	size_t needed = frameUsed.load();
+
+	for (size_t i = 0; i < overflowBlocks.size(); i++) {
+		::operator delete(overflowBlocks[i]);
+	}
+	overflowBlocks.clear();
+
+	if (needed > blockSize) {
+		// Room for the whole of the last frame and some growth
+		size_t size = alignUp(needed + needed / 2, 64 * 1024);
+		::operator delete(blockStorage);
+		blockStorage = ::operator new(size + ArenaAlignment);
+		block = (char*)alignUp((size_t)(uintptr_t)blockStorage, ArenaAlignment);
+		blockSize = size;
+	}
+
+	blockUsed = 0;
+	frameUsed = 0;
+}
+
+//----------------------------------------------------------------------------
+
+void*
+frameAlloc(size_t size, size_t align)
+{
+	align = std::max<size_t>(align, 1);
+	frameUsed += size + align - 1;
+
+	size_t used = blockUsed.load(std::memory_order_relaxed);
+	for (;;) {
+		size_t begin = alignUp(used, align);
+		if (begin + size > blockSize) { break; }
+		if (blockUsed.compare_exchange_weak(used, begin + size, std::memory_order_relaxed)) {
+			return block + begin;
+		}
+	}
+
+	// The block is full: serve this frame from the heap
+	std::lock_guard<std::mutex> lock(overflowMutex);
+	void* p = ::operator new(size + align);
+	overflowBlocks.push_back(p);
+	return (void*)alignUp((size_t)(uintptr_t)p, align);
+}
+
+size_t
+frameArenaUsed()
+{
+	return frameUsed.load();
+}
+
+//----------------------------------------------------------------------------
+
+unsigned long
+heapAllocations()
+{
+	return allocationCount.load(std::memory_order_relaxed);
+}
+
+// Replacing the global operator new counts every C++ allocation; new[],
+//   the nothrow forms and the sized deletes all forward to these.
+void*
+operator new(std::size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	for (;;) {
+		void* p = malloc(size > 0 ? size : 1);
+		if (p != NULL) { return p; }
+
+		std::new_handler handler = std::get_new_handler();
+		if (handler == NULL) { throw std::bad_alloc(); }
+		handler();
+	}
+}
+
+void
+operator delete(void* p) noexcept
+{
+	free(p);
+}
@@ -0,0 +1,47 @@
+#ifndef __FRAMEARENA_H__
+#define __FRAMEARENA_H__
+
+#include <cstddef>
+
+//----------------------------------------------------------------------------
+//
+//  Per-frame linear allocator.
+//
+//  Everything that only lives for one frame (draw command buffers, visible
+//    lists, pose palettes, per-chunk counters) is carved out of one block
+//    by bumping an offset.  resetFrameArena() at the start of display()
+//    rewinds the offset, which frees the whole frame at once; nothing is
+//    freed individually.
+//
+//  When a frame needs more than the block holds, the rest is served from
+//    overflow blocks on the heap and the next reset replaces the block by
+//    one large enough for the whole frame, so once the frame size has
+//    settled the loop runs without touching the heap.
+//
+//  frameAlloc() is safe to call from parallelFor() workers.
+//
+
+const size_t  ArenaAlignment = 64;    // a cache line
+
+// Rewinds the arena; the memory of the previous frame becomes invalid
+void resetFrameArena();
+
+// `size` bytes aligned to `align` (a power of two, at most ArenaAlignment)
+void* frameAlloc(size_t size, size_t align = ArenaAlignment);
+
+// Uninitialized storage for `count` plain structs
+template <typename T>
+inline T*
+frameArray(int count)
+{
+	return (T*)frameAlloc(sizeof(T) * (count > 0 ? count : 1));
+}
+
+// Bytes handed out since the last reset
+size_t frameArenaUsed();
+
+// Calls of the global operator new since the program started.  Only C++
+//   allocations are seen, not malloc() or the allocations of the GL driver.
+unsigned long heapAllocations();
+
+#endif // __FRAMEARENA_H__
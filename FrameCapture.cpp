@@ -0,0 +1,607 @@
+#include "FrameCapture.h"
+#include "Angel.h"
+#include "GLState.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum Format { FormatPPM, FormatPNG, FormatRaw };
+enum SlotState { SlotFree, SlotReading, SlotEncoding };
+
+// Slots are used and given back in ring order, so the ring holds the reads
+//   in flight as well as the frames the encoder has not finished
+const int     NumSlots = 6;
+const int     ReadLatency = 2;      // frames to a mapping without fences
+const double  BudgetMs = 1.0;       // render thread time for mappings
+
+struct Slot {
+	GLuint          buffer;
+	GLsync          fence;
+	GLsizeiptr      size;           // allocated bytes
+	int             width, height;
+	unsigned long   issued;         // frame counter at the read
+	int             number;         // in the output
+	const GLubyte*  pixels;         // mapping, RGBA bottom row first
+	SlotState       state;          // only changed by the render thread
+};
+
+// Render thread
+bool           capturing = false;
+bool           paused = false;
+bool           fences = false;
+Slot           slots[NumSlots];
+int            nextSlot = 0;        // the oldest slot once the ring is full
+unsigned long  issuedFrames = 0;
+int            nextNumber = 0;
+int            droppedFrames = 0;
+
+// Shared with the encoder
+Format                   format;
+std::string              pattern;   // printf pattern, or the stream path
+FILE*                    stream = NULL;
+std::deque<int>          queue;     // slots to encode
+int                      finished[NumSlots];
+int                      numFinished = 0;
+std::mutex               queueMutex;
+std::condition_variable  slotQueued;
+bool                     stopping = false;
+std::thread              encoder;
+std::atomic<int>         writtenFrames(0);
+std::atomic<int>         rejectedFrames(0);   // raw frames of the wrong size
+int                      streamWidth, streamHeight;
+
+//----------------------------------------------------------------------------
+//
+//  Encoding, on the encoder thread
+//
+
+uint32_t  crcTable[256];
+
+void
+initCrcTable()
+{
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++) {
+			c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		}
+		crcTable[n] = c;
+	}
+}
+
+uint32_t
+crc32(uint32_t crc, const unsigned char* p, size_t n)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < n; i++) {
+		crc = crcTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+uint32_t
+adler32(const unsigned char* p, size_t n)
+{
+	uint32_t a = 1, b = 0;
+	while (n > 0) {
+		size_t run = std::min(n, (size_t)5552);   // no overflow before the modulo
+		for (size_t i = 0; i < run; i++) {
+			a += p[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		p += run;
+		n -= run;
+	}
+	return (b << 16) | a;
+}
+
+// Deflate stream: bits are packed from the least significant end, Huffman
+//   codes from their most significant bit
+struct BitWriter {
+	std::vector<unsigned char>*  out;
+	uint32_t                     bits;
+	int                          count;
+
+	void put(uint32_t value, int n)
+	{
+		bits |= value << count;
+		count += n;
+		while (count >= 8) {
+			out->push_back((unsigned char)bits);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+
+	void putCode(uint32_t code, int n)
+	{
+		uint32_t reversed = 0;
+		for (int i = 0; i < n; i++) {
+			reversed = (reversed << 1) | ((code >> i) & 1);
+		}
+		put(reversed, n);
+	}
+
+	void flush()
+	{
+		if (count > 0) { out->push_back((unsigned char)bits); }
+		bits = 0;
+		count = 0;
+	}
+};
+
+const int  lengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const int  lengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const int  distanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const int  distanceExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Fixed literal/length code of deflate
+void
+putSymbol(BitWriter* w, int symbol)
+{
+	if (symbol < 144)       { w->putCode(0x30 + symbol, 8); }
+	else if (symbol < 256)  { w->putCode(0x190 + symbol - 144, 9); }
+	else if (symbol < 280)  { w->putCode(symbol - 256, 7); }
+	else                    { w->putCode(0xc0 + symbol - 280, 8); }
+}
+
+void
+putMatch(BitWriter* w, int length, int distance)
+{
+	int l = 28;
+	while (lengthBase[l] > length) { l--; }
+	putSymbol(w, 257 + l);
+	w->put(length - lengthBase[l], lengthExtra[l]);
+
+	int d = 29;
+	while (distanceBase[d] > distance) { d--; }
+	w->putCode(d, 5);
+	w->put(distance - distanceBase[d], distanceExtra[d]);
+}
+
+// One fixed-code block whose matches only look one pixel back and one row
+//   up, which is where rendered frames repeat themselves
+void
+deflateRows(const std::vector<unsigned char>& data, int rowBytes, std::vector<unsigned char>* out)
+{
+	BitWriter w = { out, 0, 0 };
+	w.put(1, 1);                    // final block
+	w.put(1, 2);                    // fixed codes
+
+	int distances[2] = { 3, rowBytes };
+	int numDistances = (rowBytes <= 32768) ? 2 : 1;
+	size_t n = data.size();
+
+	for (size_t i = 0; i < n; ) {
+		int best = 0, bestDistance = 0;
+		for (int k = 0; k < numDistances; k++) {
+			size_t d = distances[k];
+			if (i < d) { continue; }
+
+			size_t limit = std::min((size_t)258, n - i);
+			size_t len = 0;
+			while (len < limit && data[i + len] == data[i + len - d]) { len++; }
+			if ((int)len > best) {
+				best = (int)len;
+				bestDistance = (int)d;
+			}
+		}
+
+		if (best >= 3) {
+			putMatch(&w, best, bestDistance);
+			i += best;
+		}
+		else {
+			putSymbol(&w, data[i]);
+			i++;
+		}
+	}
+	putSymbol(&w, 256);             // end of block
+	w.flush();
+}
+
+void
+putBigEndian(std::vector<unsigned char>* out, uint32_t v)
+{
+	out->push_back((unsigned char)(v >> 24));
+	out->push_back((unsigned char)(v >> 16));
+	out->push_back((unsigned char)(v >> 8));
+	out->push_back((unsigned char)v);
+}
+
+void
+putChunk(std::vector<unsigned char>* out, const char* type, const unsigned char* data, size_t n)
+{
+	putBigEndian(out, (uint32_t)n);
+	size_t start = out->size();
+	out->insert(out->end(), type, type + 4);
+	out->insert(out->end(), data, data + n);
+	putBigEndian(out, crc32(0, &(*out)[start], n + 4));
+}
+
+// RGB rows, top first, each behind `lead` zero bytes (the PNG filter type)
+void
+toRows(const GLubyte* pixels, int w, int h, int lead, std::vector<unsigned char>* rows)
+{
+	rows->resize((size_t)(w * 3 + lead) * h);
+
+	unsigned char* dst = rows->data();
+	for (int y = h - 1; y >= 0; y--) {
+		const GLubyte* src = pixels + (size_t)y * w * 4;
+		for (int i = 0; i < lead; i++) { *dst++ = 0; }
+		for (int x = 0; x < w; x++, src += 4) {
+			*dst++ = src[0];
+			*dst++ = src[1];
+			*dst++ = src[2];
+		}
+	}
+}
+
+bool
+writeFile(const std::string& path, const unsigned char* data, size_t n)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (fp == NULL) { return false; }
+	bool ok = fwrite(data, 1, n, fp) == n;
+	return (fclose(fp) == 0) && ok;
+}
+
+bool
+encode(const Slot& s, std::vector<unsigned char>* rows, std::vector<unsigned char>* file)
+{
+	if (format == FormatRaw) {
+		if (streamWidth < 0) {
+			streamWidth = s.width;
+			streamHeight = s.height;
+		}
+		if (s.width != streamWidth || s.height != streamHeight) {
+			if (rejectedFrames++ == 0) {
+				std::cerr << "Capture stream is " << streamWidth << "x" << streamHeight
+				          << "; dropping frames of other sizes" << std::endl;
+			}
+			return true;
+		}
+		toRows(s.pixels, s.width, s.height, 0, rows);
+		return fwrite(rows->data(), 1, rows->size(), stream) == rows->size();
+	}
+
+	char path[1024];
+	snprintf(path, sizeof(path), pattern.c_str(), s.number);
+
+	if (format == FormatPPM) {
+		char header[64];
+		int n = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", s.width, s.height);
+		toRows(s.pixels, s.width, s.height, 0, rows);
+		file->assign(header, header + n);
+		file->insert(file->end(), rows->begin(), rows->end());
+		return writeFile(path, file->data(), file->size());
+	}
+
+	toRows(s.pixels, s.width, s.height, 1, rows);
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	file->assign(signature, signature + 8);
+
+	std::vector<unsigned char> header;
+	putBigEndian(&header, s.width);
+	putBigEndian(&header, s.height);
+	const unsigned char layout[5] = { 8, 2, 0, 0, 0 };   // 8-bit RGB
+	header.insert(header.end(), layout, layout + 5);
+	putChunk(file, "IHDR", header.data(), header.size());
+
+	std::vector<unsigned char> z;
+	z.reserve(rows->size() / 4);
+	z.push_back(0x78);
+	z.push_back(0x01);
+	deflateRows(*rows, s.width * 3 + 1, &z);
+	putBigEndian(&z, adler32(rows->data(), rows->size()));
+	putChunk(file, "IDAT", z.data(), z.size());
+	putChunk(file, "IEND", NULL, 0);
+
+	return writeFile(path, file->data(), file->size());
+}
+
+// Reads the pixels straight from the mapped buffers; the render thread
+//   unmaps them once they are listed in `finished`
+void
+encoderMain()
+{
+	std::vector<unsigned char> rows, file;
+	bool failed = false;
+
+	for (;;) {
+		int i;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			slotQueued.wait(lock, [] { return stopping || !queue.empty(); });
+			if (queue.empty()) { break; }
+			i = queue.front();
+			queue.pop_front();
+		}
+
+		// After a failed write the rest is discarded, not retried
+		if (!failed) {
+			if (encode(slots[i], &rows, &file)) {
+				writtenFrames++;
+			}
+			else {
+				std::cerr << "Failed to write captured frame " << slots[i].number
+				          << "; capture stopped" << std::endl;
+				failed = true;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(queueMutex);
+		finished[numFinished++] = i;
+	}
+}
+
+//----------------------------------------------------------------------------
+//
+//  Readback, on the render thread
+//
+
+// A path without a number gets one before its extension.  Anything but a
+//   single %d conversion is refused, since the path becomes a format.
+bool
+makePattern(const std::string& path, std::string* result)
+{
+	size_t percent = path.find('%');
+	if (percent == std::string::npos) {
+		size_t dot = path.rfind('.');
+		*result = path.substr(0, dot) + "%05d" + path.substr(dot);
+		return true;
+	}
+
+	size_t d = path.find_first_not_of("0123456789", percent + 1);
+	if (d == std::string::npos || path[d] != 'd' || path.find('%', d) != std::string::npos) {
+		return false;
+	}
+	*result = path;
+	return true;
+}
+
+bool
+readDone(const Slot& s)
+{
+	if (!fences) {
+		return issuedFrames - s.issued >= ReadLatency;
+	}
+	GLenum status = glClientWaitSync(s.fence, 0, 0);
+	return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+// Maps a finished read and queues it for the encoder.  With `wait` it
+//   first blocks until the GPU is done.
+void
+mapSlot(Slot* s, bool wait)
+{
+	if (fences) {
+		if (wait) {
+			while (glClientWaitSync(s->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+		}
+		glDeleteSync(s->fence);
+		s->fence = 0;
+	}
+
+	stateBindBuffer(GL_PIXEL_PACK_BUFFER, s->buffer);
+	s->pixels = (const GLubyte*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, s->size, GL_MAP_READ_BIT);
+	stateBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (s->pixels == NULL) {
+		s->state = SlotFree;
+		droppedFrames++;
+		frameStats.captureDropped++;
+		return;
+	}
+
+	s->state = SlotEncoding;
+	s->number = nextNumber++;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queue.push_back((int)(s - slots));
+	}
+	slotQueued.notify_one();
+	frameStats.captureFrames++;
+}
+
+// Unmaps the buffers the encoder is done with
+void
+releaseEncoded()
+{
+	int done[NumSlots], n;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		n = numFinished;
+		std::copy(finished, finished + n, done);
+		numFinished = 0;
+	}
+
+	for (int i = 0; i < n; i++) {
+		Slot& s = slots[done[i]];
+		stateBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		s.pixels = NULL;
+		s.state = SlotFree;
+	}
+	stateBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+bool
+startCapture(const char* path)
+{
+	stopCapture();
+
+	std::string p(path);
+	std::string extension = p.substr(std::min(p.size(), p.rfind('.')));
+	if (extension == ".ppm" || extension == ".png") {
+		format = (extension == ".ppm") ? FormatPPM : FormatPNG;
+		if (!makePattern(p, &pattern)) {
+			std::cerr << "Capture path " << path << " may only hold one %d conversion" << std::endl;
+			return false;
+		}
+	}
+	else if (extension == ".raw" || extension == ".rgb") {
+		format = FormatRaw;
+		pattern = p;
+		if ((stream = fopen(path, "wb")) == NULL) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return false;
+		}
+	}
+	else {
+		std::cerr << "Capture path " << path << " needs a .ppm, .png, .raw or .rgb extension" << std::endl;
+		return false;
+	}
+
+	static bool registered = false;
+	if (!registered) {
+		initCrcTable();
+		atexit(stopCapture);
+		registered = true;
+	}
+
+	queue.clear();
+	numFinished = 0;
+	stopping = false;
+	writtenFrames = 0;
+	rejectedFrames = 0;
+	streamWidth = streamHeight = -1;
+	encoder = std::thread(encoderMain);
+
+	nextNumber = 0;
+	droppedFrames = 0;
+	paused = false;
+	capturing = true;
+	return true;
+}
+
+void
+stopCapture()
+{
+	if (!capturing) { return; }
+
+	// The reads still in flight are the last frames shown
+	for (int k = 0; k < NumSlots; k++) {
+		Slot& s = slots[(nextSlot + k) % NumSlots];
+		if (s.state == SlotReading) { mapSlot(&s, true); }
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	slotQueued.notify_one();
+	encoder.join();
+	releaseEncoded();
+
+	std::cerr << "capture: " << writtenFrames << " frames written to " << pattern << ", "
+	          << droppedFrames + rejectedFrames << " dropped" << std::endl;
+	if (stream != NULL) {
+		fclose(stream);
+		stream = NULL;
+	}
+	for (int i = 0; i < NumSlots; i++) {
+		if (slots[i].buffer != 0) { stateDeleteBuffers(1, &slots[i].buffer); }
+	}
+	memset(slots, 0, sizeof(slots));
+	nextSlot = 0;
+	capturing = false;
+}
+
+void
+pauseCapture(bool p)
+{
+	paused = p;
+}
+
+bool
+isCapturing()
+{
+	return capturing && !paused;
+}
+
+//----------------------------------------------------------------------------
+
+void
+captureFrame(int width, int height)
+{
+	if (!capturing || paused || width <= 0 || height <= 0) { return; }
+
+	double t = timeNow();
+	if (slots[0].buffer == 0) {
+		fences = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+		for (int i = 0; i < NumSlots; i++) {
+			glGenBuffers(1, &slots[i].buffer);
+		}
+	}
+	issuedFrames++;
+	releaseEncoded();
+
+	// Oldest first, stopping at the first read the GPU has not finished;
+	//   past the budget the rest waits for the next frame
+	int mapped = 0;
+	for (int k = 0; k < NumSlots; k++) {
+		Slot& s = slots[(nextSlot + k) % NumSlots];
+		if (s.state != SlotReading) { continue; }
+		if (!readDone(s) || (mapped > 0 && (timeNow() - t) * 1000.0 > BudgetMs)) { break; }
+		mapSlot(&s, false);
+		mapped++;
+	}
+
+	Slot& s = slots[nextSlot];
+	if (s.state != SlotFree) {
+		// The GPU or the encoder is a whole ring behind
+		droppedFrames++;
+		frameStats.captureDropped++;
+	}
+	else {
+		GLsizeiptr size = (GLsizeiptr)width * height * 4;
+		stateBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+		if (s.size != size) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+			s.size = size;
+		}
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		stateBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		s.fence = fences ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+		s.width = width;
+		s.height = height;
+		s.issued = issuedFrames;
+		s.state = SlotReading;
+		nextSlot = (nextSlot + 1) % NumSlots;
+	}
+
+	frameStats.captureMs += (timeNow() - t) * 1000.0;
+}
@@ -0,0 +1,49 @@
+#ifndef __FRAMECAPTURE_H__
+#define __FRAMECAPTURE_H__
+
+//----------------------------------------------------------------------------
+//
+//  Recording of the displayed frames to disk.
+//
+//  captureFrame() starts an asynchronous read of the frame into the next
+//    of a small ring of pixel buffer objects and puts a fence behind it.
+//    A buffer is mapped only once its fence has passed, a few frames
+//    later, so the render thread never waits for the GPU.  The encoder
+//    thread reads the pixels straight from the mapping, does all the
+//    flipping, compression and file writing, and hands the buffer back
+//    to be unmapped and reused.
+//
+//  The render thread only issues reads, maps and unmaps, and it stops
+//    mapping for the frame once a fixed time budget is spent.  A frame is
+//    dropped, not waited for, when the whole ring is still with the GPU
+//    or the encoder.  frameStats counts captured and dropped frames.
+//
+//  The path chooses the output:
+//
+//    *.ppm, *.png  one image per frame.  A printf conversion such as
+//                  %05d in the path is replaced by the frame number;
+//                  without one the number goes before the extension.
+//                  PNG uses only the fixed Huffman codes of deflate,
+//                  which still shrinks the flat areas of these frames.
+//    *.raw, *.rgb  one stream of RGB24 frames, top row first, for
+//                  ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -i path.
+//                  Frames of another size than the first are dropped.
+//
+
+// Starts recording; false when the path has no known extension.  Any
+//   earlier capture is stopped first.
+bool startCapture(const char* path);
+
+// Finishes the frames in flight, waits for the encoder and closes the
+//   output.  Registered with atexit() by startCapture().
+void stopCapture();
+
+// Holds or resumes recording without closing the output
+void pauseCapture(bool paused);
+bool isCapturing();
+
+// Reads the width x height frame from the bound read framebuffer.  Call
+//   after the frame is drawn and before glutSwapBuffers().
+void captureFrame(int width, int height);
+
+#endif // __FRAMECAPTURE_H__
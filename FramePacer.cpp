@@ -0,0 +1,136 @@
+#include "FramePacer.h"
+#include "Stats.h"
+
+#include <gl/glut.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+namespace {
+
+bool    installed = false;
+bool    animating = false;
+bool    timerSet = false;
+#ifdef _WIN32
+bool    finePeriod = false;     // timeBeginPeriod(1) is in effect
+#endif
+double  interval = 0.0;         // seconds per frame, 0 for unlimited
+double  deadline = 0.0;         // earliest start of the next frame
+double  lateMs = 0.0;           // how far past its deadline the frame started
+
+// Wake this much before the deadline and sleep the rest in small steps
+const double  TimerSlack = 0.002;
+
+void
+waitUntil(double t)
+{
+	for (double now = timeNow(); now < t; now = timeNow()) {
+		if (t - now > 0.0005) {
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void
+onTimer(int)
+{
+	timerSet = false;
+	waitUntil(deadline);
+	lateMs = (timeNow() - deadline) * 1000.0;
+	glutPostRedisplay();
+}
+
+void
+schedule()
+{
+	if (!installed || timerSet) { return; }
+
+	double wait = deadline - timeNow();
+	if (wait <= 0.0) {
+		lateMs = 0.0;
+		glutPostRedisplay();
+		return;
+	}
+
+	timerSet = true;
+	glutTimerFunc((unsigned)std::max(0.0, (wait - TimerSlack) * 1000.0), onTimer, 0);
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+initFramePacing(double fps)
+{
+#ifdef _WIN32
+	// 1 ms scheduler ticks instead of the default 15.6 ms
+	if (!finePeriod) {
+		timeBeginPeriod(1);
+		finePeriod = true;
+	}
+#endif
+	static bool registered = false;
+	if (!registered) {
+		atexit(stopFramePacing);
+		registered = true;
+	}
+	installed = true;
+	interval = (fps > 0.0) ? 1.0 / fps : 0.0;
+	deadline = timeNow();
+	requestRedraw();
+}
+
+void
+stopFramePacing()
+{
+	installed = false;
+#ifdef _WIN32
+	if (finePeriod) {
+		timeEndPeriod(1);
+		finePeriod = false;
+	}
+#endif
+}
+
+void
+requestRedraw()
+{
+	schedule();
+}
+
+void
+setAnimating(bool on)
+{
+	animating = on;
+	if (on) { requestRedraw(); }
+}
+
+bool
+isAnimating()
+{
+	return animating;
+}
+
+void
+frameDone()
+{
+	if (!installed) { return; }
+	frameStats.paceLateMs = lateMs;
+
+	// Keep a steady cadence, but never try to catch up on missed frames
+	double now = timeNow();
+	deadline = std::max(deadline + interval, now);
+	if (deadline - now > interval) { deadline = now + interval; }
+
+	if (animating) { schedule(); }
+}
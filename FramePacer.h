@@ -0,0 +1,37 @@
+#ifndef __FRAMEPACER_H__
+#define __FRAMEPACER_H__
+
+//----------------------------------------------------------------------------
+//
+//  On-demand redraw with frame pacing.
+//
+//  A frame is drawn only when something asked for one: input calls
+//    requestRedraw(), and while the scene is animating every finished
+//    frame asks for the next.  The animation starts paused, so an idle
+//    window draws nothing until it is started or receives input.  Requests are served no sooner than one
+//    frame interval after the previous frame started, so at most the
+//    target rate is drawn.  Between frames the process waits in GLUT's
+//    event loop on a timer rather than spinning in an idle callback; the
+//    timer is set a little early and the last stretch before the
+//    deadline is slept in short steps, which keeps frames evenly spaced
+//    even with coarse OS timers.  With nothing to draw there is no timer
+//    at all and the process sleeps until the next input event.
+//
+
+// Installs the scheduler; fps <= 0 redraws as fast as possible.  On
+//   Windows it raises the system timer resolution until
+//   stopFramePacing(), which is registered with atexit().
+void initFramePacing(double fps);
+void stopFramePacing();
+
+// The scene changed: draw a frame at the next deadline
+void requestRedraw();
+
+// While animating, every frame schedules the next one.  Off at startup.
+void setAnimating(bool animating);
+bool isAnimating();
+
+// Call at the end of display(), after the buffers were swapped
+void frameDone();
+
+#endif // __FRAMEPACER_H__
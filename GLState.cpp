@@ -0,0 +1,477 @@
+#include "GLState.h"
+#include "Stats.h"
+
+#include <cstring>
+#include <set>
+#include <string>
+
+namespace {
+
+const GLuint  Unknown = 0xffffffffu;
+
+// Capabilities whose enabled state is cached
+const GLenum  trackedCaps[] = {
+	GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_STENCIL_TEST,
+	GL_RASTERIZER_DISCARD, GL_POLYGON_OFFSET_FILL, GL_PROGRAM_POINT_SIZE,
+	GL_CLIP_DISTANCE0, GL_CLIP_DISTANCE1, GL_CLIP_DISTANCE2, GL_CLIP_DISTANCE3
+};
+const int     NumTrackedCaps = sizeof(trackedCaps) / sizeof(trackedCaps[0]);
+
+// Fixed-function capabilities, rejected by a core context
+const GLenum  legacyCaps[] = {
+	GL_LIGHTING, GL_LIGHT0, GL_LIGHT1, GL_LIGHT2, GL_LIGHT3, GL_LIGHT4,
+	GL_LIGHT5, GL_LIGHT6, GL_LIGHT7, GL_COLOR_MATERIAL, GL_NORMALIZE,
+	GL_ALPHA_TEST, GL_FOG, GL_TEXTURE_2D
+};
+const int     NumLegacyCaps = sizeof(legacyCaps) / sizeof(legacyCaps[0]);
+
+const GLenum  bufferTargets[] = {
+	GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_TEXTURE_BUFFER,
+	GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER, GL_UNIFORM_BUFFER
+};
+const int     NumBufferTargets = sizeof(bufferTargets) / sizeof(bufferTargets[0]);
+
+const int     MaxTextureUnits = 16;
+const GLenum  textureTargets[] = { GL_TEXTURE_2D, GL_TEXTURE_BUFFER };
+const int     NumTextureTargets = 2;
+
+// Fixed-function parameters whose values are cached
+const int     MaxLights = 8;
+const GLenum  lightParams[] = { GL_AMBIENT, GL_DIFFUSE, GL_SPECULAR, GL_POSITION };
+const int     NumLightParams = sizeof(lightParams) / sizeof(lightParams[0]);
+const GLenum  materialParams[] = { GL_AMBIENT, GL_DIFFUSE, GL_SPECULAR, GL_EMISSION, GL_SHININESS };
+const int     NumMaterialParams = sizeof(materialParams) / sizeof(materialParams[0]);
+
+// A cached vector parameter; size 0 until it is first set
+struct Param {
+	GLfloat  value[4];
+	int      size;
+};
+
+struct State {
+	GLuint   caps[NumTrackedCaps];      // GL_TRUE, GL_FALSE or Unknown
+	GLuint   legacyCaps[NumLegacyCaps];
+	GLuint   program;
+	GLuint   vao;
+	GLuint   buffers[NumBufferTargets];
+	GLuint   activeUnit;
+	GLuint   textures[MaxTextureUnits][NumTextureTargets];
+	GLuint   framebuffer, readFramebuffer;
+	GLint    viewport[4];
+	GLuint   depthFunc, depthMask, cullFace, frontFace, blendSrc, blendDst, shadeModel;
+	Param    lights[MaxLights][NumLightParams];
+	Param    materials[2][NumMaterialParams];    // front, back
+};
+
+State  cache;
+bool   coreProfile = true;
+
+inline int
+indexOf(const GLenum* list, int count, GLenum value)
+{
+	for (int i = 0; i < count; i++) {
+		if (list[i] == value) { return i; }
+	}
+	return -1;
+}
+
+// Returns true when the call has to reach GL, and counts it either way
+inline bool
+changes(GLuint* cached, GLuint value)
+{
+	if (*cached == value) {
+		frameStats.glCallsFiltered++;
+		return false;
+	}
+	*cached = value;
+	frameStats.glCalls++;
+	return true;
+}
+
+// Fixed-function call: true when it may be issued in this context
+bool
+legacyCall(const char* name)
+{
+#ifdef DEBUG
+	static std::set<std::string> reported;
+	if (reported.insert(name).second) {
+		std::cerr << "GL: " << name << " is deprecated"
+		          << (coreProfile ? " and ignored in the core profile" : "") << std::endl;
+	}
+#else
+	(void)name;
+#endif
+	if (coreProfile) {
+		frameStats.glCallsFiltered++;
+		return false;
+	}
+	return true;
+}
+
+inline bool
+sameParam(const Param& cached, const GLfloat* params, int size)
+{
+	return cached.size == size && memcmp(cached.value, params, size * sizeof(GLfloat)) == 0;
+}
+
+inline void
+setParam(Param* cached, const GLfloat* params, int size)
+{
+	memcpy(cached->value, params, size * sizeof(GLfloat));
+	cached->size = size;
+}
+
+// Sets every name of `names` found in `cached` back to the default
+void
+forget(GLuint* cached, int count, GLsizei n, const GLuint* names)
+{
+	for (GLsizei k = 0; k < n; k++) {
+		for (int i = 0; i < count; i++) {
+			if (names[k] != 0 && cached[i] == names[k]) { cached[i] = 0; }
+		}
+	}
+}
+
+void
+setCap(GLenum cap, bool enable)
+{
+	int i = indexOf(trackedCaps, NumTrackedCaps, cap);
+	if (i >= 0) {
+		if (changes(&cache.caps[i], enable ? GL_TRUE : GL_FALSE)) {
+			enable ? glEnable(cap) : glDisable(cap);
+		}
+		return;
+	}
+
+	int l = indexOf(legacyCaps, NumLegacyCaps, cap);
+	if (l >= 0) {
+		if (legacyCall(enable ? "glEnable of a fixed-function capability"
+			: "glDisable of a fixed-function capability")
+			&& changes(&cache.legacyCaps[l], enable ? GL_TRUE : GL_FALSE)) {
+			enable ? glEnable(cap) : glDisable(cap);
+		}
+		return;
+	}
+
+	frameStats.glCalls++;
+	enable ? glEnable(cap) : glDisable(cap);
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+syncGLState()
+{
+	GLint value = 0;
+
+	glGetIntegerv(GL_CONTEXT_PROFILE_MASK, &value);
+	coreProfile = (value & GL_CONTEXT_CORE_PROFILE_BIT) != 0;
+
+	for (int i = 0; i < NumTrackedCaps; i++) {
+		cache.caps[i] = glIsEnabled(trackedCaps[i]) ? GL_TRUE : GL_FALSE;
+	}
+	for (int i = 0; i < NumLegacyCaps; i++) {
+		cache.legacyCaps[i] = Unknown;
+	}
+
+	glGetIntegerv(GL_CURRENT_PROGRAM, &value);            cache.program = value;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &value);       cache.vao = value;
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &value);       cache.buffers[0] = value;
+	glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &value); cache.buffers[1] = value;
+	for (int i = 2; i < NumBufferTargets; i++) {
+		cache.buffers[i] = Unknown;
+	}
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &value);             cache.activeUnit = value - GL_TEXTURE0;
+	for (int u = 0; u < MaxTextureUnits; u++) {
+		for (int t = 0; t < NumTextureTargets; t++) {
+			cache.textures[u][t] = Unknown;
+		}
+	}
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &value);   cache.framebuffer = value;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &value);   cache.readFramebuffer = value;
+	glGetIntegerv(GL_VIEWPORT, cache.viewport);
+	glGetIntegerv(GL_DEPTH_FUNC, &value);                 cache.depthFunc = value;
+	glGetIntegerv(GL_DEPTH_WRITEMASK, &value);            cache.depthMask = value;
+	glGetIntegerv(GL_CULL_FACE_MODE, &value);             cache.cullFace = value;
+	glGetIntegerv(GL_FRONT_FACE, &value);                 cache.frontFace = value;
+	glGetIntegerv(GL_BLEND_SRC_RGB, &value);              cache.blendSrc = value;
+	glGetIntegerv(GL_BLEND_DST_RGB, &value);              cache.blendDst = value;
+	cache.shadeModel = Unknown;
+	memset(cache.lights, 0, sizeof(cache.lights));
+	memset(cache.materials, 0, sizeof(cache.materials));
+
+	// Queries above must not show up as errors of the caller
+	while (glGetError() != GL_NO_ERROR) {}
+}
+
+//----------------------------------------------------------------------------
+
+void
+stateEnable(GLenum cap)
+{
+	setCap(cap, true);
+}
+
+void
+stateDisable(GLenum cap)
+{
+	setCap(cap, false);
+}
+
+void
+stateUseProgram(GLuint program)
+{
+	if (changes(&cache.program, program)) {
+		glUseProgram(program);
+	}
+}
+
+void
+stateBindVertexArray(GLuint vao)
+{
+	if (changes(&cache.vao, vao)) {
+		glBindVertexArray(vao);
+		cache.buffers[1] = Unknown;
+	}
+}
+
+void
+stateBindBuffer(GLenum target, GLuint buffer)
+{
+	int i = indexOf(bufferTargets, NumBufferTargets, target);
+	if (i < 0) {
+		frameStats.glCalls++;
+		glBindBuffer(target, buffer);
+	}
+	else if (changes(&cache.buffers[i], buffer)) {
+		glBindBuffer(target, buffer);
+	}
+}
+
+void
+stateBindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	int t = indexOf(textureTargets, NumTextureTargets, target);
+	if (t < 0 || unit >= (GLuint)MaxTextureUnits) {
+		frameStats.glCalls += 2;
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(target, texture);
+		cache.activeUnit = unit;
+		return;
+	}
+
+	if (cache.textures[unit][t] == texture) {
+		frameStats.glCallsFiltered++;
+		return;
+	}
+	if (changes(&cache.activeUnit, unit)) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+	changes(&cache.textures[unit][t], texture);
+	glBindTexture(target, texture);
+}
+
+void
+stateBindFramebuffer(GLuint framebuffer)
+{
+	if (cache.framebuffer == framebuffer && cache.readFramebuffer == framebuffer) {
+		frameStats.glCallsFiltered++;
+		return;
+	}
+	cache.framebuffer = cache.readFramebuffer = framebuffer;
+	frameStats.glCalls++;
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void
+stateBindReadFramebuffer(GLuint framebuffer)
+{
+	if (changes(&cache.readFramebuffer, framebuffer)) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	}
+}
+
+void
+stateViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	GLint* v = cache.viewport;
+	if (v[0] == x && v[1] == y && v[2] == width && v[3] == height) {
+		frameStats.glCallsFiltered++;
+		return;
+	}
+	v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+	frameStats.glCalls++;
+	glViewport(x, y, width, height);
+}
+
+//----------------------------------------------------------------------------
+
+void
+stateDepthFunc(GLenum func)
+{
+	if (changes(&cache.depthFunc, func)) {
+		glDepthFunc(func);
+	}
+}
+
+void
+stateDepthMask(GLboolean mask)
+{
+	if (changes(&cache.depthMask, mask)) {
+		glDepthMask(mask);
+	}
+}
+
+void
+stateCullFace(GLenum face)
+{
+	if (changes(&cache.cullFace, face)) {
+		glCullFace(face);
+	}
+}
+
+void
+stateFrontFace(GLenum mode)
+{
+	if (changes(&cache.frontFace, mode)) {
+		glFrontFace(mode);
+	}
+}
+
+void
+stateBlendFunc(GLenum src, GLenum dst)
+{
+	if (cache.blendSrc == src && cache.blendDst == dst) {
+		frameStats.glCallsFiltered++;
+		return;
+	}
+	cache.blendSrc = src;
+	cache.blendDst = dst;
+	frameStats.glCalls++;
+	glBlendFunc(src, dst);
+}
+
+//----------------------------------------------------------------------------
+
+void
+stateShadeModel(GLenum mode)
+{
+	if (legacyCall("glShadeModel") && changes(&cache.shadeModel, mode)) {
+		glShadeModel(mode);
+	}
+}
+
+void
+stateLightfv(GLenum light, GLenum pname, const GLfloat* params)
+{
+	if (!legacyCall("glLightfv")) { return; }
+
+	GLuint l = light - GL_LIGHT0;
+	int p = indexOf(lightParams, NumLightParams, pname);
+	if (l < (GLuint)MaxLights && p >= 0) {
+		if (sameParam(cache.lights[l][p], params, 4)) {
+			frameStats.glCallsFiltered++;
+			return;
+		}
+		setParam(&cache.lights[l][p], params, 4);
+	}
+	frameStats.glCalls++;
+	glLightfv(light, pname, params);
+}
+
+void
+stateMaterialfv(GLenum face, GLenum pname, const GLfloat* params)
+{
+	if (!legacyCall("glMaterialfv")) { return; }
+
+	int p = indexOf(materialParams, NumMaterialParams, pname);
+	if (p >= 0) {
+		// Both sides have to match to drop a GL_FRONT_AND_BACK call
+		int size = (pname == GL_SHININESS) ? 1 : 4;
+		bool front = face != GL_BACK, back = face != GL_FRONT;
+		if ((!front || sameParam(cache.materials[0][p], params, size))
+			&& (!back || sameParam(cache.materials[1][p], params, size))) {
+			frameStats.glCallsFiltered++;
+			return;
+		}
+		if (front) { setParam(&cache.materials[0][p], params, size); }
+		if (back) { setParam(&cache.materials[1][p], params, size); }
+	}
+	frameStats.glCalls++;
+	glMaterialfv(face, pname, params);
+}
+
+//----------------------------------------------------------------------------
+
+void
+stateDeleteProgram(GLuint program)
+{
+	// A current program is only flagged; its name stays taken until
+	//   another one is used
+	if (program != 0 && cache.program == program) {
+		cache.program = Unknown;
+	}
+	frameStats.glCalls++;
+	glDeleteProgram(program);
+}
+
+void
+stateDeleteVertexArrays(GLsizei n, const GLuint* vaos)
+{
+	GLuint vao = cache.vao;
+	forget(&cache.vao, 1, n, vaos);
+	if (cache.vao != vao) {
+		cache.buffers[1] = Unknown;
+	}
+	frameStats.glCalls++;
+	glDeleteVertexArrays(n, vaos);
+}
+
+void
+stateDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	forget(cache.buffers, NumBufferTargets, n, buffers);
+	frameStats.glCalls++;
+	glDeleteBuffers(n, buffers);
+}
+
+void
+stateDeleteTextures(GLsizei n, const GLuint* textures)
+{
+	forget(&cache.textures[0][0], MaxTextureUnits * NumTextureTargets, n, textures);
+	frameStats.glCalls++;
+	glDeleteTextures(n, textures);
+}
+
+void
+stateDeleteFramebuffers(GLsizei n, const GLuint* framebuffers)
+{
+	forget(&cache.framebuffer, 1, n, framebuffers);
+	forget(&cache.readFramebuffer, 1, n, framebuffers);
+	frameStats.glCalls++;
+	glDeleteFramebuffers(n, framebuffers);
+}
+
+//----------------------------------------------------------------------------
+
+GLuint
+stateCurrentProgram()
+{
+	return cache.program;
+}
+
+GLuint
+stateCurrentVertexArray()
+{
+	return cache.vao;
+}
+
+GLuint
+stateCurrentFramebuffer()
+{
+	return cache.framebuffer;
+}
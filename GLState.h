@@ -0,0 +1,64 @@
+#ifndef __GLSTATE_H__
+#define __GLSTATE_H__
+
+#include "Angel.h"
+
+//----------------------------------------------------------------------------
+//
+//  Cache of the GL state this program changes.  Every enable, bind,
+//    program, vertex array and fixed-function state change goes through
+//    these calls; one that would set the value already current is dropped
+//    instead of reaching the driver.  frameStats counts issued and
+//    filtered calls.
+//
+//  Fixed-function calls (glShadeModel, glLightfv, glMaterialfv and the
+//    lighting enables) do not exist in the 3.2 core profile.  They are
+//    dropped in a core context and forwarded in a compatibility one; with
+//    DEBUG defined each one is reported once.
+//
+//  The element array binding belongs to the vertex array object, so it is
+//    forgotten whenever the vertex array changes.  Objects are deleted
+//    through this layer as well: GL unbinds a deleted name, and the cache
+//    has to follow before the name is handed out again.
+//
+
+// Reads the current GL state into the cache.  Call once the context
+//   exists, and again after code outside this layer changed state.
+void syncGLState();
+
+void stateEnable(GLenum cap);
+void stateDisable(GLenum cap);
+
+void stateUseProgram(GLuint program);
+void stateBindVertexArray(GLuint vao);
+void stateBindBuffer(GLenum target, GLuint buffer);
+void stateBindTexture(GLuint unit, GLenum target, GLuint texture);
+void stateBindFramebuffer(GLuint framebuffer);        // draw and read
+void stateBindReadFramebuffer(GLuint framebuffer);
+void stateViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+void stateDepthFunc(GLenum func);
+void stateDepthMask(GLboolean mask);
+void stateCullFace(GLenum face);
+void stateFrontFace(GLenum mode);
+void stateBlendFunc(GLenum src, GLenum dst);
+
+// Fixed-function state (see above).  The colours and the position of
+//   GL_LIGHT0..7 and the colours and shininess of the material are
+//   cached; a light position is compared as given, before the
+//   fixed-function model-view transforms it.
+void stateShadeModel(GLenum mode);
+void stateLightfv(GLenum light, GLenum pname, const GLfloat* params);
+void stateMaterialfv(GLenum face, GLenum pname, const GLfloat* params);
+
+void stateDeleteProgram(GLuint program);
+void stateDeleteVertexArrays(GLsizei n, const GLuint* vaos);
+void stateDeleteBuffers(GLsizei n, const GLuint* buffers);
+void stateDeleteTextures(GLsizei n, const GLuint* textures);
+void stateDeleteFramebuffers(GLsizei n, const GLuint* framebuffers);
+
+GLuint stateCurrentProgram();
+GLuint stateCurrentVertexArray();
+GLuint stateCurrentFramebuffer();
+
+#endif // __GLSTATE_H__
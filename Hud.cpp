@@ -0,0 +1,675 @@
+#include "Hud.h"
+#include "Angel.h"
+#include "GLState.h"
+#include "ShaderSource.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#  include <Windows.h>
+#  include <Psapi.h>
+#  pragma comment(lib, "psapi.lib")
+#else
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+#endif
+
+namespace {
+
+const int     HistoryFrames = 240;
+const int     Scale = 2;                // window pixels per glyph pixel
+const int     GlyphWidth = 5, GlyphHeight = 7;
+const int     Advance = (GlyphWidth + 1) * Scale;
+const int     LineHeight = (GlyphHeight + 3) * Scale;
+const int     Margin = 8;
+const int     BarWidth = 2;
+const int     FrameGraphHeight = 64;
+const double  FrameGraphMs = 50.0;      // full height of the frame time graph
+const int     CpuGraphHeight = 48;
+const double  PublishPeriod = 1.0;      // seconds
+const double  ResidentPeriod = 0.5;     // between reads of the process size
+
+// 5x7 glyphs, one byte per row from the top, bit 4 the leftmost column.
+//   Lower case is drawn as upper case; anything else missing as a space.
+const char  glyphChars[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.,:/%()-+=";
+const unsigned char  glyphRows[][7] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // space
+	{ 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e },   // 0
+	{ 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e },   // 1
+	{ 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f },   // 2
+	{ 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e },   // 3
+	{ 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 },   // 4
+	{ 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e },   // 5
+	{ 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e },   // 6
+	{ 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },   // 7
+	{ 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e },   // 8
+	{ 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c },   // 9
+	{ 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 },   // A
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e },   // B
+	{ 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e },   // C
+	{ 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c },   // D
+	{ 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f },   // E
+	{ 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 },   // F
+	{ 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f },   // G
+	{ 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 },   // H
+	{ 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e },   // I
+	{ 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c },   // J
+	{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },   // K
+	{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f },   // L
+	{ 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 },   // M
+	{ 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },   // N
+	{ 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e },   // O
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 },   // P
+	{ 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d },   // Q
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 },   // R
+	{ 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e },   // S
+	{ 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },   // T
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e },   // U
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 },   // V
+	{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a },   // W
+	{ 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 },   // X
+	{ 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04 },   // Y
+	{ 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f },   // Z
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c },   // .
+	{ 0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08 },   // ,
+	{ 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 },   // :
+	{ 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },   // /
+	{ 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },   // %
+	{ 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },   // (
+	{ 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },   // )
+	{ 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 },   // -
+	{ 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 },   // +
+	{ 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 },   // =
+};
+const int  NumGlyphs = sizeof(glyphRows) / sizeof(glyphRows[0]);
+
+// The glyphs side by side, then a column of set texels for solid quads
+const int  SolidTexel = NumGlyphs * GlyphWidth;
+
+struct Sample {
+	float  frameMs;
+	float  physicsMs;
+	float  recordMs;
+	float  submitMs;
+};
+
+struct HudVertex {
+	GLfloat  x, y;                      // window pixels from the top left
+	GLfloat  u, v;                      // glyph texels
+	GLubyte  color[4];
+};
+
+const GLubyte  Panel[4]    = {   0,   0,   0, 160 };
+const GLubyte  White[4]    = { 255, 255, 255, 255 };
+const GLubyte  Grid[4]     = { 255, 255, 255,  64 };
+const GLubyte  Good[4]     = {  80, 220,  80, 255 };
+const GLubyte  Late[4]     = { 240, 200,  40, 255 };
+const GLubyte  Missed[4]   = { 240,  60,  40, 255 };
+const GLubyte  Physics[4]  = {  80, 160, 255, 255 };
+const GLubyte  Record[4]   = { 255, 150,  50, 255 };
+const GLubyte  Submit[4]   = { 220,  90, 220, 255 };
+
+// What the publisher writes for one period
+struct Counters {
+	int         frames;
+	double      frameMs, frameMsMax;
+	double      gpuMs, physicsMs, recordMs, submitMs;
+	FrameStats  last;
+};
+
+Sample                  history[HistoryFrames];
+int                     historyCount = 0;
+int                     historyNext = 0;
+
+bool                    visible = false;
+GLuint                  program = 0, vao = 0, buffer = 0, glyphTexture = 0;
+GLint                   windowSizeLoc = -1, glyphsLoc = -1;
+unsigned                locationGeneration = 0;     // shaderGeneration() of the locations
+std::vector<HudVertex>  vertices;
+double                  hudMs = 0.0;    // the overlay's own cost last time
+size_t                  resident = 0;
+double                  residentTime = -1.0;
+
+std::mutex              countersMutex;
+Counters                counters;
+std::atomic<bool>       publishing(false);
+std::thread             publisher;
+std::string             filePath, socketPath;
+int                     listener = -1;
+
+//----------------------------------------------------------------------------
+
+// Bytes of physical memory the process holds, 0 where unknown
+size_t
+residentBytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc)) {
+		return pmc.WorkingSetSize;
+	}
+#elif defined(__linux__)
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (f != NULL) {
+		long size = 0, pages = 0;
+		int read = fscanf(f, "%ld %ld", &size, &pages);
+		fclose(f);
+		if (read == 2) {
+			return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+		}
+	}
+#endif
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//
+//  Overlay geometry
+//
+
+void
+quad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1,
+     const GLubyte* color)
+{
+	HudVertex c[4] = {
+		{ x0, y0, u0, v0, { color[0], color[1], color[2], color[3] } },
+		{ x1, y0, u1, v0, { color[0], color[1], color[2], color[3] } },
+		{ x1, y1, u1, v1, { color[0], color[1], color[2], color[3] } },
+		{ x0, y1, u0, v1, { color[0], color[1], color[2], color[3] } },
+	};
+	static const int corners[6] = { 0, 3, 2, 0, 2, 1 };     // counter-clockwise on screen
+	for (int i = 0; i < 6; i++) {
+		vertices.push_back(c[corners[i]]);
+	}
+}
+
+void
+solid(float x0, float y0, float x1, float y1, const GLubyte* color)
+{
+	float u = SolidTexel + 0.5f;
+	quad(x0, y0, x1, y1, u, 0.5f, u, 0.5f, color);
+}
+
+// Returns where the next text on the line starts
+float
+text(float x, float y, const char* s, const GLubyte* color)
+{
+	for (; *s != '\0'; s++, x += Advance) {
+		const char* g = strchr(glyphChars, toupper((unsigned char)*s));
+		if (g == NULL || *g == ' ') { continue; }
+
+		float u = (float)((g - glyphChars) * GlyphWidth);
+		quad(x, y, x + GlyphWidth * Scale, y + GlyphHeight * Scale,
+		     u, 0.0f, u + GlyphWidth, (float)GlyphHeight, color);
+	}
+	return x;
+}
+
+const Sample&
+sampleAt(int i)                         // 0 is the oldest kept
+{
+	int first = (historyCount < HistoryFrames) ? 0 : historyNext;
+	return history[(first + i) % HistoryFrames];
+}
+
+// One bar per frame, 16.7 and 33.3 ms marked
+void
+frameGraph(float x, float y)
+{
+	for (int i = 0; i < historyCount; i++) {
+		float ms = sampleAt(i).frameMs;
+		float h = (float)std::min(ms / FrameGraphMs, 1.0) * FrameGraphHeight;
+		const GLubyte* color = (ms <= 17.0f) ? Good : (ms <= 34.0f) ? Late : Missed;
+		float bx = x + (float)(i * BarWidth);
+		solid(bx, y + FrameGraphHeight - h, bx + BarWidth, y + (float)FrameGraphHeight, color);
+	}
+	for (int k = 1; k <= 2; k++) {
+		float ly = y + FrameGraphHeight * (1.0f - (float)(k * 1000.0 / 60.0 / FrameGraphMs));
+		solid(x, ly, x + (float)(HistoryFrames * BarWidth), ly + 1.0f, Grid);
+	}
+}
+
+// Physics, recording and submitting stacked, scaled to the next power of
+//   two milliseconds above the highest bar.  Returns the scale.
+double
+cpuGraph(float x, float y)
+{
+	double top = 1.0;
+	for (int i = 0; i < historyCount; i++) {
+		const Sample& s = sampleAt(i);
+		while (s.physicsMs + s.recordMs + s.submitMs > top) { top *= 2.0; }
+	}
+
+	for (int i = 0; i < historyCount; i++) {
+		const Sample& s = sampleAt(i);
+		float parts[3] = { s.physicsMs, s.recordMs, s.submitMs };
+		const GLubyte* colors[3] = { Physics, Record, Submit };
+		float bx = x + (float)(i * BarWidth);
+		float base = y + (float)CpuGraphHeight;
+		for (int k = 0; k < 3; k++) {
+			float h = (float)(parts[k] / top) * CpuGraphHeight;
+			if (h <= 0.0f) { continue; }
+			solid(bx, base - h, bx + BarWidth, base, colors[k]);
+			base -= h;
+		}
+	}
+	return top;
+}
+
+void
+buildOverlay()
+{
+	const FrameStats& s = frameStats;
+	char line[128];
+
+	double mean = 0.0, worst = 0.0;
+	for (int i = 0; i < historyCount; i++) {
+		mean += history[i].frameMs;
+		worst = std::max(worst, (double)history[i].frameMs);
+	}
+	mean /= std::max(historyCount, 1);
+
+	double now = timeNow();
+	if (residentTime < 0.0 || now - residentTime > ResidentPeriod) {
+		resident = residentBytes();
+		residentTime = now;
+	}
+
+	float x = (float)(2 * Margin), y = (float)(2 * Margin);
+	float right = x + HistoryFrames * BarWidth;      // grows to the widest line
+	vertices.clear();
+
+	snprintf(line, sizeof line, "FRAME %.1f MS  %.0f FPS  MAX %.1f  GPU %.2f",
+	         mean, (mean > 0.0) ? 1000.0 / mean : 0.0, worst, s.gpuMs);
+	right = std::max(right, text(x, y, line, White));
+	y += LineHeight;
+	frameGraph(x, y);
+	y += FrameGraphHeight + 2 * Scale;
+
+	const Sample& last = history[(historyNext + HistoryFrames - 1) % HistoryFrames];
+	float lx = x;
+	snprintf(line, sizeof line, "PHYSICS %.2f  ", last.physicsMs);
+	lx = text(lx, y, line, Physics);
+	snprintf(line, sizeof line, "RECORD %.2f  ", last.recordMs);
+	lx = text(lx, y, line, Record);
+	snprintf(line, sizeof line, "SUBMIT %.2f", last.submitMs);
+	right = std::max(right, text(lx, y, line, Submit));
+	y += LineHeight;
+
+	// The scale in the graph's top right corner
+	double top = cpuGraph(x, y);
+	snprintf(line, sizeof line, "%g MS", top);
+	text(x + HistoryFrames * BarWidth - (float)(strlen(line) * Advance), y, line, White);
+	y += CpuGraphHeight + Scale;
+
+	snprintf(line, sizeof line, "DRAWS %d  VERTICES %d  GL %d/%d",
+	         s.drawCalls, s.verticesShaded, s.glCalls, s.glCallsFiltered);
+	right = std::max(right, text(x, y, line, White));
+	y += LineHeight;
+	snprintf(line, sizeof line, "CULLED %d OUTSIDE, %d BY %d OCCLUDERS",
+	         s.culledOutside, s.culledOccluded, s.occluders);
+	right = std::max(right, text(x, y, line, White));
+	y += LineHeight;
+	snprintf(line, sizeof line, "BODIES %d  PAIRS %d  CONTACTS %d",
+	         s.numBodies, s.broadPhasePairs, s.contactPairs + s.staticContacts);
+	right = std::max(right, text(x, y, line, White));
+	y += LineHeight;
+	snprintf(line, sizeof line, "MEMORY %.1f MB  ARENA %d KB  NEW %d",
+	         resident / 1048576.0, s.arenaBytes / 1024, s.heapAllocations);
+	right = std::max(right, text(x, y, line, White));
+	y += LineHeight;
+	snprintf(line, sizeof line, "OVERLAY %.3f MS, %d QUADS",
+	         hudMs, (int)(vertices.size() / 6) + 1);
+	right = std::max(right, text(x, y, line, White));
+
+	// The panel goes first, under everything, now that its size is known
+	size_t n = vertices.size();
+	solid((float)Margin, (float)Margin, right + Margin,
+	      y + GlyphHeight * Scale + Margin, Panel);
+	std::rotate(vertices.begin(), vertices.begin() + n, vertices.end());
+}
+
+// A reloaded shader may have moved its uniforms
+void
+lookUpLocations()
+{
+	windowSizeLoc = glGetUniformLocation(program, "WindowSize");
+	glyphsLoc = glGetUniformLocation(program, "Glyphs");
+	locationGeneration = shaderGeneration();
+}
+
+void
+initHud()
+{
+	program = InitShader("vhud.glsl", "fhud.glsl");
+	followShaderProgram(&program);
+	lookUpLocations();
+
+	std::vector<GLubyte> texels((SolidTexel + 1) * GlyphHeight, 0);
+	for (int g = 0; g < NumGlyphs; g++) {
+		for (int r = 0; r < GlyphHeight; r++) {
+			for (int c = 0; c < GlyphWidth; c++) {
+				if (glyphRows[g][r] & (0x10 >> c)) {
+					texels[r * (SolidTexel + 1) + g * GlyphWidth + c] = 255;
+				}
+			}
+		}
+	}
+	for (int r = 0; r < GlyphHeight; r++) {
+		texels[r * (SolidTexel + 1) + SolidTexel] = 255;
+	}
+
+	glGenTextures(1, &glyphTexture);
+	stateBindTexture(0, GL_TEXTURE_2D, glyphTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, SolidTexel + 1, GlyphHeight, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	GLuint previous = stateCurrentVertexArray();
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &buffer);
+	stateBindVertexArray(vao);
+	stateBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	GLint pixel = glGetAttribLocation(program, "vPixel");
+	GLint texel = glGetAttribLocation(program, "vTexel");
+	GLint color = glGetAttribLocation(program, "vColor");
+	glEnableVertexAttribArray(pixel);
+	glVertexAttribPointer(pixel, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), BUFFER_OFFSET(offsetof(HudVertex, x)));
+	glEnableVertexAttribArray(texel);
+	glVertexAttribPointer(texel, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), BUFFER_OFFSET(offsetof(HudVertex, u)));
+	glEnableVertexAttribArray(color);
+	glVertexAttribPointer(color, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), BUFFER_OFFSET(offsetof(HudVertex, color)));
+	stateBindVertexArray(previous);
+}
+
+//----------------------------------------------------------------------------
+//
+//  Publisher thread
+//
+
+std::string
+formatCounters(const Counters& c)
+{
+	const FrameStats& s = c.last;
+	double n = std::max(c.frames, 1);
+	char text[1024];
+	snprintf(text, sizeof text,
+		"frame %lu\n"
+		"frames %d\n"
+		"frame_ms %.3f\n"
+		"frame_ms_max %.3f\n"
+		"gpu_ms %.3f\n"
+		"physics_ms %.3f\n"
+		"record_ms %.3f\n"
+		"submit_ms %.3f\n"
+		"draw_calls %d\n"
+		"vertices %d\n"
+		"gl_calls %d\n"
+		"gl_calls_filtered %d\n"
+		"culled_outside %d\n"
+		"culled_occluded %d\n"
+		"occluders %d\n"
+		"bodies %d\n"
+		"contacts %d\n"
+		"heap_allocations %d\n"
+		"arena_bytes %d\n"
+		"resident_bytes %lu\n",
+		s.frame, c.frames, c.frameMs / n, c.frameMsMax, c.gpuMs / n,
+		c.physicsMs / n, c.recordMs / n, c.submitMs / n,
+		s.drawCalls, s.verticesShaded, s.glCalls, s.glCallsFiltered,
+		s.culledOutside, s.culledOccluded, s.occluders,
+		s.numBodies, s.contactPairs + s.staticContacts,
+		s.heapAllocations, s.arenaBytes, (unsigned long)residentBytes());
+	return text;
+}
+
+bool
+writeCounters(const std::string& text)
+{
+	std::string temporary = filePath + ".tmp";
+	FILE* f = fopen(temporary.c_str(), "wb");
+	if (f == NULL) { return false; }
+	bool written = fwrite(text.data(), 1, text.size(), f) == text.size();
+	written = (fclose(f) == 0) && written;
+#ifdef _WIN32
+	remove(filePath.c_str());               // rename() does not replace there
+#endif
+	return written && rename(temporary.c_str(), filePath.c_str()) == 0;
+}
+
+#ifndef _WIN32
+// Every client gets the text of the last period and the connection closes
+void
+serveClients(const std::string& text, int timeoutMs)
+{
+	pollfd pfd = { listener, POLLIN, 0 };
+	if (poll(&pfd, 1, timeoutMs) <= 0) { return; }
+
+	int client = accept(listener, NULL, NULL);
+	if (client < 0) { return; }
+#ifdef MSG_NOSIGNAL
+	send(client, text.data(), text.size(), MSG_NOSIGNAL);
+#else
+	send(client, text.data(), text.size(), 0);
+#endif
+	close(client);
+}
+#endif
+
+void
+publisherMain()
+{
+	std::string text;
+	bool failed = false;
+	double next = timeNow();
+
+	while (publishing) {
+		// Wake often enough to stop quickly
+		int waitMs = (int)std::min((next - timeNow()) * 1000.0, 100.0);
+		if (waitMs > 0) {
+#ifndef _WIN32
+			if (listener >= 0) {
+				serveClients(text, waitMs);
+				continue;
+			}
+#endif
+			std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+			continue;
+		}
+		next = std::max(next + PublishPeriod, timeNow());
+
+		Counters c;
+		{
+			std::lock_guard<std::mutex> lock(countersMutex);
+			c = counters;
+			counters.frames = 0;
+			counters.frameMs = counters.frameMsMax = 0.0;
+			counters.gpuMs = counters.physicsMs = counters.recordMs = counters.submitMs = 0.0;
+		}
+		text = formatCounters(c);
+
+		// A failing file is reported once, and retried every period
+		if (!filePath.empty()) {
+			bool ok = writeCounters(text);
+			if (!ok && !failed) {
+				std::cerr << "Failed to write stats to " << filePath << std::endl;
+			}
+			failed = !ok;
+		}
+	}
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+recordHudFrame()
+{
+	const FrameStats& s = frameStats;
+	Sample& h = history[historyNext];
+	h.frameMs = (float)s.frameMs;
+	h.physicsMs = (float)(s.integrateMs + s.broadPhaseMs + s.narrowPhaseMs);
+	h.recordMs = (float)s.recordMs;
+	h.submitMs = (float)s.submitMs;
+	historyNext = (historyNext + 1) % HistoryFrames;
+	historyCount = std::min(historyCount + 1, HistoryFrames);
+
+	if (!publishing) { return; }
+
+	std::lock_guard<std::mutex> lock(countersMutex);
+	counters.frames++;
+	counters.frameMs += s.frameMs;
+	counters.frameMsMax = std::max(counters.frameMsMax, s.frameMs);
+	counters.gpuMs += s.gpuMs;
+	counters.physicsMs += h.physicsMs;
+	counters.recordMs += s.recordMs;
+	counters.submitMs += s.submitMs;
+	counters.last = s;
+}
+
+void
+toggleHud()
+{
+	visible = !visible;
+}
+
+bool
+hudVisible()
+{
+	return visible;
+}
+
+//----------------------------------------------------------------------------
+
+void
+drawHud(int width, int height)
+{
+	if (!visible || historyCount == 0) { return; }
+
+	double t = timeNow();
+	if (program == 0) {
+		initHud();
+	}
+	else if (locationGeneration != shaderGeneration()) {
+		lookUpLocations();
+	}
+	buildOverlay();
+
+	// The scene's draws set their attributes on whatever array is bound
+	GLuint previous = stateCurrentVertexArray();
+	stateBindVertexArray(vao);
+	stateBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(HudVertex), vertices.data(), GL_STREAM_DRAW);
+
+	stateUseProgram(program);
+	glUniform2f(windowSizeLoc, (GLfloat)width, (GLfloat)height);
+	glUniform1i(glyphsLoc, 0);
+	stateBindTexture(0, GL_TEXTURE_2D, glyphTexture);
+	stateViewport(0, 0, width, height);
+	stateDisable(GL_DEPTH_TEST);
+	stateDisable(GL_CULL_FACE);
+	stateEnable(GL_BLEND);
+	stateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vertices.size());
+
+	stateDisable(GL_BLEND);
+	stateEnable(GL_CULL_FACE);
+	stateEnable(GL_DEPTH_TEST);
+	stateBindVertexArray(previous);
+	hudMs = (timeNow() - t) * 1000.0;
+}
+
+//----------------------------------------------------------------------------
+
+bool
+startPublishing(const char* file, const char* socket)
+{
+	stopPublishing();
+	filePath = (file != NULL) ? file : "";
+	socketPath.clear();
+
+	if (socket != NULL) {
+#ifdef _WIN32
+		std::cerr << "Unix sockets are not supported here; use -stats-file" << std::endl;
+		return false;
+#else
+		sockaddr_un address;
+		memset(&address, 0, sizeof address);
+		address.sun_family = AF_UNIX;
+		if (strlen(socket) >= sizeof address.sun_path) {
+			std::cerr << "Socket path " << socket << " is too long" << std::endl;
+			return false;
+		}
+		strcpy(address.sun_path, socket);
+
+		// A socket left behind by an earlier run is replaced, any other file kept
+		struct stat st;
+		if (stat(socket, &st) == 0) {
+			if (!S_ISSOCK(st.st_mode)) {
+				std::cerr << socket << " exists and is not a socket" << std::endl;
+				return false;
+			}
+			unlink(socket);
+		}
+
+		listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener < 0 || bind(listener, (const sockaddr*)&address, sizeof address) != 0
+		    || listen(listener, 8) != 0) {
+			std::cerr << "Failed to listen on " << socket << std::endl;
+			if (listener >= 0) { close(listener); }
+			listener = -1;
+			return false;
+		}
+		socketPath = socket;
+#endif
+	}
+	if (filePath.empty() && socketPath.empty()) { return true; }
+
+	static bool registered = false;
+	if (!registered) {
+		atexit(stopPublishing);
+		registered = true;
+	}
+
+	memset(&counters, 0, sizeof counters);
+	publishing = true;
+	publisher = std::thread(publisherMain);
+	return true;
+}
+
+void
+stopPublishing()
+{
+	publishing = false;
+	if (publisher.joinable()) {
+		publisher.join();
+	}
+
+#ifndef _WIN32
+	if (listener >= 0) {
+		close(listener);
+		listener = -1;
+		unlink(socketPath.c_str());
+	}
+#endif
+}
@@ -0,0 +1,44 @@
+#ifndef __HUD_H__
+#define __HUD_H__
+
+//----------------------------------------------------------------------------
+//
+//  Live performance numbers: an overlay and a stats endpoint.
+//
+//  recordHudFrame() keeps the frame times of the last few seconds and, while
+//    publishing, sums them up for the current period.  It only copies a
+//    few numbers, so it runs every frame whether the overlay is shown or
+//    not.
+//
+//  The overlay draws graphs of the frame time and of the CPU time spent on
+//    physics, recording and submitting, and the draw calls, vertices,
+//    culling, physics and memory counters of the last frame.  All of it,
+//    text included, is one vertex array of quads drawn with a single
+//    glDrawArrays(): text quads read a small glyph texture, the others a
+//    solid texel of it.  It shows its own cost on the last line.  The
+//    overlay prints timings, so frames drawn with it do not hash the same
+//    in two replays.
+//
+//  A publisher thread writes the counters of every one second period as
+//    "name value" lines, to a file that is replaced by rename so readers
+//    never see half of it, and to every client that connects to a Unix
+//    socket.  Times are means over the period, except frame_ms_max;
+//    counts are those of the period's last frame.
+//
+
+void recordHudFrame();          // in display(), once frameStats is complete
+
+void toggleHud();
+bool hudVisible();
+
+// Draws the overlay over the bound framebuffer when it is shown
+//   (GL thread only)
+void drawHud(int width, int height);
+
+// Starts publishing to either or both of a file and a Unix socket (NULL
+//   for none); false with a message on std::cerr when one cannot be
+//   opened.  stopPublishing() is registered with atexit().
+bool startPublishing(const char* filePath, const char* socketPath);
+void stopPublishing();
+
+#endif // __HUD_H__
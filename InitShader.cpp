@@ -1,42 +1,33 @@
 
 #include "Angel.h"
+#include "GLState.h"
+#include "ShaderSource.h"
 
 namespace Angel {
 
-// Create a NULL-terminated string by reading the provided file
-static char*
-readShaderSource(const char* shaderFile)
+// Create a GLSL program object from vertex and fragment shader files.
+//   The files may #include others (ShaderSource.h), and the program is
+//   replaced when they change while watchShaders() runs; callers keep the
+//   name in a variable given to followShaderProgram().
+GLuint
+InitShader(const char* vShaderFile, const char* fShaderFile)
 {
-	FILE* fp;
-	fopen_s(&fp, shaderFile, "r");
-
-    if ( fp == NULL ) { return NULL; }
-
-    fseek(fp, 0L, SEEK_END);
-    long size = ftell(fp);
-
-    fseek(fp, 0L, SEEK_SET);
-    char* buf = new char[size + 1];
-    fread(buf, 1, size, fp);
-
-    buf[size] = '\0';
-    fclose(fp);
-
-    return buf;
+    return InitShader( vShaderFile, fShaderFile, NULL, 0 );
 }
 
-
-// Create a GLSL program object from vertex and fragment shader files
+// Same, capturing the given vertex shader outputs with transform feedback
+//   (one buffer per varying).  fShaderFile may be NULL for programs that
+//   only run with GL_RASTERIZER_DISCARD.
 GLuint
-InitShader(const char* vShaderFile, const char* fShaderFile)
+InitShader(const char* vShaderFile, const char* fShaderFile,
+	   const char** feedbackVaryings, int numVaryings)
 {
     struct Shader {
 	const char*  filename;
 	GLenum       type;
-	GLchar*      source;
     }  shaders[2] = {
-	{ vShaderFile, GL_VERTEX_SHADER, NULL },
-	{ fShaderFile, GL_FRAGMENT_SHADER, NULL }
+	{ vShaderFile, GL_VERTEX_SHADER },
+	{ fShaderFile, GL_FRAGMENT_SHADER }
     };
 
     GLuint program = glCreateProgram();
@@ -44,15 +35,13 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 	
     for ( int i = 0; i < 2; ++i ) {
 	Shader& s = shaders[i];
-	s.source = readShaderSource( s.filename );
-	if ( shaders[i].source == NULL ) {
-	    std::cerr << "Failed to read " << s.filename << std::endl;
-	    exit( EXIT_FAILURE );
-	}
+	if ( s.filename == NULL ) { continue; }
 
 	GLuint shader = glCreateShader( s.type );
 
-	glShaderSource( shader, 1, (const GLchar**) &s.source, NULL );
+	if ( !setShaderSource( shader, s.filename ) ) {
+	    exit( EXIT_FAILURE );
+	}
 	glCompileShader( shader );
 
 	GLint  compiled;
@@ -63,17 +52,21 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 	    glGetShaderiv( shader, GL_INFO_LOG_LENGTH, &logSize );
 	    char* logMsg = new char[logSize];
 	    glGetShaderInfoLog( shader, logSize, NULL, logMsg );
-	    std::cerr << logMsg << std::endl;
+	    std::cerr << logMsg << "Source strings: "
+		      << shaderSourceFiles( s.filename ) << std::endl;
 	    delete [] logMsg;
 
 	    exit( EXIT_FAILURE );
 	}
 
-	delete [] s.source;
-
 	glAttachShader( program, shader );
     }
 
+    if ( numVaryings > 0 ) {
+	glTransformFeedbackVaryings( program, numVaryings, feedbackVaryings,
+				     GL_SEPARATE_ATTRIBS );
+    }
+
     /* link  and error check */
     glLinkProgram(program);
 
@@ -91,8 +84,11 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 	exit( EXIT_FAILURE );
     }
 
+    registerShaderProgram( program, vShaderFile, fShaderFile,
+			   feedbackVaryings, numVaryings );
+
     /* use program object */
-    glUseProgram(program);
+    stateUseProgram(program);
 
     return program;
 }
@@ -0,0 +1,368 @@
+#include "Integrator.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const char* const  integratorNames[NumParticleIntegrators] = {
+	"euler", "verlet", "rk4", "adaptive"
+};
+
+// The part of the acceleration every body shares
+struct Forces {
+	float  drag;
+	float  stiffness;
+};
+
+inline float
+acceleration(float a, float p, float v, float anchor, const Forces& f)
+{
+	return a - f.drag * v - f.stiffness * (p - anchor);
+}
+
+//----------------------------------------------------------------------------
+// Fixed steps, one axis at a time
+
+void
+eulerAxis(float* p, float* v, const float* a, const float* dt, float anchor,
+	Forces f, int begin, int end)
+{
+	for (int i = begin; i < end; i++) {
+		v[i] += acceleration(a[i], p[i], v[i], anchor, f) * dt[i];
+		p[i] += v[i] * dt[i];
+	}
+}
+
+// The acceleration at the new position uses the velocity predicted with
+//   the old one, which drag needs
+void
+verletAxis(float* p, float* v, const float* a, const float* dt, float anchor,
+	Forces f, int begin, int end)
+{
+	for (int i = begin; i < end; i++) {
+		float h = dt[i];
+		float a0 = acceleration(a[i], p[i], v[i], anchor, f);
+		float p1 = p[i] + (v[i] + 0.5f * a0 * h) * h;
+		float a1 = acceleration(a[i], p1, v[i] + a0 * h, anchor, f);
+		p[i] = p1;
+		v[i] += 0.5f * (a0 + a1) * h;
+	}
+}
+
+void
+rk4Axis(float* p, float* v, const float* a, const float* dt, float anchor,
+	Forces f, int begin, int end)
+{
+	for (int i = begin; i < end; i++) {
+		float h = dt[i], p0 = p[i], v0 = v[i];
+		float k1p = v0;
+		float k1v = acceleration(a[i], p0, v0, anchor, f);
+		float k2p = v0 + 0.5f * h * k1v;
+		float k2v = acceleration(a[i], p0 + 0.5f * h * k1p, k2p, anchor, f);
+		float k3p = v0 + 0.5f * h * k2v;
+		float k3v = acceleration(a[i], p0 + 0.5f * h * k2p, k3p, anchor, f);
+		float k4p = v0 + h * k3v;
+		float k4v = acceleration(a[i], p0 + h * k3p, k4p, anchor, f);
+		p[i] = p0 + h / 6.0f * (k1p + 2.0f * k2p + 2.0f * k3p + k4p);
+		v[i] = v0 + h / 6.0f * (k1v + 2.0f * k2v + 2.0f * k3v + k4v);
+	}
+}
+
+//----------------------------------------------------------------------------
+// Dormand-Prince 5(4): the fifth order solution is kept and its distance
+//   from the embedded fourth order one estimates the error of the step
+
+const double  dpA[7][6] = {
+	{ 0.0 },
+	{ 1.0 / 5.0 },
+	{ 3.0 / 40.0, 9.0 / 40.0 },
+	{ 44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0 },
+	{ 19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0 },
+	{ 9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0 },
+	{ 35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0 }
+};
+
+// Fifth minus fourth order weights
+const double  dpE[7] = {
+	71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0,
+	22.0 / 525.0, -1.0 / 40.0
+};
+
+// State: position then velocity
+struct Body {
+	double  a[3];
+	double  anchor[3];
+	double  drag;
+	double  stiffness;
+};
+
+inline void
+derivative(const Body& b, const double* y, double* dy)
+{
+	for (int k = 0; k < 3; k++) {
+		dy[k] = y[3 + k];
+		dy[3 + k] = b.a[k] - b.drag * y[3 + k] - b.stiffness * (y[k] - b.anchor[k]);
+	}
+}
+
+// One step of h from y into out; returns the error relative to the tolerance
+double
+dormandPrince(const Body& b, const double* y, double h, double tolerance, double* out)
+{
+	double k[7][6], stage[6];
+
+	derivative(b, y, k[0]);
+	for (int s = 1; s < 7; s++) {
+		for (int j = 0; j < 6; j++) {
+			double sum = 0.0;
+			for (int r = 0; r < s; r++) { sum += dpA[s][r] * k[r][j]; }
+			stage[j] = y[j] + h * sum;
+		}
+		derivative(b, stage, k[s]);
+	}
+
+	// The last stage was taken at the new solution
+	memcpy(out, stage, sizeof(stage));
+
+	double error = 0.0;
+	for (int j = 0; j < 6; j++) {
+		double e = 0.0;
+		for (int s = 0; s < 7; s++) { e += dpE[s] * k[s][j]; }
+		double scale = tolerance * std::max(1.0, std::max(fabs(y[j]), fabs(out[j])));
+		error = std::max(error, fabs(h * e) / scale);
+	}
+	return error;
+}
+
+long
+adaptiveRange(ParticleSystem* ps, int begin, int end)
+{
+	float* p[3] = { ps->px, ps->py, ps->pz };
+	float* v[3] = { ps->vx, ps->vy, ps->vz };
+	const float* a[3] = { ps->ax, ps->ay, ps->az };
+
+	Body b;
+	b.drag = ps->drag;
+	b.stiffness = ps->stiffness;
+	for (int k = 0; k < 3; k++) { b.anchor[k] = ps->anchor[k]; }
+
+	long steps = 0;
+	for (int i = begin; i < end; i++) {
+		double y[6], next[6];
+		for (int k = 0; k < 3; k++) {
+			y[k] = p[k][i];
+			y[3 + k] = v[k][i];
+			b.a[k] = a[k][i];
+		}
+
+		double duration = ps->dt[i], t = 0.0;
+		double minStep = 1e-6 * duration;
+		double h = (ps->step[i] > 0.0f) ? ps->step[i] : duration;
+
+		while (duration - t > minStep) {
+			double step = std::min(h, duration - t);
+			double error = dormandPrince(b, y, step, ps->tolerance, next);
+			if (error <= 1.0 || step <= minStep) {
+				memcpy(y, next, sizeof(y));
+				t += step;
+				steps++;
+			}
+
+			// Standard controller: aim a little below the tolerance and
+			//   change the step by at most 5x either way
+			double factor = (error > 1.9e-4) ? 0.9 * pow(error, -0.2) : 5.0;
+			h = std::max(step * std::min(5.0, std::max(0.2, factor)), minStep);
+		}
+
+		for (int k = 0; k < 3; k++) {
+			p[k][i] = (float)y[k];
+			v[k][i] = (float)y[3 + k];
+		}
+		ps->step[i] = (float)h;
+	}
+	return steps;
+}
+
+//----------------------------------------------------------------------------
+// Benchmark
+
+// A spring with drag settles in a damped oscillation around the point
+//   where it balances the constant acceleration
+float
+exactPosition(float p0, float v0, float a, float drag, float stiffness, float t)
+{
+	double rest = a / stiffness;
+	double y0 = p0 - rest;
+	double w = sqrt(stiffness - 0.25 * drag * drag);
+	double decay = exp(-0.5 * drag * t);
+	return (float)(rest + decay * (y0 * cos(w * t) + (v0 + 0.5 * drag * y0) / w * sin(w * t)));
+}
+
+void
+resetBodies(ParticleSystem* ps, int bodies, float dt)
+{
+	ps->count = 0;
+	srand(3);
+	for (int i = 0; i < bodies; i++) {
+		vec3 pos(4.0 * rand() / RAND_MAX - 2.0, 4.0 * rand() / RAND_MAX - 2.0, 4.0 * rand() / RAND_MAX - 2.0);
+		vec3 vel(2.0 * rand() / RAND_MAX - 1.0, 2.0 * rand() / RAND_MAX - 1.0, 2.0 * rand() / RAND_MAX - 1.0);
+		addParticle(ps, pos, vel, vec3(0.0, -9.8, 0.0), 0.05, dt);
+	}
+}
+
+struct Run {
+	double  step;      // mean step over all bodies
+	double  error;     // largest distance from the exact position
+	double  ms;
+};
+
+Run
+runScheme(ParticleSystem* ps, int integrator, int bodies, float duration, float dt, float tolerance)
+{
+	resetBodies(ps, bodies, dt);
+	ps->integrator = integrator;
+	ps->tolerance = tolerance;
+
+	std::vector<vec3> p0(bodies), v0(bodies);
+	for (int i = 0; i < bodies; i++) {
+		p0[i] = vec3(ps->px[i], ps->py[i], ps->pz[i]);
+		v0[i] = vec3(ps->vx[i], ps->vy[i], ps->vz[i]);
+	}
+
+	int calls = (int)(duration / dt + 0.5f);
+	long steps = 0;
+	double t = timeNow();
+	for (int c = 0; c < calls; c++) {
+		steps += integrateRange(ps, 0, bodies);
+	}
+
+	Run r;
+	r.ms = (timeNow() - t) * 1000.0;
+	r.step = (double)calls * dt * bodies / std::max(steps, 1L);
+	r.error = 0.0;
+	float time = calls * dt;
+	for (int i = 0; i < bodies; i++) {
+		vec3 exact(exactPosition(p0[i].x, v0[i].x, ps->ax[i], ps->drag, ps->stiffness, time),
+			exactPosition(p0[i].y, v0[i].y, ps->ay[i], ps->drag, ps->stiffness, time),
+			exactPosition(p0[i].z, v0[i].z, ps->az[i], ps->drag, ps->stiffness, time));
+		r.error = std::max(r.error, (double)length(particlePosition(*ps, i) - exact));
+	}
+	return r;
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+const char*
+integratorName(int integrator)
+{
+	return (integrator >= 0 && integrator < NumParticleIntegrators) ? integratorNames[integrator] : "?";
+}
+
+int
+findIntegrator(const char* name)
+{
+	for (int i = 0; i < NumParticleIntegrators; i++) {
+		if (strcmp(name, integratorNames[i]) == 0) { return i; }
+	}
+	return -1;
+}
+
+long
+integrateRange(ParticleSystem* ps, int begin, int end)
+{
+	if (ps->integrator == AdaptiveRungeKutta) {
+		return adaptiveRange(ps, begin, end);
+	}
+
+	void (*axis)(float*, float*, const float*, const float*, float, Forces, int, int) =
+		(ps->integrator == VelocityVerlet) ? verletAxis :
+		(ps->integrator == RungeKutta4) ? rk4Axis : eulerAxis;
+
+	Forces f = { ps->drag, ps->stiffness };
+	axis(ps->px, ps->vx, ps->ax, ps->dt, ps->anchor.x, f, begin, end);
+	axis(ps->py, ps->vy, ps->ay, ps->dt, ps->anchor.y, f, begin, end);
+	axis(ps->pz, ps->vz, ps->az, ps->dt, ps->anchor.z, f, begin, end);
+	return end - begin;
+}
+
+//----------------------------------------------------------------------------
+// Every fixed-step scheme over steps from 1/15 s down to 1/1920 s, and the
+//   adaptive one over tolerances.  The adaptive scheme never steps past
+//   the end of a call, so it is called only every quarter second and
+//   picks its own substeps in between.  For each error bound the summary
+//   lists the largest step that meets it and what the whole run cost.
+
+void
+integratorBenchmark(int bodies)
+{
+	const float duration = 2.0f;
+	const int numSteps = 8;
+	const float steps[numSteps] = { 1 / 15.0f, 1 / 30.0f, 1 / 60.0f, 1 / 120.0f,
+		1 / 240.0f, 1 / 480.0f, 1 / 960.0f, 1 / 1920.0f };
+	const int numTolerances = 6;
+	const float tolerances[numTolerances] = { 1e-2f, 1e-3f, 1e-4f, 1e-5f, 1e-6f, 1e-7f };
+	const int numBounds = 3;
+	const double bounds[numBounds] = { 1e-2, 1e-3, 1e-4 };
+
+	ParticleSystem ps;
+	initParticles(&ps, bodies);
+	ps.drag = 0.5f;
+	ps.stiffness = 4.0f;
+	ps.anchor = vec3(0.0, 0.0, 0.0);
+
+	std::cout << "integrators: " << bodies << " damped springs for " << duration
+	          << " s, 1 thread" << std::endl;
+
+	// best[s][b]: the cheapest run of scheme s within bounds[b]
+	Run best[NumParticleIntegrators][numBounds];
+	for (int s = 0; s < NumParticleIntegrators; s++) {
+		for (int b = 0; b < numBounds; b++) { best[s][b].ms = -1.0; }
+
+		int runs = (s == AdaptiveRungeKutta) ? numTolerances : numSteps;
+		for (int k = 0; k < runs; k++) {
+			Run r = (s == AdaptiveRungeKutta)
+				? runScheme(&ps, s, bodies, duration, 0.25f, tolerances[k])
+				: runScheme(&ps, s, bodies, duration, steps[k], 0.0f);
+
+			std::cout << "  " << integratorName(s);
+			if (s == AdaptiveRungeKutta) { std::cout << " tolerance " << tolerances[k]; }
+			std::cout << "  step 1/" << 1.0 / r.step << " s  error " << r.error << "  "
+			          << r.ms << " ms (" << r.ms * 1.0e6 / (duration / r.step * bodies)
+			          << " ns per body step)" << std::endl;
+
+			for (int b = 0; b < numBounds; b++) {
+				if (r.error <= bounds[b] && (best[s][b].ms < 0.0 || r.ms < best[s][b].ms)) {
+					best[s][b] = r;
+				}
+			}
+		}
+	}
+
+	for (int b = 0; b < numBounds; b++) {
+		std::cout << "  error within " << bounds[b] << ":" << std::endl;
+		const Run& euler = best[SemiImplicitEuler][b];
+		for (int s = 0; s < NumParticleIntegrators; s++) {
+			const Run& r = best[s][b];
+			std::cout << "    " << integratorName(s) << "  ";
+			if (r.ms < 0.0) {
+				std::cout << "not reached" << std::endl;
+				continue;
+			}
+			std::cout << "step 1/" << 1.0 / r.step << " s, " << r.ms << " ms";
+			if (euler.ms > 0.0) {
+				std::cout << " (" << r.step / euler.step << "x the step, "
+				          << euler.ms / r.ms << "x the speed of euler)";
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	freeParticles(&ps);
+}
@@ -0,0 +1,45 @@
+#ifndef __INTEGRATOR_H__
+#define __INTEGRATOR_H__
+
+#include "Particles.h"
+
+//----------------------------------------------------------------------------
+//
+//  Time integration of a ParticleSystem, chosen by its `integrator` field.
+//
+//  The fixed-step schemes advance each body by exactly its dt per call.
+//    The acceleration of one axis only depends on that axis, so they run
+//    as one pass per axis over the SoA arrays, which the compiler
+//    vectorizes.  The adaptive scheme splits each body's dt into as many
+//    substeps as its tolerance needs and remembers the last one as the
+//    first guess for the next call.
+//
+//  Higher order schemes cost more per step but keep their accuracy at
+//    much larger steps; integratorBenchmark() measures the trade.  The
+//    transform feedback backend (ParticlesGPU.h) only has semi-implicit
+//    Euler.
+//
+
+enum ParticleIntegrator {
+	SemiImplicitEuler,      // vel += acc*dt; pos += vel*dt
+	VelocityVerlet,         // second order, one extra acceleration
+	RungeKutta4,            // classic fourth order
+	AdaptiveRungeKutta,     // Dormand-Prince 5(4) with step control
+	NumParticleIntegrators
+};
+
+const char* integratorName(int integrator);
+
+// ParticleIntegrator by name, -1 if there is none
+int         findIntegrator(const char* name);
+
+// Advances bodies [begin, end) by their dt; returns the steps taken, which
+//   is end - begin except for the adaptive scheme
+long        integrateRange(ParticleSystem* ps, int begin, int end);
+
+// Follows `bodies` damped springs with every scheme over a range of steps
+//   and tolerances, and compares error against an exact solution with
+//   the time spent.  Needs no GL context.
+void        integratorBenchmark(int bodies);
+
+#endif // __INTEGRATOR_H__
@@ -0,0 +1,92 @@
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------
+
+bool
+mapFile(const char* path, MappedFile* mf)
+{
+	mf->data = NULL;
+	mf->size = 0;
+
+#ifdef _WIN32
+	mf->mapping = NULL;
+	mf->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mf->file == INVALID_HANDLE_VALUE) { return false; }
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mf->file, &size) || size.QuadPart == 0) {
+		CloseHandle(mf->file);
+		mf->file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mf->mapping == NULL) {
+		CloseHandle(mf->file);
+		mf->file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	mf->data = (const unsigned char*)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (mf->data == NULL) {
+		CloseHandle(mf->mapping);
+		CloseHandle(mf->file);
+		mf->mapping = NULL;
+		mf->file = INVALID_HANDLE_VALUE;
+		return false;
+	}
+	mf->size = (size_t)size.QuadPart;
+#else
+	mf->fd = open(path, O_RDONLY);
+	if (mf->fd < 0) { return false; }
+
+	struct stat st;
+	if (fstat(mf->fd, &st) != 0 || st.st_size == 0) {
+		close(mf->fd);
+		mf->fd = -1;
+		return false;
+	}
+
+	void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, mf->fd, 0);
+	if (p == MAP_FAILED) {
+		close(mf->fd);
+		mf->fd = -1;
+		return false;
+	}
+	mf->data = (const unsigned char*)p;
+	mf->size = (size_t)st.st_size;
+#endif
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+
+void
+unmapFile(MappedFile* mf)
+{
+	if (mf->data == NULL) { return; }
+
+#ifdef _WIN32
+	UnmapViewOfFile(mf->data);
+	CloseHandle(mf->mapping);
+	CloseHandle(mf->file);
+	mf->mapping = NULL;
+	mf->file = INVALID_HANDLE_VALUE;
+#else
+	munmap((void*)mf->data, mf->size);
+	close(mf->fd);
+	mf->fd = -1;
+#endif
+
+	mf->data = NULL;
+	mf->size = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <cstddef>
+
+#ifdef _WIN32
+#  include <Windows.h>
+#endif
+
+//----------------------------------------------------------------------------
+//
+//  Read-only memory mapping of a whole file.  The mapped bytes stay valid
+//    until unmapFile() is called, so pointers into them can be handed
+//    straight to OpenGL.
+//
+
+// Starts out unmapped, with no file open
+struct MappedFile {
+	const unsigned char*  data = NULL;
+	size_t                size = 0;
+#ifdef _WIN32
+	HANDLE                file = INVALID_HANDLE_VALUE;
+	HANDLE                mapping = NULL;
+#else
+	int                   fd = -1;
+#endif
+};
+
+bool mapFile(const char* path, MappedFile* mf);
+void unmapFile(MappedFile* mf);
+
+#endif // __MAPPEDFILE_H__
@@ -0,0 +1,246 @@
+#include "Mesh.h"
+#include "GLState.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+Mesh    meshes[NumMeshes];
+GLuint  meshBuffer = 0;
+GLuint  meshIndexBuffer = 0;
+
+// Edge lists built by buildMeshEdges()
+static std::vector<GLuint>  edgeStorage[NumMeshes];
+
+const void*  meshVertexBlob = NULL;
+GLsizeiptr   meshVertexBlobSize = 0;
+
+//----------------------------------------------------------------------------
+// Fill one registry entry; the attributes are packed at *offset in the
+//   vertex buffer (points first, then normals) and *offset is advanced.
+
+void
+setMesh(int id, const char* name, const point4* points,
+	const vec3* normals, GLuint numVertices, GLintptr* offset)
+{
+	Mesh& m = meshes[id];
+
+	m.name = name;
+	m.points = points;
+	m.normals = normals;
+	m.numVertices = numVertices;
+	m.indices = NULL;
+	m.numIndices = 0;
+	m.edges = NULL;
+	m.numEdgeIndices = 0;
+	m.numEdgeVertices = 0;
+
+	m.pointsOffset = *offset;
+	m.normalsOffset = *offset + numVertices * sizeof(point4);
+	*offset = m.normalsOffset + numVertices * sizeof(vec3);
+
+	m.boundsMin = vec3(points[0].x, points[0].y, points[0].z);
+	m.boundsMax = m.boundsMin;
+	for (GLuint i = 1; i < numVertices; i++) {
+		for (int k = 0; k < 3; k++) {
+			if (points[i][k] < m.boundsMin[k]) m.boundsMin[k] = points[i][k];
+			if (points[i][k] > m.boundsMax[k]) m.boundsMax[k] = points[i][k];
+		}
+	}
+
+	m.lods[0].firstIndex = 0;
+	m.lods[0].numIndices = 0;
+	m.lods[0].error = 0.0;
+	m.lods[0].numVertices = numVertices;
+	m.numLods = 1;
+}
+
+//----------------------------------------------------------------------------
+
+GLsizeiptr
+meshVertexBytes()
+{
+	GLsizeiptr size = 0;
+	for (int i = 0; i < NumMeshes; i++) {
+		GLsizeiptr end = meshes[i].normalsOffset + meshes[i].numVertices * sizeof(vec3);
+		if (end > size) size = end;
+	}
+	return size;
+}
+
+//----------------------------------------------------------------------------
+// Weld the soup by position, then list each triangle edge once.  The pairs
+//   are sorted by their first vertex so that consecutive lines reuse
+//   vertices while they are still in the post-transform cache.
+//
+// Generated positions that should meet often differ in the last bits
+//   (a sphere's seam is evaluated at 0 and at 2 pi), so vertices weld
+//   within a tolerance relative to the bounds.  Each vertex is put in a
+//   grid cell of that size, and only the 27 cells around it can hold a
+//   vertex close enough.
+
+namespace {
+
+const float  WeldTolerance = 1.0e-5f;  // of the bounds diagonal
+
+// 21 bits per axis, enough for 1 / WeldTolerance cells and a margin
+inline uint64_t
+cellKey(int x, int y, int z)
+{
+	return ((uint64_t)(x & 0x1fffff) << 42) | ((uint64_t)(y & 0x1fffff) << 21) | (uint64_t)(z & 0x1fffff);
+}
+
+}  // namespace
+
+void
+buildMeshEdges(int id)
+{
+	Mesh& m = meshes[id];
+	const point4* p = m.points;
+
+	vec3 extent = m.boundsMax - m.boundsMin;
+	float tolerance = std::max(WeldTolerance * length(extent), 1.0e-12f);
+
+	std::vector<int> cell(3 * m.numVertices);
+	std::vector<std::pair<uint64_t, GLuint> > grid(m.numVertices);
+	for (GLuint i = 0; i < m.numVertices; i++) {
+		for (int k = 0; k < 3; k++) {
+			cell[3 * i + k] = (int)((p[i][k] - m.boundsMin[k]) / tolerance) + 1;
+		}
+		grid[i] = std::make_pair(cellKey(cell[3 * i], cell[3 * i + 1], cell[3 * i + 2]), i);
+	}
+	std::sort(grid.begin(), grid.end());
+
+	// weld[i]: the lowest vertex index welded with vertex i.  Vertices are
+	//   visited in index order, so every earlier one already has its weld.
+	std::vector<GLuint> weld(m.numVertices);
+	for (GLuint v = 0; v < m.numVertices; v++) {
+		weld[v] = v;
+		for (int n = 0; n < 27 && weld[v] == v; n++) {
+			uint64_t key = cellKey(cell[3 * v] + n % 3 - 1, cell[3 * v + 1] + n / 3 % 3 - 1,
+				cell[3 * v + 2] + n / 9 - 1);
+			std::vector<std::pair<uint64_t, GLuint> >::const_iterator it =
+				std::lower_bound(grid.begin(), grid.end(), std::make_pair(key, (GLuint)0));
+			for (; it != grid.end() && it->first == key && it->second < v; ++it) {
+				GLuint u = it->second;
+				vec3 d(p[u].x - p[v].x, p[u].y - p[v].y, p[u].z - p[v].z);
+				if (dot(d, d) <= tolerance * tolerance) {
+					weld[v] = weld[u];
+					break;
+				}
+			}
+		}
+	}
+
+	std::vector<uint64_t> pairs;
+	pairs.reserve(m.numVertices);
+	for (GLuint t = 0; t + 2 < m.numVertices; t += 3) {
+		for (int e = 0; e < 3; e++) {
+			GLuint a = weld[t + e], b = weld[t + (e + 1) % 3];
+			if (a == b) { continue; }   // degenerate
+			pairs.push_back(((uint64_t)std::min(a, b) << 32) | std::max(a, b));
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+	std::vector<GLuint>& edges = edgeStorage[id];
+	edges.resize(2 * pairs.size());
+	for (size_t i = 0; i < pairs.size(); i++) {
+		edges[2 * i] = (GLuint)(pairs[i] >> 32);
+		edges[2 * i + 1] = (GLuint)pairs[i];
+	}
+
+	std::vector<GLuint> used(edges);
+	std::sort(used.begin(), used.end());
+
+	m.edges = edges.empty() ? NULL : edges.data();
+	m.numEdgeIndices = (GLuint)edges.size();
+	m.numEdgeVertices = (GLuint)(std::unique(used.begin(), used.end()) - used.begin());
+}
+
+//----------------------------------------------------------------------------
+// Fill meshBuffer with every registered mesh and meshIndexBuffer with
+//   their index and edge lists.
+
+void
+uploadMeshes()
+{
+	if (meshBuffer == 0) {
+		glGenBuffers(1, &meshBuffer);
+		glGenBuffers(1, &meshIndexBuffer);
+	}
+
+	GLsizeiptr indexBytes = 0;
+	for (int i = 0; i < NumMeshes; i++) {
+		Mesh& m = meshes[i];
+		m.indicesOffset = indexBytes;
+		m.edgesOffset = m.indicesOffset + m.numIndices * sizeof(GLuint);
+		indexBytes = m.edgesOffset + m.numEdgeIndices * sizeof(GLuint);
+	}
+
+	stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, std::max(indexBytes, (GLsizeiptr)4), NULL, GL_STATIC_DRAW);
+	for (int i = 0; i < NumMeshes; i++) {
+		const Mesh& m = meshes[i];
+		if (m.numIndices > 0) {
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, m.indicesOffset, m.numIndices * sizeof(GLuint), m.indices);
+		}
+		if (m.numEdgeIndices > 0) {
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, m.edgesOffset, m.numEdgeIndices * sizeof(GLuint), m.edges);
+		}
+	}
+
+	stateBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+
+	if (meshVertexBlob != NULL) {
+		glBufferData(GL_ARRAY_BUFFER, meshVertexBlobSize, meshVertexBlob, GL_STATIC_DRAW);
+		return;
+	}
+
+	glBufferData(GL_ARRAY_BUFFER, meshVertexBytes(), NULL, GL_STATIC_DRAW);
+	for (int i = 0; i < NumMeshes; i++) {
+		const Mesh& m = meshes[i];
+		glBufferSubData(GL_ARRAY_BUFFER, m.pointsOffset, m.numVertices * sizeof(point4), m.points);
+		glBufferSubData(GL_ARRAY_BUFFER, m.normalsOffset, m.numVertices * sizeof(vec3), m.normals);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+void
+drawMesh(const Mesh& m, GLenum mode, GLsizei instances, int lod)
+{
+	const MeshLod& l = m.lods[lod];
+
+	if (mode == GL_LINES && m.numEdgeIndices > 0) {
+		glDrawElementsInstanced(GL_LINES, m.numEdgeIndices, GL_UNSIGNED_INT,
+			BUFFER_OFFSET(m.edgesOffset), instances);
+		frameStats.verticesShaded += m.numEdgeVertices * instances;
+	}
+	else if (l.numIndices > 0) {
+		glDrawElementsInstanced(mode, l.numIndices, GL_UNSIGNED_INT,
+			BUFFER_OFFSET(m.indicesOffset + l.firstIndex * sizeof(GLuint)), instances);
+		frameStats.verticesShaded += l.numVertices * instances;
+	}
+	else {
+		glDrawArraysInstanced(mode, 0, m.numVertices, instances);
+		frameStats.verticesShaded += m.numVertices * instances;
+	}
+	frameStats.drawCalls++;
+}
+
+//----------------------------------------------------------------------------
+
+int
+selectMeshLod(const Mesh& m, float pixelsPerUnit, float maxPixels)
+{
+	float diagonal = length(m.boundsMax - m.boundsMin) * pixelsPerUnit;
+
+	int lod = 0;
+	while (lod + 1 < m.numLods && m.lods[lod + 1].error * diagonal <= maxPixels) {
+		lod++;
+	}
+	return lod;
+}
@@ -0,0 +1,99 @@
+#ifndef __MESH_H__
+#define __MESH_H__
+
+#include "Angel.h"
+
+typedef Angel::vec4  point4;
+
+//----------------------------------------------------------------------------
+//
+//  Registry of the meshes that share the vertex buffer created in init().
+//    Each entry points at CPU-side vertex data (either the generated
+//    arrays or a memory-mapped mesh cache) and records where that data
+//    lives in the GL buffer.
+//
+//  The generated meshes are triangle soups.  Each one also carries an edge
+//    list: vertices at (nearly) equal positions are welded and every
+//    triangle edge appears once, as a pair of indices into the soup.
+//    drawMesh() uses it for GL_LINES, which makes wireframes show the real
+//    edges and shade only the welded vertices.
+//
+//  Level 0 of a mesh is the whole soup.  Coarser levels (MeshSimplify.h)
+//    are index lists into the same vertices, stored one after the other in
+//    the mesh's index list.
+//
+
+enum { CubeMesh = 0, ConeMesh = 1, SphereMesh = 2, NumMeshes = 3 };
+
+const int MaxMeshLods = 8;
+
+struct MeshLod {
+	GLuint   firstIndex;   // first element in the mesh's index list
+	GLuint   numIndices;   // 0 draws all vertices without an index list
+	GLfloat  error;        // as a fraction of the bounds diagonal
+	GLuint   numVertices;  // distinct vertices the level uses
+};
+
+struct Mesh {
+	const char*    name;
+	const point4*  points;
+	const vec3*    normals;
+	GLuint         numVertices;
+	const GLuint*  indices;
+	GLuint         numIndices;
+	const GLuint*  edges;            // GL_LINES pairs
+	GLuint         numEdgeIndices;
+	GLuint         numEdgeVertices;  // distinct vertices the edges use
+
+	// byte offsets of the attributes inside the shared vertex buffer
+	GLintptr       pointsOffset;
+	GLintptr       normalsOffset;
+
+	// byte offsets of the index lists inside the shared element buffer
+	GLintptr       indicesOffset;
+	GLintptr       edgesOffset;
+
+	vec3           boundsMin;
+	vec3           boundsMax;
+
+	MeshLod        lods[MaxMeshLods];
+	int            numLods;
+};
+
+extern Mesh    meshes[NumMeshes];
+extern GLuint  meshBuffer;      // GL vertex buffer holding every mesh
+extern GLuint  meshIndexBuffer; // GL element buffer with every index list
+
+// Set when every mesh lives in one contiguous block laid out exactly as
+//   the GL vertex buffer (a mapped mesh cache), NULL otherwise.
+extern const void*  meshVertexBlob;
+extern GLsizeiptr   meshVertexBlobSize;
+
+void       setMesh(int id, const char* name, const point4* points,
+                   const vec3* normals, GLuint numVertices, GLintptr* offset);
+GLsizeiptr meshVertexBytes();
+
+// Builds the edge list of a registered mesh from its triangles.  Bump
+//   MeshEdgesVersion whenever its output changes, so cached copies of
+//   the old lists are rebuilt.
+const unsigned int  MeshEdgesVersion = 2;   // 2: welds within a tolerance
+void       buildMeshEdges(int id);
+
+// Creates meshBuffer and meshIndexBuffer and leaves both bound; the
+//   element buffer binding is part of the current vertex array object.
+void       uploadMeshes();
+
+// Draws one level of the mesh: GL_LINES draws the full edge list, any other
+//   mode the level's triangles.  The mesh's attributes and meshIndexBuffer
+//   must be bound.
+void       drawMesh(const Mesh& m, GLenum mode, GLsizei instances = 1, int lod = 0);
+
+// The coarsest level whose error stays within maxPixels when one unit of
+//   the mesh covers pixelsPerUnit pixels
+int        selectMeshLod(const Mesh& m, float pixelsPerUnit, float maxPixels);
+
+// Generates the unit primitives and fills the registry (Primitives.cpp)
+void          registerPrimitives();
+unsigned int  primitivesKey();
+
+#endif // __MESH_H__
@@ -0,0 +1,249 @@
+#include "MeshCache.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static MappedFile  cacheFile;
+
+//----------------------------------------------------------------------------
+
+static uint64_t
+alignUp(uint64_t offset)
+{
+	return (offset + MeshCacheAlign - 1) & ~(uint64_t)(MeshCacheAlign - 1);
+}
+
+static bool
+inFile(uint64_t offset, uint64_t size, uint64_t fileSize)
+{
+	return offset <= fileSize && size <= fileSize - offset;
+}
+
+// Index lists are drawn straight from the map, so every entry has to name
+//   a vertex of its own mesh
+static bool
+indicesBelow(const unsigned char* blob, uint64_t offset, uint32_t count, uint32_t limit)
+{
+	const GLuint* indices = (const GLuint*)(blob + offset);
+	for (uint32_t i = 0; i < count; i++) {
+		if (indices[i] >= limit) { return false; }
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+
+bool
+loadMeshCache(const char* path, uint32_t key)
+{
+	MappedFile mf;
+	if (!mapFile(path, &mf)) { return false; }
+
+	const MeshCacheHeader* h = (const MeshCacheHeader*)mf.data;
+	bool valid = mf.size >= sizeof(MeshCacheHeader)
+		&& h->magic == MeshCacheMagic
+		&& h->version == MeshCacheVersion
+		&& h->key == key
+		&& h->numMeshes == NumMeshes
+		&& h->fileSize == mf.size
+		&& inFile(sizeof(MeshCacheHeader), NumMeshes * sizeof(MeshCacheRecord), mf.size)
+		&& inFile(h->vertexBlobOffset, h->vertexBlobSize, mf.size)
+		&& inFile(h->indexBlobOffset, h->indexBlobSize, mf.size)
+		&& h->vertexBlobOffset % MeshCacheAlign == 0
+		&& h->indexBlobOffset % MeshCacheAlign == 0;
+
+	const MeshCacheRecord* records = (const MeshCacheRecord*)(mf.data + sizeof(MeshCacheHeader));
+	for (int i = 0; valid && i < NumMeshes; i++) {
+		const MeshCacheRecord& r = records[i];
+		const MeshCacheAttrib& pos = r.attribs[AttribPosition];
+		const MeshCacheAttrib& nrm = r.attribs[AttribNormal];
+
+		valid = r.name[sizeof(r.name) - 1] == '\0'
+			&& pos.semantic == AttribPosition && pos.components == 4 && pos.stride == 0
+			&& nrm.semantic == AttribNormal && nrm.components == 3 && nrm.stride == 0
+			&& pos.type == GL_FLOAT && nrm.type == GL_FLOAT
+			&& inFile(pos.offset, r.numVertices * sizeof(point4), h->vertexBlobSize)
+			&& inFile(nrm.offset, r.numVertices * sizeof(vec3), h->vertexBlobSize)
+			&& inFile(r.indicesOffset, r.numIndices * sizeof(GLuint), h->indexBlobSize)
+			&& r.indicesOffset % sizeof(GLuint) == 0
+			&& inFile(r.edgesOffset, r.numEdgeIndices * sizeof(GLuint), h->indexBlobSize)
+			&& r.edgesOffset % sizeof(GLuint) == 0
+			&& r.numLods >= 1 && r.numLods <= (uint32_t)MaxMeshLods;
+
+		for (uint32_t l = 0; valid && l < r.numLods; l++) {
+			valid = (uint64_t)r.lods[l].firstIndex + r.lods[l].numIndices <= r.numIndices
+				&& r.lods[l].numVertices <= r.numVertices;
+		}
+		if (valid) {
+			const unsigned char* indexBlob = mf.data + h->indexBlobOffset;
+			valid = indicesBelow(indexBlob, r.indicesOffset, r.numIndices, r.numVertices)
+				&& indicesBelow(indexBlob, r.edgesOffset, r.numEdgeIndices, r.numVertices)
+				&& r.numEdgeVertices <= r.numVertices;
+		}
+	}
+
+	if (!valid) {
+		std::cerr << "Ignoring stale or malformed mesh cache " << path << std::endl;
+		unmapFile(&mf);
+		return false;
+	}
+
+	closeMeshCache();
+	cacheFile = mf;
+
+	const unsigned char* vertexBlob = mf.data + h->vertexBlobOffset;
+	const unsigned char* indexBlob = mf.data + h->indexBlobOffset;
+
+	for (int i = 0; i < NumMeshes; i++) {
+		const MeshCacheRecord& r = records[i];
+		Mesh& m = meshes[i];
+
+		m.name = r.name;
+		m.points = (const point4*)(vertexBlob + r.attribs[AttribPosition].offset);
+		m.normals = (const vec3*)(vertexBlob + r.attribs[AttribNormal].offset);
+		m.numVertices = r.numVertices;
+		m.indices = r.numIndices ? (const GLuint*)(indexBlob + r.indicesOffset) : NULL;
+		m.numIndices = r.numIndices;
+		m.edges = r.numEdgeIndices ? (const GLuint*)(indexBlob + r.edgesOffset) : NULL;
+		m.numEdgeIndices = r.numEdgeIndices;
+		m.numEdgeVertices = r.numEdgeVertices;
+		m.pointsOffset = (GLintptr)r.attribs[AttribPosition].offset;
+		m.normalsOffset = (GLintptr)r.attribs[AttribNormal].offset;
+		m.boundsMin = vec3(r.boundsMin[0], r.boundsMin[1], r.boundsMin[2]);
+		m.boundsMax = vec3(r.boundsMax[0], r.boundsMax[1], r.boundsMax[2]);
+
+		m.numLods = (int)r.numLods;
+		for (int l = 0; l < m.numLods; l++) {
+			m.lods[l].firstIndex = r.lods[l].firstIndex;
+			m.lods[l].numIndices = r.lods[l].numIndices;
+			m.lods[l].error = r.lods[l].error;
+			m.lods[l].numVertices = r.lods[l].numVertices;
+		}
+	}
+
+	meshVertexBlob = vertexBlob;
+	meshVertexBlobSize = (GLsizeiptr)h->vertexBlobSize;
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+
+static bool
+writePadding(FILE* fp, uint64_t from, uint64_t to)
+{
+	static const unsigned char zeros[MeshCacheAlign] = { 0 };
+	return to == from || fwrite(zeros, 1, (size_t)(to - from), fp) == to - from;
+}
+
+bool
+writeMeshCache(const char* path, uint32_t key)
+{
+	MeshCacheHeader h;
+	MeshCacheRecord records[NumMeshes];
+	memset(&h, 0, sizeof(h));
+	memset(records, 0, sizeof(records));
+
+	uint64_t numIndices = 0;
+	for (int i = 0; i < NumMeshes; i++) {
+		const Mesh& m = meshes[i];
+		MeshCacheRecord& r = records[i];
+
+		strncpy(r.name, m.name, sizeof(r.name) - 1);
+		r.numVertices = m.numVertices;
+		r.numIndices = m.numIndices;
+		r.indicesOffset = numIndices * sizeof(GLuint);
+		numIndices += m.numIndices;
+		r.numEdgeIndices = m.numEdgeIndices;
+		r.numEdgeVertices = m.numEdgeVertices;
+		r.edgesOffset = numIndices * sizeof(GLuint);
+		numIndices += m.numEdgeIndices;
+
+		r.attribs[AttribPosition].semantic = AttribPosition;
+		r.attribs[AttribPosition].components = 4;
+		r.attribs[AttribPosition].type = GL_FLOAT;
+		r.attribs[AttribPosition].offset = (uint64_t)m.pointsOffset;
+		r.attribs[AttribNormal].semantic = AttribNormal;
+		r.attribs[AttribNormal].components = 3;
+		r.attribs[AttribNormal].type = GL_FLOAT;
+		r.attribs[AttribNormal].offset = (uint64_t)m.normalsOffset;
+
+		for (int k = 0; k < 3; k++) {
+			r.boundsMin[k] = m.boundsMin[k];
+			r.boundsMax[k] = m.boundsMax[k];
+		}
+
+		r.numLods = (uint32_t)m.numLods;
+		for (int l = 0; l < m.numLods; l++) {
+			r.lods[l].firstIndex = m.lods[l].firstIndex;
+			r.lods[l].numIndices = m.lods[l].numIndices;
+			r.lods[l].error = m.lods[l].error;
+			r.lods[l].numVertices = m.lods[l].numVertices;
+		}
+	}
+
+	h.magic = MeshCacheMagic;
+	h.version = MeshCacheVersion;
+	h.key = key;
+	h.numMeshes = NumMeshes;
+	h.vertexBlobOffset = alignUp(sizeof(h) + sizeof(records));
+	h.vertexBlobSize = (uint64_t)meshVertexBytes();
+	h.indexBlobOffset = alignUp(h.vertexBlobOffset + h.vertexBlobSize);
+	h.indexBlobSize = numIndices * sizeof(GLuint);
+	h.fileSize = h.indexBlobOffset + h.indexBlobSize;
+
+	// Write to a temporary name first so a crash never leaves a truncated
+	//   cache where the next run would find it.
+	std::string tmpPath = std::string(path) + ".tmp";
+	FILE* fp = fopen(tmpPath.c_str(), "wb");
+	if (fp == NULL) { return false; }
+
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1
+		&& fwrite(records, sizeof(records), 1, fp) == 1
+		&& writePadding(fp, sizeof(h) + sizeof(records), h.vertexBlobOffset);
+
+	// The vertex blob is the GL buffer image: attributes at their offsets
+	std::vector<unsigned char> blob((size_t)h.vertexBlobSize, 0);
+	for (int i = 0; ok && i < NumMeshes; i++) {
+		const Mesh& m = meshes[i];
+		memcpy(&blob[m.pointsOffset], m.points, m.numVertices * sizeof(point4));
+		memcpy(&blob[m.normalsOffset], m.normals, m.numVertices * sizeof(vec3));
+	}
+	ok = ok && fwrite(blob.data(), 1, blob.size(), fp) == blob.size()
+		&& writePadding(fp, h.vertexBlobOffset + h.vertexBlobSize, h.indexBlobOffset);
+
+	for (int i = 0; ok && i < NumMeshes; i++) {
+		const Mesh& m = meshes[i];
+		ok = (m.numIndices == 0
+			|| fwrite(m.indices, sizeof(GLuint), m.numIndices, fp) == m.numIndices)
+			&& (m.numEdgeIndices == 0
+			|| fwrite(m.edges, sizeof(GLuint), m.numEdgeIndices, fp) == m.numEdgeIndices);
+	}
+
+	ok = (fclose(fp) == 0) && ok;
+	if (ok) {
+		remove(path);
+		ok = rename(tmpPath.c_str(), path) == 0;
+	}
+	if (!ok) {
+		remove(tmpPath.c_str());
+		std::cerr << "Failed to write mesh cache " << path << std::endl;
+	}
+
+	return ok;
+}
+
+//----------------------------------------------------------------------------
+
+void
+closeMeshCache()
+{
+	if (meshVertexBlob != NULL && cacheFile.data != NULL) {
+		meshVertexBlob = NULL;
+		meshVertexBlobSize = 0;
+	}
+	unmapFile(&cacheFile);
+}
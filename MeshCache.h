@@ -0,0 +1,80 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include <stdint.h>
+#include "Mesh.h"
+
+//----------------------------------------------------------------------------
+//
+//  Binary mesh cache.  The file is laid out so that it can be memory-mapped
+//    and used in place:
+//
+//      MeshCacheHeader
+//      MeshCacheRecord[numMeshes]     attribute layout, bounds and LOD table
+//      vertex blob                    the GL vertex buffer, byte for byte
+//      index blob                     GLuint index and edge lists of every mesh
+//
+//    Blobs start on MeshCacheAlign byte boundaries.  All fields are little
+//    endian, which is what every platform we build on uses.
+//
+
+const uint32_t  MeshCacheMagic = 0x4853454d;   // "MESH"
+const uint32_t  MeshCacheVersion = 3;   // 2: edge lists, 3: LOD vertex counts
+const uint32_t  MeshCacheAlign = 64;
+
+enum { AttribPosition = 0, AttribNormal = 1, NumMeshAttribs = 2 };
+
+struct MeshCacheHeader {
+	uint32_t  magic;
+	uint32_t  version;
+	uint32_t  key;             // generator parameters, see primitivesKey()
+	uint32_t  numMeshes;
+	uint64_t  vertexBlobOffset;
+	uint64_t  vertexBlobSize;
+	uint64_t  indexBlobOffset;
+	uint64_t  indexBlobSize;
+	uint64_t  fileSize;
+};
+
+struct MeshCacheAttrib {
+	uint32_t  semantic;        // AttribPosition, AttribNormal
+	uint32_t  components;
+	uint32_t  type;            // GL_FLOAT
+	uint32_t  stride;          // 0 for tightly packed
+	uint64_t  offset;          // into the vertex blob
+};
+
+struct MeshCacheLod {
+	uint32_t  firstIndex;
+	uint32_t  numIndices;
+	float     error;
+	uint32_t  numVertices;
+};
+
+struct MeshCacheRecord {
+	char             name[16];
+	uint32_t         numVertices;
+	uint32_t         numIndices;
+	uint64_t         indicesOffset;   // into the index blob
+	uint32_t         numEdgeIndices;
+	uint32_t         numEdgeVertices;
+	uint64_t         edgesOffset;     // into the index blob
+	MeshCacheAttrib  attribs[NumMeshAttribs];
+	float            boundsMin[4];
+	float            boundsMax[4];
+	uint32_t         numLods;
+	uint32_t         reserved;
+	MeshCacheLod     lods[MaxMeshLods];
+};
+
+// Map the cache and point the mesh registry (and meshVertexBlob) into it.
+//   Returns false, leaving the registry untouched, if the file is missing,
+//   malformed or was built with a different version or key.
+bool loadMeshCache(const char* path, uint32_t key);
+
+// Write the current registry to path.
+bool writeMeshCache(const char* path, uint32_t key);
+
+void closeMeshCache();
+
+#endif // __MESHCACHE_H__
@@ -0,0 +1,642 @@
+#include "MeshSimplify.h"
+#include "Parallel.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <stdint.h>
+#include <vector>
+
+// Halve the triangles per level while the error stays small
+const LodTarget  defaultLodTargets[] = {
+	{ 0.5f, 0.01f }, { 0.25f, 0.02f }, { 0.125f, 0.04f }, { 0.0625f, 0.08f }
+};
+const int        numDefaultLodTargets = sizeof(defaultLodTargets) / sizeof(defaultLodTargets[0]);
+
+// Index lists of every level, referenced by the registry
+static std::vector<GLuint>  lodStorage[NumMeshes];
+
+namespace {
+
+// A normal that turns by one unit costs as much as a move of this
+//   fraction of the bounds diagonal
+const double  NormalWeight = 0.05;
+
+// Weight of the planes standing on open edges, against the surface's own
+const double  BorderWeight = 10.0;
+
+// A collapse may turn no remaining triangle by more than about 75 degrees
+const double  MinTurnCos = 0.25;
+
+enum { CornerFree, CornerBorder, CornerLocked, CornerGone };
+
+// Squared distance to a triangle in (position, normal) space, summed over
+//   triangles and weighted by their area.  a is the upper triangle of the
+//   symmetric 6x6 matrix, row by row.
+struct Quadric {
+	double  a[21];
+	double  b[6];
+	double  c;
+	double  w;       // area it was summed from
+};
+
+void
+clearQuadric(Quadric* q)
+{
+	memset(q, 0, sizeof(*q));
+}
+
+void
+addQuadric(Quadric* q, const Quadric& r)
+{
+	for (int i = 0; i < 21; i++) { q->a[i] += r.a[i]; }
+	for (int i = 0; i < 6; i++) { q->b[i] += r.b[i]; }
+	q->c += r.c;
+	q->w += r.w;
+}
+
+double
+quadricError(const Quadric& q, const double* v)
+{
+	double s = q.c;
+	int k = 0;
+	for (int i = 0; i < 6; i++) {
+		s += q.a[k++] * v[i] * v[i];
+		for (int j = i + 1; j < 6; j++) {
+			s += 2.0 * q.a[k++] * v[i] * v[j];
+		}
+		s += 2.0 * q.b[i] * v[i];
+	}
+	return s;
+}
+
+inline double
+dot6(const double* a, const double* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3] + a[4] * b[4] + a[5] * b[5];
+}
+
+// The quadric of the plane through p, q and r, which spans two of the six
+//   dimensions: |v - p|^2 minus the square of its projections on the plane
+void
+triangleQuadric(const double* p, const double* q, const double* r, double area, Quadric* out)
+{
+	clearQuadric(out);
+
+	double e1[6], e2[6];
+	for (int i = 0; i < 6; i++) {
+		e1[i] = q[i] - p[i];
+		e2[i] = r[i] - p[i];
+	}
+	double len = sqrt(dot6(e1, e1));
+	if (len < 1e-12) { return; }
+	for (int i = 0; i < 6; i++) { e1[i] /= len; }
+
+	double d = dot6(e2, e1);
+	for (int i = 0; i < 6; i++) { e2[i] -= d * e1[i]; }
+	len = sqrt(dot6(e2, e2));
+	if (len < 1e-12) { return; }
+	for (int i = 0; i < 6; i++) { e2[i] /= len; }
+
+	double pe1 = dot6(p, e1), pe2 = dot6(p, e2);
+	int k = 0;
+	for (int i = 0; i < 6; i++) {
+		for (int j = i; j < 6; j++) {
+			out->a[k++] = area * ((i == j ? 1.0 : 0.0) - e1[i] * e1[j] - e2[i] * e2[j]);
+		}
+		out->b[i] = area * (pe1 * e1[i] + pe2 * e2[i] - p[i]);
+	}
+	out->c = area * (dot6(p, p) - pe1 * pe1 - pe2 * pe2);
+	out->w = area;
+}
+
+// The quadric of the plane n.x + d = 0 over the positions only
+void
+planeQuadric(const double* n, double d, double weight, Quadric* out)
+{
+	clearQuadric(out);
+
+	int k = 0;
+	for (int i = 0; i < 6; i++) {
+		for (int j = i; j < 6; j++) {
+			out->a[k++] = (i < 3 && j < 3) ? weight * n[i] * n[j] : 0.0;
+		}
+		out->b[i] = (i < 3) ? weight * d * n[i] : 0.0;
+	}
+	out->c = weight * d * d;
+}
+
+inline void
+cross3(const double* a, const double* b, double* out)
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+inline double
+dot3(const double* a, const double* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// A triangle side, keyed by the corners at its ends
+struct Edge {
+	uint64_t  corners;
+	int       side;         // 3 * triangle + first vertex
+};
+
+// Collapse of corner `from` onto corner `to`, valid while neither corner
+//   has changed since it was queued
+struct Candidate {
+	float         error;
+	int           from, to;
+	unsigned int  stamp;
+
+	bool operator<(const Candidate& c) const { return error > c.error; }
+};
+
+struct Simplifier {
+	// vertices: the soup welded by position and normal
+	std::vector<GLuint>   vertexSoup;       // a soup vertex with its attributes
+	std::vector<int>      vertexCorner;
+	std::vector<double>   attribs;          // 6 per vertex
+	std::vector<Quadric>  quadrics;
+
+	// corners: the vertices welded by position
+	std::vector<std::vector<int> >  cornerVertices;
+	std::vector<std::vector<int> >  cornerTriangles;
+	std::vector<unsigned char>      cornerKind;
+	std::vector<unsigned int>       version;
+
+	std::vector<int>            triangles;  // 3 vertices each
+	std::vector<unsigned char>  alive;
+	int                         numTriangles;
+	int                         liveTriangles;
+
+	double                      diagonal;
+	std::priority_queue<Candidate>  queue;
+
+	// scratch
+	std::vector<int>  ringFrom, ringTo, mapping;
+};
+
+inline const double*
+position(const Simplifier& s, int vertex)
+{
+	return &s.attribs[6 * vertex];
+}
+
+inline int
+cornerOf(const Simplifier& s, int t, int k)
+{
+	return s.vertexCorner[s.triangles[3 * t + k]];
+}
+
+bool
+hasCorner(const Simplifier& s, int t, int corner)
+{
+	return cornerOf(s, t, 0) == corner || cornerOf(s, t, 1) == corner || cornerOf(s, t, 2) == corner;
+}
+
+// The corners sharing a live triangle with `corner`, sorted
+void
+ring(const Simplifier& s, int corner, std::vector<int>* out)
+{
+	out->clear();
+	const std::vector<int>& tris = s.cornerTriangles[corner];
+	for (size_t i = 0; i < tris.size(); i++) {
+		if (!s.alive[tris[i]]) { continue; }
+		for (int k = 0; k < 3; k++) {
+			int c = cornerOf(s, tris[i], k);
+			if (c != corner) { out->push_back(c); }
+		}
+	}
+	std::sort(out->begin(), out->end());
+	out->erase(std::unique(out->begin(), out->end()), out->end());
+}
+
+//----------------------------------------------------------------------------
+// Weld the soup, sum the quadrics and find the open and non-manifold edges
+
+void
+setup(Simplifier& s, const Mesh& m)
+{
+	const point4* p = m.points;
+	const vec3* n = m.normals;
+	GLuint numVertices = m.numVertices;
+
+	vec3 extent = m.boundsMax - m.boundsMin;
+	s.diagonal = std::max((double)length(extent), 1e-6);
+	double normalScale = NormalWeight * s.diagonal;
+
+	std::vector<GLuint> order(numVertices);
+	for (GLuint i = 0; i < numVertices; i++) { order[i] = i; }
+	std::sort(order.begin(), order.end(), [p, n](GLuint a, GLuint b) {
+		for (int k = 0; k < 4; k++) {
+			if (p[a][k] != p[b][k]) { return p[a][k] < p[b][k]; }
+		}
+		for (int k = 0; k < 3; k++) {
+			if (n[a][k] != n[b][k]) { return n[a][k] < n[b][k]; }
+		}
+		return a < b;
+	});
+
+	std::vector<int> vertexOf(numVertices);
+	int numCorners = 0;
+	for (GLuint i = 0; i < numVertices; i++) {
+		GLuint v = order[i], prev = (i > 0) ? order[i - 1] : v;
+		bool samePosition = i > 0, sameNormal = i > 0;
+		for (int k = 0; samePosition && k < 4; k++) { samePosition = p[v][k] == p[prev][k]; }
+		for (int k = 0; sameNormal && k < 3; k++) { sameNormal = n[v][k] == n[prev][k]; }
+
+		if (!samePosition) { numCorners++; }
+		if (samePosition && sameNormal) {
+			vertexOf[v] = vertexOf[prev];
+			continue;
+		}
+
+		vertexOf[v] = (int)s.vertexSoup.size();
+		s.vertexSoup.push_back(v);
+		s.vertexCorner.push_back(numCorners - 1);
+		double a[6] = { p[v].x, p[v].y, p[v].z,
+			normalScale * n[v].x, normalScale * n[v].y, normalScale * n[v].z };
+		s.attribs.insert(s.attribs.end(), a, a + 6);
+	}
+
+	int numWelded = (int)s.vertexSoup.size();
+	s.cornerVertices.assign(numCorners, std::vector<int>());
+	s.cornerTriangles.assign(numCorners, std::vector<int>());
+	s.cornerKind.assign(numCorners, CornerFree);
+	s.version.assign(numCorners, 0);
+	for (int v = 0; v < numWelded; v++) {
+		s.cornerVertices[s.vertexCorner[v]].push_back(v);
+	}
+
+	// Triangles that still have three corners
+	s.triangles.clear();
+	for (GLuint t = 0; t + 2 < numVertices; t += 3) {
+		int a = vertexOf[t], b = vertexOf[t + 1], c = vertexOf[t + 2];
+		if (s.vertexCorner[a] == s.vertexCorner[b] || s.vertexCorner[b] == s.vertexCorner[c]
+			|| s.vertexCorner[c] == s.vertexCorner[a]) {
+			continue;
+		}
+		s.triangles.push_back(a);
+		s.triangles.push_back(b);
+		s.triangles.push_back(c);
+	}
+	s.numTriangles = (int)s.triangles.size() / 3;
+	s.liveTriangles = s.numTriangles;
+	s.alive.assign(s.numTriangles, 1);
+
+	s.quadrics.resize(numWelded);
+	for (int v = 0; v < numWelded; v++) { clearQuadric(&s.quadrics[v]); }
+
+	// Every vertex of a triangle gets its quadric, weighted by its area
+	std::vector<Edge> edges;
+	edges.reserve(3 * s.numTriangles);
+	for (int t = 0; t < s.numTriangles; t++) {
+		const int* v = &s.triangles[3 * t];
+		const double *a = position(s, v[0]), *b = position(s, v[1]), *c = position(s, v[2]);
+
+		double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		double w[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		double normal[3];
+		cross3(u, w, normal);
+		double area = 0.5 * sqrt(dot3(normal, normal));
+
+		Quadric q;
+		triangleQuadric(a, b, c, area, &q);
+		for (int k = 0; k < 3; k++) {
+			addQuadric(&s.quadrics[v[k]], q);
+			s.cornerTriangles[s.vertexCorner[v[k]]].push_back(t);
+		}
+
+		for (int k = 0; k < 3; k++) {
+			uint64_t c0 = s.vertexCorner[v[k]], c1 = s.vertexCorner[v[(k + 1) % 3]];
+			Edge e = { (std::min(c0, c1) << 32) | std::max(c0, c1), 3 * t + k };
+			edges.push_back(e);
+		}
+	}
+	std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.corners < b.corners; });
+
+	std::vector<int> borderEdges(numCorners, 0);
+	for (size_t i = 0; i < edges.size(); ) {
+		size_t j = i + 1;
+		while (j < edges.size() && edges[j].corners == edges[i].corners) { j++; }
+
+		int c0 = (int)(edges[i].corners >> 32), c1 = (int)(edges[i].corners & 0xffffffff);
+		if (j - i > 2) {
+			s.cornerKind[c0] = s.cornerKind[c1] = CornerLocked;
+		}
+		else if (j - i == 1) {
+			// Open edge: the plane through it, square to its triangle
+			int t = edges[i].side / 3, k = edges[i].side % 3;
+			const int* v = &s.triangles[3 * t];
+			const double *a = position(s, v[k]), *b = position(s, v[(k + 1) % 3]),
+				*c = position(s, v[(k + 2) % 3]);
+
+			double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			double w[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			double normal[3], plane[3];
+			cross3(u, w, normal);
+			cross3(u, normal, plane);
+			double len = sqrt(dot3(plane, plane));
+			if (len > 0.0) {
+				for (int x = 0; x < 3; x++) { plane[x] /= len; }
+				Quadric q;
+				planeQuadric(plane, -dot3(plane, a), BorderWeight * dot3(u, u), &q);
+				addQuadric(&s.quadrics[v[k]], q);
+				addQuadric(&s.quadrics[v[(k + 1) % 3]], q);
+			}
+			borderEdges[c0]++;
+			borderEdges[c1]++;
+		}
+		i = j;
+	}
+
+	// A border corner on more than one open loop is kept
+	for (int c = 0; c < numCorners; c++) {
+		if (s.cornerKind[c] == CornerFree && borderEdges[c] > 0) {
+			s.cornerKind[c] = (borderEdges[c] == 2) ? CornerBorder : CornerLocked;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// Checks the collapse of `from` onto `to` and computes its error; on
+//   success s.mapping holds the vertex of `to` each vertex of `from` becomes
+
+bool
+evaluate(Simplifier& s, int from, int to, Candidate* out)
+{
+	if (s.cornerKind[from] == CornerLocked || s.cornerKind[from] == CornerGone
+		|| s.cornerKind[to] == CornerGone) {
+		return false;
+	}
+
+	// The triangles on the edge go away; the rest must not flip
+	const double* target = position(s, s.cornerVertices[to][0]);
+	int shared = 0;
+	const std::vector<int>& tris = s.cornerTriangles[from];
+	for (size_t i = 0; i < tris.size(); i++) {
+		int t = tris[i];
+		if (!s.alive[t]) { continue; }
+		if (hasCorner(s, t, to)) {
+			shared++;
+			continue;
+		}
+
+		const double* p[3];
+		const double* q[3];
+		for (int k = 0; k < 3; k++) {
+			int v = s.triangles[3 * t + k];
+			p[k] = position(s, v);
+			q[k] = (s.vertexCorner[v] == from) ? target : p[k];
+		}
+		double u0[3], w0[3], u1[3], w1[3], n0[3], n1[3];
+		for (int x = 0; x < 3; x++) {
+			u0[x] = p[1][x] - p[0][x]; w0[x] = p[2][x] - p[0][x];
+			u1[x] = q[1][x] - q[0][x]; w1[x] = q[2][x] - q[0][x];
+		}
+		cross3(u0, w0, n0);
+		cross3(u1, w1, n1);
+		if (dot3(n0, n1) <= MinTurnCos * sqrt(dot3(n0, n0) * dot3(n1, n1))) { return false; }
+	}
+
+	// Corners on an open edge only slide along it
+	if (shared == 0 || shared > 2) { return false; }
+	if (s.cornerKind[from] == CornerBorder && shared != 1) { return false; }
+
+	// Only the corners across the edge may be shared, or the collapse
+	//   would fold two parts of the surface onto each other
+	ring(s, from, &s.ringFrom);
+	ring(s, to, &s.ringTo);
+	int common = 0;
+	for (size_t i = 0, j = 0; i < s.ringFrom.size() && j < s.ringTo.size(); ) {
+		if (s.ringFrom[i] < s.ringTo[j]) { i++; }
+		else if (s.ringFrom[i] > s.ringTo[j]) { j++; }
+		else { common++; i++; j++; }
+	}
+	if (common != shared) { return false; }
+
+	// Each vertex of `from` goes to the vertex of `to` that fits its
+	//   quadric best
+	const std::vector<int>& fromVertices = s.cornerVertices[from];
+	const std::vector<int>& toVertices = s.cornerVertices[to];
+	double cost = 0.0, weight = 0.0;
+	s.mapping.resize(fromVertices.size());
+	for (size_t i = 0; i < fromVertices.size(); i++) {
+		const Quadric& q = s.quadrics[fromVertices[i]];
+		double best = DBL_MAX;
+		for (size_t j = 0; j < toVertices.size(); j++) {
+			double e = quadricError(q, &s.attribs[6 * toVertices[j]]);
+			if (e < best) {
+				best = e;
+				s.mapping[i] = toVertices[j];
+			}
+		}
+		cost += best;
+		weight += q.w;
+	}
+	for (size_t j = 0; j < toVertices.size(); j++) {
+		const Quadric& q = s.quadrics[toVertices[j]];
+		cost += quadricError(q, &s.attribs[6 * toVertices[j]]);
+		weight += q.w;
+	}
+
+	out->error = (float)(sqrt(std::max(cost, 0.0) / std::max(weight, 1e-30)) / s.diagonal);
+	out->from = from;
+	out->to = to;
+	out->stamp = s.version[from] + s.version[to];
+	return true;
+}
+
+void
+push(Simplifier& s, int from, int to)
+{
+	Candidate c;
+	if (evaluate(s, from, to, &c)) {
+		s.queue.push(c);
+	}
+}
+
+// Queues both directions of every edge of `corner`
+void
+pushEdges(Simplifier& s, int corner)
+{
+	std::vector<int> neighbours;
+	ring(s, corner, &neighbours);
+	for (size_t i = 0; i < neighbours.size(); i++) {
+		push(s, corner, neighbours[i]);
+		push(s, neighbours[i], corner);
+	}
+}
+
+void
+collapse(Simplifier& s, int from, int to)
+{
+	const std::vector<int>& fromVertices = s.cornerVertices[from];
+
+	std::vector<int>& tris = s.cornerTriangles[from];
+	for (size_t i = 0; i < tris.size(); i++) {
+		int t = tris[i];
+		if (!s.alive[t]) { continue; }
+		if (hasCorner(s, t, to)) {
+			s.alive[t] = 0;
+			s.liveTriangles--;
+			continue;
+		}
+		for (int k = 0; k < 3; k++) {
+			int& v = s.triangles[3 * t + k];
+			if (s.vertexCorner[v] != from) { continue; }
+			v = s.mapping[std::find(fromVertices.begin(), fromVertices.end(), v) - fromVertices.begin()];
+		}
+		s.cornerTriangles[to].push_back(t);
+	}
+	for (size_t i = 0; i < fromVertices.size(); i++) {
+		addQuadric(&s.quadrics[s.mapping[i]], s.quadrics[fromVertices[i]]);
+	}
+
+	s.cornerKind[from] = CornerGone;
+	tris.clear();
+
+	std::vector<int>& toTris = s.cornerTriangles[to];
+	size_t live = 0;
+	for (size_t i = 0; i < toTris.size(); i++) {
+		if (s.alive[toTris[i]]) { toTris[live++] = toTris[i]; }
+	}
+	toTris.resize(live);
+
+	// Everything around `to` has new triangles
+	std::vector<int> neighbours;
+	ring(s, to, &neighbours);
+	s.version[to]++;
+	for (size_t i = 0; i < neighbours.size(); i++) { s.version[neighbours[i]]++; }
+	pushEdges(s, to);
+	for (size_t i = 0; i < neighbours.size(); i++) { pushEdges(s, neighbours[i]); }
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+// One collapse sequence serves the whole chain: every level continues from
+//   the one before and writes out the triangles that are left.
+
+void
+buildMeshLods(int id, const LodTarget* targets, int count)
+{
+	Mesh& m = meshes[id];
+
+	Simplifier s;
+	setup(s, m);
+	for (int c = 0; c < (int)s.cornerVertices.size(); c++) {
+		pushEdges(s, c);
+	}
+
+	std::vector<GLuint> indices;
+	std::vector<int> used(s.vertexSoup.size(), -1);
+	int numLods = 1;
+	int previous = (int)(m.numVertices / 3);
+	float error = 0.0f;
+
+	for (int l = 0; l < count && numLods < MaxMeshLods; l++) {
+		int target = (int)(targets[l].triangles * s.numTriangles);
+		float limit = (targets[l].error > 0.0f) ? targets[l].error : FLT_MAX;
+
+		while (s.liveTriangles > target && !s.queue.empty()) {
+			Candidate c = s.queue.top();
+			if (c.stamp != s.version[c.from] + s.version[c.to] || s.cornerKind[c.from] == CornerGone) {
+				s.queue.pop();
+				continue;
+			}
+			if (c.error > limit) { break; }
+
+			s.queue.pop();
+			if (!evaluate(s, c.from, c.to, &c)) { continue; }
+			collapse(s, c.from, c.to);
+			error = std::max(error, c.error);
+		}
+
+		if (s.liveTriangles >= previous) { continue; }
+		previous = s.liveTriangles;
+
+		MeshLod& lod = m.lods[numLods++];
+		lod.firstIndex = (GLuint)indices.size();
+		lod.numIndices = 3 * s.liveTriangles;
+		lod.error = error;
+		lod.numVertices = 0;
+		for (int t = 0; t < s.numTriangles; t++) {
+			if (!s.alive[t]) { continue; }
+			for (int k = 0; k < 3; k++) {
+				int v = s.triangles[3 * t + k];
+				if (used[v] != l) {
+					used[v] = l;
+					lod.numVertices++;
+				}
+				indices.push_back(s.vertexSoup[v]);
+			}
+		}
+	}
+
+	lodStorage[id].swap(indices);
+	m.indices = lodStorage[id].empty() ? NULL : lodStorage[id].data();
+	m.numIndices = (GLuint)lodStorage[id].size();
+	m.numLods = numLods;
+}
+
+void
+buildAllMeshLods(const LodTarget* targets, int count)
+{
+	parallelFor(NumMeshes, 1, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			buildMeshLods(i, targets, count);
+		}
+	});
+}
+
+//----------------------------------------------------------------------------
+
+void
+printMeshLods(std::ostream& os)
+{
+	for (int i = 0; i < NumMeshes; i++) {
+		const Mesh& m = meshes[i];
+		GLuint full = m.numVertices / 3;
+		os << m.name << ": " << m.numLods << " levels" << std::endl;
+		for (int l = 0; l < m.numLods; l++) {
+			const MeshLod& lod = m.lods[l];
+			GLuint triangles = (lod.numIndices > 0 ? lod.numIndices : m.numVertices) / 3;
+			os << "  level " << l << "  " << triangles << " triangles ("
+			   << 100.0 * triangles / std::max(full, 1u) << "%), " << lod.numVertices
+			   << " vertices, error " << lod.error << std::endl;
+		}
+	}
+}
+
+void
+simplifyBenchmark(int rounds)
+{
+	double t = timeNow();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < NumMeshes; i++) {
+			buildMeshLods(i, defaultLodTargets, numDefaultLodTargets);
+		}
+	}
+	double serialMs = (timeNow() - t) * 1000.0 / rounds;
+
+	t = timeNow();
+	for (int r = 0; r < rounds; r++) {
+		buildAllMeshLods(defaultLodTargets, numDefaultLodTargets);
+	}
+	double parallelMs = (timeNow() - t) * 1000.0 / rounds;
+
+	std::cout << "simplify: " << NumMeshes << " meshes, " << numDefaultLodTargets << " targets" << std::endl
+	          << "  1 thread    " << serialMs << " ms" << std::endl
+	          << "  " << workerCount() << " workers   " << parallelMs << " ms ("
+	          << serialMs / parallelMs << "x)" << std::endl;
+	printMeshLods(std::cout);
+}
@@ -0,0 +1,61 @@
+#ifndef __MESHSIMPLIFY_H__
+#define __MESHSIMPLIFY_H__
+
+#include "Mesh.h"
+
+#include <iostream>
+
+//----------------------------------------------------------------------------
+//
+//  Levels of detail for any registered mesh, by quadric error metrics.
+//
+//  The soup is welded into vertices of equal position and normal; all the
+//    vertices at one position form a corner that moves as a whole, so the
+//    surface stays closed where the normals are split.  Every vertex
+//    keeps a quadric over position and normal (Garland and Heckbert's
+//    attribute form), and corners are collapsed onto a neighbouring
+//    corner, cheapest first.  Each vertex of the collapsed corner takes
+//    the vertex of the kept corner whose normal fits it best, and the
+//    cost counts how far both position and normal move.  Collapses that
+//    would flip a triangle or make an edge shared by more than two
+//    triangles are skipped.
+//
+//  Open edges get extra quadrics for the plane standing on the edge, and a
+//    corner on an open edge may only slide along it, so borders keep
+//    their shape.  Corners where the surface is not a manifold are kept.
+//
+//  The kept corner is one of the original vertices, so every level is only
+//    an index list into the mesh's own vertices: the vertex buffer does not
+//    grow and all levels share it.  Level 0 stays the full soup.
+//
+
+// One level of the chain.  A level ends at whichever limit it reaches
+//   first; 0 leaves a limit out.
+struct LodTarget {
+	float  triangles;   // fraction of the full mesh's triangles to keep
+	float  error;       // largest error, as a fraction of the bounds diagonal
+};
+
+extern const LodTarget  defaultLodTargets[];
+extern const int        numDefaultLodTargets;
+
+// Replaces LODs 1 and up of a mesh with levels for the targets in order.
+//   A level that would remove nothing more is left out, and the chain
+//   ends at MaxMeshLods.
+void buildMeshLods(int id, const LodTarget* targets, int count);
+
+// Bump whenever the levels built for the same targets change, so cached
+//   copies of the old levels are rebuilt
+const unsigned int  MeshSimplifyVersion = 1;
+
+// buildMeshLods() for every registered mesh, one mesh per worker
+void buildAllMeshLods(const LodTarget* targets, int count);
+
+// Triangles, reduction and error of every level of every mesh
+void printMeshLods(std::ostream& os);
+
+// Rebuilds the LODs of the registered meshes `rounds` times on one thread
+//   and on the pool, and reports the levels.  Needs no GL context.
+void simplifyBenchmark(int rounds);
+
+#endif // __MESHSIMPLIFY_H__
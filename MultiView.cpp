@@ -0,0 +1,349 @@
+#include "MultiView.h"
+#include "CommandBuffer.h"
+#include "FrameArena.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "Parallel.h"
+#include "ShaderSource.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const GLfloat  Distance = 2.0;      // from the camera to what it looks at, as viewMatrix()
+
+GLuint   program = 0;
+GLint    viewProjectionLoc = -1, viewRectLoc = -1;
+unsigned locationGeneration = 0;     // shaderGeneration() of the locations above
+bool     viewportIndex = false;
+
+View     views[MaxViews];
+int      numViews = 0;
+
+GLuint*  nodeMasks = NULL;          // views that see each node, frame arena
+
+// Turns the camera's eye space about the point it looks at
+mat4
+orbit(const mat4& rotation)
+{
+	return Translate(0.0, 0.0, -Distance) * rotation * Translate(0.0, 0.0, Distance);
+}
+
+void
+defaultViews(int count)
+{
+	// The front view is the one of reshape().  The scene is as deep as it
+	//   is wide, so the side and top views keep all of it.
+	mat4 front = Ortho(-6.0, 6.0, -6.0, 6.0, 0.5, 3.0);
+	mat4 ortho = Ortho(-6.0, 6.0, -6.0, 6.0, Distance - 6.0, Distance + 6.0);
+	mat4 perspective = Perspective(50.0, 1.0, 1.0, 40.0);
+
+	numViews = std::min(std::max(count, 1), MaxViews);
+	for (int v = 0; v < numViews; v++) {
+		View& view = views[v];
+		view.projection = (v == 0) ? front : (v < 3) ? ortho : perspective;
+		switch (v) {
+		case 0:  view.eye = mat4();  break;                    // front
+		case 1:  view.eye = orbit(RotateY(-90.0));  break;     // side, from +x
+		case 2:  view.eye = orbit(RotateX(90.0));  break;      // top, from +y
+		default:
+			view.eye = Translate(0.0, 0.0, -14.0) * RotateX(30.0) *
+				RotateY(-40.0 - 360.0 * (v - 3) / (numViews - 3)) *
+				Translate(0.0, 0.0, Distance);
+			break;
+		}
+	}
+}
+
+// Pixel rectangle of tile t in the grid for `count` views, the first row
+//   at the top
+void
+tileRect(int t, int count, int width, int height, int* x, int* y, int* w, int* h)
+{
+	int cols = (int)ceil(sqrt((double)count));
+	int rows = (count + cols - 1) / cols;
+	int col = t % cols, row = rows - 1 - t / cols;
+
+	*x = width * col / cols;
+	*w = width * (col + 1) / cols - *x;
+	*y = height * row / rows;
+	*h = height * (row + 1) / rows - *y;
+}
+
+// Bit v is set unless the box of `m` lies outside one plane of view v
+GLuint
+viewMask(const Mesh& m, const mat4& model, const mat4* clip, int count)
+{
+	vec4 corners[8];
+	for (int c = 0; c < 8; c++) {
+		corners[c] = model * vec4((c & 1) ? m.boundsMax.x : m.boundsMin.x,
+			(c & 2) ? m.boundsMax.y : m.boundsMin.y,
+			(c & 4) ? m.boundsMax.z : m.boundsMin.z, 1.0);
+	}
+
+	GLuint mask = 0;
+	for (int v = 0; v < count; v++) {
+		int outside = 0x3f;
+		for (int c = 0; c < 8 && outside != 0; c++) {
+			vec4 p = clip[v] * corners[c];
+			int code = 0;
+			if (p.x < -p.w) { code |= 1; }
+			if (p.x > p.w)  { code |= 2; }
+			if (p.y < -p.w) { code |= 4; }
+			if (p.y > p.w)  { code |= 8; }
+			if (p.z < -p.w) { code |= 16; }
+			if (p.z > p.w)  { code |= 32; }
+			outside &= code;
+		}
+		if (outside == 0) { mask |= 1u << v; }
+	}
+	return mask;
+}
+
+// The world-to-clip matrices of `count` views; bit v of a node's mask
+//   goes to instance v
+void
+cullNodes(Scene* s, const mat4* clip, int count)
+{
+	double t = timeNow();
+
+	int grain = std::max(evenGrain(s->count), 64);
+	int numChunks = (s->count + grain - 1) / grain;
+	int* outside = frameArray<int>(numChunks);
+	std::fill(outside, outside + numChunks, 0);
+	nodeMasks = frameArray<GLuint>(s->count);
+
+	parallelFor(s->count, grain, [&](int begin, int end, int) {
+		int chunk = begin / grain;
+		for (int i = begin; i < end; i++) {
+			s->flags[i] &= ~NodeCulled;
+			nodeMasks[i] = 0;
+			if (s->flags[i] & NodeHidden) { continue; }
+
+			nodeMasks[i] = viewMask(meshes[s->mesh[i]], s->transform[i], clip, count);
+			if (nodeMasks[i] == 0) {
+				s->flags[i] |= NodeCulled;
+				outside[chunk]++;
+			}
+		}
+	});
+
+	for (int c = 0; c < numChunks; c++) {
+		frameStats.culledOutside += outside[c];
+	}
+	frameStats.occlusionTestMs += (timeNow() - t) * 1000.0;
+}
+
+// A reloaded shader may have moved its uniforms, or switched between
+//   viewport indices and clip distances
+void
+lookUpLocations()
+{
+	viewProjectionLoc = glGetUniformLocation(program, "ViewProjection");
+	viewRectLoc = glGetUniformLocation(program, "ViewRect");
+
+	// The shader only declares the tiles when it cannot pick viewports
+	viewportIndex = viewRectLoc < 0;
+	locationGeneration = shaderGeneration();
+}
+
+// Replays the recorded commands with instance k drawn through
+//   viewProjection[k] (from the recorded eye space) into tile tiles[k]
+void
+drawInstances(const Light& light, const mat4* viewProjection, const int* tiles, int count,
+	int grid, int width, int height)
+{
+	GLfloat matrices[MaxViews][16];
+	for (int k = 0; k < count; k++) {
+		memcpy(matrices[k], (const GLfloat*)viewProjection[k], sizeof(matrices[k]));
+	}
+	if (locationGeneration != shaderGeneration()) {
+		lookUpLocations();
+	}
+	stateUseProgram(program);
+	glUniformMatrix4fv(viewProjectionLoc, count, GL_TRUE, &matrices[0][0]);
+
+	int x, y, w, h;
+	if (viewportIndex) {
+		// glViewport sets every viewport, so the others follow it
+		tileRect(tiles[0], grid, width, height, &x, &y, &w, &h);
+		stateViewport(x, y, w, h);
+		for (int k = 1; k < count; k++) {
+			tileRect(tiles[k], grid, width, height, &x, &y, &w, &h);
+			glViewportIndexedf(k, (GLfloat)x, (GLfloat)y, (GLfloat)w, (GLfloat)h);
+		}
+	}
+	else {
+		GLfloat rects[MaxViews][4];
+		for (int k = 0; k < count; k++) {
+			tileRect(tiles[k], grid, width, height, &x, &y, &w, &h);
+			rects[k][0] = (GLfloat)w / width;
+			rects[k][1] = (GLfloat)h / height;
+			rects[k][2] = (GLfloat)(2 * x + w) / width - 1.0f;
+			rects[k][3] = (GLfloat)(2 * y + h) / height - 1.0f;
+		}
+		glUniform4fv(viewRectLoc, count, &rects[0][0]);
+		for (int i = 0; i < 4; i++) { stateEnable(GL_CLIP_DISTANCE0 + i); }
+	}
+
+	submitCommands(program, light, count, nodeMasks);
+
+	if (viewportIndex) {
+		stateViewport(0, 0, width, height);
+	}
+	else {
+		for (int i = 0; i < 4; i++) { stateDisable(GL_CLIP_DISTANCE0 + i); }
+	}
+}
+
+// Pixels that are background in one image and not in the other
+int
+coverageDifference(const std::vector<GLubyte>& a, const std::vector<GLubyte>& b, const GLubyte* clear)
+{
+	int differ = 0;
+	for (size_t i = 0; i < a.size(); i += 4) {
+		bool ea = a[i] == clear[0] && a[i + 1] == clear[1] && a[i + 2] == clear[2];
+		bool eb = b[i] == clear[0] && b[i + 1] == clear[1] && b[i + 2] == clear[2];
+		differ += (ea != eb);
+	}
+	return differ;
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+initMultiView(int count)
+{
+	defaultViews(count);
+	if (program != 0) { return; }
+
+	program = InitShader("vmultiview.glsl", "fshader53.glsl");
+	followShaderProgram(&program);
+	lookUpLocations();
+	if (!viewportIndex) {
+		std::cerr << "Multi-view splits the target with clip distances" << std::endl;
+	}
+}
+
+//----------------------------------------------------------------------------
+
+void
+cullViews(Scene* s, const mat4& view)
+{
+	mat4 clip[MaxViews];
+	for (int v = 0; v < numViews; v++) {
+		clip[v] = views[v].projection * views[v].eye * view;
+	}
+	cullNodes(s, clip, numViews);
+}
+
+void
+drawMultiView(const Light& light, int width, int height)
+{
+	mat4 viewProjection[MaxViews];
+	int tiles[MaxViews];
+	for (int v = 0; v < numViews; v++) {
+		viewProjection[v] = views[v].projection * views[v].eye;
+		tiles[v] = v;
+	}
+	drawInstances(light, viewProjection, tiles, numViews, numViews, width, height);
+}
+
+//----------------------------------------------------------------------------
+
+void
+multiViewBenchmark(int nodes, int frames, int width, int height)
+{
+	initMultiView(MaxViews);
+
+	Scene s;
+	initScene(&s, nodes, 16);
+	addRandomNodes(&s, nodes, 1.5, 1);
+
+	Light light;
+	light.position = point4(0.0, 0.0, -1.0, 0.0);
+	light.ambient = light.diffuse = light.specular = color4(1.0, 1.0, 1.0, 1.0);
+	mat4 camera = Translate(0.0, 0.0, -Distance) * RotateX(20.0) * RotateY(30.0);
+
+	const GLubyte clear[3] = { 255, 0, 255 };
+	glClearColor(1.0, 0.0, 1.0, 1.0);
+	stateEnable(GL_DEPTH_TEST);
+	stateViewport(0, 0, width, height);
+
+	std::vector<GLubyte> single(width * height * 4), separate(width * height * 4);
+
+	// On a software GL the vertex shading runs inside the draw calls, so
+	//   the preparation of the frame is timed apart from its submission
+	std::cout << "multi-view: " << nodes << " nodes at " << width << "x" << height << ", "
+	          << (viewportIndex ? "viewport index" : "clip distances") << std::endl
+	          << "  ms/frame: cull and record / submit / until the GPU is done" << std::endl;
+
+	for (int n = 1; n <= MaxViews; n++) {
+		defaultViews(n);
+
+		// One pass: cull, record and submit once for every view
+		double prepare = 0.0, submit = 0.0, total = 0.0;
+		int draws = frameStats.drawCalls;
+		for (int f = 0; f < frames; f++) {
+			resetFrameArena();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glFinish();
+			double t0 = timeNow();
+			cullViews(&s, camera);
+			recordScene(s, camera, light);
+			double t1 = timeNow();
+			drawMultiView(light, width, height);
+			double t2 = timeNow();
+			glFinish();
+			prepare += t1 - t0;
+			submit += t2 - t1;
+			total += timeNow() - t0;
+		}
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &single[0]);
+		draws = frameStats.drawCalls - draws;
+
+		// The same views traversed and submitted one after another
+		double prepareEach = 0.0, submitEach = 0.0, totalEach = 0.0;
+		int drawsEach = frameStats.drawCalls;
+		for (int f = 0; f < frames; f++) {
+			resetFrameArena();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glFinish();
+			double t0 = timeNow();
+			for (int v = 0; v < n; v++) {
+				double t1 = timeNow();
+				mat4 eye = views[v].eye * camera;
+				mat4 clip = views[v].projection * eye;
+				cullNodes(&s, &clip, 1);
+				recordScene(s, eye, light);
+				double t2 = timeNow();
+				drawInstances(light, &views[v].projection, &v, 1, n, width, height);
+				prepareEach += t2 - t1;
+				submitEach += timeNow() - t2;
+			}
+			glFinish();
+			totalEach += timeNow() - t0;
+		}
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &separate[0]);
+		drawsEach = frameStats.drawCalls - drawsEach;
+
+		// Lighting differs by design (one eye space for all views), so
+		//   only the covered pixels are compared
+		double k = 1000.0 / frames;
+		std::cout << "  " << n << " views  single pass " << prepare * k << " / " << submit * k
+		          << " / " << total * k << " (" << draws / frames << " draws), view by view "
+		          << prepareEach * k << " / " << submitEach * k << " / " << totalEach * k
+		          << " (" << drawsEach / frames << " draws), "
+		          << coverageDifference(single, separate, clear) << " pixels covered differently"
+		          << std::endl;
+	}
+
+	resetFrameArena();
+	freeScene(&s);
+}
@@ -0,0 +1,55 @@
+#ifndef __MULTIVIEW_H__
+#define __MULTIVIEW_H__
+
+#include "Angel.h"
+#include "Scene.h"
+
+//----------------------------------------------------------------------------
+//
+//  Several views of the scene drawn in a single pass.
+//
+//  The scene is culled and recorded once, for the camera of the frame.
+//    cullViews() tests every node against the frustums of all views in
+//    one pass and remembers which views see it; a node no view sees gets
+//    NodeCulled and is never recorded.  drawMultiView() then replays the
+//    commands once, each draw instanced once per view: the instance
+//    transforms the vertex into its view and skips views that cannot see
+//    the node.  The CPU cost of a frame is that of a single view, plus
+//    one frustum test per node and view.
+//
+//  Views are tiles of one target, counted from the top left.  Where the
+//    driver lets the vertex shader pick a viewport
+//    (ARB_shader_viewport_layer_array) each instance writes
+//    gl_ViewportIndex; elsewhere it scales itself into its tile and clip
+//    distances trim it to the tile's edges.
+//
+//  All views are lit as the recorded camera sees the scene.  Occlusion
+//    culling needs a single view and is not used with them.
+//
+
+const int  MaxViews = 8;            // vmultiview.glsl
+
+struct View {
+	mat4  projection;
+	mat4  eye;                      // from the recorded camera's eye space
+};
+
+// Compiles the program and sets up `count` views around the point the
+//   camera looks at: front, side and top orthographic as in reshape(),
+//   then perspective views from above, spread around the scene.
+void initMultiView(int count);
+
+// Sets or clears NodeCulled on every node for the views of this camera
+void cullViews(Scene* s, const mat4& view);
+
+// Draws the last recordScene() into every view of the bound width x
+//   height target (GL thread only)
+void drawMultiView(const Light& light, int width, int height);
+
+// Culls, records and draws `nodes` random objects in 1 to MaxViews views,
+//   once in a single pass and once view by view, and compares the CPU
+//   time of the two and their images.  Needs a GL context and the meshes
+//   uploaded.
+void multiViewBenchmark(int nodes, int frames, int width, int height);
+
+#endif // __MULTIVIEW_H__
@@ -6,7 +6,36 @@
 //    rotation.
 
 #include "Angel.h"
+#include "Mesh.h"
+#include "MeshCache.h"
+#include "Particles.h"
+#include "Collision.h"
+#include "ParticlesGPU.h"
+#include "Replay.h"
+#include "Scene.h"
+#include "CommandBuffer.h"
+#include "ClusteredLights.h"
+#include "Occlusion.h"
+#include "GLState.h"
+#include "FramePacer.h"
+#include "FrameArena.h"
+#include "Robots.h"
+#include "DynamicResolution.h"
+#include "ProceduralMesh.h"
+#include "SceneFile.h"
+#include "Picking.h"
+#include "SoftwareRaster.h"
+#include "FrameCapture.h"
+#include "MultiView.h"
+#include "MeshSimplify.h"
+#include "Integrator.h"
+#include "ShaderSource.h"
+#include "Hud.h"
+#include "Stats.h"
 #include <gl/glut.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <Windows.h>
 
 #define GL_PI 3.1415f
@@ -22,11 +51,8 @@ const int  Quit = 4;
 
 
 
-// Shader transformation matrices
-mat4  model_view;
-
-// Model-view and projection matrices uniform location
-GLuint  ModelView, Projection;
+// Projection matrix; display() builds the view from Theta each frame
+mat4         projection;
 
 // Array of rotation angles (in degrees) for each coordinate axis
 enum { Xaxis = 0, Yaxis = 1, Zaxis = 2, NumAxes = 3 };
@@ -39,13 +65,7 @@ point4 light_position(0.0, 0.0, -1.0, 0.0);
 color4 light_ambient(0.5, 0.5, 0.5, 1.0);
 color4 light_diffuse(1.0, 1.0, 1.0, 1.0);
 color4 light_specular(0.0, 1.0, 0.0, 1.0);
-// Parameters controlling the size of the Robot's arm
-const GLfloat BASE_HEIGHT = 2.0;
-const GLfloat BASE_WIDTH = 5.0;
-const GLfloat LOWER_ARM_HEIGHT = 5.0;
-const GLfloat LOWER_ARM_WIDTH = 0.5;
-const GLfloat UPPER_ARM_HEIGHT = 5.0;
-const GLfloat UPPER_ARM_WIDTH = 0.5;
+// The size of the Robot's arm is in Robots.h
 
 
 extern const int cubeNumVertices = 36; //(6 faces)(2 triangles/face)(3 vertices/triangle)
@@ -72,636 +92,392 @@ const unsigned int cubeOffset = 0;
 const unsigned int coneOffset = sizeof(cubePoints) + sizeof(cubeNormals);
 const unsigned int sphereOffset = sizeof(cubePoints) + sizeof(cubeNormals) + +sizeof(conePoints) + sizeof(coneNormals);
 
-//----------------------------------------------------------------------------
+// Binary copy of the generated primitives, memory-mapped on later runs
+const char* primitiveCacheFile = "primitives.mshc";
 
-// OpenGL initialization
-void
-init()
-{
-	cube();
-	cone(coneSlices);
-	sphere(shpereSlices, shpereStacks);
+// Static scenery, text or compiled (-scene FILE)
+const char* sceneFile = "bicycle.scene";
 
+// Bounciness of ball contacts
+const float ballRestitution = 0.5;
 
-	// Load shaders and use the resulting shader program
-	program = InitShader("vshader53.glsl", "fshader53.glsl");
-	glUseProgram(program);
+// Integrate the balls with transform feedback instead of on the CPU
+bool gpuParticles = false;
 
+// How the CPU moves the balls (-integrator NAME)
+int ballIntegrator = SemiImplicitEuler;
 
-	// Create a vertex array object
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+// Scene nodes that draw the balls
+int ballNodes[10];
 
-	// Create and initialize a buffer object
-	GLuint buffer;
-	glGenBuffers(1, &buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, buffer);
-	glBufferData(GL_ARRAY_BUFFER,
-		sizeof(cubePoints) + sizeof(cubeNormals)
-		+ sizeof(conePoints) + sizeof(coneNormals)
-		+ sizeof(spherePoints) + sizeof(sphereNormals),
-		NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, cubeOffset, sizeof(cubePoints), cubePoints);
-	glBufferSubData(GL_ARRAY_BUFFER, cubeOffset + sizeof(cubePoints), sizeof(cubeNormals), cubeNormals);
-	glBufferSubData(GL_ARRAY_BUFFER, coneOffset, sizeof(conePoints), conePoints);
-	glBufferSubData(GL_ARRAY_BUFFER, coneOffset + sizeof(conePoints), sizeof(coneNormals), coneNormals);
-	glBufferSubData(GL_ARRAY_BUFFER, sphereOffset, sizeof(spherePoints), spherePoints);
-	glBufferSubData(GL_ARRAY_BUFFER, sphereOffset + sizeof(spherePoints), sizeof(sphereNormals), sphereNormals);
+// The node last picked with the left button, drawn with pickMaterial
+//   until the next pick (-1 for none), and its own material
+int pickedNode = -1;
+GLuint pickedNodeMaterial = 0;
+int pickMaterial = 0;
 
+// Extra random objects added to the scene (-scene-objects N)
+int sceneObjects = 0;
 
-	// Retrieve transformation uniform variable locations
-	ModelView = glGetUniformLocation(program, "ModelView");
-	Projection = glGetUniformLocation(program, "Projection");
+// Window size in pixels, for turning mouse positions into rays
+int windowWidth = 512, windowHeight = 512;
 
-	glEnable(GL_DEPTH_TEST);
+// Skip nodes hidden behind the big boxes (-no-occlusion turns it off)
+bool occlusionCulling = true;
 
-	glShadeModel(GL_SMOOTH);
+// Start with the animation running instead of paused; 'p' toggles it
+//   (-animate)
+bool startAnimating = false;
 
-	glFrontFace(GL_CCW);
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
+// Frames per second to pace the redraws to (-fps N, 0 for unlimited)
+double targetFps = 60.0;
 
-	glClearColor(1.0, 1.0, 1.0, 1.0);
-}
+// GPU time per frame that the render resolution is scaled to meet
+//   (-budget MS, off by default)
+double frameBudgetMs = 0.0;
 
+// Rasterize the scene on the CPU and show the image (-software)
+bool softwareRendering = false;
 
+// Views drawn side by side in one pass (-multiview N, 0 for the camera only)
+int numViews = 0;
 
+// Error in pixels that a node may be drawn with at a coarser level of its
+//   mesh (-lod-pixels P, 0 for full detail)
+float lodPixels = 0.0;
 
+// Instanced robot arms (-robots N)
+int numRobots = 0;
 
-// Array of rotation angles (in degrees) for each rotation axis
-enum { Base = 0, LowerArm = 1, UpperArm = 2, NumAngles = 3 };
-int      Axis1 = Base;
-//GLfloat  Theta[NumAngles] = { 0.0 };
+// Random point lights shaded by clusters (-lights N)
+int numPointLights = 0;
+GLuint clusterProgram = 0;
 
-//----------------------------------------------------------------------------
-void
-base()
-{
-	// set up vertex arrays
-	GLuint vPosition = glGetAttribLocation(program, "vPosition");
-	glEnableVertexAttribArray(vPosition);
-	glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-	GLuint vNormal = glGetAttribLocation(program, "vNormal");
-	glEnableVertexAttribArray(vNormal);
-	glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sizeof(cubePoints)));
-
-	color4 material_ambient(1.0, 0.0, 1.0, 1.0);
-	color4 material_diffuse(1.0, 0.8, 0.0, 1.0);
-	color4 material_specular(1.0, 0.8, 0.0, 1.0);
-	float  material_shininess = 100.0;
-
-	color4 ambient_product = light_ambient * material_ambient;
-	color4 diffuse_product = light_diffuse * material_diffuse;
-	color4 specular_product = light_specular * material_specular;
-
-	glUniform4fv(glGetUniformLocation(program, "AmbientProduct"), 1, ambient_product);
-	glUniform4fv(glGetUniformLocation(program, "DiffuseProduct"), 1, diffuse_product);
-	glUniform4fv(glGetUniformLocation(program, "SpecularProduct"), 1, specular_product);
-	glUniform4fv(glGetUniformLocation(program, "LightPosition"), 1, light_position);
-	glUniform1f(glGetUniformLocation(program, "Shininess"), material_shininess);
-
-	mat4 instance = (Translate(0.0, 0.5 * BASE_HEIGHT, 0.0) *
-		Scale(BASE_WIDTH,
-			BASE_HEIGHT,
-			BASE_WIDTH));
-
-	glUniformMatrix4fv(ModelView, 1, GL_TRUE, model_view * instance);
-
-	glDrawArrays(GL_TRIANGLES, 0, cubeNumVertices);
-}
+// Draw the scene's primitives by vertex pulling instead of from the mesh
+//   buffer (-procedural), with this many slices and stacks (-tessellation N)
+bool proceduralPrimitives = false;
+int tessellation = 20;
+GLuint proceduralProgram = 0;
+
+// Rebuild the shader programs when their files change (-hot-reload)
+bool hotReload = false;
 
 //----------------------------------------------------------------------------
 
+// Initial state of the falling balls drawn by ball() .. ball10()
 void
-upper_arm()
+initBalls()
 {
-	// set up vertex arrays
-	GLuint vPosition = glGetAttribLocation(program, "vPosition");
-	glEnableVertexAttribArray(vPosition);
-	glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-	GLuint vNormal = glGetAttribLocation(program, "vNormal");
-	glEnableVertexAttribArray(vNormal);
-	glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sizeof(cubePoints)));
-
-	color4 material_ambient(1.0, 1.0, 0.0, 1.0);
-	color4 material_diffuse(1.0, 0.0, 0.8, 1.0);
-	color4 material_specular(1.0, 1.0, 0.8, 2.0);
-	float  material_shininess = 100.0;
-
-	color4 ambient_product = light_ambient * material_ambient;
-	color4 diffuse_product = light_diffuse * material_diffuse;
-	color4 specular_product = light_specular * material_specular;
-
-	glUniform4fv(glGetUniformLocation(program, "AmbientProduct"), 1, ambient_product);
-	glUniform4fv(glGetUniformLocation(program, "DiffuseProduct"), 1, diffuse_product);
-	glUniform4fv(glGetUniformLocation(program, "SpecularProduct"), 1, specular_product);
-	glUniform4fv(glGetUniformLocation(program, "LightPosition"), 1, light_position);
-	glUniform1f(glGetUniformLocation(program, "Shininess"), material_shininess);
-
-	mat4 instance = (Translate(0.0, 0.5 * UPPER_ARM_HEIGHT, 0.0) *
-		Scale(UPPER_ARM_WIDTH,
-			UPPER_ARM_HEIGHT,
-			UPPER_ARM_WIDTH));
-
-	glUniformMatrix4fv(ModelView, 1, GL_TRUE, model_view * instance);
-	glDrawArrays(GL_TRIANGLES, 0, cubeNumVertices);
+	const vec3 start(-3.0, 1.0, 0.0);
+	const vec3 rest(0.0, 0.0, 0.0);
+	const vec3 acc(3.0, 9.0, 0.0);
+	const float deltaT[10] = { 0.001, 0.003, 0.005, 0.007, 0.0001,
+		0.0003, 0.0005, 0.0009, 0.0009, 0.0009 };
+
+	initParticles(&balls, 10);
+	balls.integrator = ballIntegrator;
+	addParticle(&balls, vec3(-3.0, 2.0, 0.0), rest, acc, 1.0, deltaT[0]);
+	for (int i = 1; i < 10; i++) {
+		addParticle(&balls, start, rest, acc, 1.0, deltaT[i]);
+	}
 }
 
-//----------------------------------------------------------------------------
-
+// The scenery and the balls.  Static nodes are the pieces the balls
+//   collide with; ball nodes follow the particle positions every frame.
 void
-lower_arm()
+buildScene()
 {
-	// set up vertex arrays
-	GLuint vPosition = glGetAttribLocation(program, "vPosition");
-	glEnableVertexAttribArray(vPosition);
-	glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-	GLuint vNormal = glGetAttribLocation(program, "vNormal");
-	glEnableVertexAttribArray(vNormal);
-	glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sizeof(cubePoints)));
-
-	color4 material_ambient(1.0, 0.0, 1.0, 1.0);
-	color4 material_diffuse(1.0, 0.8, 0.0, 1.0);
-	color4 material_specular(1.0, 0.8, 0.0, 1.0);
-	float  material_shininess = 100.0;
-
-	color4 ambient_product = light_ambient * material_ambient;
-	color4 diffuse_product = light_diffuse * material_diffuse;
-	color4 specular_product = light_specular * material_specular;
-
-	glUniform4fv(glGetUniformLocation(program, "AmbientProduct"), 1, ambient_product);
-	glUniform4fv(glGetUniformLocation(program, "DiffuseProduct"), 1, diffuse_product);
-	glUniform4fv(glGetUniformLocation(program, "SpecularProduct"), 1, specular_product);
-	glUniform4fv(glGetUniformLocation(program, "LightPosition"), 1, light_position);
-	glUniform1f(glGetUniformLocation(program, "Shininess"), material_shininess);
-
-	mat4 instance = (Translate(0.0, 0.5 * LOWER_ARM_HEIGHT, 0.0) *
-		Scale(LOWER_ARM_WIDTH,
-			LOWER_ARM_HEIGHT,
-			LOWER_ARM_WIDTH));
-
-	glUniformMatrix4fv(ModelView, 1, GL_TRUE, model_view * instance);
-	glDrawArrays(GL_TRIANGLES, 0, cubeNumVertices);
+	initScene(&scene, 64, 32);
+
+	// The static scenery, from a scene file (SceneFile.h).  The static
+	//   boxes are marked as occluders there: they are large enough to hide
+	//   the pieces behind them.  Without it the balls would fall through
+	//   nothing, so a scene that does not load ends the program; the
+	//   loader has said why.
+	if (!loadSceneFile(&scene, sceneFile)) {
+		exit(EXIT_FAILURE);
+	}
+
+	// falling balls
+	const color4 ballMaterials[10][3] = {
+		{ color4(1.0, 0.0, 1.0, 1.0), color4(1.0, 0.8, 0.0, 1.0), color4(1.0, 0.8, 0.0, 1.0) },
+		{ color4(1.0, 0.0, 1.0, 1.0), color4(1.0, 0.8, 0.0, 1.0), color4(1.0, 0.8, 0.0, 1.0) },
+		{ color4(1.0, 0.0, 1.0, 1.0), color4(1.0, 0.8, 0.0, 1.0), color4(1.0, 0.8, 0.0, 1.0) },
+		{ color4(0.7, 0.2, 0.5, 1.0), color4(1.0, 0.8, 0.0, 1.0), color4(1.0, 0.8, 0.0, 1.0) },
+		{ color4(0.3, 0.8, 0.3, 1.0), color4(1.0, 0.8, 0.0, 1.0), color4(1.0, 0.8, 0.0, 1.0) },
+		{ color4(0.5, 0.5, 0.8, 1.0), color4(1.0, 0.8, 0.0, 1.0), color4(0.5, 0.0, 0.0, 1.0) },
+		{ color4(0.1, 0.5, 0.3, 1.0), color4(0.7, 0.8, 0.3, 1.0), color4(1.0, 0.8, 0.0, 1.0) },
+		{ color4(0.1, 0.3, 0.6, 1.0), color4(0.3, 0.2, 0.5, 1.0), color4(0.2, 0.1, 0.8, 1.0) },
+		{ color4(0.1, 0.2, 0.3, 1.0), color4(0.1, 0.5, 0.9, 1.0), color4(0.4, 0.3, 0.6, 1.0) },
+		{ color4(0.6, 1.0, 0.4, 1.0), color4(0.9, 0.1, 0.6, 1.0), color4(0.4, 0.3, 0.6, 1.0) }
+	};
+
+	for (int i = 0; i < 10; i++) {
+		GLuint flags = gpuParticles ? NodeHidden : 0;
+		ballNodes[i] = addNode(&scene, Translate(particlePosition(balls, i)), SphereMesh,
+			addMaterial(&scene, ballMaterials[i][0], ballMaterials[i][1], ballMaterials[i][2], 100.0),
+			GL_LINES, flags);
+	}
+
+	pickMaterial = addMaterial(&scene, color4(1.0, 1.0, 1.0, 1.0), color4(1.0, 1.0, 0.0, 1.0),
+		color4(1.0, 1.0, 1.0, 1.0), 100.0);
 }
 
+// The static pieces of the scene, as colliders
 void
-robot1()
+initColliders()
 {
-	model_view *= RotateY(30);
-	base();
+	clearStaticColliders();
 
-	model_view *= (Translate(0.0, BASE_HEIGHT, 0.0) *
-		RotateZ(Theta[LowerArm]));
-	lower_arm();
+	for (int i = 0; i < scene.count; i++) {
+		if (!(scene.flags[i] & NodeStatic)) { continue; }
 
-	model_view *= (Translate(0.0, LOWER_ARM_HEIGHT, 0.0) *
-		RotateZ(Theta[UpperArm]));
-	upper_arm();
+		if (scene.mesh[i] == CubeMesh) {
+			addStaticBox(scene.transform[i]);
+		}
+		else if (scene.mesh[i] == SphereMesh) {
+			addStaticSphere(scene.transform[i]);
+		}
+	}
 }
 
-//----------------------------------------------------------------------------
+// Advance the balls one frame and resolve their contacts
 void
-cube1(color4 material_ambient,
-	color4 material_diffuse,
-	color4 material_specular, float material_shininess)
+stepBalls()
 {
-	// set up vertex arrays
-	GLuint vPosition = glGetAttribLocation(program, "vPosition");
-	glEnableVertexAttribArray(vPosition);
-	glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(cubeOffset));
+	double t = timeNow();
+	integrateParticles(&balls);
+	frameStats.integrateMs += (timeNow() - t) * 1000.0;
+
+	collideParticles(&balls, ballRestitution);
 
-	GLuint vNormal = glGetAttribLocation(program, "vNormal");
-	glEnableVertexAttribArray(vNormal);
-	glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(cubeOffset + sizeof(cubePoints)));
+	for (int i = 0; i < 10; i++) {
+		scene.transform[ballNodes[i]] = Translate(particlePosition(balls, i));
+	}
+	refitPickNodes(scene, ballNodes, 10);
+}
 
-	color4 ambient_product = light_ambient * material_ambient;
-	color4 diffuse_product = light_diffuse * material_diffuse;
-	color4 specular_product = light_specular * material_specular;
+// The camera: the scene turned by the mouse angles, seen from the viewer
+mat4
+viewMatrix()
+{
+	const vec3 viewer_pos(0.0, 0.0, 2.0);
+	return Translate(-viewer_pos) *
+		RotateX(Theta[Xaxis]) *
+		RotateY(Theta[Yaxis]) *
+		RotateZ(Theta[Zaxis]);
+}
 
-	glUniform4fv(glGetUniformLocation(program, "AmbientProduct"), 1, ambient_product);
-	glUniform4fv(glGetUniformLocation(program, "DiffuseProduct"), 1, diffuse_product);
-	glUniform4fv(glGetUniformLocation(program, "SpecularProduct"), 1, specular_product);
-	glUniform4fv(glGetUniformLocation(program, "LightPosition"), 1, light_position);
-	glUniform1f(glGetUniformLocation(program, "Shininess"), material_shininess);
+// The light as the draw commands see it
+Light
+sceneLight()
+{
+	Light light;
+	light.position = light_position;
+	light.ambient = light_ambient;
+	light.diffuse = light_diffuse;
+	light.specular = light_specular;
+	return light;
+}
 
+//----------------------------------------------------------------------------
 
-	glUniformMatrix4fv(ModelView, 1, GL_TRUE, model_view);
+// Meshes, scene and physics; none of it needs a GL context
+void
+initSceneState()
+{
+	// Use the mesh cache when it is current; otherwise generate the
+	//   primitives and write the cache for the next run.
+	if (!loadMeshCache(primitiveCacheFile, primitivesKey())) {
+		registerPrimitives();
+		writeMeshCache(primitiveCacheFile, primitivesKey());
+	}
 
-	glDrawArrays(GL_TRIANGLES, 0, cubeNumVertices);
+	initBalls();
+	buildScene();
+	if (sceneObjects > 0) {
+		addRandomNodes(&scene, sceneObjects, 3.0, 1);
+	}
+	initColliders();
+	buildPicking(scene);
 }
 
-//----------------------------------------------------------------------------
+// OpenGL initialization
 void
-cone1(color4 material_ambient,
-	color4 material_diffuse,
-	color4 material_specular, float material_shininess)
+init()
 {
-	// set up vertex arrays
-	GLuint vPosition = glGetAttribLocation(program, "vPosition");
-	glEnableVertexAttribArray(vPosition);
-	glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(coneOffset));
+	syncGLState();
+	initSceneState();
 
-	GLuint vNormal = glGetAttribLocation(program, "vNormal");
-	glEnableVertexAttribArray(vNormal);
-	glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(coneOffset + sizeof(conePoints)));
 
-	color4 ambient_product = light_ambient * material_ambient;
-	color4 diffuse_product = light_diffuse * material_diffuse;
-	color4 specular_product = light_specular * material_specular;
+	// Load shaders and use the resulting shader program
+	program = InitShader("vshader53.glsl", "fshader53.glsl");
+	followShaderProgram(&program);
+	stateUseProgram(program);
 
-	glUniform4fv(glGetUniformLocation(program, "AmbientProduct"), 1, ambient_product);
-	glUniform4fv(glGetUniformLocation(program, "DiffuseProduct"), 1, diffuse_product);
-	glUniform4fv(glGetUniformLocation(program, "SpecularProduct"), 1, specular_product);
-	glUniform4fv(glGetUniformLocation(program, "LightPosition"), 1, light_position);
-	glUniform1f(glGetUniformLocation(program, "Shininess"), material_shininess);
 
+	// Create a vertex array object
+	GLuint vao;
+	glGenVertexArrays(1, &vao);
+	stateBindVertexArray(vao);
 
-	glUniformMatrix4fv(ModelView, 1, GL_TRUE, model_view);
+	// Create and initialize a buffer object; pulled primitives only need
+	//   it for the instanced paths
+	if (!proceduralPrimitives || gpuParticles || numPointLights > 0 || numRobots > 0 || numViews > 0) {
+		uploadMeshes();
+	}
+	if (proceduralPrimitives) {
+		proceduralProgram = initProceduralMeshes();
+		followShaderProgram(&proceduralProgram);
+		setProceduralTessellation(tessellation, tessellation);
+	}
 
-	glDrawArrays(GL_TRIANGLES, 0, coneNumVertices);
-}
+	if (gpuParticles) {
+		// Each ball keeps the material of its (hidden) scene node
+		GLuint ballMaterials[10];
+		for (int i = 0; i < 10; i++) {
+			ballMaterials[i] = scene.material[ballNodes[i]];
+		}
+		initGpuParticles(balls, scene.materials, scene.numMaterials, ballMaterials);
+	}
+	if (numPointLights > 0) {
+		initPointLights(&pointLights, numPointLights);
+		addRandomPointLights(&pointLights, numPointLights, 6.0, 1);
+		clusterProgram = initClusteredLighting();
+		followShaderProgram(&clusterProgram);
+	}
+	if (numRobots > 0) {
+		initRobotArms(&robotArms, numRobots);
+		addRandomRobotArms(&robotArms, numRobots, 1.0, 1);
+		initRobotRendering();
+	}
+	if (numViews > 0) {
+		initMultiView(numViews);
+	}
 
-//----------------------------------------------------------------------------
-void
-sphere1(color4 material_ambient,
-	color4 material_diffuse,
-	color4 material_specular, float material_shininess,
-	GLenum Mode = GL_TRIANGLES)
-{
-	// set up vertex arrays
-	GLuint vPosition = glGetAttribLocation(program, "vPosition");
-	glEnableVertexAttribArray(vPosition);
-	glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0,
-		BUFFER_OFFSET(sphereOffset));
+	stateEnable(GL_DEPTH_TEST);
 
-	GLuint vNormal = glGetAttribLocation(program, "vNormal");
-	glEnableVertexAttribArray(vNormal);
-	glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0,
-		BUFFER_OFFSET(sphereOffset + sizeof(spherePoints)));
+	stateShadeModel(GL_SMOOTH);
 
-	color4 ambient_product = light_ambient * material_ambient;
-	color4 diffuse_product = light_diffuse * material_diffuse;
-	color4 specular_product = light_specular * material_specular;
+	stateFrontFace(GL_CCW);
+	stateEnable(GL_CULL_FACE);
+	stateCullFace(GL_BACK);
 
-	glUniform4fv(glGetUniformLocation(program, "AmbientProduct"), 1, ambient_product);
-	glUniform4fv(glGetUniformLocation(program, "DiffuseProduct"), 1, diffuse_product);
-	glUniform4fv(glGetUniformLocation(program, "SpecularProduct"), 1, specular_product);
-	glUniform4fv(glGetUniformLocation(program, "LightPosition"), 1, light_position);
-	glUniform1f(glGetUniformLocation(program, "Shininess"), material_shininess);
+	glClearColor(1.0, 1.0, 1.0, 1.0);
+}
 
 
-	glUniformMatrix4fv(ModelView, 1, GL_TRUE, model_view);
 
-	glDrawArrays(Mode, 0, sphereNumVertices);
-}
 
+
+// Array of rotation angles (in degrees) for each rotation axis
+enum { Base = 0, LowerArm = 1, UpperArm = 2, NumAngles = 3 };
+int      Axis1 = Base;
+//GLfloat  Theta[NumAngles] = { 0.0 };
+
+// Advance the automatic rotation.  This runs once per displayed frame, not
+//   per idle call, so a recorded session replays to the same images.
 void
-ball()
-{
-	static vec3 pos(-3.0, 2.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.001;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(1.0, 0.0, 1.0, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0), 100.0, GL_LINES);
-}
-void
-ball2()
-{
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.003;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(1.0, 0.0, 1.0, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0), 100.0, GL_LINES);
-}
-void
-ball3()
-{
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.005;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(1.0, 0.0, 1.0, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0), 100.0, GL_LINES);
-}
-void
-ball4()
-{
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.007;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(0.7, 0.2, 0.5, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0), 100.0, GL_LINES);
-}
-void
-ball5()
-{
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.0001;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(0.3, 0.8, 0.3, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0), 100.0, GL_LINES);
-}
-void
-ball6()
-{
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.0003;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(0.5, 0.5, 0.8, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0),
-		color4(0.5, 0.0, 0.0, 1.0), 100.0, GL_LINES);
-}
-void
-ball7()
-{
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.0005;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(0.1, 0.5, 0.3, 1.0),
-		color4(0.7, 0.8, 0.3, 1.0),
-		color4(1.0, 0.8, 0.0, 1.0), 100.0, GL_LINES);
-}
-void
-ball8()
-{
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.0009;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(0.1, 0.3, 0.6, 1.0),
-		color4(0.3, 0.2, 0.5, 1.0),
-		color4(0.2, 0.1, 0.8, 1.0), 100.0, GL_LINES);
-}
-//----------------------------------------------------------------------------
-void
-ball9()
-{
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.0009;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(0.1, 0.2, 0.3, 1.0),
-		color4(0.1, 0.5, 0.9, 1.0),
-		color4(0.4, 0.3, 0.6, 1.0), 100.0, GL_LINES);
-}
-void
-ball10()
+animate()
 {
-	static vec3 pos(-3.0, 1.0, 0.0);
-	static vec3 vel(0.0, 0.0, 0.0);
-	static vec3 acc(3.0, 9.0, 0.0);
-	//const vec3 grv(0.0, -9.8, 0.0);
-	const float deltaT = 0.0009;
-
-	//update acc, vel, pos
-//	acc += grv * deltaT;
-	vel += acc * deltaT;
-	pos += vel * deltaT;
-
-	model_view *= Translate(pos);
-	sphere1(color4(0.6, 1.0, 0.4, 1.0),
-		color4(0.9, 0.1, 0.6, 1.0),
-		color4(0.4, 0.3, 0.6, 1.0), 100.0, GL_LINES);
+	//Theta[Xaxis] += 0.5; if (Theta[Xaxis] > 360.0) Theta[Xaxis] -= 360.0;
+	//Theta[Yaxis] += 0.5; if (Theta[Yaxis] > 360.0) Theta[Yaxis] -= 360.0;
+	Theta[Zaxis] += 0.07; if (Theta[Zaxis] > 360.0) Theta[Zaxis] -= 360.0;
 }
 
-
 void
 display(void)
 {
+	bool reloading = hotReload && updateShaders();
+	beginScaledFrame();
 	glClearColor(0.75, 0.75, 0.75, 1.0);  //
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	beginFrameStats();
+	resetFrameArena();
+	unsigned long allocations = heapAllocations();
+	if (isAnimating()) {
+		animate();
+		animateRobotArms(&robotArms);
+	}
 	//  Generate tha model-view matrixn
 
-	glShadeModel(GL_SMOOTH);                              // Ų ̵ 
-	glEnable(GL_DEPTH_TEST);                              //   
-	glEnable(GL_CULL_FACE);                               // ĸ 
-	glEnable(GL_LIGHTING);                                //  Ȱȭ
+	stateShadeModel(GL_SMOOTH);                           // Ų ̵ 
+	stateEnable(GL_DEPTH_TEST);                           //   
+	stateEnable(GL_CULL_FACE);                            // ĸ 
+	stateEnable(GL_LIGHTING);                             //  Ȱȭ
 
 	   // LIGHT0    
-	glMaterialfv(GL_FRONT, GL_AMBIENT, light_ambient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE, light_diffuse);
+	stateMaterialfv(GL_FRONT, GL_AMBIENT, light_ambient);
+	stateMaterialfv(GL_FRONT, GL_DIFFUSE, light_diffuse);
 
 	// LIGHT0 
-	glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);       // ֺ  
-	glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);       // л걤  
-	glLightfv(GL_LIGHT0, GL_POSITION, light_position);     //  ġ 
+	stateLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);    // ֺ  
+	stateLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);    // л걤  
+	stateLightfv(GL_LIGHT0, GL_POSITION, light_position);  //  ġ 
 
 	// LIGHT0 Ҵ.
-	glEnable(GL_LIGHT0);
-
-	const vec3 viewer_pos(0.0, 0.0, 2.0);
-	model_view = (Translate(-viewer_pos) *
-		RotateX(Theta[Xaxis]) *
-		RotateY(Theta[Yaxis]) *
-		RotateZ(Theta[Zaxis]));
-	mat4 model_view_sv = model_view;
-
-	//model_view *= RotateX(90);
-	//upper_arm();
-	model_view = model_view_sv;
-	model_view *= (Translate(-3.0, 0.0, 0.0)*Scale(0.7, 0.7, 1.0));  //  
-	sphere1(color4(0.2, 0.1, 1.0, 1.0),
-		color4(1.0, 0.5, 0.5, 1.0),
-		color4(1.0, 0.5, 0.5, 1.0), 100.0, GL_LINES);
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-3.0, 3.0, 0.0)*Scale(0.7, 0.7, 1.0));  //  
-	sphere1(color4(0.4, 0.3, 1.0, 1.0),
-		color4(1.0, 0.5, 0.5, 1.0),
-		color4(1.0, 0.5, 0.5, 1.0), 100.0, GL_LINES);
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-0.5, 0.1, 0.0)*Scale(1.5, 0.3, 1.0));  // ڵ1 
-	sphere1(color4(1.0, 0.411765, 0.705882, 1.0),
-		color4(0.690196, 0.188235, 0.376471, 1.0),
-		color4(0.6, 0.196078, 0.0, 1.0), 100.0, GL_LINES);
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-0.5, 0.1, 0.0)*Scale(0.3, 1.5, 1.0));  // ڵ2
-	sphere1(color4(1.0, 0.2, 1.0, 1.0),
-		color4(1.0, 0.5, -0.5, 1.0),
-		color4(1.0, 0.5, 0.5, 1.0), 100.0, GL_LINES);
-
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-3.0, 0.0, 0.0)*Scale(0.3, 0.7, 1.0));  // ü 
-	upper_arm();
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-2.0, -0.1, 0.0)*Scale(5.0, 0.05, 2.0)); // պκ 
-	upper_arm();
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-0.5, 1.0, 0.0)*Scale(0.5, 0.3, 1.0));  //  
-	lower_arm();
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-0.1, 0.8, 0.0)*Scale(0.5, 0.3, 1.0));  //  
-	lower_arm();
-
-	model_view = model_view_sv;
-	model_view *= Translate(1.0, 2.2, 0.0)*Scale(1.0, 1.0, 1.0);
-	cone1(color4(0.2, 0.3, 0.11222, 1.0),     // Ӹ 
-		color4(0.803922, 0.803922, 0.756863, 1.0),
-		color4(0.933333, 0.898039, 0.870588, 1.0), 100.0);
-
-	model_view = model_view_sv;
-	model_view *= Translate(1.3, 2.1, 0.0)*Scale(1.3, 1.3, 1.0);
-	sphere1(color4(1.0, 0.3, 2.0, 1.0),     // Ӹ  
-		color4(0.3, 1.0, 1.0, 1.0),
-		color4(0.5, -0.5, 0.0, 1.0), 100.0, GL_LINES);
-
-
-
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-0.8, 2.3, 0.0)*RotateY(90)*Scale(0.5, 1.0, 2.0)); // ü  
-	cube1(color4(0.7, 1.7, 1.0, 1.0),
-		color4(1.0, 0.7, 0.7, 1.0),
-		color4(2.0, 0.7, 1.7, 1.0), 100.0);
-
-
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-2.1, 2.5, 0.0)*RotateY(90)*Scale(0.2, 0.3, 2.0)); // ٸ1
-	cube1(color4(0.7, 0.7, 1.0, 2.0),
-		color4(1.0, 1.7, 0.7, 1.0),
-		color4(1.0, 0.7, 0.7, 1.0), 100.0);
-
-	model_view = model_view_sv;
-	model_view *= (Translate(-2.1, 2.0, 0.0)*RotateY(90)*Scale(0.2, 0.3, 2.0)); //ٸ2
-	cube1(color4(0.7, 0.7, 1.0, 2.0),
-		color4(1.0, 1.7, 0.7, 1.0),
-		color4(1.0, 0.7, 0.7, 1.0), 100.0);
-
-
-	
-	// falling ball
-	// falling ball
-	model_view = model_view_sv;
-	ball();
-	
-	model_view = model_view_sv;
-	ball2();
-
-	model_view = model_view_sv;
-	ball3();
+	stateEnable(GL_LIGHT0);
 
-	model_view = model_view_sv;
-	ball4();
-
-
-	model_view = model_view_sv;
-	ball5();
+	const mat4 view = viewMatrix();
+	setClusterProjection(projection, 0.5, 3.0, renderWidth(), renderHeight());
 
+	// falling ball (held in place while paused)
+	if (isAnimating() && gpuParticles) {
+		stepGpuParticles();
+	}
+	else if (isAnimating()) {
+		stepBalls();
+	}
 
-	model_view = model_view_sv;
-	ball6();
+	if (numViews > 0) {
+		cullViews(&scene, view);
+	}
+	else if (occlusionCulling) {
+		cullScene(&scene, view, projection);
+	}
 
+	// reshape()'s projection spans 12 units of eye space
+	Light light = sceneLight();
+	setLodSelection(renderHeight() / 12.0, lodPixels);
+	recordScene(scene, view, light);
+	if (numViews > 0) {
+		drawMultiView(light, renderWidth(), renderHeight());
+	}
+	else if (softwareRendering) {
+		renderSoftware(projection, light, color4(0.75, 0.75, 0.75, 1.0));
+		presentSoftwareFrame(windowWidth, windowHeight);
+	}
+	else if (pointLights.count > 0) {
+		binLights(pointLights, view);
+		bindClusteredLighting();
+		submitCommands(clusterProgram, light);
+	}
+	else {
+		submitCommands(proceduralPrimitives ? proceduralProgram : program, light);
+	}
 
-	model_view = model_view_sv;
-	ball7();
+	drawRobotArms(robotArms, view, projection, light);
 
-	model_view = model_view_sv;
-	ball8();
+	if (gpuParticles) {
+		drawGpuParticles(view, projection, light, GL_LINES);
+	}
 
-	model_view = model_view_sv;
-	ball9();
+	endScaledFrame();
 
-	model_view = model_view_sv;
-	ball10();
-	//  model_view = model_view_sv;
-	//  model_view *= (Translate(3.0, 1.0, 0.0)*Scale(0.2, 0.3, 2.0));
-	 // robot1()
+	frameStats.heapAllocations = (int)(heapAllocations() - allocations);
+	frameStats.arenaBytes = (int)frameArenaUsed();
+	recordHudFrame();
+	drawHud(windowWidth, windowHeight);
 
+	recordFrame(frameStats.frameMs);
+	captureFrame(windowWidth, windowHeight);
 	glutSwapBuffers();
+	frameDone();
+
+	// Keep drawing until the reloaded shaders are swapped in
+	if (reloading) {
+		requestRedraw();
+	}
 }
 
 
@@ -709,8 +485,11 @@ display(void)
 void
 menu(int option)
 {
+	recordMenu(option);
+	requestRedraw();
+
 	if (option == Quit) {
-		exit(EXIT_SUCCESS);
+		if (!isReplaying()) { exit(EXIT_SUCCESS); }
 	}
 	else {
 		Axis1 = option;
@@ -718,9 +497,36 @@ menu(int option)
 }
 //----------------------------------------------------------------------------
 
+// Draws node (-1 for none) in the highlight material, and the node picked
+//   before in its own again
+void
+highlightNode(int node)
+{
+	if (pickedNode >= 0) {
+		scene.material[pickedNode] = pickedNodeMaterial;
+	}
+	pickedNode = node;
+	if (node >= 0) {
+		pickedNodeMaterial = scene.material[node];
+		scene.material[node] = pickMaterial;
+	}
+}
+
 void
 mouse(int button, int state, int x, int y)
 {
+	recordMouse(button, state, x, y);
+	requestRedraw();
+
+	// Highlight what is under the cursor, as the view was before this
+	//   click turns it
+	if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
+		vec3 origin, direction;
+		PickHit hit;
+		pickRay(x, y, windowWidth, windowHeight, viewMatrix(), projection, &origin, &direction);
+		highlightNode(pickScene(scene, origin, direction, &hit) ? hit.node : -1);
+	}
+
 	if (state == GLUT_DOWN) {
 		switch (button) {
 		case GLUT_LEFT_BUTTON:    Theta[Xaxis] += 10.5; if (Theta[Xaxis] > 360.0) Theta[Xaxis] -= 360.0;  break;
@@ -743,25 +549,28 @@ mouse(int button, int state, int x, int y)
 
 //----------------------------------------------------------------------------
 
-void
-idle(void)
-{
-	//Theta[Xaxis] += 0.5; if (Theta[Xaxis] > 360.0) Theta[Xaxis] -= 360.0;
-	//Theta[Yaxis] += 0.5; if (Theta[Yaxis] > 360.0) Theta[Yaxis] -= 360.0;
-	Theta[Zaxis] += 0.07; if (Theta[Zaxis] > 360.0) Theta[Zaxis] -= 360.0;
-
-	glutPostRedisplay();
-}
-
-//----------------------------------------------------------------------------
-
 void
 keyboard(unsigned char key, int x, int y)
 {
+	recordKeyboard(key, x, y);
+	requestRedraw();
+
 	switch (key) {
 	case 033: // Escape Key
 	case 'q': case 'Q':
-		exit(EXIT_SUCCESS);
+		if (!isReplaying()) { exit(EXIT_SUCCESS); }
+		break;
+	case 's': case 'S':
+		printFrameStats(std::cout);
+		break;
+	case 'h': case 'H':
+		toggleHud();
+		break;
+	case 'p': case 'P':
+		setAnimating(!isAnimating());
+		break;
+	case 'c': case 'C':
+		pauseCapture(isCapturing());
 		break;
 	}
 }
@@ -771,14 +580,124 @@ keyboard(unsigned char key, int x, int y)
 void
 reshape(int width, int height)
 {
-	glViewport(0, 0, width, height);
+	recordReshape(width, height);
+	requestRedraw();
+
+	stateViewport(0, 0, width, height);
+	resizeDynamicResolution(width, height);
+	windowWidth = width;
+	windowHeight = height;
+	if (softwareRendering) {
+		resizeSoftwareTarget(width, height);
+	}
 
 	GLfloat aspect = GLfloat(width) / height;
 	//mat4  projection = Perspective( 150.0, aspect, 0.5, 3.0 );
 	//mat4  projection = Frustum(-5.0, 5.0, -5.0, 5.0, 0.5, 3.0);
-	mat4  projection = Ortho(-6.0, 6.0, -6.0, 6.0, 0.5, 3.0);
+	projection = Ortho(-6.0, 6.0, -6.0, 6.0, 0.5, 3.0);
+
+	// Looked up each time: a reloaded shader may have moved it
+	stateUseProgram(program);
+	glUniformMatrix4fv(glGetUniformLocation(program, "Projection"), 1, GL_TRUE, projection);
+	if (proceduralProgram != 0) {
+		stateUseProgram(proceduralProgram);
+		glUniformMatrix4fv(glGetUniformLocation(proceduralProgram, "Projection"), 1, GL_TRUE, projection);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+// Animates and rasterizes `frames` frames on the CPU without a window,
+//   for hosts with no GL driver, and writes the last one to imagePath
+int
+runHeadless(int frames, const char* imagePath)
+{
+	initSceneState();
+	resizeSoftwareTarget(1024, 1024);
+	projection = Ortho(-6.0, 6.0, -6.0, 6.0, 0.5, 3.0);
+	Light light = sceneLight();
+	setLodSelection(1024 / 12.0, lodPixels);
+
+	for (int f = 0; f < frames; f++) {
+		beginFrameStats();
+		resetFrameArena();
+		animate();
+		stepBalls();
+
+		mat4 view = viewMatrix();
+		if (occlusionCulling) {
+			cullScene(&scene, view, projection);
+		}
+		recordScene(scene, view, light);
+		renderSoftware(projection, light, color4(0.75, 0.75, 0.75, 1.0));
+	}
+
+	printFrameStats(std::cout);
+	return writeSoftwareImage(imagePath) ? 0 : EXIT_FAILURE;
+}
+
+//----------------------------------------------------------------------------
 
-	glUniformMatrix4fv(Projection, 1, GL_TRUE, projection);
+// Changed shaders need a frame to be swapped in, also while nothing else
+//   asks for one
+void
+pollShaders(int)
+{
+	if (shadersPending()) {
+		requestRedraw();
+	}
+	glutTimerFunc(250, pollShaders, 0);
+}
+
+//----------------------------------------------------------------------------
+
+// The argument after the flag at argv[*i], which it consumes; NULL with a
+//   usage message when there is none
+const char*
+nextArgument(int argc, char** argv, int* i, const char* what)
+{
+	if (*i + 1 >= argc) {
+		std::cerr << "usage: " << argv[*i] << " needs " << what << std::endl;
+		return NULL;
+	}
+	return argv[++*i];
+}
+
+// A positive count after the flag at argv[*i], as nextArgument()
+bool
+countArgument(int argc, char** argv, int* i, int* count)
+{
+	const char* flag = argv[*i];
+	const char* text = nextArgument(argc, argv, i, "a count");
+	if (text == NULL) { return false; }
+
+	char* end;
+	long n = strtol(text, &end, 10);
+	if (*end != '\0' || n <= 0 || n > INT_MAX) {
+		std::cerr << "usage: " << flag << " needs a positive count, not " << text << std::endl;
+		return false;
+	}
+	*count = (int)n;
+	return true;
+}
+
+// A finite amount of zero or more after the flag at argv[*i], described
+//   by what, as nextArgument()
+bool
+amountArgument(int argc, char** argv, int* i, const char* what, double* amount)
+{
+	const char* flag = argv[*i];
+	const char* text = nextArgument(argc, argv, i, what);
+	if (text == NULL) { return false; }
+
+	char* end;
+	double x = strtod(text, &end);
+	if (end == text || *end != '\0' || !(x >= 0.0) || x == HUGE_VAL) {
+		std::cerr << "usage: " << flag << " needs " << what << " of 0 or more, not " << text << std::endl;
+		return false;
+	}
+	*amount = x;
+	return true;
 }
 
 //----------------------------------------------------------------------------
@@ -790,6 +709,212 @@ reshape(int width, int height)
 int
 main(int argc, char **argv)
 {
+	int benchParticles = 0;
+	int benchLights = 0;
+	int benchProcedural = 0;
+	int benchRaster = 0;
+	int benchMultiView = 0;
+	int headlessFrames = 0;
+	const char* headlessImage = NULL;
+	const char* recordPath = NULL;
+	const char* replayPath = NULL;
+	const char* hashPath = NULL;
+	const char* capturePath = NULL;
+	const char* statsFile = NULL;
+	const char* statsSocket = NULL;
+	bool showHud = false;
+
+	for (int i = 1; i < argc; i++) {
+		int count = 0;
+
+		if (strcmp(argv[i], "-bench-collision") == 0) {
+			// needs no window
+			if (!countArgument(argc, argv, &i, &count)) { return EXIT_FAILURE; }
+			collisionBenchmark(count, 100);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-bench-commands") == 0) {
+			// needs no window
+			if (!countArgument(argc, argv, &i, &count)) { return EXIT_FAILURE; }
+			commandBenchmark(count, 100);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-bench-integrators") == 0) {
+			// needs no window
+			if (!countArgument(argc, argv, &i, &count)) { return EXIT_FAILURE; }
+			integratorBenchmark(count);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-integrator") == 0) {
+			const char* name = nextArgument(argc, argv, &i, "an integrator");
+			if (name == NULL) { return EXIT_FAILURE; }
+			ballIntegrator = findIntegrator(name);
+			if (ballIntegrator < 0) {
+				std::cerr << "unknown integrator " << name << "; use euler, verlet, rk4 or adaptive" << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (strcmp(argv[i], "-bench-robots") == 0) {
+			// needs no window
+			if (!countArgument(argc, argv, &i, &count)) { return EXIT_FAILURE; }
+			robotBenchmark(count, 100);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-bench-scene") == 0) {
+			// needs no window
+			if (!countArgument(argc, argv, &i, &count)) { return EXIT_FAILURE; }
+			sceneFileBenchmark(count);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-compile-scene") == 0) {
+			// text scene in, binary scene out
+			if (i + 2 >= argc) {
+				std::cerr << "usage: -compile-scene needs a text scene and a binary scene" << std::endl;
+				return EXIT_FAILURE;
+			}
+			initScene(&scene, 0, 0);
+			return (loadSceneText(&scene, argv[i + 1]) && writeSceneBinary(scene, argv[i + 2]))
+				? 0 : EXIT_FAILURE;
+		}
+		else if (strcmp(argv[i], "-scene") == 0) {
+			if ((sceneFile = nextArgument(argc, argv, &i, "a scene file")) == NULL) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-bench-occlusion") == 0) {
+			if (!countArgument(argc, argv, &i, &count)) { return EXIT_FAILURE; }
+			registerPrimitives();
+			occlusionBenchmark(count, 100);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-bench-picking") == 0) {
+			if (!countArgument(argc, argv, &i, &count)) { return EXIT_FAILURE; }
+			registerPrimitives();
+			pickingBenchmark(count, 100000);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-bench-simplify") == 0) {
+			registerPrimitives();
+			simplifyBenchmark(10);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-lod-pixels") == 0) {
+			double pixels;
+			if (!amountArgument(argc, argv, &i, "a size in pixels", &pixels)) { return EXIT_FAILURE; }
+			lodPixels = (float)pixels;
+		}
+		else if (strcmp(argv[i], "-no-occlusion") == 0) {
+			occlusionCulling = false;
+		}
+		else if (strcmp(argv[i], "-animate") == 0) {
+			startAnimating = true;
+		}
+		else if (strcmp(argv[i], "-scene-objects") == 0) {
+			if (!countArgument(argc, argv, &i, &sceneObjects)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-bench-particles") == 0) {
+			if (!countArgument(argc, argv, &i, &benchParticles)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-bench-lights") == 0) {
+			if (!countArgument(argc, argv, &i, &benchLights)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-bench-raster") == 0) {
+			if (!countArgument(argc, argv, &i, &benchRaster)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-multiview") == 0) {
+			// 4 gives the front, side, top and perspective views
+			if (!countArgument(argc, argv, &i, &numViews)) { return EXIT_FAILURE; }
+			numViews = std::min(numViews, MaxViews);
+		}
+		else if (strcmp(argv[i], "-bench-multiview") == 0) {
+			if (!countArgument(argc, argv, &i, &benchMultiView)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-software") == 0) {
+			softwareRendering = true;
+		}
+		else if (strcmp(argv[i], "-headless") == 0) {
+			// frames, then the image to write
+			if (i + 2 >= argc) {
+				std::cerr << "usage: -headless needs a frame count and an image file" << std::endl;
+				return EXIT_FAILURE;
+			}
+			if (!countArgument(argc, argv, &i, &headlessFrames)) { return EXIT_FAILURE; }
+			headlessImage = argv[++i];
+		}
+		else if (strcmp(argv[i], "-bench-procedural") == 0) {
+			if (!countArgument(argc, argv, &i, &benchProcedural)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-procedural") == 0) {
+			proceduralPrimitives = true;
+		}
+		else if (strcmp(argv[i], "-tessellation") == 0) {
+			if (!countArgument(argc, argv, &i, &tessellation)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-fps") == 0) {
+			if (!amountArgument(argc, argv, &i, "a frame rate", &targetFps)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-budget") == 0) {
+			if (!amountArgument(argc, argv, &i, "a frame time in milliseconds", &frameBudgetMs)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-robots") == 0) {
+			if (!countArgument(argc, argv, &i, &numRobots)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-lights") == 0) {
+			if (!countArgument(argc, argv, &i, &numPointLights)) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-gpu-particles") == 0) {
+			gpuParticles = true;
+		}
+		else if (strcmp(argv[i], "-record") == 0) {
+			if ((recordPath = nextArgument(argc, argv, &i, "a file")) == NULL) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-replay") == 0) {
+			if ((replayPath = nextArgument(argc, argv, &i, "a file")) == NULL) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-hash") == 0) {
+			if ((hashPath = nextArgument(argc, argv, &i, "a file")) == NULL) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-capture") == 0) {
+			if ((capturePath = nextArgument(argc, argv, &i, "a file")) == NULL) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-hot-reload") == 0) {
+			hotReload = true;
+		}
+		else if (strcmp(argv[i], "-hud") == 0) {
+			showHud = true;
+		}
+		else if (strcmp(argv[i], "-stats-file") == 0) {
+			if ((statsFile = nextArgument(argc, argv, &i, "a file")) == NULL) { return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[i], "-stats-socket") == 0) {
+			if ((statsSocket = nextArgument(argc, argv, &i, "a socket path")) == NULL) { return EXIT_FAILURE; }
+		}
+	}
+
+	if (headlessImage != NULL) {
+		return runHeadless(headlessFrames, headlessImage);
+	}
+	if (softwareRendering && (numRobots > 0 || numPointLights > 0 || gpuParticles)) {
+		std::cerr << "-software draws the scene nodes only; ignoring -robots, -lights and -gpu-particles" << std::endl;
+		numRobots = 0;
+		numPointLights = 0;
+		gpuParticles = false;
+	}
+	if (softwareRendering && frameBudgetMs > 0.0) {
+		// The scene is rasterized on the CPU at the window size
+		std::cerr << "-software renders at the window size; ignoring -budget" << std::endl;
+		frameBudgetMs = 0.0;
+	}
+	if (gpuParticles && ballIntegrator != SemiImplicitEuler) {
+		std::cerr << "-gpu-particles integrates with euler; ignoring -integrator" << std::endl;
+		ballIntegrator = SemiImplicitEuler;
+	}
+	if (numViews > 0 && (softwareRendering || numRobots > 0 || numPointLights > 0 || gpuParticles)) {
+		std::cerr << "-multiview draws the scene nodes only; ignoring -software, -robots, -lights and -gpu-particles" << std::endl;
+		softwareRendering = false;
+		numRobots = 0;
+		numPointLights = 0;
+		gpuParticles = false;
+	}
+
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
 
@@ -801,12 +926,72 @@ main(int argc, char **argv)
 	glewInit();
 
 	init();
+	initDynamicResolution(frameBudgetMs);
+
+	if (benchParticles > 0) {
+		// Run with LIBGL_ALWAYS_SOFTWARE=1 to measure Mesa llvmpipe
+		particleBenchmark(benchParticles, 200);
+		return 0;
+	}
+	if (benchLights > 0) {
+		lightingBenchmark(benchLights, 20);
+		return 0;
+	}
+	if (benchProcedural > 0) {
+		if (meshBuffer == 0) {
+			uploadMeshes();
+		}
+		proceduralBenchmark(program, benchProcedural, 20);
+		return 0;
+	}
+	if (benchRaster > 0) {
+		// Run with LIBGL_ALWAYS_SOFTWARE=1 to compare with Mesa llvmpipe
+		if (meshBuffer == 0) {
+			uploadMeshes();
+		}
+		rasterBenchmark(program, benchRaster, 10, 1024, 1024);
+		return 0;
+	}
+	if (benchMultiView > 0) {
+		if (meshBuffer == 0) {
+			uploadMeshes();
+		}
+		multiViewBenchmark(benchMultiView, 10, 1024, 1024);
+		return 0;
+	}
+
+	if (capturePath != NULL && !startCapture(capturePath)) {
+		return EXIT_FAILURE;
+	}
+	if ((statsFile != NULL || statsSocket != NULL) && !startPublishing(statsFile, statsSocket)) {
+		return EXIT_FAILURE;
+	}
+	if (showHud) {
+		toggleHud();
+	}
+
+	// A replay needs the same flag as the recorded session
+	setAnimating(startAnimating);
+	if (replayPath != NULL) {
+		// Headless: frames go to an offscreen framebuffer
+		glutHideWindow();
+		ReplayCallbacks callbacks = { display, reshape, mouse, keyboard, menu };
+		return runReplay(replayPath, callbacks, hashPath);
+	}
+	if (recordPath != NULL && !startRecording(recordPath)) {
+		return EXIT_FAILURE;
+	}
+
+	if (hotReload) {
+		watchShaders();
+		pollShaders(0);
+	}
 
 	glutDisplayFunc(display);
 	glutKeyboardFunc(keyboard);
 	glutReshapeFunc(reshape);
 	glutMouseFunc(mouse);
-	glutIdleFunc(idle);
+	initFramePacing(targetFps);
 	glutCreateMenu(menu);
 	// Set the menu values to the relevant rotation axis values (or Quit)
 	glutAddMenuEntry("Simple Form", Base);
@@ -0,0 +1,369 @@
+#include "Occlusion.h"
+#include "FrameArena.h"
+#include "Mesh.h"
+#include "Parallel.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#endif
+
+namespace {
+
+const int  BandHeight = 16;
+const int  NumBands = OcclusionHeight / BandHeight;
+const int  MaxLevels = 16;
+
+// A screen space triangle: edge functions, depth plane and pixel bounds.
+//   Empty when minX > maxX.
+struct ScreenTriangle {
+	float  a[3], b[3], c[3];     // edge k: a*x + b*y + c >= 0 inside
+	float  za, zb, zc;           // depth: za*x + zb*y + zc
+	int    minX, maxX, minY, maxY;
+};
+
+std::vector<ScreenTriangle>  triangles;
+std::vector<int>             occluders;        // node indices
+std::vector<int>             firstTriangle;    // per occluder
+
+// Level 0 is the depth buffer; each level above keeps the farthest depth
+//   of 2x2 texels below it.
+std::vector<float>  levels[MaxLevels];
+int                 numLevels = 0;
+
+void
+initPyramid()
+{
+	if (numLevels > 0) { return; }
+
+	int w = OcclusionWidth, h = OcclusionHeight;
+	for (numLevels = 0; numLevels < MaxLevels; numLevels++) {
+		levels[numLevels].resize(w * h);
+		if (w == 1 && h == 1) { numLevels++; break; }
+		w = std::max(w / 2, 1);
+		h = std::max(h / 2, 1);
+	}
+}
+
+inline int
+levelWidth(int level) { return std::max(OcclusionWidth >> level, 1); }
+
+inline int
+levelHeight(int level) { return std::max(OcclusionHeight >> level, 1); }
+
+// Clip space to pixels and depth in [0, 1].  False when the vertex lies
+//   outside the near or far plane; such triangles are dropped, which only
+//   ever makes the culling less aggressive.
+bool
+toScreen(const vec4& p, float* x, float* y, float* z)
+{
+	if (p.w <= 0.0 || p.z < -p.w || p.z > p.w) { return false; }
+
+	*x = (0.5 * p.x / p.w + 0.5) * OcclusionWidth;
+	*y = (0.5 * p.y / p.w + 0.5) * OcclusionHeight;
+	*z = 0.5 * p.z / p.w + 0.5;
+	return true;
+}
+
+void
+setupTriangle(const vec4* clip, ScreenTriangle* t)
+{
+	t->minX = 1; t->maxX = 0;
+
+	float x[3], y[3], z[3];
+	for (int k = 0; k < 3; k++) {
+		if (!toScreen(clip[k], &x[k], &y[k], &z[k])) { return; }
+	}
+
+	// Counter-clockwise triangles face the viewer, as with GL_CULL_FACE
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area <= 0.0) { return; }
+
+	for (int k = 0; k < 3; k++) {
+		int j = (k + 1) % 3;
+		t->a[k] = y[k] - y[j];
+		t->b[k] = x[j] - x[k];
+		t->c[k] = -t->a[k] * x[k] - t->b[k] * y[k];
+
+		// Widen each edge by 1/256 pixel so rounding cannot open gaps
+		//   along the edges two triangles share
+		t->c[k] += (fabs(t->a[k]) + fabs(t->b[k])) * (1.0f / 256.0f);
+	}
+
+	t->za = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+	t->zb = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+	t->zc = z[0] - t->za * x[0] - t->zb * y[0];
+
+	float lox = std::min(x[0], std::min(x[1], x[2])), hix = std::max(x[0], std::max(x[1], x[2]));
+	float loy = std::min(y[0], std::min(y[1], y[2])), hiy = std::max(y[0], std::max(y[1], y[2]));
+	t->minX = std::max((int)floor(lox), 0);
+	t->maxX = std::min((int)ceil(hix), OcclusionWidth - 1);
+	t->minY = std::max((int)floor(loy), 0);
+	t->maxY = std::min((int)ceil(hiy), OcclusionHeight - 1);
+}
+
+// Rasterize the part of triangle t inside rows [y0, y1], keeping the
+//   nearest depth.  Pixels are sampled at their centers.
+void
+rasterize(const ScreenTriangle& t, int y0, int y1, float* depth)
+{
+	y0 = std::max(y0, t.minY);
+	y1 = std::min(y1, t.maxY);
+	int x0 = t.minX & ~3;
+
+#ifdef OCCLUSION_SSE2
+	const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (int y = y0; y <= y1; y++) {
+		float py = y + 0.5f;
+		__m128 e0 = _mm_set1_ps(t.b[0] * py + t.c[0]);
+		__m128 e1 = _mm_set1_ps(t.b[1] * py + t.c[1]);
+		__m128 e2 = _mm_set1_ps(t.b[2] * py + t.c[2]);
+		__m128 zrow = _mm_set1_ps(t.zb * py + t.zc);
+		float* row = depth + y * OcclusionWidth;
+
+		// The buffer lives in a std::vector, which only aligns to the
+		//   allocator's default
+		for (int x = x0; x <= t.maxX; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 inside = _mm_and_ps(
+				_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[0]), px), e0), zero),
+				           _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[1]), px), e1), zero)),
+				_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[2]), px), e2), zero));
+			if (_mm_movemask_ps(inside) == 0) { continue; }
+
+			__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.za), px), zrow);
+			__m128 old = _mm_loadu_ps(row + x);
+			__m128 nearer = _mm_min_ps(old, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+		}
+	}
+#else
+	for (int y = y0; y <= y1; y++) {
+		float py = y + 0.5f;
+		float* row = depth + y * OcclusionWidth;
+
+		for (int x = x0; x <= t.maxX; x++) {
+			float px = x + 0.5f;
+			if (t.a[0] * px + t.b[0] * py + t.c[0] < 0.0f
+				|| t.a[1] * px + t.b[1] * py + t.c[1] < 0.0f
+				|| t.a[2] * px + t.b[2] * py + t.c[2] < 0.0f) { continue; }
+
+			float z = t.za * px + t.zb * py + t.zc;
+			if (z < row[x]) { row[x] = z; }
+		}
+	}
+#endif
+}
+
+void
+buildPyramid()
+{
+	for (int l = 1; l < numLevels; l++) {
+		const float* src = levels[l - 1].data();
+		float* dst = levels[l].data();
+		int sw = levelWidth(l - 1), sh = levelHeight(l - 1);
+		int w = levelWidth(l), h = levelHeight(l);
+
+		for (int y = 0; y < h; y++) {
+			const float* r0 = src + std::min(2 * y, sh - 1) * sw;
+			const float* r1 = src + std::min(2 * y + 1, sh - 1) * sw;
+			for (int x = 0; x < w; x++) {
+				int x0 = std::min(2 * x, sw - 1), x1 = std::min(2 * x + 1, sw - 1);
+				dst[y * w + x] = std::max(std::max(r0[x0], r0[x1]), std::max(r1[x0], r1[x1]));
+			}
+		}
+	}
+}
+
+enum { Visible = 0, OutsideView = 1, Occluded = 2 };
+
+int
+testBounds(const Mesh& m, const mat4& mvp)
+{
+	float lox = 1e30f, hix = -1e30f, loy = 1e30f, hiy = -1e30f, loz = 1e30f, hiz = -1e30f;
+
+	for (int c = 0; c < 8; c++) {
+		vec4 p = mvp * vec4((c & 1) ? m.boundsMax.x : m.boundsMin.x,
+			(c & 2) ? m.boundsMax.y : m.boundsMin.y,
+			(c & 4) ? m.boundsMax.z : m.boundsMin.z, 1.0);
+
+		// Crossing the eye plane: give up on the box and draw it
+		if (p.w <= 1e-6) { return Visible; }
+
+		lox = std::min(lox, p.x / p.w); hix = std::max(hix, p.x / p.w);
+		loy = std::min(loy, p.y / p.w); hiy = std::max(hiy, p.y / p.w);
+		loz = std::min(loz, p.z / p.w); hiz = std::max(hiz, p.z / p.w);
+	}
+
+	if (hix < -1.0 || lox > 1.0 || hiy < -1.0 || loy > 1.0 || hiz < -1.0 || loz > 1.0) {
+		return OutsideView;
+	}
+	if (loz < -1.0) { return Visible; }   // reaches in front of the near plane
+
+	// Pixel rectangle, grown by one pixel to cover the sampling gaps
+	int x0 = std::max((int)floor((0.5 * lox + 0.5) * OcclusionWidth) - 1, 0);
+	int x1 = std::min((int)floor((0.5 * hix + 0.5) * OcclusionWidth) + 1, OcclusionWidth - 1);
+	int y0 = std::max((int)floor((0.5 * loy + 0.5) * OcclusionHeight) - 1, 0);
+	int y1 = std::min((int)floor((0.5 * hiy + 0.5) * OcclusionHeight) + 1, OcclusionHeight - 1);
+
+	int level = 0;
+	while (level + 1 < numLevels && std::max(x1 - x0, y1 - y0) >> level >= 2) { level++; }
+
+	const float* texels = levels[level].data();
+	int w = levelWidth(level);
+	float farthest = 0.0;
+	for (int y = y0 >> level; y <= y1 >> level; y++) {
+		for (int x = x0 >> level; x <= x1 >> level; x++) {
+			farthest = std::max(farthest, texels[y * w + x]);
+		}
+	}
+
+	return (0.5 * loz + 0.5 > farthest) ? Occluded : Visible;
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+cullScene(Scene* s, const mat4& view, const mat4& projection)
+{
+	double t = timeNow();
+	initPyramid();
+	mat4 viewProjection = projection * view;
+
+	// Occluder triangles, one slot per triangle of every occluder
+	occluders.clear();
+	firstTriangle.clear();
+	int numTriangles = 0;
+	for (int i = 0; i < s->count; i++) {
+		if ((s->flags[i] & (NodeOccluder | NodeHidden)) == NodeOccluder) {
+			occluders.push_back(i);
+			firstTriangle.push_back(numTriangles);
+			numTriangles += meshes[s->mesh[i]].numVertices / 3;
+		}
+	}
+	triangles.resize(numTriangles);
+
+	parallelFor((int)occluders.size(), 1, [&](int begin, int end, int) {
+		for (int o = begin; o < end; o++) {
+			int node = occluders[o];
+			const Mesh& m = meshes[s->mesh[node]];
+			mat4 mvp = viewProjection * s->transform[node];
+
+			for (GLuint v = 0; v + 2 < m.numVertices; v += 3) {
+				vec4 clip[3] = { mvp * m.points[v], mvp * m.points[v + 1], mvp * m.points[v + 2] };
+				setupTriangle(clip, &triangles[firstTriangle[o] + v / 3]);
+			}
+		}
+	});
+
+	// Each band of rows is cleared and filled by a single worker
+	float* depth = levels[0].data();
+	parallelFor(NumBands, 1, [&](int begin, int end, int) {
+		for (int band = begin; band < end; band++) {
+			int y0 = band * BandHeight, y1 = y0 + BandHeight - 1;
+			std::fill(depth + y0 * OcclusionWidth, depth + (y1 + 1) * OcclusionWidth, 1.0f);
+
+			for (int k = 0; k < numTriangles; k++) {
+				const ScreenTriangle& tri = triangles[k];
+				if (tri.minX > tri.maxX || tri.maxY < y0 || tri.minY > y1) { continue; }
+				rasterize(tri, y0, y1, depth);
+			}
+		}
+	});
+
+	buildPyramid();
+	double rasterEnd = timeNow();
+
+	// Test every other node against the pyramid
+	int grain = std::max(evenGrain(s->count), 64);
+	int numChunks = (s->count + grain - 1) / grain;
+	int* outside = frameArray<int>(numChunks);
+	int* occluded = frameArray<int>(numChunks);
+	std::fill(outside, outside + numChunks, 0);
+	std::fill(occluded, occluded + numChunks, 0);
+
+	parallelFor(s->count, grain, [&](int begin, int end, int) {
+		int chunk = begin / grain;
+		for (int i = begin; i < end; i++) {
+			s->flags[i] &= ~NodeCulled;
+			if (s->flags[i] & (NodeHidden | NodeOccluder)) { continue; }
+
+			int result = testBounds(meshes[s->mesh[i]], viewProjection * s->transform[i]);
+			if (result != Visible) {
+				s->flags[i] |= NodeCulled;
+				(result == OutsideView ? outside : occluded)[chunk]++;
+			}
+		}
+	});
+
+	for (int c = 0; c < numChunks; c++) {
+		frameStats.culledOutside += outside[c];
+		frameStats.culledOccluded += occluded[c];
+	}
+	frameStats.occluders += (int)occluders.size();
+	frameStats.occluderTriangles += numTriangles;
+	frameStats.occlusionRasterMs += (rasterEnd - t) * 1000.0;
+	frameStats.occlusionTestMs += (timeNow() - rasterEnd) * 1000.0;
+}
+
+const float*
+occlusionDepth()
+{
+	return numLevels > 0 ? levels[0].data() : NULL;
+}
+
+//----------------------------------------------------------------------------
+
+void
+occlusionBenchmark(int nodes, int frames)
+{
+	Scene s;
+	initScene(&s, nodes + 64, 32);
+
+	// A 4x4 wall of boxes across the middle of the view
+	int wall = addMaterial(&s, color4(0.5, 0.5, 0.5, 1.0), color4(0.5, 0.5, 0.5, 1.0),
+		color4(0.0, 0.0, 0.0, 1.0), 10.0);
+	for (int y = 0; y < 4; y++) {
+		for (int x = 0; x < 4; x++) {
+			addNode(&s, Translate(-6.0 + 4.0 * x, -6.0 + 4.0 * y, 0.0) * Scale(3.9, 3.9, 0.5),
+				CubeMesh, wall, GL_TRIANGLES, NodeOccluder);
+		}
+	}
+	addRandomNodes(&s, nodes, 10.0, 1);
+
+	mat4 view = Translate(0.0, 0.0, -12.0);
+	mat4 projection = Perspective(60.0, 1.0, 0.5, 100.0);
+
+	beginFrameStats();
+	resetFrameArena();
+	cullScene(&s, view, projection);
+	FrameStats result = frameStats;
+
+	double t = timeNow();
+	for (int f = 0; f < frames; f++) {
+		beginFrameStats();
+		resetFrameArena();
+		cullScene(&s, view, projection);
+	}
+	double total = (timeNow() - t) * 1000.0 / frames;
+
+	std::cout << "occlusion: " << nodes << " objects, " << result.occluders << " occluders ("
+	          << result.occluderTriangles << " triangles), " << OcclusionWidth << "x"
+	          << OcclusionHeight << " depth, " << workerCount() << " threads" << std::endl
+	          << "  outside view " << result.culledOutside << ", occluded "
+	          << result.culledOccluded << ", drawn "
+	          << nodes - result.culledOutside - result.culledOccluded << std::endl
+	          << "  raster + pyramid " << frameStats.occlusionRasterMs << " ms, tests "
+	          << frameStats.occlusionTestMs << " ms, " << total << " ms/frame" << std::endl;
+
+	freeScene(&s);
+}
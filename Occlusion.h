@@ -0,0 +1,39 @@
+#ifndef __OCCLUSION_H__
+#define __OCCLUSION_H__
+
+#include "Angel.h"
+#include "Scene.h"
+
+//----------------------------------------------------------------------------
+//
+//  Software occlusion culling.
+//
+//  Every frame cullScene() rasterizes the triangles of the occluder nodes
+//    (NodeOccluder) into a small depth buffer on the CPU.  The buffer is
+//    split into horizontal bands that the worker pool fills in parallel,
+//    four pixels at a time with SSE2 where it is available.  A max-depth
+//    pyramid is then built over it, and the bounding box of every other
+//    visible node is tested against the pyramid level where the box
+//    covers at most 3x3 texels.  Nodes outside the view volume or behind
+//    the occluders get NodeCulled, which recordScene() skips; the flag is
+//    recomputed from scratch every frame.
+//
+//  The test is conservative up to the resolution of the depth buffer:
+//    gaps between occluders narrower than a pixel count as closed.
+//
+
+const int  OcclusionWidth = 256;
+const int  OcclusionHeight = 256;
+
+// Sets or clears NodeCulled on every node for this view
+void cullScene(Scene* s, const mat4& view, const mat4& projection);
+
+// The occluder depth buffer of the last cullScene(), OcclusionWidth x
+//   OcclusionHeight depths in [0, 1], bottom row first
+const float* occlusionDepth();
+
+// Times cullScene() on `nodes` random objects behind a wall of occluders.
+//   Needs no GL context.
+void occlusionBenchmark(int nodes, int frames);
+
+#endif // __OCCLUSION_H__
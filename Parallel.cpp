@@ -0,0 +1,133 @@
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Job {
+	const ChunkBody*  body;
+	int               count;
+	int               grain;
+	std::atomic<int>  next;
+	int               pending;   // workers still running
+};
+
+std::vector<std::thread>  workers;
+std::mutex                poolMutex;
+std::mutex                submitMutex;
+std::condition_variable   wakeWorkers;
+std::condition_variable   jobDone;
+Job*                      currentJob = NULL;
+unsigned                  generation = 0;
+
+thread_local int          workerIndex = -1;   // -1: not inside the pool
+
+void
+runChunks(Job* job, int worker)
+{
+	for (;;) {
+		int begin = job->next.fetch_add(job->grain);
+		if (begin >= job->count) { break; }
+		(*job->body)(begin, std::min(begin + job->grain, job->count), worker);
+	}
+}
+
+void
+workerMain(int index)
+{
+	workerIndex = index;
+	unsigned seen = 0;
+
+	for (;;) {
+		Job* job;
+		{
+			std::unique_lock<std::mutex> lock(poolMutex);
+			wakeWorkers.wait(lock, [&] { return generation != seen; });
+			seen = generation;
+			job = currentJob;
+		}
+
+		runChunks(job, index);
+
+		std::lock_guard<std::mutex> lock(poolMutex);
+		if (--job->pending == 0) { jobDone.notify_one(); }
+	}
+}
+
+void
+startPool()
+{
+	static std::once_flag started;
+	std::call_once(started, [] {
+		int n = std::max(1u, std::thread::hardware_concurrency());
+		for (int i = 1; i < n; i++) {
+			workers.push_back(std::thread(workerMain, i));
+			workers.back().detach();
+		}
+	});
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+int
+workerCount()
+{
+	startPool();
+	return (int)workers.size() + 1;
+}
+
+int
+evenGrain(int count)
+{
+	int n = workerCount();
+	return std::max(1, (count + n - 1) / n);
+}
+
+//----------------------------------------------------------------------------
+
+void
+parallelFor(int count, int grain, const ChunkBody& body)
+{
+	if (count <= 0) { return; }
+	grain = std::max(1, grain);
+
+	startPool();
+	if (workers.empty() || workerIndex >= 0 || count <= grain) {
+		// Nested, single chunk or single core: run here
+		int worker = std::max(0, workerIndex);
+		for (int begin = 0; begin < count; begin += grain) {
+			body(begin, std::min(begin + grain, count), worker);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> submit(submitMutex);
+
+	Job job;
+	job.body = &body;
+	job.count = count;
+	job.grain = grain;
+	job.next = 0;
+	job.pending = (int)workers.size();
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		currentJob = &job;
+		generation++;
+	}
+	wakeWorkers.notify_all();
+
+	workerIndex = 0;
+	runChunks(&job, 0);
+	workerIndex = -1;
+
+	std::unique_lock<std::mutex> lock(poolMutex);
+	jobDone.wait(lock, [&] { return job.pending == 0; });
+	currentJob = NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+//----------------------------------------------------------------------------
+//
+//  A persistent pool of worker threads shared by every multi-threaded pass
+//    (physics, culling, command recording, ...).
+//
+//  parallelFor() splits [0, count) into chunks of `grain` items and calls
+//    body(begin, end, worker) for each one, where worker is in
+//    [0, workerCount()) and is unique among the threads running at the
+//    same time, so it can index per-thread scratch buffers.  The calling
+//    thread takes part as worker 0 and the call returns once every chunk
+//    is done.  Nested calls run inline on the calling thread.
+//
+
+int  workerCount();
+
+// Non-owning reference to the chunk callback.  Unlike std::function it
+//   never copies the callable, so handing a lambda with a large capture
+//   to parallelFor() does not allocate.
+struct ChunkBody {
+	template <typename F>
+	ChunkBody(const F& f) : object(&f), call(&invoke<F>) {}
+
+	void operator()(int begin, int end, int worker) const { call(object, begin, end, worker); }
+
+	template <typename F>
+	static void invoke(const void* f, int begin, int end, int worker) { (*(const F*)f)(begin, end, worker); }
+
+	const void*  object;
+	void       (*call)(const void*, int, int, int);
+};
+
+void parallelFor(int count, int grain, const ChunkBody& body);
+
+// Grain that gives every worker one contiguous, equally sized block.  Chunk
+//   k then always covers [k * grain, (k + 1) * grain), which lets callers
+//   store per-chunk results and merge them in a deterministic order.
+int  evenGrain(int count);
+
+#endif // __PARALLEL_H__
@@ -0,0 +1,93 @@
+#include "Particles.h"
+#include "Integrator.h"
+#include "Parallel.h"
+
+#include <cstdlib>
+
+ParticleSystem  balls;
+
+const int  NumParticleArrays = 13;
+
+//----------------------------------------------------------------------------
+
+static int
+alignedCapacity(int capacity)
+{
+	// 16 floats per cache line keeps every array 64-byte aligned
+	return (capacity + 15) & ~15;
+}
+
+//----------------------------------------------------------------------------
+
+void
+initParticles(ParticleSystem* ps, int capacity)
+{
+	*ps = ParticleSystem();
+	ps->capacity = capacity;
+	ps->tolerance = 1e-4;
+
+	int stride = alignedCapacity(capacity);
+	size_t bytes = NumParticleArrays * stride * sizeof(float) + 64;
+	unsigned char* block = (unsigned char*)calloc(bytes, 1);
+	if (block == NULL) {
+		std::cerr << "Out of memory allocating " << capacity << " particles" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// Keep the raw pointer just in front of the aligned block so that
+	//   freeParticles() can release it.
+	float* base = (float*)(((size_t)block + sizeof(void*) + 63) & ~(size_t)63);
+	((void**)base)[-1] = block;
+
+	float** arrays[NumParticleArrays] = {
+		&ps->px, &ps->py, &ps->pz, &ps->vx, &ps->vy, &ps->vz,
+		&ps->ax, &ps->ay, &ps->az, &ps->radius, &ps->invMass, &ps->dt, &ps->step
+	};
+	for (int i = 0; i < NumParticleArrays; i++) {
+		*arrays[i] = base + i * stride;
+	}
+}
+
+void
+freeParticles(ParticleSystem* ps)
+{
+	if (ps->px != NULL) {
+		free(((void**)ps->px)[-1]);
+	}
+	*ps = ParticleSystem();
+}
+
+//----------------------------------------------------------------------------
+
+int
+addParticle(ParticleSystem* ps, const vec3& pos, const vec3& vel,
+	const vec3& acc, float radius, float deltaT)
+{
+	if (ps->count >= ps->capacity) { return -1; }
+
+	int i = ps->count++;
+	ps->px[i] = pos.x; ps->py[i] = pos.y; ps->pz[i] = pos.z;
+	ps->vx[i] = vel.x; ps->vy[i] = vel.y; ps->vz[i] = vel.z;
+	ps->ax[i] = acc.x; ps->ay[i] = acc.y; ps->az[i] = acc.z;
+	ps->radius[i] = radius;
+	ps->invMass[i] = 1.0;
+	ps->dt[i] = deltaT;
+	ps->step[i] = deltaT;
+
+	return i;
+}
+
+//----------------------------------------------------------------------------
+
+void
+integrateParticles(ParticleSystem* ps)
+{
+	if (ps->count < 4096) {
+		integrateRange(ps, 0, ps->count);
+		return;
+	}
+
+	parallelFor(ps->count, 4096, [ps](int begin, int end, int) {
+		integrateRange(ps, begin, end);
+	});
+}
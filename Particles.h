@@ -0,0 +1,54 @@
+#ifndef __PARTICLES_H__
+#define __PARTICLES_H__
+
+#include "Angel.h"
+
+//----------------------------------------------------------------------------
+//
+//  Dynamic spheres stored as structure-of-arrays so the integrator and the
+//    collision passes stream through contiguous, 64-byte aligned floats.
+//
+//  Every body feels its constant acceleration plus the system's linear drag
+//    and spring towards an anchor.  Both are off unless set, which leaves
+//    the constant acceleration alone.
+//
+
+struct ParticleSystem {
+	int     count;
+	int     capacity;
+	float*  px;  float* py;  float* pz;     // position
+	float*  vx;  float* vy;  float* vz;     // velocity
+	float*  ax;  float* ay;  float* az;     // constant acceleration
+	float*  radius;
+	float*  invMass;
+	float*  dt;                             // per-body time step
+	float*  step;                           // adaptive substep to try next
+
+	int     integrator;                     // ParticleIntegrator (Integrator.h)
+	float   tolerance;                      // adaptive error per substep
+	float   drag;                           // acc -= drag * vel
+	float   stiffness;                      // acc -= stiffness * (pos - anchor)
+	vec3    anchor;
+};
+
+// The balls of the scene (see ball() .. ball10())
+extern ParticleSystem  balls;
+
+void initParticles(ParticleSystem* ps, int capacity);
+void freeParticles(ParticleSystem* ps);
+
+// Returns the index of the new particle, or -1 when the system is full
+int  addParticle(ParticleSystem* ps, const vec3& pos, const vec3& vel,
+                 const vec3& acc, float radius, float deltaT);
+
+// Advances every particle by its dt with the system's integrator; the
+//   default, semi-implicit Euler, is  vel += acc*dt; pos += vel*dt
+void integrateParticles(ParticleSystem* ps);
+
+inline vec3
+particlePosition(const ParticleSystem& ps, int i)
+{
+	return vec3(ps.px[i], ps.py[i], ps.pz[i]);
+}
+
+#endif // __PARTICLES_H__
@@ -0,0 +1,312 @@
+#include "ParticlesGPU.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "ShaderSource.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+GLuint  updateProgram = 0;
+GLuint  drawProgram = 0;
+
+GLuint  posBuffer[2], velBuffer[2], accBuffer;
+GLuint  posTexture[2];
+GLuint  materialBuffer, materialTexture;     // palette, 3 texels per material
+GLuint  indexBuffer, indexTexture;           // palette index of each particle
+GLuint  updateVao[2], drawVao;
+
+int     numParticles = 0;
+int     current = 0;
+
+// Uniform locations in drawProgram, as of shader generation drawGeneration
+GLint   drawModelView, drawProjection, drawLightPosition;
+GLint   drawAmbient, drawDiffuse, drawSpecular;
+GLint   drawParticles, drawParticleMaterials, drawMaterials;
+unsigned  drawGeneration = 0;
+
+// Restores the program and vertex array that were bound on construction
+struct SavedBindings {
+	GLuint program, vao;
+	SavedBindings()
+	{
+		program = stateCurrentProgram();
+		vao = stateCurrentVertexArray();
+	}
+	~SavedBindings()
+	{
+		stateUseProgram(program);
+		stateBindVertexArray(vao);
+	}
+};
+
+void
+packParticles(const ParticleSystem& ps, std::vector<GLfloat>& pos,
+	std::vector<GLfloat>& vel, std::vector<GLfloat>& acc)
+{
+	pos.resize(4 * ps.count);
+	vel.resize(4 * ps.count);
+	acc.resize(3 * ps.count);
+	for (int i = 0; i < ps.count; i++) {
+		pos[4 * i + 0] = ps.px[i]; pos[4 * i + 1] = ps.py[i];
+		pos[4 * i + 2] = ps.pz[i]; pos[4 * i + 3] = ps.radius[i];
+		vel[4 * i + 0] = ps.vx[i]; vel[4 * i + 1] = ps.vy[i];
+		vel[4 * i + 2] = ps.vz[i]; vel[4 * i + 3] = ps.dt[i];
+		acc[3 * i + 0] = ps.ax[i]; acc[3 * i + 1] = ps.ay[i]; acc[3 * i + 2] = ps.az[i];
+	}
+}
+
+// A reloaded shader may have moved its uniforms
+void
+lookUpDrawLocations()
+{
+	drawModelView = glGetUniformLocation(drawProgram, "ModelView");
+	drawProjection = glGetUniformLocation(drawProgram, "Projection");
+	drawLightPosition = glGetUniformLocation(drawProgram, "LightPosition");
+	drawAmbient = glGetUniformLocation(drawProgram, "LightAmbient");
+	drawDiffuse = glGetUniformLocation(drawProgram, "LightDiffuse");
+	drawSpecular = glGetUniformLocation(drawProgram, "LightSpecular");
+	drawParticles = glGetUniformLocation(drawProgram, "Particles");
+	drawParticleMaterials = glGetUniformLocation(drawProgram, "ParticleMaterials");
+	drawMaterials = glGetUniformLocation(drawProgram, "Materials");
+	drawGeneration = shaderGeneration();
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+initGpuParticles(const ParticleSystem& ps, const Material* materials, int numMaterials,
+	const GLuint* materialIndex)
+{
+	SavedBindings saved;
+
+	if (updateProgram == 0) {
+		const char* varyings[] = { "outPosRadius", "outVelDt" };
+		updateProgram = InitShader("vparticle_update.glsl", NULL, varyings, 2);
+		drawProgram = InitShader("vparticle_draw.glsl", "fshader53.glsl");
+		followShaderProgram(&updateProgram);
+		followShaderProgram(&drawProgram);
+		lookUpDrawLocations();
+
+		glGenBuffers(2, posBuffer);
+		glGenBuffers(2, velBuffer);
+		glGenBuffers(1, &accBuffer);
+		glGenTextures(2, posTexture);
+		glGenBuffers(1, &materialBuffer);
+		glGenTextures(1, &materialTexture);
+		glGenBuffers(1, &indexBuffer);
+		glGenTextures(1, &indexTexture);
+		glGenVertexArrays(2, updateVao);
+		glGenVertexArrays(1, &drawVao);
+	}
+
+	std::vector<GLfloat> pos, vel, acc;
+	packParticles(ps, pos, vel, acc);
+	numParticles = ps.count;
+	current = 0;
+
+	for (int i = 0; i < 2; i++) {
+		stateBindBuffer(GL_ARRAY_BUFFER, posBuffer[i]);
+		glBufferData(GL_ARRAY_BUFFER, pos.size() * sizeof(GLfloat), pos.data(), GL_DYNAMIC_COPY);
+		stateBindBuffer(GL_ARRAY_BUFFER, velBuffer[i]);
+		glBufferData(GL_ARRAY_BUFFER, vel.size() * sizeof(GLfloat), vel.data(), GL_DYNAMIC_COPY);
+
+		stateBindTexture(0, GL_TEXTURE_BUFFER, posTexture[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, posBuffer[i]);
+	}
+
+	stateBindBuffer(GL_ARRAY_BUFFER, accBuffer);
+	glBufferData(GL_ARRAY_BUFFER, acc.size() * sizeof(GLfloat), acc.data(), GL_STATIC_DRAW);
+
+	// The palette holds the materials themselves; the light is applied
+	//   when drawing
+	std::vector<GLfloat> palette(12 * numMaterials);
+	for (int m = 0; m < numMaterials; m++) {
+		const Material& mat = materials[m];
+		for (int k = 0; k < 4; k++) {
+			palette[12 * m + k] = mat.ambient[k];
+			palette[12 * m + 4 + k] = mat.diffuse[k];
+			palette[12 * m + 8 + k] = mat.specular[k];
+		}
+		palette[12 * m + 11] = mat.shininess;
+	}
+	std::vector<GLuint> index(ps.count, 0);
+	if (materialIndex != NULL) {
+		index.assign(materialIndex, materialIndex + ps.count);
+	}
+
+	stateBindBuffer(GL_TEXTURE_BUFFER, materialBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, palette.size() * sizeof(GLfloat), palette.data(), GL_STATIC_DRAW);
+	stateBindTexture(0, GL_TEXTURE_BUFFER, materialTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, materialBuffer);
+	stateBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, index.size() * sizeof(GLuint), index.data(), GL_STATIC_DRAW);
+	stateBindTexture(0, GL_TEXTURE_BUFFER, indexTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+
+	// Update inputs: vao i reads buffer pair i
+	GLuint vPosRadius = glGetAttribLocation(updateProgram, "vPosRadius");
+	GLuint vVelDt = glGetAttribLocation(updateProgram, "vVelDt");
+	GLuint vAcc = glGetAttribLocation(updateProgram, "vAcc");
+	for (int i = 0; i < 2; i++) {
+		stateBindVertexArray(updateVao[i]);
+		stateBindBuffer(GL_ARRAY_BUFFER, posBuffer[i]);
+		glEnableVertexAttribArray(vPosRadius);
+		glVertexAttribPointer(vPosRadius, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+		stateBindBuffer(GL_ARRAY_BUFFER, velBuffer[i]);
+		glEnableVertexAttribArray(vVelDt);
+		glVertexAttribPointer(vVelDt, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+		stateBindBuffer(GL_ARRAY_BUFFER, accBuffer);
+		glEnableVertexAttribArray(vAcc);
+		glVertexAttribPointer(vAcc, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+	}
+
+	// Draw inputs: the unit sphere from the shared mesh buffer
+	const Mesh& sphere = meshes[SphereMesh];
+	stateBindVertexArray(drawVao);
+	stateBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+	GLuint vPosition = glGetAttribLocation(drawProgram, "vPosition");
+	glEnableVertexAttribArray(vPosition);
+	glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sphere.pointsOffset));
+	GLint vNormal = glGetAttribLocation(drawProgram, "vNormal");
+	if (vNormal >= 0) {
+		glEnableVertexAttribArray(vNormal);
+		glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sphere.normalsOffset));
+	}
+	stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshIndexBuffer);
+
+	stateBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+}
+
+//----------------------------------------------------------------------------
+
+void
+stepGpuParticles()
+{
+	SavedBindings saved;
+	int next = 1 - current;
+
+	stateUseProgram(updateProgram);
+	stateBindVertexArray(updateVao[current]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, posBuffer[next]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, velBuffer[next]);
+
+	stateEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, numParticles);
+	glEndTransformFeedback();
+	stateDisable(GL_RASTERIZER_DISCARD);
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, 0);
+
+	current = next;
+	frameStats.numBodies += numParticles;
+}
+
+//----------------------------------------------------------------------------
+
+void
+drawGpuParticles(const mat4& modelView, const mat4& projection, const Light& light,
+	GLenum mode)
+{
+	SavedBindings saved;
+
+	if (drawGeneration != shaderGeneration()) {
+		lookUpDrawLocations();
+	}
+	stateUseProgram(drawProgram);
+	stateBindVertexArray(drawVao);
+
+	glUniformMatrix4fv(drawModelView, 1, GL_TRUE, modelView);
+	glUniformMatrix4fv(drawProjection, 1, GL_TRUE, projection);
+	glUniform4fv(drawLightPosition, 1, light.position);
+	glUniform4fv(drawAmbient, 1, light.ambient);
+	glUniform4fv(drawDiffuse, 1, light.diffuse);
+	glUniform4fv(drawSpecular, 1, light.specular);
+
+	stateBindTexture(0, GL_TEXTURE_BUFFER, posTexture[current]);
+	glUniform1i(drawParticles, 0);
+	stateBindTexture(1, GL_TEXTURE_BUFFER, indexTexture);
+	glUniform1i(drawParticleMaterials, 1);
+	stateBindTexture(2, GL_TEXTURE_BUFFER, materialTexture);
+	glUniform1i(drawMaterials, 2);
+
+	drawMesh(meshes[SphereMesh], mode, numParticles);
+}
+
+//----------------------------------------------------------------------------
+
+void
+particleBenchmark(int count, int steps)
+{
+	ParticleSystem ps;
+	initParticles(&ps, count);
+
+	srand(1);
+	for (int i = 0; i < count; i++) {
+		vec3 pos(10.0 * rand() / RAND_MAX, 10.0 * rand() / RAND_MAX, 10.0 * rand() / RAND_MAX);
+		vec3 vel(2.0 * rand() / RAND_MAX - 1.0, 2.0 * rand() / RAND_MAX - 1.0, 2.0 * rand() / RAND_MAX - 1.0);
+		vec3 acc(3.0, 9.0, 0.0);
+		addParticle(&ps, pos, vel, acc, 0.05, 0.001 + 0.009 * rand() / RAND_MAX);
+	}
+
+	// Transform feedback: the state stays on the GPU
+	Material plain = { color4(1.0, 1.0, 1.0, 1.0), color4(1.0, 1.0, 1.0, 1.0), color4(1.0, 1.0, 1.0, 1.0), 100.0 };
+	initGpuParticles(ps, &plain, 1, NULL);
+	glFinish();
+	double t0 = timeNow();
+	for (int s = 0; s < steps; s++) {
+		stepGpuParticles();
+	}
+	glFinish();
+	double gpu = timeNow() - t0;
+
+	// CPU integrator plus the upload the renderer would need every step
+	GLuint upload;
+	glGenBuffers(1, &upload);
+	stateBindBuffer(GL_ARRAY_BUFFER, upload);
+	glBufferData(GL_ARRAY_BUFFER, count * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+	std::vector<GLfloat> packed(4 * count);
+
+	glFinish();
+	t0 = timeNow();
+	for (int s = 0; s < steps; s++) {
+		integrateParticles(&ps);
+		for (int i = 0; i < count; i++) {
+			packed[4 * i + 0] = ps.px[i]; packed[4 * i + 1] = ps.py[i];
+			packed[4 * i + 2] = ps.pz[i]; packed[4 * i + 3] = ps.radius[i];
+		}
+		glBufferSubData(GL_ARRAY_BUFFER, 0, packed.size() * sizeof(GLfloat), packed.data());
+	}
+	glFinish();
+	double cpu = timeNow() - t0;
+
+	// Both paths started from the same state and should still agree
+	std::vector<GLfloat> result(4 * count);
+	stateBindBuffer(GL_ARRAY_BUFFER, posBuffer[current]);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, result.size() * sizeof(GLfloat), result.data());
+	float maxError = 0.0;
+	for (int i = 0; i < count; i++) {
+		maxError = std::max(maxError, (float)fabs(result[4 * i + 0] - ps.px[i]));
+		maxError = std::max(maxError, (float)fabs(result[4 * i + 1] - ps.py[i]));
+		maxError = std::max(maxError, (float)fabs(result[4 * i + 2] - ps.pz[i]));
+	}
+
+	stateBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+	stateDeleteBuffers(1, &upload);
+
+	std::cout << "particles: " << count << " bodies, " << steps << " steps on "
+	          << glGetString(GL_RENDERER) << std::endl
+	          << "  cpu integrate + upload " << cpu * 1000.0 / steps << " ms/step ("
+	          << count * 4 * sizeof(GLfloat) / 1024 << " KiB uploaded per step)" << std::endl
+	          << "  transform feedback     " << gpu * 1000.0 / steps << " ms/step" << std::endl
+	          << "  max position difference " << maxError << std::endl;
+
+	freeParticles(&ps);
+}
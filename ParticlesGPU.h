@@ -0,0 +1,38 @@
+#ifndef __PARTICLESGPU_H__
+#define __PARTICLESGPU_H__
+
+#include "Angel.h"
+#include "Particles.h"
+#include "Scene.h"
+
+//----------------------------------------------------------------------------
+//
+//  Transform feedback backend for a ParticleSystem.  Positions (with the
+//    radius in w) and velocities (with the time step in w) live in two
+//    pairs of GL buffers; every step reads one pair in a vertex shader,
+//    captures the result into the other and swaps them.  The renderer
+//    reads the current position buffer through a buffer texture, so the
+//    particle state never leaves GPU memory.
+//
+//  Collisions are not handled by this backend.
+//
+
+// Copy the particles and the material palette to the GPU and build the
+//   update and draw programs.  Particle i is drawn with material
+//   materialIndex[i] of the palette; without materialIndex every particle
+//   uses the first one.
+void initGpuParticles(const ParticleSystem& ps, const Material* materials,
+                      int numMaterials, const GLuint* materialIndex);
+
+void stepGpuParticles();
+
+// Draw every particle as an instance of the unit sphere mesh
+void drawGpuParticles(const mat4& modelView, const mat4& projection,
+                      const Light& light, GLenum mode);
+
+// Times the CPU integrator plus position upload against the transform
+//   feedback step for `count` particles and checks that both agree.
+//   Needs a current GL context.
+void particleBenchmark(int count, int steps);
+
+#endif // __PARTICLESGPU_H__
@@ -0,0 +1,785 @@
+#include "Picking.h"
+#include "Mesh.h"
+#include "Parallel.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const int  NumBins = 16;
+const int  MaxLeafSize = 4;
+const int  MaxSahDepth = 32;    // median splits below this depth keep every
+const int  StackSize = 64;      //   tree under 32 + 31 levels
+
+struct Box {
+	float  lo[3];
+	float  hi[3];
+};
+
+struct BvhNode {
+	float   lo[3];
+	GLuint  offset;     // interior: slot of the second child; leaf: first primitive
+	float   hi[3];
+	GLuint  count;      // primitives in a leaf, 0 for an interior node
+};
+
+// A subtree left for the worker pool
+struct Task {
+	int  begin, end;
+	int  slot;
+	int  depth;
+};
+
+// The top level, with what a refit needs
+struct Hierarchy {
+	std::vector<BvhNode>  nodes;
+	std::vector<GLuint>   order;      // scene nodes in leaf order
+	std::vector<Box>      boxes;      // world bounds of each scene node
+	std::vector<int>      parent;     // per slot, -1 at the root
+	std::vector<int>      leafOf;     // per scene node
+	std::vector<Task>     tasks;
+	std::vector<int>      topNodes;   // interior slots above the tasks, parents first
+};
+
+struct Triangle {
+	vec3    v0, e1, e2;
+	GLuint  id;
+};
+
+struct MeshTree {
+	std::vector<BvhNode>   nodes;
+	std::vector<Triangle>  triangles;   // in leaf order
+};
+
+struct Ray {
+	vec3  origin;
+	vec3  direction;
+	vec3  inverse;      // 1 / direction, infinite along axes it is parallel to
+};
+
+Hierarchy  objects;
+MeshTree   meshTrees[NumMeshes];
+bool       meshTreesBuilt = false;
+
+//----------------------------------------------------------------------------
+
+inline void
+emptyBox(Box* b)
+{
+	for (int k = 0; k < 3; k++) {
+		b->lo[k] = FLT_MAX;
+		b->hi[k] = -FLT_MAX;
+	}
+}
+
+inline void
+growBox(Box* b, const float* lo, const float* hi)
+{
+	for (int k = 0; k < 3; k++) {
+		b->lo[k] = std::min(b->lo[k], lo[k]);
+		b->hi[k] = std::max(b->hi[k], hi[k]);
+	}
+}
+
+inline float
+centroid(const Box& b, int k)
+{
+	return 0.5f * (b.lo[k] + b.hi[k]);
+}
+
+// Half the surface area, which is all the SAH needs
+inline float
+halfArea(const Box& b)
+{
+	float dx = b.hi[0] - b.lo[0], dy = b.hi[1] - b.lo[1], dz = b.hi[2] - b.lo[2];
+	return (dx < 0.0f) ? 0.0f : dx * dy + dy * dz + dz * dx;
+}
+
+// Bounds of a mesh under an affine transform, from its center and extent
+void
+worldBox(const Scene& s, int i, Box* box)
+{
+	const Mesh& m = meshes[s.mesh[i]];
+	const mat4& t = s.transform[i];
+	vec3 c = 0.5 * (m.boundsMin + m.boundsMax), e = 0.5 * (m.boundsMax - m.boundsMin);
+
+	for (int k = 0; k < 3; k++) {
+		float wc = t[k][0] * c.x + t[k][1] * c.y + t[k][2] * c.z + t[k][3];
+		float we = fabs(t[k][0]) * e.x + fabs(t[k][1]) * e.y + fabs(t[k][2]) * e.z;
+		box->lo[k] = wc - we;
+		box->hi[k] = wc + we;
+	}
+}
+
+//----------------------------------------------------------------------------
+// Binned SAH build
+
+struct Builder {
+	const Box*          boxes;
+	GLuint*             order;
+	BvhNode*            nodes;
+	int*                parent;     // NULL when not kept
+	int*                leafOf;     // NULL when not kept
+	int                 taskSize;   // ranges this small become tasks
+	std::vector<Task>*  tasks;      // NULL builds everything here
+	std::vector<int>*   topNodes;
+};
+
+// Where to split order[begin, end); begin makes a leaf
+int
+splitRange(const Builder& b, int begin, int end, int depth, const Box& bounds, const Box& centroids)
+{
+	int count = end - begin;
+	if (count <= 1) { return begin; }
+
+	int axis = 0;
+	for (int k = 1; k < 3; k++) {
+		if (centroids.hi[k] - centroids.lo[k] > centroids.hi[axis] - centroids.lo[axis]) { axis = k; }
+	}
+	float lo = centroids.lo[axis], extent = centroids.hi[axis] - lo;
+
+	if (extent > 0.0f && depth < MaxSahDepth) {
+		float scale = NumBins * (1.0f - FLT_EPSILON) / extent;
+		const Box* boxes = b.boxes;
+		auto binOf = [=](GLuint id) {
+			return std::min(NumBins - 1, (int)((centroid(boxes[id], axis) - lo) * scale));
+		};
+
+		Box binBox[NumBins];
+		int binCount[NumBins];
+		for (int i = 0; i < NumBins; i++) {
+			emptyBox(&binBox[i]);
+			binCount[i] = 0;
+		}
+		for (int i = begin; i < end; i++) {
+			const Box& p = boxes[b.order[i]];
+			int bin = binOf(b.order[i]);
+			growBox(&binBox[bin], p.lo, p.hi);
+			binCount[bin]++;
+		}
+
+		// Sweep from the right, then from the left to price every plane
+		float rightArea[NumBins];
+		int rightCount[NumBins];
+		Box side;
+		emptyBox(&side);
+		for (int i = NumBins - 1, n = 0; i > 0; i--) {
+			growBox(&side, binBox[i].lo, binBox[i].hi);
+			n += binCount[i];
+			rightArea[i] = halfArea(side);
+			rightCount[i] = n;
+		}
+
+		float best = FLT_MAX;
+		int bestBin = -1;
+		emptyBox(&side);
+		for (int i = 0, n = 0; i < NumBins - 1; i++) {
+			growBox(&side, binBox[i].lo, binBox[i].hi);
+			n += binCount[i];
+			if (n == 0 || rightCount[i + 1] == 0) { continue; }
+
+			float cost = halfArea(side) * n + rightArea[i + 1] * rightCount[i + 1];
+			if (cost < best) {
+				best = cost;
+				bestBin = i;
+			}
+		}
+
+		if (bestBin >= 0) {
+			// One traversal step costs about one primitive test
+			float area = halfArea(bounds);
+			if (count <= MaxLeafSize && count * area <= area + best) { return begin; }
+
+			return (int)(std::partition(b.order + begin, b.order + end,
+				[=](GLuint id) { return binOf(id) <= bestBin; }) - b.order);
+		}
+	}
+
+	if (count <= MaxLeafSize) { return begin; }
+
+	// Coincident centroids or a deep tree: halve at the median
+	int mid = (begin + end) / 2;
+	const Box* boxes = b.boxes;
+	std::nth_element(b.order + begin, b.order + mid, b.order + end, [=](GLuint p, GLuint q) {
+		return centroid(boxes[p], axis) < centroid(boxes[q], axis);
+	});
+	return mid;
+}
+
+// Builds the subtree over order[begin, end) with its root at nodes[slot]
+void
+buildRange(const Builder& b, int begin, int end, int slot, int parentSlot, int depth)
+{
+	if (b.parent != NULL) { b.parent[slot] = parentSlot; }
+	if (b.tasks != NULL && end - begin <= b.taskSize) {
+		Task t = { begin, end, slot, depth };
+		b.tasks->push_back(t);
+		return;
+	}
+
+	Box bounds, centroids;
+	emptyBox(&bounds);
+	emptyBox(&centroids);
+	for (int i = begin; i < end; i++) {
+		const Box& p = b.boxes[b.order[i]];
+		float c[3] = { centroid(p, 0), centroid(p, 1), centroid(p, 2) };
+		growBox(&bounds, p.lo, p.hi);
+		growBox(&centroids, c, c);
+	}
+
+	BvhNode* n = &b.nodes[slot];
+	memcpy(n->lo, bounds.lo, sizeof(n->lo));
+	memcpy(n->hi, bounds.hi, sizeof(n->hi));
+
+	int mid = splitRange(b, begin, end, depth, bounds, centroids);
+	if (mid == begin) {
+		n->offset = begin;
+		n->count = end - begin;
+		for (int i = begin; b.leafOf != NULL && i < end; i++) {
+			b.leafOf[b.order[i]] = slot;
+		}
+		return;
+	}
+
+	n->offset = slot + 2 * (mid - begin);
+	n->count = 0;
+	if (b.topNodes != NULL) { b.topNodes->push_back(slot); }
+
+	buildRange(b, begin, mid, slot + 1, slot, depth + 1);
+	buildRange(b, mid, end, n->offset, slot, depth + 1);
+}
+
+//----------------------------------------------------------------------------
+
+void
+buildMeshTree(int id)
+{
+	const Mesh& m = meshes[id];
+	MeshTree& tree = meshTrees[id];
+
+	// Full detail: the index list of the first LOD, or the whole soup
+	const GLuint* indices = (m.lods[0].numIndices > 0) ? m.indices + m.lods[0].firstIndex : NULL;
+	int numTriangles = (indices != NULL ? m.lods[0].numIndices : m.numVertices) / 3;
+
+	std::vector<Triangle> triangles(numTriangles);
+	std::vector<Box> boxes(numTriangles);
+	std::vector<GLuint> order(numTriangles);
+	for (int t = 0; t < numTriangles; t++) {
+		vec3 p[3];
+		Box& box = boxes[t];
+		emptyBox(&box);
+		for (int k = 0; k < 3; k++) {
+			const point4& v = m.points[indices != NULL ? indices[3 * t + k] : 3 * t + k];
+			p[k] = vec3(v.x, v.y, v.z);
+			growBox(&box, p[k], p[k]);
+		}
+		triangles[t].v0 = p[0];
+		triangles[t].e1 = p[1] - p[0];
+		triangles[t].e2 = p[2] - p[0];
+		triangles[t].id = t;
+		order[t] = t;
+	}
+
+	tree.nodes.assign(std::max(2 * numTriangles - 1, 1), BvhNode());
+	if (numTriangles > 0) {
+		Builder b = { boxes.data(), order.data(), tree.nodes.data(), NULL, NULL, 0, NULL, NULL };
+		buildRange(b, 0, numTriangles, 0, -1, 0);
+	}
+
+	// Leaves index the triangles directly
+	tree.triangles.resize(numTriangles);
+	for (int i = 0; i < numTriangles; i++) {
+		tree.triangles[i] = triangles[order[i]];
+	}
+}
+
+void
+computeBoxes(const Scene& s)
+{
+	Box* boxes = objects.boxes.data();
+	const Scene* sp = &s;
+	parallelFor(s.count, 4096, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			worldBox(*sp, i, &boxes[i]);
+		}
+	});
+}
+
+void
+buildObjects(const Scene& s, bool parallel)
+{
+	Hierarchy& h = objects;
+	int n = s.count, slots = std::max(2 * n - 1, 1);
+
+	h.boxes.resize(n);
+	h.order.resize(n);
+	h.leafOf.resize(n);
+	h.nodes.assign(slots, BvhNode());
+	h.parent.assign(slots, -1);
+	h.tasks.clear();
+	h.topNodes.clear();
+
+	computeBoxes(s);
+	for (int i = 0; i < n; i++) {
+		h.order[i] = i;
+	}
+	if (n == 0) { return; }
+
+	Builder b = { h.boxes.data(), h.order.data(), h.nodes.data(), h.parent.data(),
+		h.leafOf.data(), 0, NULL, NULL };
+
+	if (!parallel) {
+		buildRange(b, 0, n, 0, -1, 0);
+		Task all = { 0, n, 0, 0 };
+		h.tasks.push_back(all);
+		return;
+	}
+
+	// The top of the tree on this thread, down to about four subtrees per
+	//   worker, then the subtrees on the pool
+	b.taskSize = std::max(n / (4 * workerCount()), 256);
+	b.tasks = &h.tasks;
+	b.topNodes = &h.topNodes;
+	buildRange(b, 0, n, 0, -1, 0);
+
+	Builder sub = b;
+	sub.tasks = NULL;
+	sub.topNodes = NULL;
+	parallelFor((int)h.tasks.size(), 1, [&](int begin, int end, int) {
+		for (int k = begin; k < end; k++) {
+			const Task& t = h.tasks[k];
+			buildRange(sub, t.begin, t.end, t.slot, h.parent[t.slot], t.depth);
+		}
+	});
+}
+
+// Recomputes the bounds of one node from its children or primitives and
+//   returns whether they changed
+bool
+refitNode(Hierarchy& h, int slot)
+{
+	BvhNode& n = h.nodes[slot];
+	Box b;
+	emptyBox(&b);
+	if (n.count > 0) {
+		for (GLuint i = n.offset; i < n.offset + n.count; i++) {
+			const Box& p = h.boxes[h.order[i]];
+			growBox(&b, p.lo, p.hi);
+		}
+	}
+	else {
+		growBox(&b, h.nodes[slot + 1].lo, h.nodes[slot + 1].hi);
+		growBox(&b, h.nodes[n.offset].lo, h.nodes[n.offset].hi);
+	}
+
+	bool changed = memcmp(n.lo, b.lo, sizeof(n.lo)) != 0 || memcmp(n.hi, b.hi, sizeof(n.hi)) != 0;
+	memcpy(n.lo, b.lo, sizeof(n.lo));
+	memcpy(n.hi, b.hi, sizeof(n.hi));
+	return changed;
+}
+
+//----------------------------------------------------------------------------
+// Queries
+
+Ray
+makeRay(const vec3& origin, const vec3& direction)
+{
+	Ray r;
+	r.origin = origin;
+	r.direction = direction;
+	for (int k = 0; k < 3; k++) {
+		r.inverse[k] = 1.0f / direction[k];
+	}
+	return r;
+}
+
+// Slab test; tEnter is where the ray enters the box
+inline bool
+entersNode(const BvhNode& n, const Ray& r, float tBest, float* tEnter)
+{
+	float t0 = 0.0f, t1 = tBest;
+	for (int k = 0; k < 3; k++) {
+		float a = (n.lo[k] - r.origin[k]) * r.inverse[k];
+		float b = (n.hi[k] - r.origin[k]) * r.inverse[k];
+		if (a > b) { std::swap(a, b); }
+		t0 = (a > t0) ? a : t0;
+		t1 = (b < t1) ? b : t1;
+	}
+	*tEnter = t0;
+	return t0 <= t1;
+}
+
+// Visits the leaves the ray reaches before tBest, nearer child first.
+//   leaf(first, count) may lower tBest.
+template <typename Leaf>
+void
+traverse(const BvhNode* nodes, const Ray& r, const float* tBest, const Leaf& leaf)
+{
+	int stack[StackSize];
+	int sp = 0, slot = 0;
+	float t;
+
+	if (!entersNode(nodes[0], r, *tBest, &t)) { return; }
+
+	for (;;) {
+		const BvhNode& n = nodes[slot];
+		if (n.count > 0) {
+			leaf(n.offset, n.count);
+		}
+		else {
+			int near = slot + 1, far = n.offset;
+			float tNear, tFar;
+			bool hitNear = entersNode(nodes[near], r, *tBest, &tNear);
+			bool hitFar = entersNode(nodes[far], r, *tBest, &tFar);
+			if (hitNear && hitFar) {
+				if (tFar < tNear) { std::swap(near, far); }
+				stack[sp++] = far;
+				slot = near;
+				continue;
+			}
+			if (hitNear || hitFar) {
+				slot = hitNear ? near : far;
+				continue;
+			}
+		}
+
+		// Pushed nodes may lie beyond a hit found since
+		do {
+			if (sp == 0) { return; }
+			slot = stack[--sp];
+		} while (!entersNode(nodes[slot], r, *tBest, &t));
+	}
+}
+
+// Moller-Trumbore; lowers *t on a nearer hit
+inline bool
+hitTriangle(const Triangle& tri, const Ray& r, float* t)
+{
+	vec3 p = cross(r.direction, tri.e2);
+	float det = dot(tri.e1, p);
+	if (fabs(det) < 1e-12f) { return false; }   // parallel or degenerate
+
+	float inv = 1.0f / det;
+	vec3 s = r.origin - tri.v0;
+	float u = dot(s, p) * inv;
+	if (u < 0.0f || u > 1.0f) { return false; }
+
+	vec3 q = cross(s, tri.e1);
+	float v = dot(r.direction, q) * inv;
+	if (v < 0.0f || u + v > 1.0f) { return false; }
+
+	float d = dot(tri.e2, q) * inv;
+	if (d <= 0.0f || d >= *t) { return false; }
+	*t = d;
+	return true;
+}
+
+bool
+invertAffine(const mat4& m, mat4* inv)
+{
+	float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+	float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+	float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+	float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+	if (fabs(det) < 1e-20f) { return false; }
+
+	float d = 1.0f / det;
+	mat4& r = *inv;
+	r[0][0] = c00 * d;
+	r[1][0] = c01 * d;
+	r[2][0] = c02 * d;
+	r[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * d;
+	r[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * d;
+	r[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * d;
+	r[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * d;
+	r[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * d;
+	r[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * d;
+	for (int k = 0; k < 3; k++) {
+		r[k][3] = -(r[k][0] * m[0][3] + r[k][1] * m[1][3] + r[k][2] * m[2][3]);
+	}
+	r[3] = vec4(0.0, 0.0, 0.0, 1.0);
+	return true;
+}
+
+// Gauss-Jordan with partial pivoting, for the projection
+bool
+invert(const mat4& m, mat4* inv)
+{
+	double a[4][8];
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			a[i][j] = m[i][j];
+			a[i][j + 4] = (i == j) ? 1.0 : 0.0;
+		}
+	}
+
+	for (int c = 0; c < 4; c++) {
+		int pivot = c;
+		for (int i = c + 1; i < 4; i++) {
+			if (fabs(a[i][c]) > fabs(a[pivot][c])) { pivot = i; }
+		}
+		if (a[pivot][c] == 0.0) { return false; }
+		for (int j = 0; j < 8; j++) { std::swap(a[c][j], a[pivot][j]); }
+
+		double d = 1.0 / a[c][c];
+		for (int j = 0; j < 8; j++) { a[c][j] *= d; }
+		for (int i = 0; i < 4; i++) {
+			if (i == c) { continue; }
+			double f = a[i][c];
+			for (int j = 0; j < 8; j++) { a[i][j] -= f * a[c][j]; }
+		}
+	}
+
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			(*inv)[i][j] = (GLfloat)a[i][j + 4];
+		}
+	}
+	return true;
+}
+
+// Closest hit of the ray with the triangles of node `id`, by brute force
+void
+bruteForceNode(const Scene& s, int id, const vec3& origin, const vec3& direction,
+	float* tBest, int* node)
+{
+	mat4 inv;
+	if (!invertAffine(s.transform[id], &inv)) { return; }
+
+	vec4 o = inv * vec4(origin, 1.0), d = inv * vec4(direction, 0.0);
+	Ray local = makeRay(vec3(o.x, o.y, o.z), vec3(d.x, d.y, d.z));
+	const MeshTree& tree = meshTrees[s.mesh[id]];
+	for (size_t i = 0; i < tree.triangles.size(); i++) {
+		if (hitTriangle(tree.triangles[i], local, tBest)) { *node = id; }
+	}
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+buildPicking(const Scene& s)
+{
+	if (!meshTreesBuilt) {
+		parallelFor(NumMeshes, 1, [](int begin, int end, int) {
+			for (int i = begin; i < end; i++) {
+				buildMeshTree(i);
+			}
+		});
+		meshTreesBuilt = true;
+	}
+
+	buildObjects(s, true);
+}
+
+void
+refitPicking(const Scene& s)
+{
+	Hierarchy& h = objects;
+	if ((int)h.boxes.size() != s.count) {
+		buildPicking(s);
+		return;
+	}
+
+	computeBoxes(s);
+
+	// Children sit at higher slots than their parent, so walking each
+	//   subtree's slots backwards refits it bottom up
+	parallelFor((int)h.tasks.size(), 1, [&](int begin, int end, int) {
+		for (int k = begin; k < end; k++) {
+			const Task& t = h.tasks[k];
+			for (int slot = t.slot + 2 * (t.end - t.begin) - 2; slot >= t.slot; slot--) {
+				const BvhNode& n = h.nodes[slot];
+				if (n.count > 0 || n.offset > 0) { refitNode(h, slot); }
+			}
+		}
+	});
+	for (int k = (int)h.topNodes.size() - 1; k >= 0; k--) {
+		refitNode(h, h.topNodes[k]);
+	}
+}
+
+void
+refitPickNodes(const Scene& s, const int* nodes, int count)
+{
+	Hierarchy& h = objects;
+	if ((int)h.boxes.size() != s.count) {
+		buildPicking(s);
+		return;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int id = nodes[i];
+		if (id < 0 || id >= s.count) { continue; }
+
+		worldBox(s, id, &h.boxes[id]);
+		for (int slot = h.leafOf[id]; slot >= 0 && refitNode(h, slot); slot = h.parent[slot]) {}
+	}
+}
+
+//----------------------------------------------------------------------------
+
+void
+pickRay(int x, int y, int width, int height, const mat4& view,
+	const mat4& projection, vec3* origin, vec3* direction)
+{
+	mat4 inv;
+	invert(projection * view, &inv);
+
+	GLfloat nx = 2.0 * (x + 0.5) / width - 1.0;
+	GLfloat ny = 1.0 - 2.0 * (y + 0.5) / height;
+	vec4 n = inv * vec4(nx, ny, -1.0, 1.0);
+	vec4 f = inv * vec4(nx, ny, 1.0, 1.0);
+
+	*origin = vec3(n.x, n.y, n.z) / n.w;
+	*direction = vec3(f.x, f.y, f.z) / f.w - *origin;
+}
+
+bool
+pickScene(const Scene& s, const vec3& origin, const vec3& direction, PickHit* hit)
+{
+	const Hierarchy& h = objects;
+	hit->node = -1;
+	hit->triangle = -1;
+	hit->t = FLT_MAX;
+	if (h.boxes.empty() || (int)h.boxes.size() != s.count) { return false; }
+
+	Ray r = makeRay(origin, direction);
+	float tBest = FLT_MAX;
+
+	traverse(h.nodes.data(), r, &tBest, [&](GLuint first, GLuint count) {
+		for (GLuint i = first; i < first + count; i++) {
+			int id = h.order[i];
+			const MeshTree& tree = meshTrees[s.mesh[id]];
+			mat4 inv;
+			if ((s.flags[id] & NodeHidden) || tree.triangles.empty() ||
+				!invertAffine(s.transform[id], &inv)) {
+				continue;
+			}
+
+			// An affine map keeps the ray parameter, so t stays comparable
+			vec4 o = inv * vec4(origin, 1.0), d = inv * vec4(direction, 0.0);
+			Ray local = makeRay(vec3(o.x, o.y, o.z), vec3(d.x, d.y, d.z));
+			traverse(tree.nodes.data(), local, &tBest, [&](GLuint tf, GLuint tc) {
+				for (GLuint j = tf; j < tf + tc; j++) {
+					if (hitTriangle(tree.triangles[j], local, &tBest)) {
+						hit->node = id;
+						hit->triangle = tree.triangles[j].id;
+					}
+				}
+			});
+		}
+	});
+
+	if (hit->node < 0) { return false; }
+	hit->t = tBest;
+	hit->position = origin + tBest * direction;
+	return true;
+}
+
+//----------------------------------------------------------------------------
+
+void
+pickingBenchmark(int nodes, int queries)
+{
+	Scene s;
+	initScene(&s, nodes, 16);
+	addRandomNodes(&s, nodes, 10.0, 1);
+
+	double t = timeNow();
+	meshTreesBuilt = false;
+	buildPicking(s);
+	double firstMs = (timeNow() - t) * 1000.0;
+
+	t = timeNow();
+	buildObjects(s, false);
+	double serialMs = (timeNow() - t) * 1000.0;
+
+	t = timeNow();
+	buildObjects(s, true);
+	double parallelMs = (timeNow() - t) * 1000.0;
+
+	long long triangles = 0;
+	for (int i = 0; i < nodes; i++) {
+		triangles += meshTrees[s.mesh[i]].triangles.size();
+	}
+
+	// Nudge a few nodes, as the balls move every frame
+	const int numMoved = 10;
+	int moved[numMoved];
+	for (int k = 0; k < numMoved; k++) {
+		moved[k] = (int)((long long)k * nodes / numMoved);
+	}
+
+	t = timeNow();
+	refitPicking(s);
+	double refitMs = (timeNow() - t) * 1000.0;
+
+	const int rounds = 100;
+	t = timeNow();
+	for (int r = 0; r < rounds; r++) {
+		for (int k = 0; k < numMoved; k++) {
+			s.transform[moved[k]] = Translate(0.001, 0.0, 0.0) * s.transform[moved[k]];
+		}
+		refitPickNodes(s, moved, numMoved);
+	}
+	double moveUs = (timeNow() - t) * 1.0e6 / rounds;
+
+	// Rays from a sphere around the scene through random points inside it
+	srand(2);
+	std::vector<vec3> origins(queries), directions(queries);
+	for (int q = 0; q < queries; q++) {
+		vec3 d(rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f);
+		vec3 target(20.0f * rand() / RAND_MAX - 10.0f, 20.0f * rand() / RAND_MAX - 10.0f,
+			20.0f * rand() / RAND_MAX - 10.0f);
+		origins[q] = 30.0f * normalize(d);
+		directions[q] = target - origins[q];
+	}
+
+	int hits = 0;
+	PickHit hit;
+	t = timeNow();
+	for (int q = 0; q < queries; q++) {
+		hits += pickScene(s, origins[q], directions[q], &hit);
+	}
+	double queryUs = (timeNow() - t) * 1.0e6 / queries;
+
+	// The same answers as testing every node
+	int checked = std::min(queries, 20), agree = 0;
+	for (int q = 0; q < checked; q++) {
+		pickScene(s, origins[q], directions[q], &hit);
+
+		Ray r = makeRay(origins[q], directions[q]);
+		float tBest = FLT_MAX, tEnter;
+		int node = -1;
+		for (int i = 0; i < nodes; i++) {
+			BvhNode n;
+			memcpy(n.lo, objects.boxes[i].lo, sizeof(n.lo));
+			memcpy(n.hi, objects.boxes[i].hi, sizeof(n.hi));
+			if (entersNode(n, r, tBest, &tEnter)) {
+				bruteForceNode(s, i, origins[q], directions[q], &tBest, &node);
+			}
+		}
+		agree += (node == hit.node) && (node < 0 || fabs(tBest - hit.t) <= 1e-5f * tBest);
+	}
+
+	std::cout << "picking: " << nodes << " nodes, " << triangles << " triangles" << std::endl
+	          << "  mesh trees + top level " << firstMs << " ms" << std::endl
+	          << "  top level, 1 thread    " << serialMs << " ms" << std::endl
+	          << "  top level, " << workerCount() << " workers   " << parallelMs << " ms ("
+	          << serialMs / parallelMs << "x)" << std::endl
+	          << "  refit all nodes        " << refitMs << " ms" << std::endl
+	          << "  refit " << numMoved << " moved nodes   " << moveUs << " us" << std::endl
+	          << "  query                  " << queryUs << " us/ray (" << 1.0e6 / queryUs
+	          << " rays/s), " << hits << " of " << queries << " hit" << std::endl
+	          << "  " << agree << " of " << checked << " match a brute-force search" << std::endl;
+
+	freeScene(&s);
+}
@@ -0,0 +1,57 @@
+#ifndef __PICKING_H__
+#define __PICKING_H__
+
+#include "Angel.h"
+#include "Scene.h"
+
+//----------------------------------------------------------------------------
+//
+//  Ray picking through a two-level bounding volume hierarchy.
+//
+//  The bottom level is one hierarchy per registered mesh over its
+//    triangles in model space, built once.  The top level is built over
+//    the world-space bounds of the scene nodes.  Both are binned SAH
+//    trees stored depth first: a node's first child follows it and the
+//    subtree over primitives [begin, end) occupies 2 * (end - begin) - 1
+//    slots, so disjoint subtrees are built by the worker pool without
+//    sharing anything.  When nodes move, refitPicking() recomputes every
+//    bound and refitPickNodes() only the paths above the nodes given; the
+//    topology is kept, so a refit tree gets slower to query as objects
+//    drift away from where it was built.
+//
+//  A query walks the top level, moves the ray into the model space of each
+//    node whose bounds it enters and walks that mesh's triangles.
+//    Hidden nodes are skipped.  Robot arms and GPU particles are not part
+//    of the scene and cannot be picked.
+//
+
+struct PickHit {
+	int    node;        // scene node, -1 when nothing was hit
+	int    triangle;    // in the node's mesh, in drawing order
+	float  t;           // along the ray: position = origin + t * direction
+	vec3   position;    // world space
+};
+
+// Builds the mesh hierarchies the first time, then the top level over
+//   every node of `s`
+void buildPicking(const Scene& s);
+
+// After transforms changed: all nodes, or only the `count` listed ones.
+//   Both rebuild when nodes were added since the last build.
+void refitPicking(const Scene& s);
+void refitPickNodes(const Scene& s, const int* nodes, int count);
+
+// World-space ray through the center of window pixel (x, y), y down as
+//   GLUT reports it.  The direction spans the near plane to the far plane.
+void pickRay(int x, int y, int width, int height, const mat4& view,
+             const mat4& projection, vec3* origin, vec3* direction);
+
+// Closest triangle in front of the origin; false on a miss
+bool pickScene(const Scene& s, const vec3& origin, const vec3& direction, PickHit* hit);
+
+// Times the build, refits and ray queries on `nodes` random objects and
+//   checks a sample of the hits against a brute-force search.  Needs no
+//   GL context, only the registered meshes.
+void pickingBenchmark(int nodes, int queries);
+
+#endif // __PICKING_H__
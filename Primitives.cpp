@@ -1,5 +1,9 @@
 
 #include "Angel.h"
+#include "Mesh.h"
+#include "MeshSimplify.h"
+
+#include <cstring>
 
 typedef Angel::vec4  color4;
 typedef Angel::vec4  point4;
@@ -208,3 +212,47 @@ sphere(int slices, int stacks)
 	sphereNormals[sphIdx] = normal; spherePoints[sphIdx] = p2; sphIdx++;
 }
 
+
+///////////////////// Registry ///////////////////////////
+
+// Identifies the generator parameters and the edge and LOD builders a
+//   cached copy of the primitives was built with, so a stale cache is
+//   regenerated instead of loaded.
+unsigned int
+primitivesKey()
+{
+	const int params[] = { cubeNumVertices, coneSlices, shpereSlices, shpereStacks,
+	                       (int)MeshEdgesVersion, (int)MeshSimplifyVersion };
+	unsigned int key = 2166136261u;
+	for (int i = 0; i < 6; i++) {
+		key = (key ^ (unsigned int)params[i]) * 16777619u;
+	}
+	for (int i = 0; i < numDefaultLodTargets; i++) {
+		unsigned int bits[2];
+		memcpy(bits, &defaultLodTargets[i], sizeof(bits));
+		key = (key ^ bits[0]) * 16777619u;
+		key = (key ^ bits[1]) * 16777619u;
+	}
+	return key;
+}
+
+// Generate the unit primitives and register them in the same order (and
+//   so at the same buffer offsets) that the draw functions expect.
+void
+registerPrimitives()
+{
+	cubeIdx = 0;
+	cube();
+	cone(coneSlices);
+	sphere(shpereSlices, shpereStacks);
+
+	GLintptr offset = 0;
+	setMesh(CubeMesh, "cube", cubePoints, cubeNormals, cubeNumVertices, &offset);
+	setMesh(ConeMesh, "cone", conePoints, coneNormals, coneNumVertices, &offset);
+	setMesh(SphereMesh, "sphere", spherePoints, sphereNormals, sphereNumVertices, &offset);
+
+	for (int i = 0; i < NumMeshes; i++) {
+		buildMeshEdges(i);
+	}
+	buildAllMeshLods(defaultLodTargets, numDefaultLodTargets);
+}
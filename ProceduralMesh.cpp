@@ -0,0 +1,186 @@
+#include "ProceduralMesh.h"
+#include "GLState.h"
+#include "ShaderSource.h"
+#include "Stats.h"
+
+#include <algorithm>
+
+namespace {
+
+GLuint  pullProgram = 0;
+GLuint  emptyVao = 0;
+int     slices = 20, stacks = 20;
+
+// Uniform locations of the program last drawn with, as of a shader
+//   generation
+GLuint  cachedProgram = 0;
+unsigned  cachedGeneration = 0;
+GLint   primitiveLoc, slicesLoc, stacksLoc, linesLoc;
+
+GLsizei
+triangleCount(int mesh, int sl, int st)
+{
+	switch (mesh) {
+	case CubeMesh:  return 12;
+	case ConeMesh:  return sl;
+	default:        return 2 * sl * (st - 2);
+	}
+}
+
+// Bytes the attributes of the generated sphere take in the vertex buffer
+//   at a tessellation, counting the six padding vertices per slice that
+//   sphere() allocates
+GLsizeiptr
+bufferedSphereBytes(int sl, int st)
+{
+	return 6 * sl * (st - 1) * (GLsizeiptr)(sizeof(point4) + sizeof(vec3));
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+GLuint
+initProceduralMeshes()
+{
+	if (pullProgram == 0) {
+		pullProgram = InitShader("vprocedural.glsl", "fshader53.glsl");
+		followShaderProgram(&pullProgram);
+		glGenVertexArrays(1, &emptyVao);
+	}
+	return pullProgram;
+}
+
+GLuint
+proceduralVertexArray()
+{
+	return emptyVao;
+}
+
+void
+setProceduralTessellation(int s, int t)
+{
+	slices = std::max(s, 3);
+	stacks = std::max(t, 3);
+	cachedProgram = 0;
+}
+
+GLsizei
+proceduralVertexCount(int mesh, GLenum mode)
+{
+	return triangleCount(mesh, slices, stacks) * ((mode == GL_LINES) ? 6 : 3);
+}
+
+//----------------------------------------------------------------------------
+
+void
+drawProceduralMesh(GLuint program, int mesh, GLenum mode, GLsizei instances)
+{
+	// A reloaded shader may have moved its uniforms
+	if (program != cachedProgram || shaderGeneration() != cachedGeneration) {
+		primitiveLoc = glGetUniformLocation(program, "Primitive");
+		slicesLoc = glGetUniformLocation(program, "Slices");
+		stacksLoc = glGetUniformLocation(program, "Stacks");
+		linesLoc = glGetUniformLocation(program, "Lines");
+		glUniform1i(slicesLoc, slices);
+		glUniform1i(stacksLoc, stacks);
+		cachedProgram = program;
+		cachedGeneration = shaderGeneration();
+	}
+
+	GLsizei count = proceduralVertexCount(mesh, mode);
+	glUniform1i(primitiveLoc, mesh);
+	glUniform1i(linesLoc, mode == GL_LINES);
+	glDrawArraysInstanced(mode, 0, count, instances);
+
+	// Nothing is shared between triangles: every pulled vertex is shaded
+	frameStats.verticesShaded += count * instances;
+	frameStats.drawCalls++;
+}
+
+//----------------------------------------------------------------------------
+
+void
+proceduralBenchmark(GLuint bufferedProgram, int objects, int frames)
+{
+	GLuint program = initProceduralMeshes();
+	GLuint previousProgram = stateCurrentProgram();
+	GLuint previousVao = stateCurrentVertexArray();
+	int previousSlices = slices, previousStacks = stacks;
+
+	// A grid of small spheres filling the viewport
+	int side = 1;
+	while (side * side < objects) { side++; }
+	mat4 projection = Ortho(-1.0, 1.0, -1.0, 1.0, -1.0, 1.0);
+	vec4 ambient(0.2, 0.0, 0.2, 1.0), diffuse(1.0, 0.8, 0.0, 1.0), specular(1.0, 1.0, 1.0, 1.0);
+	point4 lightPosition(0.0, 0.0, 1.0, 0.0);
+
+	double passMs[3];
+	for (int pass = 0; pass < 3; pass++) {
+		GLuint p = (pass == 0) ? bufferedProgram : program;
+		stateUseProgram(p);
+
+		if (pass == 0) {
+			const Mesh& m = meshes[SphereMesh];
+			stateBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+			GLuint vPosition = glGetAttribLocation(p, "vPosition");
+			glEnableVertexAttribArray(vPosition);
+			glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(m.pointsOffset));
+			GLint vNormal = glGetAttribLocation(p, "vNormal");
+			if (vNormal >= 0) {
+				glEnableVertexAttribArray(vNormal);
+				glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(m.normalsOffset));
+			}
+		}
+		else {
+			// The second pulled pass runs at a tessellation the buffers do not hold
+			setProceduralTessellation(pass == 1 ? 20 : 64, pass == 1 ? 20 : 64);
+			stateBindVertexArray(emptyVao);
+		}
+
+		glUniformMatrix4fv(glGetUniformLocation(p, "Projection"), 1, GL_TRUE, projection);
+		glUniform4fv(glGetUniformLocation(p, "AmbientProduct"), 1, ambient);
+		glUniform4fv(glGetUniformLocation(p, "DiffuseProduct"), 1, diffuse);
+		glUniform4fv(glGetUniformLocation(p, "SpecularProduct"), 1, specular);
+		glUniform4fv(glGetUniformLocation(p, "LightPosition"), 1, lightPosition);
+		glUniform1f(glGetUniformLocation(p, "Shininess"), 100.0);
+		GLint modelView = glGetUniformLocation(p, "ModelView");
+
+		glFinish();
+		double t = timeNow();
+		for (int f = 0; f < frames; f++) {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			for (int i = 0; i < objects; i++) {
+				GLfloat r = 1.0 / side;
+				mat4 mv = Translate(-1.0 + r * (2 * (i % side) + 1), -1.0 + r * (2 * (i / side) + 1), 0.0) *
+					Scale(r, r, r);
+				glUniformMatrix4fv(modelView, 1, GL_TRUE, mv);
+				if (pass == 0) {
+					drawMesh(meshes[SphereMesh], GL_TRIANGLES);
+				}
+				else {
+					drawProceduralMesh(p, SphereMesh, GL_TRIANGLES);
+				}
+			}
+		}
+		glFinish();
+		passMs[pass] = (timeNow() - t) * 1000.0 / frames;
+
+		stateBindVertexArray(previousVao);
+	}
+	setProceduralTessellation(previousSlices, previousStacks);
+	stateUseProgram(previousProgram);
+
+	GLsizeiptr buffered = meshVertexBytes();
+	for (int i = 0; i < NumMeshes; i++) {
+		buffered += (meshes[i].numIndices + meshes[i].numEdgeIndices) * sizeof(GLuint);
+	}
+
+	std::cout << "procedural: " << objects << " spheres, " << frames << " frames on "
+	          << glGetString(GL_RENDERER) << std::endl
+	          << "  buffered 20x20 " << passMs[0] << " ms/frame, " << buffered / 1024
+	          << " KiB of mesh buffers for all primitives" << std::endl
+	          << "  pulled   20x20 " << passMs[1] << " ms/frame, no buffers" << std::endl
+	          << "  pulled   64x64 " << passMs[2] << " ms/frame, no buffers (its vertices alone would take "
+	          << bufferedSphereBytes(64, 64) / 1024 << " KiB buffered)" << std::endl;
+}
@@ -0,0 +1,42 @@
+#ifndef __PROCEDURALMESH_H__
+#define __PROCEDURALMESH_H__
+
+#include "Angel.h"
+#include "Mesh.h"
+
+//----------------------------------------------------------------------------
+//
+//  Vertex pulling for the unit primitives.
+//
+//  vprocedural.glsl rebuilds the triangles that Primitives.cpp generates
+//    from gl_VertexID and a few uniforms (which primitive, its slices and
+//    stacks), so drawing them binds an empty vertex array and no buffer at
+//    all.  The tessellation is a uniform, not a buffer size: any number of
+//    slices and stacks costs the same zero bytes.  The price is that every
+//    vertex is evaluated once per triangle using it, with no post-transform
+//    reuse, and that GL_LINES draws the three edges of every triangle
+//    instead of the welded edge list (Mesh.h): shared edges are drawn
+//    twice and lit with the normals of their triangles.
+//
+
+// Builds the pulling program and its empty vertex array and returns the
+//   program (GL thread)
+GLuint  initProceduralMeshes();
+
+GLuint  proceduralVertexArray();
+
+// Slices and stacks of the cone and sphere; 20 x 20 matches the buffers
+void    setProceduralTessellation(int slices, int stacks);
+
+GLsizei proceduralVertexCount(int mesh, GLenum mode);
+
+// Draws one of CubeMesh, ConeMesh or SphereMesh with `program`, which must
+//   be current and use vprocedural.glsl, and proceduralVertexArray() bound
+void    drawProceduralMesh(GLuint program, int mesh, GLenum mode, GLsizei instances = 1);
+
+// Draws `objects` spheres per frame from the mesh buffer with
+//   `bufferedProgram` and by pulling, and reports the time and the buffer
+//   memory of each.  Needs a current GL context and uploadMeshes().
+void    proceduralBenchmark(GLuint bufferedProgram, int objects, int frames);
+
+#endif // __PROCEDURALMESH_H__
@@ -0,0 +1,263 @@
+#include "Replay.h"
+#include "GLState.h"
+#include "Stats.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const uint32_t  ReplayMagic = 0x594c5052;   // "RPLY"
+const uint32_t  ReplayVersion = 1;
+
+enum { EventMouse = 1, EventKeyboard, EventMenu, EventReshape, EventFrame };
+
+struct ReplayHeader {
+	uint32_t  magic;
+	uint32_t  version;
+};
+
+struct ReplayEvent {
+	uint32_t  frame;      // number of the frame this event precedes
+	uint8_t   type;
+	uint8_t   button;     // mouse button, key or menu option
+	uint8_t   state;
+	uint8_t   reserved;
+	int16_t   x, y;       // pointer position, or width and height
+	uint32_t  value;      // EventFrame: frame time in microseconds
+};
+
+FILE*     recording = NULL;
+uint32_t  recordedFrames = 0;
+bool      replaying = false;
+
+void
+writeEvent(uint8_t type, int button, int state, int x, int y, uint32_t value)
+{
+	if (recording == NULL || replaying) { return; }
+
+	ReplayEvent e;
+	e.frame = recordedFrames;
+	e.type = type;
+	e.button = (uint8_t)button;
+	e.state = (uint8_t)state;
+	e.reserved = 0;
+	e.x = (int16_t)x;
+	e.y = (int16_t)y;
+	e.value = value;
+	fwrite(&e, sizeof(e), 1, recording);
+}
+
+// Render target for headless frames
+GLuint  fbo = 0, colorBuffer = 0, depthBuffer = 0;
+int     fboWidth = 0, fboHeight = 0;
+
+void
+resizeTarget(int width, int height)
+{
+	if (fbo == 0) {
+		glGenFramebuffers(1, &fbo);
+		glGenRenderbuffers(1, &colorBuffer);
+		glGenRenderbuffers(1, &depthBuffer);
+	}
+	stateBindFramebuffer(fbo);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+	fboWidth = width;
+	fboHeight = height;
+}
+
+uint64_t
+hashPixels(const std::vector<unsigned char>& pixels)
+{
+	// 64-bit FNV-1a
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < pixels.size(); i++) {
+		h = (h ^ pixels[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+bool
+startRecording(const char* path)
+{
+	stopRecording();
+
+	recording = fopen(path, "wb");
+	if (recording == NULL) {
+		std::cerr << "Failed to open " << path << " for recording" << std::endl;
+		return false;
+	}
+
+	ReplayHeader h = { ReplayMagic, ReplayVersion };
+	fwrite(&h, sizeof(h), 1, recording);
+	recordedFrames = 0;
+
+	// exit() is the usual way out of the program (see keyboard() and menu())
+	static bool registered = false;
+	if (!registered) {
+		atexit(stopRecording);
+		registered = true;
+	}
+	return true;
+}
+
+void
+stopRecording()
+{
+	if (recording != NULL) {
+		fclose(recording);
+		recording = NULL;
+	}
+}
+
+void
+recordMouse(int button, int state, int x, int y)
+{
+	writeEvent(EventMouse, button, state, x, y, 0);
+}
+
+void
+recordKeyboard(unsigned char key, int x, int y)
+{
+	writeEvent(EventKeyboard, key, 0, x, y, 0);
+}
+
+void
+recordMenu(int option)
+{
+	writeEvent(EventMenu, option, 0, 0, 0, 0);
+}
+
+void
+recordReshape(int width, int height)
+{
+	writeEvent(EventReshape, 0, 0, width, height, 0);
+}
+
+void
+recordFrame(double frameMs)
+{
+	writeEvent(EventFrame, 0, 0, 0, 0, (uint32_t)(frameMs * 1000.0));
+	if (recording != NULL && !replaying) {
+		recordedFrames++;
+	}
+}
+
+bool
+isReplaying()
+{
+	return replaying;
+}
+
+//----------------------------------------------------------------------------
+
+int
+runReplay(const char* path, const ReplayCallbacks& callbacks, const char* hashPath)
+{
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		std::cerr << "Failed to open recording " << path << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	ReplayHeader h;
+	if (fread(&h, sizeof(h), 1, fp) != 1 || h.magic != ReplayMagic || h.version != ReplayVersion) {
+		std::cerr << path << " is not a recording of this version" << std::endl;
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<ReplayEvent> events;
+	ReplayEvent e;
+	while (fread(&e, sizeof(e), 1, fp) == 1) {
+		events.push_back(e);
+	}
+	fclose(fp);
+
+	FILE* out = stdout;
+	if (hashPath != NULL && (out = fopen(hashPath, "w")) == NULL) {
+		std::cerr << "Failed to open " << hashPath << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	replaying = true;
+
+	std::vector<double> frameTimes;
+	std::vector<unsigned char> pixels;
+	double recordedMs = 0.0;
+	int allocatingFrames = 0;     // after the first, which sizes the arena
+
+	for (size_t i = 0; i < events.size(); i++) {
+		const ReplayEvent& ev = events[i];
+
+		switch (ev.type) {
+		case EventMouse:    callbacks.mouse(ev.button, ev.state, ev.x, ev.y);  break;
+		case EventKeyboard: callbacks.keyboard(ev.button, ev.x, ev.y);  break;
+		case EventMenu:     callbacks.menu(ev.button);  break;
+		case EventReshape:
+			resizeTarget(ev.x, ev.y);
+			callbacks.reshape(ev.x, ev.y);
+			break;
+		case EventFrame: {
+			if (fbo == 0) {
+				std::cerr << "Recording has no window size before its first frame" << std::endl;
+				return EXIT_FAILURE;
+			}
+			stateBindFramebuffer(fbo);
+
+			double t = timeNow();
+			callbacks.display();
+			glFinish();
+			frameTimes.push_back((timeNow() - t) * 1000.0);
+			if (frameTimes.size() > 1 && frameStats.heapAllocations > 0) {
+				allocatingFrames++;
+			}
+			recordedMs += ev.value / 1000.0;
+
+			pixels.resize(fboWidth * fboHeight * 4);
+			glReadPixels(0, 0, fboWidth, fboHeight, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+			fprintf(out, "frame %u %016llx\n", ev.frame,
+				(unsigned long long)hashPixels(pixels));
+			break;
+		}
+		}
+	}
+
+	if (out != stdout) { fclose(out); }
+	replaying = false;
+
+	if (frameTimes.empty()) {
+		std::cerr << "Recording contains no frames" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	double total = 0.0;
+	for (size_t i = 0; i < frameTimes.size(); i++) total += frameTimes[i];
+	std::vector<double> sorted(frameTimes);
+	std::sort(sorted.begin(), sorted.end());
+
+	std::cerr << "replay: " << frameTimes.size() << " frames in " << total << " ms on "
+	          << glGetString(GL_RENDERER) << std::endl
+	          << "  mean " << total / frameTimes.size() << " ms, median "
+	          << sorted[sorted.size() / 2] << " ms, p95 "
+	          << sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)] << " ms, max "
+	          << sorted.back() << " ms" << std::endl
+	          << "  recorded session mean " << recordedMs / frameTimes.size() << " ms" << std::endl
+	          << "  " << allocatingFrames << " frames after the first allocated on the heap" << std::endl;
+
+	return EXIT_SUCCESS;
+}
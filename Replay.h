@@ -0,0 +1,49 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "Angel.h"
+
+//----------------------------------------------------------------------------
+//
+//  Input and frame recording for repeatable performance runs.
+//
+//  While recording, every GLUT input callback, every reshape and the end
+//    of every displayed frame are appended to a compact binary file,
+//    tagged with the number of the frame they happened before.  Because
+//    all simulation and animation state advances once per displayed frame,
+//    replaying the same events before the same frames reproduces the same
+//    images.
+//
+//  runReplay() plays a recording back headless: frames are rendered into
+//    an offscreen framebuffer as fast as possible, timed, and hashed so
+//    that the output of two builds can be compared line by line.
+//
+
+struct ReplayCallbacks {
+	void (*display)();
+	void (*reshape)(int width, int height);
+	void (*mouse)(int button, int state, int x, int y);
+	void (*keyboard)(unsigned char key, int x, int y);
+	void (*menu)(int option);
+};
+
+bool startRecording(const char* path);
+void stopRecording();
+
+void recordMouse(int button, int state, int x, int y);
+void recordKeyboard(unsigned char key, int x, int y);
+void recordMenu(int option);
+void recordReshape(int width, int height);
+void recordFrame(double frameMs);
+
+// True while runReplay() feeds events to the callbacks.  A recording
+//   ends with the event that quit the session, which must not exit()
+//   before the replay reports.
+bool isReplaying();
+
+// Returns the process exit status.  Frame hashes go to hashPath, or to
+//   standard output when it is NULL.
+int  runReplay(const char* path, const ReplayCallbacks& callbacks,
+               const char* hashPath);
+
+#endif // __REPLAY_H__
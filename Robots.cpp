@@ -0,0 +1,493 @@
+#include "Robots.h"
+#include "FrameArena.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "Parallel.h"
+#include "ShaderSource.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ROBOTS_SSE2
+#endif
+
+RobotArms  robotArms;
+
+const int  NumRobotArrays = 9;
+
+namespace {
+
+GLuint  drawProgram = 0;
+GLuint  drawVao = 0;
+GLuint  paletteBuffer = 0;
+GLuint  paletteTexture = 0;
+int     batchArms = 1;          // arms whose palette fits one buffer texture
+
+// Uniform locations in drawProgram, as of shader generation drawGeneration
+GLint   drawModelView, drawProjection, drawLightPosition, drawShininess;
+GLint   drawAmbient, drawDiffuse, drawSpecular, drawJoints, drawJoint, drawPart;
+unsigned  drawGeneration = 0;
+
+// The parts in joint space and their materials
+struct RobotPart {
+	GLfloat  height, width;
+	color4   ambient, diffuse, specular;
+};
+
+const RobotPart  parts[NumJoints] = {
+	{ BASE_HEIGHT, BASE_WIDTH, color4(1.0, 0.0, 1.0, 1.0),
+		color4(1.0, 0.8, 0.0, 1.0), color4(1.0, 0.8, 0.0, 1.0) },
+	{ LOWER_ARM_HEIGHT, LOWER_ARM_WIDTH, color4(1.0, 0.0, 1.0, 1.0),
+		color4(1.0, 0.8, 0.0, 1.0), color4(1.0, 0.8, 0.0, 1.0) },
+	{ UPPER_ARM_HEIGHT, UPPER_ARM_WIDTH, color4(1.0, 1.0, 0.0, 1.0),
+		color4(1.0, 0.0, 0.8, 1.0), color4(1.0, 1.0, 0.8, 2.0) },
+};
+
+const float  DegreesToRadians = 3.14159265f / 180.0f;
+
+// sin and cos of an angle in degrees.  The argument is reduced to
+//   [-pi/4, pi/4] around the nearest multiple of pi/2 and both functions
+//   are evaluated with the minimax polynomials of Cephes' sinf/cosf;
+//   the SSE2 version below computes exactly the same steps on 4 lanes.
+inline void
+sinCosDegrees(float degrees, float* s, float* c)
+{
+	float x = degrees * DegreesToRadians;
+	float q = floorf(x * 0.636619772f + 0.5f);
+	float r = (x - q * 1.5703125f) - q * 4.83826794e-4f;
+	float r2 = r * r;
+
+	float sr = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+	float cr = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568e-2f + r2 * (-1.388731625e-3f + r2 * 2.443315711e-5f));
+
+	int quadrant = (int)q & 3;
+	*s = (quadrant & 1) ? cr : sr;
+	*c = (quadrant & 1) ? sr : cr;
+	if (quadrant == 1 || quadrant == 2) { *c = -*c; }
+	if (quadrant >= 2) { *s = -*s; }
+}
+
+// The joints of one arm, or of one arm per lane.  With uniform scale s,
+//   heading h and hinge angles a, b:
+//     base  = T(p) * RotateY(h) * S(s)
+//     lower = base * T(0, BASE_HEIGHT, 0) * RotateZ(a)
+//     upper = lower * T(0, LOWER_ARM_HEIGHT, 0) * RotateZ(b)
+//   expanded so that only the sines and cosines are needed.  out[j] gets
+//   the three rows of joint j.
+template <typename V>
+inline void
+armJoints(V px, V py, V pz, V s, V sh, V ch, V sa, V ca, V sb, V cb, V zero, V out[NumJoints][12])
+{
+	V ssh = s * sh, sch = s * ch;
+	V cab = ca * cb - sa * sb, sab = sa * cb + ca * sb;
+	V lowerY = py + s * V(BASE_HEIGHT);
+	V hinge = sa * V(LOWER_ARM_HEIGHT);
+
+	V base[12] = { sch, zero, ssh, px,   zero, s, zero, py,   zero - ssh, zero, sch, pz };
+	V lower[12] = { sch * ca, zero - sch * sa, ssh, px,
+		s * sa, s * ca, zero, lowerY,
+		zero - ssh * ca, ssh * sa, sch, pz };
+	V upper[12] = { sch * cab, zero - sch * sab, ssh, px - sch * hinge,
+		s * sab, s * cab, zero, lowerY + s * ca * V(LOWER_ARM_HEIGHT),
+		zero - ssh * cab, ssh * sab, sch, pz + ssh * hinge };
+
+	for (int k = 0; k < 12; k++) {
+		out[BaseJoint][k] = base[k];
+		out[LowerArmJoint][k] = lower[k];
+		out[UpperArmJoint][k] = upper[k];
+	}
+}
+
+void
+poseRange(const RobotArms& ra, int begin, int end, GLfloat* palette)
+{
+	int i = begin;
+
+#ifdef ROBOTS_SSE2
+	struct Lanes {
+		__m128 v;
+		Lanes() {}
+		Lanes(__m128 a) : v(a) {}
+		explicit Lanes(float a) : v(_mm_set1_ps(a)) {}
+		Lanes operator+(Lanes b) const { return _mm_add_ps(v, b.v); }
+		Lanes operator-(Lanes b) const { return _mm_sub_ps(v, b.v); }
+		Lanes operator*(Lanes b) const { return _mm_mul_ps(v, b.v); }
+	};
+
+	struct SinCos {
+		__m128 s, c;
+		explicit SinCos(const float* degrees)
+		{
+			__m128 x = _mm_mul_ps(_mm_loadu_ps(degrees), _mm_set1_ps(DegreesToRadians));
+			__m128i qi = _mm_cvttps_epi32(floorLanes(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(0.636619772f)), _mm_set1_ps(0.5f))));
+			__m128 q = _mm_cvtepi32_ps(qi);
+			__m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(1.5703125f))),
+				_mm_mul_ps(q, _mm_set1_ps(4.83826794e-4f)));
+			__m128 r2 = _mm_mul_ps(r, r);
+
+			__m128 sp = _mm_add_ps(_mm_set1_ps(8.3321608736e-3f), _mm_mul_ps(r2, _mm_set1_ps(-1.9515295891e-4f)));
+			sp = _mm_add_ps(_mm_set1_ps(-1.6666654611e-1f), _mm_mul_ps(r2, sp));
+			__m128 sr = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), sp));
+
+			__m128 cp = _mm_add_ps(_mm_set1_ps(-1.388731625e-3f), _mm_mul_ps(r2, _mm_set1_ps(2.443315711e-5f)));
+			cp = _mm_add_ps(_mm_set1_ps(4.166664568e-2f), _mm_mul_ps(r2, cp));
+			__m128 cr = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)),
+				_mm_mul_ps(_mm_mul_ps(r2, r2), cp));
+
+			// Odd quadrants swap sine and cosine; the signs follow the quadrant
+			__m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+			__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(qi, one), one));
+			__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(qi, two), 30));
+			__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(qi, one), two), 30));
+
+			s = _mm_or_ps(_mm_and_ps(swap, cr), _mm_andnot_ps(swap, sr));
+			c = _mm_or_ps(_mm_and_ps(swap, sr), _mm_andnot_ps(swap, cr));
+			s = _mm_xor_ps(s, sinSign);
+			c = _mm_xor_ps(c, cosSign);
+		}
+
+		// SSE2 has no floor: truncate, then step down where that rounded up
+		static __m128 floorLanes(__m128 x)
+		{
+			__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+			return _mm_sub_ps(t, _mm_and_ps(_mm_cmplt_ps(x, t), _mm_set1_ps(1.0f)));
+		}
+	};
+
+	for (; i + 4 <= end; i += 4) {
+		SinCos h(ra.heading + i), a(ra.lowerAngle + i), b(ra.upperAngle + i);
+
+		Lanes joints[NumJoints][12];
+		armJoints<Lanes>(_mm_loadu_ps(ra.x + i), _mm_loadu_ps(ra.y + i), _mm_loadu_ps(ra.z + i),
+			_mm_loadu_ps(ra.size + i), h.s, h.c, a.s, a.c, b.s, b.c, Lanes(0.0f), joints);
+
+		// Each row is held as 4 registers of 4 arms; transpose to 4 rows of 1 arm
+		for (int j = 0; j < NumJoints; j++) {
+			for (int row = 0; row < 3; row++) {
+				__m128 r0 = joints[j][4 * row].v, r1 = joints[j][4 * row + 1].v;
+				__m128 r2 = joints[j][4 * row + 2].v, r3 = joints[j][4 * row + 3].v;
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+				GLfloat* dst = palette + i * PaletteStride + 12 * j + 4 * row;
+				_mm_storeu_ps(dst, r0);
+				_mm_storeu_ps(dst + PaletteStride, r1);
+				_mm_storeu_ps(dst + 2 * PaletteStride, r2);
+				_mm_storeu_ps(dst + 3 * PaletteStride, r3);
+			}
+		}
+	}
+#endif
+
+	for (; i < end; i++) {
+		float sh, ch, sa, ca, sb, cb;
+		sinCosDegrees(ra.heading[i], &sh, &ch);
+		sinCosDegrees(ra.lowerAngle[i], &sa, &ca);
+		sinCosDegrees(ra.upperAngle[i], &sb, &cb);
+
+		float joints[NumJoints][12];
+		armJoints<float>(ra.x[i], ra.y[i], ra.z[i], ra.size[i], sh, ch, sa, ca, sb, cb, 0.0f, joints);
+		memcpy(palette + i * PaletteStride, joints, sizeof(joints));
+	}
+}
+
+// Uniform in [lo, hi)
+GLfloat
+randomRange(GLfloat lo, GLfloat hi)
+{
+	return lo + (hi - lo) * rand() / (RAND_MAX + 1.0);
+}
+
+// A reloaded shader may have moved its uniforms
+void
+lookUpDrawLocations()
+{
+	drawModelView = glGetUniformLocation(drawProgram, "ModelView");
+	drawProjection = glGetUniformLocation(drawProgram, "Projection");
+	drawLightPosition = glGetUniformLocation(drawProgram, "LightPosition");
+	drawAmbient = glGetUniformLocation(drawProgram, "AmbientProduct");
+	drawDiffuse = glGetUniformLocation(drawProgram, "DiffuseProduct");
+	drawSpecular = glGetUniformLocation(drawProgram, "SpecularProduct");
+	drawShininess = glGetUniformLocation(drawProgram, "Shininess");
+	drawJoints = glGetUniformLocation(drawProgram, "Joints");
+	drawJoint = glGetUniformLocation(drawProgram, "Joint");
+	drawPart = glGetUniformLocation(drawProgram, "Part");
+	drawGeneration = shaderGeneration();
+}
+
+inline GLfloat
+wrapDegrees(GLfloat a)
+{
+	return a - 360.0f * floorf(a / 360.0f);
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+static int
+alignedCapacity(int capacity)
+{
+	// 16 floats per cache line keeps every array 64-byte aligned
+	return (capacity + 15) & ~15;
+}
+
+void
+initRobotArms(RobotArms* ra, int capacity)
+{
+	memset(ra, 0, sizeof(*ra));
+	ra->capacity = capacity;
+
+	int stride = alignedCapacity(capacity);
+	size_t bytes = NumRobotArrays * stride * sizeof(float) + 64;
+	unsigned char* block = (unsigned char*)calloc(bytes, 1);
+	if (block == NULL) {
+		std::cerr << "Out of memory allocating " << capacity << " robot arms" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// Keep the raw pointer just in front of the aligned block so that
+	//   freeRobotArms() can release it.
+	float* base = (float*)(((size_t)block + sizeof(void*) + 63) & ~(size_t)63);
+	((void**)base)[-1] = block;
+
+	float** arrays[NumRobotArrays] = {
+		&ra->x, &ra->y, &ra->z, &ra->size, &ra->heading,
+		&ra->lowerAngle, &ra->upperAngle, &ra->lowerRate, &ra->upperRate
+	};
+	for (int i = 0; i < NumRobotArrays; i++) {
+		*arrays[i] = base + i * stride;
+	}
+}
+
+void
+freeRobotArms(RobotArms* ra)
+{
+	if (ra->x != NULL) {
+		free(((void**)ra->x)[-1]);
+	}
+	memset(ra, 0, sizeof(*ra));
+}
+
+//----------------------------------------------------------------------------
+
+int
+addRobotArm(RobotArms* ra, const vec3& base, float size, float heading,
+	float lowerAngle, float upperAngle)
+{
+	if (ra->count >= ra->capacity) { return -1; }
+
+	int i = ra->count++;
+	ra->x[i] = base.x;
+	ra->y[i] = base.y;
+	ra->z[i] = base.z;
+	ra->size[i] = size;
+	ra->heading[i] = heading;
+	ra->lowerAngle[i] = lowerAngle;
+	ra->upperAngle[i] = upperAngle;
+	ra->lowerRate[i] = 0.0;
+	ra->upperRate[i] = 0.0;
+	return i;
+}
+
+void
+addRandomRobotArms(RobotArms* ra, int count, float extent, unsigned seed)
+{
+	srand(seed);
+
+	for (int n = 0; n < count; n++) {
+		vec3 base(randomRange(-extent, extent), 0.0, randomRange(-extent, extent));
+		int i = addRobotArm(ra, base, randomRange(0.03, 0.06), randomRange(0.0, 360.0),
+			randomRange(-60.0, 60.0), randomRange(-90.0, 90.0));
+		if (i < 0) { break; }
+
+		ra->lowerRate[i] = randomRange(-1.0, 1.0);
+		ra->upperRate[i] = randomRange(-2.0, 2.0);
+	}
+}
+
+void
+animateRobotArms(RobotArms* ra)
+{
+	for (int i = 0; i < ra->count; i++) {
+		ra->lowerAngle[i] = wrapDegrees(ra->lowerAngle[i] + ra->lowerRate[i]);
+		ra->upperAngle[i] = wrapDegrees(ra->upperAngle[i] + ra->upperRate[i]);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+void
+poseRobotArms(const RobotArms& ra, GLfloat* palette)
+{
+	// Chunks start on multiples of 4 so every SIMD step is a full one
+	int grain = (std::max(evenGrain(ra.count), 256) + 3) & ~3;
+
+	const RobotArms* rp = &ra;
+	parallelFor(ra.count, grain, [&](int begin, int end, int) {
+		poseRange(*rp, begin, end, palette);
+	});
+}
+
+//----------------------------------------------------------------------------
+
+void
+initRobotRendering()
+{
+	if (drawProgram == 0) {
+		drawProgram = InitShader("vrobot.glsl", "fshader53.glsl");
+		followShaderProgram(&drawProgram);
+		lookUpDrawLocations();
+
+		glGenBuffers(1, &paletteBuffer);
+		glGenTextures(1, &paletteTexture);
+		glGenVertexArrays(1, &drawVao);
+	}
+
+	// A buffer texture may hold as few as 65536 texels; more arms than
+	//   fit are drawn in batches
+	GLint maxTexels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	batchArms = std::max(1, maxTexels / (PaletteStride / 4));
+
+	stateBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+	stateBindTexture(0, GL_TEXTURE_BUFFER, paletteTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, paletteBuffer);
+
+	// Every part is a box: the cube mesh from the shared buffer
+	GLuint vao = stateCurrentVertexArray();
+	const Mesh& cube = meshes[CubeMesh];
+	stateBindVertexArray(drawVao);
+	stateBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+	GLuint vPosition = glGetAttribLocation(drawProgram, "vPosition");
+	glEnableVertexAttribArray(vPosition);
+	glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(cube.pointsOffset));
+	GLint vNormal = glGetAttribLocation(drawProgram, "vNormal");
+	if (vNormal >= 0) {
+		glEnableVertexAttribArray(vNormal);
+		glVertexAttribPointer(vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(cube.normalsOffset));
+	}
+	stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshIndexBuffer);
+	stateBindVertexArray(vao);
+}
+
+//----------------------------------------------------------------------------
+
+void
+drawRobotArms(const RobotArms& ra, const mat4& view, const mat4& projection,
+	const Light& light)
+{
+	if (ra.count == 0) { return; }
+
+	double t = timeNow();
+	GLfloat* palette = frameArray<GLfloat>(ra.count * PaletteStride);
+	poseRobotArms(ra, palette);
+	frameStats.kinematicsMs += (timeNow() - t) * 1000.0;
+
+	GLuint program = stateCurrentProgram();
+	GLuint vao = stateCurrentVertexArray();
+
+	if (drawGeneration != shaderGeneration()) {
+		lookUpDrawLocations();
+	}
+	stateUseProgram(drawProgram);
+	stateBindVertexArray(drawVao);
+	stateBindTexture(0, GL_TEXTURE_BUFFER, paletteTexture);
+	glUniform1i(drawJoints, 0);
+	glUniformMatrix4fv(drawModelView, 1, GL_TRUE, view);
+	glUniformMatrix4fv(drawProjection, 1, GL_TRUE, projection);
+	glUniform4fv(drawLightPosition, 1, light.position);
+
+	// One instanced draw per part and batch
+	stateBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+	for (int first = 0; first < ra.count; first += batchArms) {
+		int count = std::min(batchArms, ra.count - first);
+		glBufferData(GL_TEXTURE_BUFFER, count * PaletteStride * sizeof(GLfloat),
+			palette + first * PaletteStride, GL_STREAM_DRAW);
+
+		for (int j = 0; j < NumJoints; j++) {
+			const RobotPart& part = parts[j];
+			mat4 instance = Translate(0.0, 0.5 * part.height, 0.0) *
+				Scale(part.width, part.height, part.width);
+
+			glUniform1i(drawJoint, j);
+			glUniformMatrix4fv(drawPart, 1, GL_TRUE, instance);
+			glUniform4fv(drawAmbient, 1, light.ambient * part.ambient);
+			glUniform4fv(drawDiffuse, 1, light.diffuse * part.diffuse);
+			glUniform4fv(drawSpecular, 1, light.specular * part.specular);
+			glUniform1f(drawShininess, 100.0);
+
+			drawMesh(meshes[CubeMesh], GL_TRIANGLES, count);
+		}
+	}
+
+	stateUseProgram(program);
+	stateBindVertexArray(vao);
+
+	frameStats.robotArms += ra.count;
+}
+
+//----------------------------------------------------------------------------
+
+void
+robotBenchmark(int arms, int frames)
+{
+	RobotArms ra;
+	initRobotArms(&ra, arms);
+	addRandomRobotArms(&ra, arms, 5.0, 1);
+
+	resetFrameArena();
+	GLfloat* reference = frameArray<GLfloat>(arms * PaletteStride);
+	GLfloat* palette = frameArray<GLfloat>(arms * PaletteStride);
+
+	// The reference: one mat4 product per step, per arm
+	double t = timeNow();
+	for (int f = 0; f < frames; f++) {
+		for (int i = 0; i < arms; i++) {
+			mat4 joints[NumJoints];
+			joints[BaseJoint] = Translate(ra.x[i], ra.y[i], ra.z[i]) * RotateY(ra.heading[i]) *
+				Scale(ra.size[i], ra.size[i], ra.size[i]);
+			joints[LowerArmJoint] = joints[BaseJoint] * Translate(0.0, BASE_HEIGHT, 0.0) *
+				RotateZ(ra.lowerAngle[i]);
+			joints[UpperArmJoint] = joints[LowerArmJoint] * Translate(0.0, LOWER_ARM_HEIGHT, 0.0) *
+				RotateZ(ra.upperAngle[i]);
+
+			GLfloat* dst = reference + i * PaletteStride;
+			for (int j = 0; j < NumJoints; j++) {
+				memcpy(dst + 12 * j, (const GLfloat*)joints[j], 12 * sizeof(GLfloat));
+			}
+		}
+	}
+	double serial = (timeNow() - t) * 1000.0 / frames;
+
+	t = timeNow();
+	for (int f = 0; f < frames; f++) {
+		poseRange(ra, 0, arms, palette);
+	}
+	double simd = (timeNow() - t) * 1000.0 / frames;
+
+	t = timeNow();
+	for (int f = 0; f < frames; f++) {
+		poseRobotArms(ra, palette);
+	}
+	double parallel = (timeNow() - t) * 1000.0 / frames;
+
+	float maxError = 0.0;
+	for (int k = 0; k < arms * PaletteStride; k++) {
+		maxError = std::max(maxError, std::fabs(palette[k] - reference[k]));
+	}
+
+	std::cout << "robots: " << arms << " arms, " << NumJoints << " joints each" << std::endl
+	          << "  mat4 products    " << serial << " ms/frame" << std::endl
+	          << "  SIMD, 1 thread   " << simd << " ms/frame (" << serial / simd << "x)" << std::endl
+	          << "  SIMD, " << workerCount() << " threads  " << parallel << " ms/frame ("
+	          << serial / parallel << "x)" << std::endl
+	          << "  largest difference " << maxError << std::endl;
+
+	freeRobotArms(&ra);
+}
@@ -0,0 +1,79 @@
+#ifndef __ROBOTS_H__
+#define __ROBOTS_H__
+
+#include "Angel.h"
+#include "Scene.h"
+
+//----------------------------------------------------------------------------
+//
+//  Instanced articulated arms.
+//
+//  Every arm is a robot of three boxes: a base turned about y, a lower arm
+//    hinged about z on top of the base and an upper arm hinged about z on
+//    top of the lower arm.  The poses are kept as structure-of-arrays.
+//    poseRobotArms() runs the forward kinematics for four arms per SSE2
+//    step and writes the three joint matrices of every arm to a palette;
+//    drawRobotArms() uploads the palette to a buffer texture and draws all
+//    arms with one instanced call per part, each instance fetching its
+//    joint matrix by gl_InstanceID.  When the palette is larger than a
+//    buffer texture may be (GL_MAX_TEXTURE_BUFFER_SIZE), the arms are
+//    drawn in batches that fit.
+//
+
+// Parameters controlling the size of the Robot's arm
+const GLfloat BASE_HEIGHT = 2.0;
+const GLfloat BASE_WIDTH = 5.0;
+const GLfloat LOWER_ARM_HEIGHT = 5.0;
+const GLfloat LOWER_ARM_WIDTH = 0.5;
+const GLfloat UPPER_ARM_HEIGHT = 5.0;
+const GLfloat UPPER_ARM_WIDTH = 0.5;
+
+enum { BaseJoint = 0, LowerArmJoint = 1, UpperArmJoint = 2, NumJoints = 3 };
+
+// Floats per arm in the palette: three rows of a 3x4 matrix per joint
+const int  PaletteStride = NumJoints * 12;
+
+struct RobotArms {
+	int     count;
+	int     capacity;
+	float*  x;  float* y;  float* z;      // position of the base
+	float*  size;                         // uniform scale
+	float*  heading;                      // degrees about y
+	float*  lowerAngle;                   // degrees about z
+	float*  upperAngle;
+	float*  lowerRate;                    // degrees per animated frame
+	float*  upperRate;
+};
+
+extern RobotArms  robotArms;
+
+void initRobotArms(RobotArms* ra, int capacity);
+void freeRobotArms(RobotArms* ra);
+
+// Returns the index of the new arm, or -1 when the set is full
+int  addRobotArm(RobotArms* ra, const vec3& base, float size, float heading,
+                 float lowerAngle, float upperAngle);
+
+// `count` arms standing in a square of +-extent on the y = 0 plane, each
+//   swinging its joints at its own rate
+void addRandomRobotArms(RobotArms* ra, int count, float extent, unsigned seed);
+
+// Advance every joint by its rate
+void animateRobotArms(RobotArms* ra);
+
+// Forward kinematics: PaletteStride floats per arm, row-major 3x4 joint
+//   matrices in BaseJoint, LowerArmJoint, UpperArmJoint order
+void poseRobotArms(const RobotArms& ra, GLfloat* palette);
+
+// Builds the draw program (GL thread, after uploadMeshes())
+void initRobotRendering();
+
+void drawRobotArms(const RobotArms& ra, const mat4& view, const mat4& projection,
+                   const Light& light);
+
+// Times the kinematics of `arms` arms composed with mat4 products and
+//   with the SIMD pass on one thread and on the whole pool, and checks
+//   that they agree.  Needs no GL context.
+void robotBenchmark(int arms, int frames);
+
+#endif // __ROBOTS_H__
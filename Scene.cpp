@@ -0,0 +1,132 @@
+#include "Scene.h"
+#include "Mesh.h"
+
+#include <cstdlib>
+#include <cstring>
+
+Scene  scene;
+
+//----------------------------------------------------------------------------
+
+template <typename T>
+static void
+growArray(T** array, int count, int capacity)
+{
+	T* grown = new T[capacity];
+	for (int i = 0; i < count; i++) {
+		grown[i] = (*array)[i];
+	}
+	delete [] *array;
+	*array = grown;
+}
+
+static void
+reserveNodes(Scene* s, int capacity)
+{
+	if (capacity <= s->capacity) { return; }
+
+	growArray(&s->transform, s->count, capacity);
+	growArray(&s->mesh, s->count, capacity);
+	growArray(&s->material, s->count, capacity);
+	growArray(&s->mode, s->count, capacity);
+	growArray(&s->flags, s->count, capacity);
+	s->capacity = capacity;
+}
+
+//----------------------------------------------------------------------------
+
+void
+initScene(Scene* s, int capacity, int materialCapacity)
+{
+	memset(s, 0, sizeof(*s));
+	reserveNodes(s, capacity);
+	growArray(&s->materials, 0, materialCapacity);
+	s->materialCapacity = materialCapacity;
+}
+
+void
+freeScene(Scene* s)
+{
+	delete [] s->transform;
+	delete [] s->mesh;
+	delete [] s->material;
+	delete [] s->mode;
+	delete [] s->flags;
+	delete [] s->materials;
+	memset(s, 0, sizeof(*s));
+}
+
+void
+reserveScene(Scene* s, int nodes, int materials)
+{
+	reserveNodes(s, nodes);
+	if (materials > s->materialCapacity) {
+		growArray(&s->materials, s->numMaterials, materials);
+		s->materialCapacity = materials;
+	}
+}
+
+//----------------------------------------------------------------------------
+
+int
+addMaterial(Scene* s, const color4& ambient, const color4& diffuse,
+	const color4& specular, GLfloat shininess)
+{
+	if (s->numMaterials == s->materialCapacity) {
+		s->materialCapacity = s->materialCapacity ? 2 * s->materialCapacity : 16;
+		growArray(&s->materials, s->numMaterials, s->materialCapacity);
+	}
+
+	Material& m = s->materials[s->numMaterials];
+	m.ambient = ambient;
+	m.diffuse = diffuse;
+	m.specular = specular;
+	m.shininess = shininess;
+
+	return s->numMaterials++;
+}
+
+int
+addNode(Scene* s, const mat4& transform, GLuint mesh, GLuint material,
+	GLenum mode, GLuint flags)
+{
+	if (s->count == s->capacity) {
+		reserveNodes(s, s->capacity ? 2 * s->capacity : 64);
+	}
+
+	int i = s->count++;
+	s->transform[i] = transform;
+	s->mesh[i] = mesh;
+	s->material[i] = material;
+	s->mode[i] = mode;
+	s->flags[i] = flags;
+
+	return i;
+}
+
+//----------------------------------------------------------------------------
+
+// Uniform in [lo, hi)
+static GLfloat
+randomRange(GLfloat lo, GLfloat hi)
+{
+	return lo + (hi - lo) * rand() / (RAND_MAX + 1.0);
+}
+
+void
+addRandomNodes(Scene* s, int count, GLfloat extent, unsigned seed)
+{
+	srand(seed);
+
+	int firstMaterial = s->numMaterials;
+	for (int m = 0; m < 16; m++) {
+		color4 c(randomRange(0.0, 1.0), randomRange(0.0, 1.0), randomRange(0.0, 1.0), 1.0);
+		addMaterial(s, c, c, color4(1.0, 1.0, 1.0, 1.0), 100.0);
+	}
+
+	for (int i = 0; i < count; i++) {
+		mat4 t = Translate(randomRange(-extent, extent), randomRange(-extent, extent),
+			randomRange(-extent, extent)) * RotateY(randomRange(0.0, 360.0)) * Scale(0.1, 0.1, 0.1);
+		addNode(s, t, rand() % NumMeshes, firstMaterial + rand() % 16, GL_TRIANGLES, 0);
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include "Angel.h"
+
+typedef Angel::vec4  color4;
+typedef Angel::vec4  point4;
+
+//----------------------------------------------------------------------------
+//
+//  The objects drawn each frame, stored as flat arrays indexed by node.
+//    Every node is one mesh from the registry (Mesh.h) drawn with one
+//    transform relative to the camera, one material and one primitive
+//    mode.
+//
+
+enum {
+	NodeStatic = 1,     // part of the fixed scenery (collides with the balls)
+	NodeHidden = 2,     // skipped when recording draw commands
+	NodeOccluder = 4,   // rasterized for occlusion culling (Occlusion.h)
+	NodeCulled = 8      // set by cullScene() for the current frame
+};
+
+struct Material {
+	color4   ambient;
+	color4   diffuse;
+	color4   specular;
+	GLfloat  shininess;
+};
+
+struct Light {
+	point4   position;
+	color4   ambient;
+	color4   diffuse;
+	color4   specular;
+};
+
+struct Scene {
+	int        count;
+	int        capacity;
+	mat4*      transform;    // model transform of each node
+	GLuint*    mesh;         // registry id
+	GLuint*    material;     // index into materials
+	GLenum*    mode;         // GL_TRIANGLES or GL_LINES
+	GLuint*    flags;
+
+	int        numMaterials;
+	int        materialCapacity;
+	Material*  materials;
+};
+
+extern Scene  scene;
+
+void initScene(Scene* s, int capacity, int materialCapacity);
+void freeScene(Scene* s);
+
+// Grows the arrays to hold at least `nodes` nodes and `materials` materials
+void reserveScene(Scene* s, int nodes, int materials);
+
+int  addMaterial(Scene* s, const color4& ambient, const color4& diffuse,
+                 const color4& specular, GLfloat shininess);
+int  addNode(Scene* s, const mat4& transform, GLuint mesh, GLuint material,
+             GLenum mode, GLuint flags);
+
+// Scatters `count` small objects through the cube [-extent, extent]^3
+//   with 16 new materials; the same seed gives the same objects.
+void addRandomNodes(Scene* s, int count, GLfloat extent, unsigned seed);
+
+#endif // __SCENE_H__
@@ -0,0 +1,535 @@
+#include "SceneFile.h"
+#include "FrameArena.h"
+#include "MappedFile.h"
+#include "Mesh.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// Transforms are copied between the file and the scene as whole arrays
+static_assert(sizeof(mat4) == 16 * sizeof(GLfloat), "mat4 must be 16 packed floats");
+
+namespace {
+
+const char* const  meshNames[NumMeshes] = { "cube", "cone", "sphere" };
+
+struct FlagName {
+	const char*  name;
+	GLuint       flag;
+};
+
+const FlagName  flagNames[] = {
+	{ "static", NodeStatic }, { "hidden", NodeHidden }, { "occluder", NodeOccluder }
+};
+const int     NumFlagNames = sizeof(flagNames) / sizeof(flagNames[0]);
+const GLuint  SavedFlags = NodeStatic | NodeHidden | NodeOccluder;
+
+uint64_t
+alignUp(uint64_t offset)
+{
+	return (offset + SceneFileAlign - 1) & ~(uint64_t)(SceneFileAlign - 1);
+}
+
+bool
+inFile(uint64_t offset, uint64_t size, uint64_t fileSize)
+{
+	return offset <= fileSize && size <= fileSize - offset && offset % SceneFileAlign == 0;
+}
+
+//----------------------------------------------------------------------------
+// Text form
+
+struct Reader {
+	const char*  path;
+	const char*  p;
+	const char*  end;
+	int          line;
+	const char*  word;
+	size_t       length;
+};
+
+// Steps to the next word of the current line; false at the end of it.
+//   '#' comments out the rest of the line.
+bool
+nextWord(Reader* r)
+{
+	while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\r')) { r->p++; }
+	if (r->p < r->end && *r->p == '#') {
+		while (r->p < r->end && *r->p != '\n') { r->p++; }
+	}
+	if (r->p == r->end || *r->p == '\n') { return false; }
+
+	r->word = r->p;
+	while (r->p < r->end && !isspace((unsigned char)*r->p)) { r->p++; }
+	r->length = r->p - r->word;
+	return true;
+}
+
+// Moves to the start of the next line; false at the end of the file
+bool
+nextLine(Reader* r)
+{
+	while (r->p < r->end && *r->p != '\n') { r->p++; }
+	if (r->p == r->end) { return false; }
+	r->p++;
+	r->line++;
+	return true;
+}
+
+bool
+isWord(const Reader& r, const char* word)
+{
+	return strlen(word) == r.length && memcmp(r.word, word, r.length) == 0;
+}
+
+bool
+readNumbers(Reader* r, GLfloat* v, int n)
+{
+	char buffer[64];
+	for (int i = 0; i < n; i++) {
+		if (!nextWord(r) || r->length >= sizeof(buffer)) { return false; }
+
+		// The mapped text is not NUL terminated
+		memcpy(buffer, r->word, r->length);
+		buffer[r->length] = '\0';
+		char* end;
+		v[i] = strtof(buffer, &end);
+		if (end != buffer + r->length) { return false; }
+	}
+	return true;
+}
+
+bool
+fail(const Reader& r, const char* message)
+{
+	std::cerr << r.path << ":" << r.line << ": " << message << std::endl;
+	return false;
+}
+
+bool
+parseNode(Reader* r, Scene* s, const std::map<std::string, int>& materialIds)
+{
+	int mesh = -1;
+	if (nextWord(r)) {
+		for (int i = 0; i < NumMeshes; i++) {
+			if (isWord(*r, meshNames[i])) { mesh = i; }
+		}
+	}
+	if (mesh < 0) { return fail(*r, "expected cube, cone or sphere"); }
+
+	if (!nextWord(r)) { return fail(*r, "node without a material"); }
+	std::map<std::string, int>::const_iterator material =
+		materialIds.find(std::string(r->word, r->length));
+	if (material == materialIds.end()) { return fail(*r, "unknown material"); }
+
+	if (!nextWord(r) || !(isWord(*r, "triangles") || isWord(*r, "lines"))) {
+		return fail(*r, "expected triangles or lines");
+	}
+	GLenum mode = isWord(*r, "lines") ? GL_LINES : GL_TRIANGLES;
+
+	mat4 transform;
+	GLuint flags = 0;
+	while (nextWord(r)) {
+		GLfloat v[16];
+		bool isFlag = false;
+		for (int f = 0; f < NumFlagNames; f++) {
+			if (isWord(*r, flagNames[f].name)) {
+				flags |= flagNames[f].flag;
+				isFlag = true;
+			}
+		}
+
+		if (isFlag) {
+			continue;
+		}
+		else if (isWord(*r, "translate")) {
+			if (!readNumbers(r, v, 3)) { return fail(*r, "translate needs 3 numbers"); }
+			transform = transform * Translate(v[0], v[1], v[2]);
+		}
+		else if (isWord(*r, "scale")) {
+			if (!readNumbers(r, v, 3)) { return fail(*r, "scale needs 3 numbers"); }
+			transform = transform * Scale(v[0], v[1], v[2]);
+		}
+		else if (isWord(*r, "rotatex")) {
+			if (!readNumbers(r, v, 1)) { return fail(*r, "rotatex needs an angle"); }
+			transform = transform * RotateX(v[0]);
+		}
+		else if (isWord(*r, "rotatey")) {
+			if (!readNumbers(r, v, 1)) { return fail(*r, "rotatey needs an angle"); }
+			transform = transform * RotateY(v[0]);
+		}
+		else if (isWord(*r, "rotatez")) {
+			if (!readNumbers(r, v, 1)) { return fail(*r, "rotatez needs an angle"); }
+			transform = transform * RotateZ(v[0]);
+		}
+		else if (isWord(*r, "matrix")) {
+			if (!readNumbers(r, v, 16)) { return fail(*r, "matrix needs 16 numbers"); }
+			transform = transform * mat4(vec4(v[0], v[1], v[2], v[3]), vec4(v[4], v[5], v[6], v[7]),
+				vec4(v[8], v[9], v[10], v[11]), vec4(v[12], v[13], v[14], v[15]));
+		}
+		else {
+			return fail(*r, "unknown flag or transform");
+		}
+	}
+
+	addNode(s, transform, mesh, material->second, mode, flags);
+	return true;
+}
+
+bool
+parseScene(Reader* r, Scene* s)
+{
+	std::map<std::string, int> materialIds;
+
+	do {
+		if (!nextWord(r)) { continue; }   // blank line
+
+		if (isWord(*r, "material")) {
+			if (!nextWord(r)) { return fail(*r, "material without a name"); }
+			std::string name(r->word, r->length);
+			if (materialIds.count(name) != 0) { return fail(*r, "material defined twice"); }
+
+			GLfloat v[13];
+			if (!readNumbers(r, v, 13)) { return fail(*r, "material needs 13 numbers"); }
+			materialIds[name] = addMaterial(s, color4(v[0], v[1], v[2], v[3]),
+				color4(v[4], v[5], v[6], v[7]), color4(v[8], v[9], v[10], v[11]), v[12]);
+		}
+		else if (isWord(*r, "node")) {
+			if (!parseNode(r, s, materialIds)) { return false; }
+		}
+		else {
+			return fail(*r, "expected material or node");
+		}
+
+		if (nextWord(r)) { return fail(*r, "unexpected words at the end of the line"); }
+	} while (nextLine(r));
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+
+bool
+writePadding(FILE* fp, uint64_t from, uint64_t to)
+{
+	static const unsigned char zeros[SceneFileAlign] = { 0 };
+	return to == from || fwrite(zeros, 1, (size_t)(to - from), fp) == to - from;
+}
+
+long
+fileSize(const char* path)
+{
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) { return 0; }
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fclose(fp);
+	return size;
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+bool
+loadSceneFile(Scene* s, const char* path)
+{
+	uint32_t magic = 0;
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		std::cerr << "Cannot open scene " << path << std::endl;
+		return false;
+	}
+	size_t n = fread(&magic, sizeof(magic), 1, fp);
+	fclose(fp);
+
+	return (n == 1 && magic == SceneFileMagic) ? loadSceneBinary(s, path) : loadSceneText(s, path);
+}
+
+bool
+loadSceneText(Scene* s, const char* path)
+{
+	MappedFile mf;
+	if (!mapFile(path, &mf)) {
+		std::cerr << "Cannot read scene " << path << std::endl;
+		return false;
+	}
+
+	Reader r = { path, (const char*)mf.data, (const char*)mf.data + mf.size, 1, NULL, 0 };
+	int count = s->count, numMaterials = s->numMaterials;
+
+	bool ok = parseScene(&r, s);
+	if (!ok) {
+		s->count = count;
+		s->numMaterials = numMaterials;
+	}
+
+	unmapFile(&mf);
+	return ok;
+}
+
+//----------------------------------------------------------------------------
+// Map the file and copy each array into the scene with one memcpy; only
+//   the ids need a pass of their own, to validate them and to rebase the
+//   material ids past the materials already in the scene.
+
+bool
+loadSceneBinary(Scene* s, const char* path)
+{
+	MappedFile mf;
+	if (!mapFile(path, &mf)) {
+		std::cerr << "Cannot read scene " << path << std::endl;
+		return false;
+	}
+
+	const SceneFileHeader* h = (const SceneFileHeader*)mf.data;
+	uint64_t n = (mf.size >= sizeof(SceneFileHeader)) ? h->numNodes : 0;
+	bool valid = mf.size >= sizeof(SceneFileHeader)
+		&& h->magic == SceneFileMagic
+		&& h->version == SceneFileVersion
+		&& h->fileSize == mf.size
+		&& h->numNodes <= INT_MAX / 2 && h->numMaterials <= INT_MAX / 2
+		&& inFile(h->materialsOffset, (uint64_t)h->numMaterials * sizeof(SceneFileMaterial), mf.size)
+		&& inFile(h->transformsOffset, n * sizeof(mat4), mf.size)
+		&& inFile(h->meshesOffset, n * sizeof(uint32_t), mf.size)
+		&& inFile(h->materialIdsOffset, n * sizeof(uint32_t), mf.size)
+		&& inFile(h->modesOffset, n * sizeof(uint32_t), mf.size)
+		&& inFile(h->flagsOffset, n * sizeof(uint32_t), mf.size);
+
+	if (!valid) {
+		std::cerr << "Malformed scene file " << path << std::endl;
+		unmapFile(&mf);
+		return false;
+	}
+
+	int first = s->count, firstMaterial = s->numMaterials;
+	reserveScene(s, first + (int)n, firstMaterial + (int)h->numMaterials);
+
+	const SceneFileMaterial* materials = (const SceneFileMaterial*)(mf.data + h->materialsOffset);
+	for (uint32_t m = 0; m < h->numMaterials; m++) {
+		const SceneFileMaterial& fm = materials[m];
+		addMaterial(s, color4(fm.ambient[0], fm.ambient[1], fm.ambient[2], fm.ambient[3]),
+			color4(fm.diffuse[0], fm.diffuse[1], fm.diffuse[2], fm.diffuse[3]),
+			color4(fm.specular[0], fm.specular[1], fm.specular[2], fm.specular[3]),
+			fm.shininess);
+	}
+
+	memcpy(&s->transform[first], mf.data + h->transformsOffset, n * sizeof(mat4));
+	memcpy(&s->mesh[first], mf.data + h->meshesOffset, n * sizeof(uint32_t));
+	memcpy(&s->mode[first], mf.data + h->modesOffset, n * sizeof(uint32_t));
+
+	const uint32_t* materialIds = (const uint32_t*)(mf.data + h->materialIdsOffset);
+	const uint32_t* flags = (const uint32_t*)(mf.data + h->flagsOffset);
+	uint32_t maxMesh = 0, maxMaterial = 0;
+	bool badMode = false;
+	for (uint64_t i = 0; i < n; i++) {
+		maxMesh = std::max(maxMesh, s->mesh[first + i]);
+		maxMaterial = std::max(maxMaterial, materialIds[i]);
+		badMode |= s->mode[first + i] != GL_LINES && s->mode[first + i] != GL_TRIANGLES;
+		s->material[first + i] = firstMaterial + materialIds[i];
+		s->flags[first + i] = flags[i] & SavedFlags;
+	}
+
+	bool missing = n > 0 && (maxMesh >= (uint32_t)NumMeshes || maxMaterial >= h->numMaterials);
+	unmapFile(&mf);
+
+	if (missing || badMode) {
+		std::cerr << "Scene file " << path << (missing ? " refers to missing meshes or materials"
+			: " has modes other than lines and triangles") << std::endl;
+		s->numMaterials = firstMaterial;
+		return false;
+	}
+
+	s->count = first + (int)n;
+	return true;
+}
+
+//----------------------------------------------------------------------------
+
+bool
+writeSceneText(const Scene& s, const char* path)
+{
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL) {
+		std::cerr << "Failed to write scene " << path << std::endl;
+		return false;
+	}
+
+	fprintf(fp, "# %d materials, %d nodes\n", s.numMaterials, s.count);
+	for (int m = 0; m < s.numMaterials; m++) {
+		const Material& mat = s.materials[m];
+		fprintf(fp, "material m%d", m);
+		const color4* colors[3] = { &mat.ambient, &mat.diffuse, &mat.specular };
+		for (int c = 0; c < 3; c++) {
+			fprintf(fp, "  %.9g %.9g %.9g %.9g", (*colors[c])[0], (*colors[c])[1],
+				(*colors[c])[2], (*colors[c])[3]);
+		}
+		fprintf(fp, "  %.9g\n", mat.shininess);
+	}
+
+	for (int i = 0; i < s.count; i++) {
+		fprintf(fp, "node %s m%u %s", meshNames[s.mesh[i]], s.material[i],
+			(s.mode[i] == GL_LINES) ? "lines" : "triangles");
+		for (int f = 0; f < NumFlagNames; f++) {
+			if (s.flags[i] & flagNames[f].flag) { fprintf(fp, " %s", flagNames[f].name); }
+		}
+
+		const GLfloat* m = (const GLfloat*)s.transform[i];
+		fprintf(fp, " matrix");
+		for (int k = 0; k < 16; k++) {
+			fprintf(fp, " %.9g", m[k]);
+		}
+		fprintf(fp, "\n");
+	}
+
+	bool ok = (ferror(fp) == 0);
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		std::cerr << "Failed to write scene " << path << std::endl;
+	}
+	return ok;
+}
+
+bool
+writeSceneBinary(const Scene& s, const char* path)
+{
+	uint64_t n = (uint64_t)s.count;
+
+	SceneFileHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = SceneFileMagic;
+	h.version = SceneFileVersion;
+	h.numNodes = (uint32_t)s.count;
+	h.numMaterials = (uint32_t)s.numMaterials;
+	h.materialsOffset = alignUp(sizeof(h));
+	h.transformsOffset = alignUp(h.materialsOffset + h.numMaterials * sizeof(SceneFileMaterial));
+	h.meshesOffset = alignUp(h.transformsOffset + n * sizeof(mat4));
+	h.materialIdsOffset = alignUp(h.meshesOffset + n * sizeof(uint32_t));
+	h.modesOffset = alignUp(h.materialIdsOffset + n * sizeof(uint32_t));
+	h.flagsOffset = alignUp(h.modesOffset + n * sizeof(uint32_t));
+	h.fileSize = h.flagsOffset + n * sizeof(uint32_t);
+
+	std::vector<SceneFileMaterial> materials(s.numMaterials);
+	memset(materials.data(), 0, materials.size() * sizeof(SceneFileMaterial));
+	for (int m = 0; m < s.numMaterials; m++) {
+		for (int k = 0; k < 4; k++) {
+			materials[m].ambient[k] = s.materials[m].ambient[k];
+			materials[m].diffuse[k] = s.materials[m].diffuse[k];
+			materials[m].specular[k] = s.materials[m].specular[k];
+		}
+		materials[m].shininess = s.materials[m].shininess;
+	}
+
+	std::vector<uint32_t> flags(s.count);
+	for (int i = 0; i < s.count; i++) {
+		flags[i] = s.flags[i] & SavedFlags;
+	}
+
+	// Written under a temporary name, as the mesh cache is
+	std::string tmpPath = std::string(path) + ".tmp";
+	FILE* fp = fopen(tmpPath.c_str(), "wb");
+	if (fp == NULL) {
+		std::cerr << "Failed to write scene " << path << std::endl;
+		return false;
+	}
+
+	struct Array { uint64_t offset; const void* data; uint64_t size; };
+	const Array arrays[] = {
+		{ h.materialsOffset, materials.data(), materials.size() * sizeof(SceneFileMaterial) },
+		{ h.transformsOffset, s.transform, n * sizeof(mat4) },
+		{ h.meshesOffset, s.mesh, n * sizeof(uint32_t) },
+		{ h.materialIdsOffset, s.material, n * sizeof(uint32_t) },
+		{ h.modesOffset, s.mode, n * sizeof(uint32_t) },
+		{ h.flagsOffset, flags.data(), n * sizeof(uint32_t) }
+	};
+
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+	uint64_t at = sizeof(h);
+	for (int a = 0; ok && a < 6; a++) {
+		ok = writePadding(fp, at, arrays[a].offset)
+			&& (arrays[a].size == 0 || fwrite(arrays[a].data, 1, (size_t)arrays[a].size, fp) == arrays[a].size);
+		at = arrays[a].offset + arrays[a].size;
+	}
+
+	ok = (fclose(fp) == 0) && ok;
+	if (ok) {
+		remove(path);
+		ok = rename(tmpPath.c_str(), path) == 0;
+	}
+	if (!ok) {
+		remove(tmpPath.c_str());
+		std::cerr << "Failed to write scene " << path << std::endl;
+	}
+
+	return ok;
+}
+
+//----------------------------------------------------------------------------
+
+void
+sceneFileBenchmark(int nodes)
+{
+	const char* textPath = "benchmark.scene";
+	const char* binaryPath = "benchmark.sceneb";
+
+	Scene source;
+	initScene(&source, nodes, 16);
+	addRandomNodes(&source, nodes, 10.0, 1);
+	for (int i = 0; i < nodes; i += 7) {
+		source.mode[i] = GL_LINES;
+		source.flags[i] = NodeStatic;
+	}
+
+	if (!writeSceneText(source, textPath) || !writeSceneBinary(source, binaryPath)) {
+		freeScene(&source);
+		return;
+	}
+
+	Scene text, binary;
+	initScene(&text, 0, 0);
+	initScene(&binary, 0, 0);
+
+	double t = timeNow();
+	bool ok = loadSceneText(&text, textPath);
+	double textMs = (timeNow() - t) * 1000.0;
+
+	unsigned long allocations = heapAllocations();
+	t = timeNow();
+	ok = loadSceneBinary(&binary, binaryPath) && ok;
+	double binaryMs = (timeNow() - t) * 1000.0;
+	allocations = heapAllocations() - allocations;
+
+	// %.9g round-trips a float, so both copies should match exactly
+	int mismatches = 0;
+	for (int i = 0; ok && i < nodes; i++) {
+		const Scene* loaded[2] = { &text, &binary };
+		for (int c = 0; c < 2; c++) {
+			const Scene& l = *loaded[c];
+			if (memcmp(&l.transform[i], &source.transform[i], sizeof(mat4)) != 0
+				|| l.mesh[i] != source.mesh[i] || l.material[i] != source.material[i]
+				|| l.mode[i] != source.mode[i] || l.flags[i] != source.flags[i]) {
+				mismatches++;
+			}
+		}
+	}
+
+	std::cout << "scene files: " << nodes << " nodes" << std::endl
+	          << "  text   " << fileSize(textPath) / 1024 << " KiB, loaded in " << textMs << " ms" << std::endl
+	          << "  binary " << fileSize(binaryPath) / 1024 << " KiB, mapped and copied in " << binaryMs
+	          << " ms (" << textMs / binaryMs << "x) with " << allocations << " heap allocations" << std::endl
+	          << "  " << (ok ? mismatches : -1) << " nodes differ from the source" << std::endl;
+
+	remove(textPath);
+	remove(binaryPath);
+	freeScene(&text);
+	freeScene(&binary);
+	freeScene(&source);
+}
@@ -0,0 +1,76 @@
+#ifndef __SCENEFILE_H__
+#define __SCENEFILE_H__
+
+#include <stdint.h>
+#include "Scene.h"
+
+//----------------------------------------------------------------------------
+//
+//  Scene description files.
+//
+//  The text form is one statement per line; '#' starts a comment.
+//
+//      material <name> <ambient r g b a> <diffuse r g b a>
+//               <specular r g b a> <shininess>
+//      node <cube|cone|sphere> <material name> <triangles|lines> <word>...
+//
+//    A node's words are flags (static, hidden, occluder) and transform
+//    steps (translate x y z, scale x y z, rotatex|rotatey|rotatez degrees,
+//    matrix with 16 row-major values), in any order.  The steps multiply
+//    left to right, as Translate(..) * Scale(..) reads in code.
+//
+//  The binary form is the scene arrays themselves, laid out to be mapped
+//    and copied straight into a Scene:
+//
+//      SceneFileHeader
+//      SceneFileMaterial[numMaterials]
+//      row-major float[16] transforms    one per node
+//      uint32 mesh ids, material ids, modes and flags, one array each
+//
+//    Every array starts on a SceneFileAlign byte boundary.  Like the mesh
+//    cache (MeshCache.h) all fields are little endian.
+//
+
+const uint32_t  SceneFileMagic = 0x424e4353;   // "SCNB"
+const uint32_t  SceneFileVersion = 1;
+const uint32_t  SceneFileAlign = 64;
+
+struct SceneFileHeader {
+	uint32_t  magic;
+	uint32_t  version;
+	uint32_t  numNodes;
+	uint32_t  numMaterials;
+	uint64_t  materialsOffset;
+	uint64_t  transformsOffset;
+	uint64_t  meshesOffset;
+	uint64_t  materialIdsOffset;
+	uint64_t  modesOffset;
+	uint64_t  flagsOffset;
+	uint64_t  fileSize;
+};
+
+struct SceneFileMaterial {
+	float     ambient[4];
+	float     diffuse[4];
+	float     specular[4];
+	float     shininess;
+	uint32_t  reserved[3];
+};
+
+// Appends the materials and nodes of a scene file, binary or text as its
+//   first bytes tell, to `s`.  Material references in the file are
+//   relative to the file.  On failure the scene is left as it was.
+bool loadSceneFile(Scene* s, const char* path);
+
+bool loadSceneText(Scene* s, const char* path);
+bool loadSceneBinary(Scene* s, const char* path);
+
+// Transforms are written as matrix steps; NodeCulled is not saved
+bool writeSceneText(const Scene& s, const char* path);
+bool writeSceneBinary(const Scene& s, const char* path);
+
+// Writes `nodes` random nodes in both forms and times loading each.
+//   Needs no GL context.
+void sceneFileBenchmark(int nodes);
+
+#endif // __SCENEFILE_H__
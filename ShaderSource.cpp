@@ -0,0 +1,904 @@
+#include "ShaderSource.h"
+#include "GLState.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#  include <poll.h>
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#endif
+
+namespace {
+
+// GL_KHR_parallel_shader_compile
+const GLenum  CompletionStatus = 0x91B1;
+
+// How often the watcher looks at its stop flag, or at the files when it
+//   has no inotify
+const int     PollMs = 250;
+
+struct Include {
+	std::string  path;              // next to the including file
+	size_t       begin, end;        // the #include line and its newline
+	int          line;
+};
+
+struct ShaderFile {
+	std::string           path;
+	bool                  loaded;   // false while the file is missing or empty
+	MappedFile            map;
+	uint64_t              hash;     // of the mapped bytes
+	std::vector<Include>  includes;
+	size_t                versionEnd;   // past the #version line, 0 for none
+	int                   versionLine;
+};
+
+// The pieces of one file with its includes expanded.  They point into the
+//   mappings and into `directives`, whose elements a deque keeps in place.
+struct Expansion {
+	std::vector<const GLchar*>  strings;
+	std::vector<GLint>          lengths;
+	std::deque<std::string>     directives;
+	std::vector<int>            files;      // it and everything it includes
+};
+
+struct Program {
+	GLuint                    program;
+	std::string               files[2];     // vertex, fragment ("" for none)
+	std::vector<std::string>  varyings;
+	uint64_t                  keys[2];      // of the sources linked or queued
+	bool                      queued;
+};
+
+// A compile in flight, GL thread only
+struct Rebuild {
+	int       index;                        // into `programs`
+	GLuint    scratch;
+	GLuint    shaders[2];
+	bool      linking;                      // past the compiles
+	unsigned  issued;                       // frame of the last step
+};
+
+std::mutex                     mutex;       // guards all but `building`
+std::deque<ShaderFile>         files;       // the index is the source string number
+std::map<std::string, int>     fileIndex;
+std::map<uint64_t, Expansion>  expansions;
+std::vector<Program>           programs;
+std::vector<int>               changed;     // queued programs
+
+std::vector<Rebuild>           building;
+std::vector<GLuint*>           followers;   // see followShaderProgram()
+std::atomic<unsigned>          generation(0);
+std::atomic<bool>              watching(false);
+std::thread                    watcher;
+
+//----------------------------------------------------------------------------
+//
+//  Files and expansions, with `mutex` held
+//
+
+uint64_t
+fnv1a(const void* data, size_t size, uint64_t h = 14695981039346656037ull)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		h = (h ^ p[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+std::string
+directoryOf(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return (slash == std::string::npos) ? std::string() : path.substr(0, slash + 1);
+}
+
+bool
+startsWith(const char* p, const char* end, const char* word)
+{
+	size_t n = strlen(word);
+	return (size_t)(end - p) >= n && memcmp(p, word, n) == 0;
+}
+
+// Finds the #version line and the  #include "file"  lines.  A malformed
+//   include is left in the text for the compiler to complain about.
+void
+parseFile(ShaderFile* f)
+{
+	f->includes.clear();
+	f->versionEnd = 0;
+	f->versionLine = 0;
+	if (!f->loaded) { return; }
+
+	std::string dir = directoryOf(f->path);
+	const char* text = (const char*)f->map.data;
+	size_t size = f->map.size;
+
+	int line = 1;
+	for (size_t begin = 0; begin < size; line++) {
+		size_t end = begin;
+		while (end < size && text[end] != '\n') { end++; }
+		if (end < size) { end++; }
+
+		const char* p = text + begin;
+		const char* e = text + end;
+		while (p < e && (*p == ' ' || *p == '\t')) { p++; }
+		if (p < e && *p == '#') {
+			for (p++; p < e && (*p == ' ' || *p == '\t'); p++) {}
+
+			if (startsWith(p, e, "include")) {
+				for (p += 7; p < e && (*p == ' ' || *p == '\t'); p++) {}
+				const char* q = (p < e && *p == '"') ? p + 1 : e;
+				while (q < e && *q != '"' && *q != '\n') { q++; }
+				if (q < e && *q == '"') {
+					Include inc = { dir + std::string(p + 1, q), begin, end, line };
+					f->includes.push_back(inc);
+				}
+			}
+			else if (startsWith(p, e, "version") && f->versionEnd == 0 && f->includes.empty()) {
+				f->versionEnd = end;
+				f->versionLine = line;
+			}
+		}
+		begin = end;
+	}
+}
+
+// Maps the file again; true when its content changed.  Expansions of the
+//   old content are dropped before its mapping goes.
+bool
+refreshFile(int i)
+{
+	ShaderFile& f = files[i];
+
+	MappedFile map;
+	bool loaded = mapFile(f.path.c_str(), &map);
+	uint64_t hash = loaded ? fnv1a(map.data, map.size) : 0;
+	if (loaded == f.loaded && hash == f.hash) {
+		if (loaded) { unmapFile(&map); }
+		return false;
+	}
+
+	for (std::map<uint64_t, Expansion>::iterator it = expansions.begin(); it != expansions.end(); ) {
+		const std::vector<int>& used = it->second.files;
+		if (std::find(used.begin(), used.end(), i) != used.end()) {
+			it = expansions.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	if (f.loaded) { unmapFile(&f.map); }
+	f.loaded = loaded;
+	f.map = map;
+	f.hash = hash;
+	parseFile(&f);
+	return true;
+}
+
+int
+fileFor(const std::string& path)
+{
+	std::map<std::string, int>::iterator it = fileIndex.find(path);
+	if (it != fileIndex.end()) { return it->second; }
+
+	int i = (int)files.size();
+	files.push_back(ShaderFile());
+	ShaderFile& f = files.back();
+	f.path = path;
+	f.loaded = false;
+	f.hash = 0;
+	f.versionEnd = 0;
+	f.versionLine = 0;
+	fileIndex[path] = i;
+	refreshFile(i);
+	return i;
+}
+
+void
+addPiece(Expansion* e, const GLchar* text, size_t length)
+{
+	if (length == 0) { return; }
+	e->strings.push_back(text);
+	e->lengths.push_back((GLint)length);
+}
+
+// The line after the directive is `line` of source string `file`.  It
+//   starts with a newline in case the text before it has none.
+void
+addLineDirective(Expansion* e, int line, int file)
+{
+	e->directives.push_back("\n#line " + std::to_string(line) + " " + std::to_string(file) + "\n");
+	addPiece(e, e->directives.back().c_str(), e->directives.back().size());
+}
+
+// The cached expansion of file i, NULL after printing why there is none.
+//   `stack` holds the files being expanded, to catch include cycles.
+const Expansion*
+expand(int i, std::vector<int>* stack, uint64_t* key)
+{
+	if (!files[i].loaded) {
+		std::cerr << "Failed to read " << files[i].path << std::endl;
+		return NULL;
+	}
+	if (std::find(stack->begin(), stack->end(), i) != stack->end()) {
+		std::cerr << files[i].path << " includes itself" << std::endl;
+		return NULL;
+	}
+
+	// The key covers the file number too, as it is written into #line
+	const ShaderFile& f = files[i];
+	std::vector<const Expansion*> children;
+	std::vector<int> childFiles;
+	uint64_t k = fnv1a(&i, sizeof i, f.hash);
+
+	stack->push_back(i);
+	for (size_t n = 0; n < f.includes.size(); n++) {
+		int child = fileFor(f.includes[n].path);
+		uint64_t childKey;
+		const Expansion* c = expand(child, stack, &childKey);
+		if (c == NULL) {
+			std::cerr << "  included from " << f.path << ":" << f.includes[n].line << std::endl;
+			stack->pop_back();
+			return NULL;
+		}
+		children.push_back(c);
+		childFiles.push_back(child);
+		k = fnv1a(&childKey, sizeof childKey, k);
+	}
+	stack->pop_back();
+
+	*key = k;
+	std::map<uint64_t, Expansion>::iterator it = expansions.find(k);
+	if (it != expansions.end()) { return &it->second; }
+
+	Expansion& e = expansions[k];
+	const GLchar* text = (const GLchar*)f.map.data;
+	e.files.push_back(i);
+
+	size_t start = 0;
+	if (f.versionEnd > 0) {
+		addPiece(&e, text, f.versionEnd);
+		addLineDirective(&e, f.versionLine + 1, i);
+		start = f.versionEnd;
+	}
+	for (size_t n = 0; n < f.includes.size(); n++) {
+		const Include& inc = f.includes[n];
+		const Expansion& c = *children[n];
+		addPiece(&e, text + start, inc.begin - start);
+		addLineDirective(&e, 1, childFiles[n]);
+		e.strings.insert(e.strings.end(), c.strings.begin(), c.strings.end());
+		e.lengths.insert(e.lengths.end(), c.lengths.begin(), c.lengths.end());
+		addLineDirective(&e, inc.line + 1, i);
+		start = inc.end;
+
+		for (size_t m = 0; m < c.files.size(); m++) {
+			if (std::find(e.files.begin(), e.files.end(), c.files[m]) == e.files.end()) {
+				e.files.push_back(c.files[m]);
+			}
+		}
+	}
+	addPiece(&e, text + start, f.map.size - start);
+
+	return &e;
+}
+
+const Expansion*
+expandPath(const char* path, uint64_t* key)
+{
+	std::vector<int> stack;
+	return expand(fileFor(path), &stack, key);
+}
+
+// Queues the programs whose sources no longer match their keys
+void
+queueChangedPrograms()
+{
+	for (size_t n = 0; n < programs.size(); n++) {
+		Program& p = programs[n];
+		uint64_t keys[2] = { 0, 0 };
+		bool complete = true;
+		for (int s = 0; s < 2; s++) {
+			if (!p.files[s].empty() && expandPath(p.files[s].c_str(), &keys[s]) == NULL) {
+				complete = false;
+			}
+		}
+		if (!complete || (keys[0] == p.keys[0] && keys[1] == p.keys[1])) { continue; }
+
+		p.keys[0] = keys[0];
+		p.keys[1] = keys[1];
+		if (!p.queued) {
+			p.queued = true;
+			changed.push_back((int)n);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+//
+//  Watcher thread
+//
+
+// Re-reads the files in `paths`, or with `paths` NULL all of them.  Only
+//   a change of content counts: modification times have a resolution of
+//   a second or worse on some file systems, and two saves of the same
+//   size within it would look like one.
+void
+reloadFiles(const std::set<std::string>* paths)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	bool any = false;
+	for (size_t i = 0; i < files.size(); i++) {
+		ShaderFile& f = files[i];
+		if (paths != NULL && paths->count(f.path) == 0) { continue; }
+		if (refreshFile((int)i)) {
+			std::cerr << "Shader file " << f.path << " changed" << std::endl;
+			any = true;
+		}
+	}
+	if (any) {
+		queueChangedPrograms();
+	}
+}
+
+#ifdef __linux__
+// Follows the directories of all known files, including those of
+//   includes that do not exist yet.  Editors that save by renaming a new
+//   file over the old one only show up as events of the directory.
+void
+watchDirectories(int fd, std::map<int, std::string>* watches, std::set<std::string>* directories)
+{
+	std::vector<std::string> wanted;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < files.size(); i++) {
+			wanted.push_back(directoryOf(files[i].path));
+		}
+	}
+
+	for (size_t i = 0; i < wanted.size(); i++) {
+		if (!directories->insert(wanted[i]).second) { continue; }
+		const char* dir = wanted[i].empty() ? "." : wanted[i].c_str();
+		int wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (wd >= 0) {
+			(*watches)[wd] = wanted[i];
+		}
+	}
+}
+#endif
+
+void
+watcherMain()
+{
+#ifdef __linux__
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		std::cerr << "inotify is not available; polling the shader files" << std::endl;
+	}
+	std::map<int, std::string> watches;
+	std::set<std::string> directories;
+
+	while (fd >= 0 && watching) {
+		watchDirectories(fd, &watches, &directories);
+
+		pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, PollMs) <= 0) { continue; }
+
+		// A save is often several events; each file is read once
+		std::set<std::string> paths;
+		alignas(inotify_event) char buffer[4096];
+		ssize_t n;
+		while ((n = read(fd, buffer, sizeof buffer)) > 0) {
+			for (char* p = buffer; p < buffer + n; ) {
+				const inotify_event* e = (const inotify_event*)p;
+				if (e->len > 0 && watches.count(e->wd) > 0) {
+					paths.insert(watches[e->wd] + e->name);
+				}
+				p += sizeof(inotify_event) + e->len;
+			}
+		}
+		reloadFiles(&paths);
+	}
+	if (fd >= 0) {
+		close(fd);
+		return;
+	}
+#endif
+
+	while (watching) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(PollMs));
+		reloadFiles(NULL);
+	}
+}
+
+//----------------------------------------------------------------------------
+//
+//  Relinking, on the GL thread
+//
+
+struct UniformValue {
+	std::string           name;
+	GLenum                type;
+	std::vector<GLfloat>  floats;
+	std::vector<GLint>    ints;     // ints, bools, unsigned ints and samplers
+};
+
+int
+uniformComponents(GLenum type)
+{
+	switch (type) {
+	case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: case GL_UNSIGNED_INT_VEC2:
+		return 2;
+	case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: case GL_UNSIGNED_INT_VEC3:
+		return 3;
+	case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_UNSIGNED_INT_VEC4:
+	case GL_FLOAT_MAT2:
+		return 4;
+	case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2:
+		return 6;
+	case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2:
+		return 8;
+	case GL_FLOAT_MAT3:
+		return 9;
+	case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3:
+		return 12;
+	case GL_FLOAT_MAT4:
+		return 16;
+	default:
+		return 1;
+	}
+}
+
+bool
+isFloatUniform(GLenum type)
+{
+	switch (type) {
+	case GL_FLOAT: case GL_FLOAT_VEC2: case GL_FLOAT_VEC3: case GL_FLOAT_VEC4:
+	case GL_FLOAT_MAT2: case GL_FLOAT_MAT3: case GL_FLOAT_MAT4:
+	case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT3x2:
+	case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x2: case GL_FLOAT_MAT4x3:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool
+isUnsignedUniform(GLenum type)
+{
+	return type == GL_UNSIGNED_INT || type == GL_UNSIGNED_INT_VEC2
+		|| type == GL_UNSIGNED_INT_VEC3 || type == GL_UNSIGNED_INT_VEC4;
+}
+
+void
+setUniform(GLint loc, const UniformValue& u)
+{
+	const GLfloat* f = u.floats.data();
+	const GLint* i = u.ints.data();
+	const GLuint* ui = (const GLuint*)u.ints.data();
+
+	switch (u.type) {
+	case GL_FLOAT:             glUniform1fv(loc, 1, f); break;
+	case GL_FLOAT_VEC2:        glUniform2fv(loc, 1, f); break;
+	case GL_FLOAT_VEC3:        glUniform3fv(loc, 1, f); break;
+	case GL_FLOAT_VEC4:        glUniform4fv(loc, 1, f); break;
+	case GL_FLOAT_MAT2:        glUniformMatrix2fv(loc, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT3:        glUniformMatrix3fv(loc, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT4:        glUniformMatrix4fv(loc, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT2x3:      glUniformMatrix2x3fv(loc, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT2x4:      glUniformMatrix2x4fv(loc, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT3x2:      glUniformMatrix3x2fv(loc, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT3x4:      glUniformMatrix3x4fv(loc, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT4x2:      glUniformMatrix4x2fv(loc, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT4x3:      glUniformMatrix4x3fv(loc, 1, GL_FALSE, f); break;
+	case GL_INT_VEC2:          case GL_BOOL_VEC2: glUniform2iv(loc, 1, i); break;
+	case GL_INT_VEC3:          case GL_BOOL_VEC3: glUniform3iv(loc, 1, i); break;
+	case GL_INT_VEC4:          case GL_BOOL_VEC4: glUniform4iv(loc, 1, i); break;
+	case GL_UNSIGNED_INT:      glUniform1uiv(loc, 1, ui); break;
+	case GL_UNSIGNED_INT_VEC2: glUniform2uiv(loc, 1, ui); break;
+	case GL_UNSIGNED_INT_VEC3: glUniform3uiv(loc, 1, ui); break;
+	case GL_UNSIGNED_INT_VEC4: glUniform4uiv(loc, 1, ui); break;
+	default:                   glUniform1iv(loc, 1, i); break;   // int, bool, samplers
+	}
+}
+
+// Every element of every active uniform, and the uniform block bindings
+void
+saveUniforms(GLuint program, std::vector<UniformValue>* values, std::vector<std::pair<std::string, GLint> >* blocks)
+{
+	GLint count = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	for (GLint n = 0; n < count; n++) {
+		char name[256];
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(program, (GLuint)n, sizeof name, NULL, &size, &type, name);
+
+		// Arrays are listed once as "name[0]"
+		std::string base = name;
+		size_t bracket = base.find('[');
+		if (bracket != std::string::npos) { base.erase(bracket); }
+
+		for (GLint e = 0; e < size; e++) {
+			UniformValue u;
+			u.name = (size > 1 || bracket != std::string::npos) ? base + "[" + std::to_string(e) + "]" : base;
+			u.type = type;
+			GLint loc = glGetUniformLocation(program, u.name.c_str());
+			if (loc < 0) { continue; }   // in a uniform block
+
+			if (isFloatUniform(type)) {
+				u.floats.resize(uniformComponents(type));
+				glGetUniformfv(program, loc, u.floats.data());
+			}
+			else {
+				u.ints.resize(uniformComponents(type));
+				if (isUnsignedUniform(type)) {
+					glGetUniformuiv(program, loc, (GLuint*)u.ints.data());
+				}
+				else {
+					glGetUniformiv(program, loc, u.ints.data());
+				}
+			}
+			values->push_back(u);
+		}
+	}
+
+	count = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	for (GLint n = 0; n < count; n++) {
+		char name[256];
+		GLint binding;
+		glGetActiveUniformBlockName(program, (GLuint)n, sizeof name, NULL, name);
+		glGetActiveUniformBlockiv(program, (GLuint)n, GL_UNIFORM_BLOCK_BINDING, &binding);
+		blocks->push_back(std::make_pair(std::string(name), binding));
+	}
+}
+
+// Uniforms the new code dropped or retyped keep their defaults
+void
+restoreUniforms(GLuint program, const std::vector<UniformValue>& values,
+                const std::vector<std::pair<std::string, GLint> >& blocks)
+{
+	stateUseProgram(program);
+
+	GLint count = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	std::map<std::string, GLenum> types;
+	for (GLint n = 0; n < count; n++) {
+		char name[256];
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(program, (GLuint)n, sizeof name, NULL, &size, &type, name);
+		std::string base = name;
+		types[base.substr(0, base.find('['))] = type;
+	}
+
+	for (size_t n = 0; n < values.size(); n++) {
+		const UniformValue& u = values[n];
+		std::map<std::string, GLenum>::iterator t = types.find(u.name.substr(0, u.name.find('[')));
+		GLint loc = glGetUniformLocation(program, u.name.c_str());
+		if (t != types.end() && t->second == u.type && loc >= 0) {
+			setUniform(loc, u);
+		}
+	}
+	for (size_t n = 0; n < blocks.size(); n++) {
+		GLuint index = glGetUniformBlockIndex(program, blocks[n].first.c_str());
+		if (index != GL_INVALID_INDEX) {
+			glUniformBlockBinding(program, index, (GLuint)blocks[n].second);
+		}
+	}
+}
+
+void
+printProgramLog(GLuint program)
+{
+	GLint logSize = 0;
+	glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logSize);
+	std::vector<char> log(std::max(logSize, 1));
+	glGetProgramInfoLog(program, (GLsizei)log.size(), NULL, log.data());
+	std::cerr << log.data() << std::endl;
+}
+
+// Whether the driver is done with a shader or program.  Without parallel
+//   compiles every step is taken to be done a frame after it was issued;
+//   querying it then may still wait, but for one step only.
+bool
+ready(GLuint object, bool isProgram)
+{
+	static int parallel = -1;
+	if (parallel < 0) {
+		parallel = glewIsSupported("GL_KHR_parallel_shader_compile")
+			|| glewIsSupported("GL_ARB_parallel_shader_compile");
+	}
+	if (!parallel) { return true; }
+
+	GLint done = GL_FALSE;
+	if (isProgram) {
+		glGetProgramiv(object, CompletionStatus, &done);
+	}
+	else {
+		glGetShaderiv(object, CompletionStatus, &done);
+	}
+	return done != GL_FALSE;
+}
+
+// The shaders were compiled: links them into the scratch program with the
+//   attribute locations of the live program, which vertex arrays were set
+//   up for.  False after printing the log of one that failed.
+bool
+startLink(const Rebuild& r)
+{
+	const Program& p = programs[r.index];
+	bool ok = true;
+
+	for (int s = 0; s < 2; s++) {
+		if (r.shaders[s] == 0) { continue; }
+		GLint compiled;
+		glGetShaderiv(r.shaders[s], GL_COMPILE_STATUS, &compiled);
+		if (compiled) { continue; }
+
+		std::cerr << p.files[s] << " failed to compile:" << std::endl;
+		GLint logSize = 0;
+		glGetShaderiv(r.shaders[s], GL_INFO_LOG_LENGTH, &logSize);
+		std::vector<char> log(std::max(logSize, 1));
+		glGetShaderInfoLog(r.shaders[s], (GLsizei)log.size(), NULL, log.data());
+		std::cerr << log.data() << "Source strings: " << shaderSourceFiles(p.files[s].c_str()) << std::endl;
+		ok = false;
+	}
+	if (!ok) { return false; }
+
+	GLint count = 0;
+	glGetProgramiv(p.program, GL_ACTIVE_ATTRIBUTES, &count);
+	for (GLint n = 0; n < count; n++) {
+		char name[256];
+		GLint size;
+		GLenum type;
+		glGetActiveAttrib(p.program, (GLuint)n, sizeof name, NULL, &size, &type, name);
+		GLint loc = glGetAttribLocation(p.program, name);
+		if (loc >= 0 && strncmp(name, "gl_", 3) != 0) {
+			glBindAttribLocation(r.scratch, (GLuint)loc, name);
+		}
+	}
+	if (!p.varyings.empty()) {
+		std::vector<const char*> names;
+		for (size_t v = 0; v < p.varyings.size(); v++) { names.push_back(p.varyings[v].c_str()); }
+		glTransformFeedbackVaryings(r.scratch, (GLsizei)names.size(), names.data(), GL_SEPARATE_ATTRIBS);
+	}
+	glLinkProgram(r.scratch);
+	return true;
+}
+
+// The scratch program linked: it takes the uniform values of the live
+//   program and its place.  The old program and its shaders are deleted,
+//   and every followed variable that held its name gets the new one.
+bool
+finishRebuild(const Rebuild& r)
+{
+	Program& p = programs[r.index];
+
+	GLint linked;
+	glGetProgramiv(r.scratch, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		std::cerr << "Shader program " << p.program << " failed to link:" << std::endl;
+		printProgramLog(r.scratch);
+		return false;
+	}
+
+	std::vector<UniformValue> values;
+	std::vector<std::pair<std::string, GLint> > blocks;
+	saveUniforms(p.program, &values, &blocks);
+	restoreUniforms(r.scratch, values, blocks);
+
+	GLuint old = p.program;
+	GLuint oldShaders[2];
+	GLsizei numOld = 0;
+	glGetAttachedShaders(old, 2, &numOld, oldShaders);
+	for (GLsizei n = 0; n < numOld; n++) { glDeleteShader(oldShaders[n]); }
+	stateDeleteProgram(old);
+
+	// Attached, they live as long as the program
+	for (int s = 0; s < 2; s++) {
+		if (r.shaders[s] != 0) { glDeleteShader(r.shaders[s]); }
+	}
+
+	p.program = r.scratch;
+	for (size_t n = 0; n < followers.size(); n++) {
+		if (*followers[n] == old) { *followers[n] = r.scratch; }
+	}
+	std::cerr << "Reloaded shader program " << old << " as " << r.scratch << std::endl;
+	return true;
+}
+
+void
+cancelRebuild(const Rebuild& r)
+{
+	stateDeleteProgram(r.scratch);
+	for (int s = 0; s < 2; s++) {
+		if (r.shaders[s] != 0) { glDeleteShader(r.shaders[s]); }
+	}
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+bool
+setShaderSource(GLuint shader, const char* path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// The mapping may only go once glShaderSource() has copied the text
+	uint64_t key;
+	const Expansion* e = expandPath(path, &key);
+	if (e == NULL) { return false; }
+	glShaderSource(shader, (GLsizei)e->strings.size(), e->strings.data(), e->lengths.data());
+	return true;
+}
+
+std::string
+shaderSourceFiles(const char* path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint64_t key;
+	const Expansion* e = expandPath(path, &key);
+	std::string list;
+	for (size_t n = 0; e != NULL && n < e->files.size(); n++) {
+		list += (n > 0 ? ", " : "") + std::to_string(e->files[n]) + " " + files[e->files[n]].path;
+	}
+	return list;
+}
+
+void
+registerShaderProgram(GLuint program, const char* vShaderFile, const char* fShaderFile,
+                      const char** feedbackVaryings, int numVaryings)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Program p;
+	p.program = program;
+	p.files[0] = (vShaderFile != NULL) ? vShaderFile : "";
+	p.files[1] = (fShaderFile != NULL) ? fShaderFile : "";
+	p.varyings.assign(feedbackVaryings, feedbackVaryings + numVaryings);
+	p.keys[0] = p.keys[1] = 0;
+	p.queued = false;
+	for (int s = 0; s < 2; s++) {
+		if (!p.files[s].empty()) { expandPath(p.files[s].c_str(), &p.keys[s]); }
+	}
+	programs.push_back(p);
+}
+
+void
+followShaderProgram(GLuint* program)
+{
+	if (std::find(followers.begin(), followers.end(), program) == followers.end()) {
+		followers.push_back(program);
+	}
+}
+
+void
+watchShaders()
+{
+	static bool registered = false;
+	if (!registered) {
+		atexit(stopWatchingShaders);
+		registered = true;
+	}
+	if (watching) { return; }
+
+	watching = true;
+	watcher = std::thread(watcherMain);
+}
+
+void
+stopWatchingShaders()
+{
+	watching = false;
+	if (watcher.joinable()) {
+		watcher.join();
+	}
+}
+
+bool
+updateShaders()
+{
+	static unsigned frame = 0;
+	frame++;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (size_t n = 0; n < changed.size(); n++) {
+			Program& p = programs[changed[n]];
+			p.queued = false;
+
+			// A newer change replaces a compile still in flight
+			for (size_t b = 0; b < building.size(); b++) {
+				if (building[b].index == changed[n]) {
+					cancelRebuild(building[b]);
+					building.erase(building.begin() + b);
+					break;
+				}
+			}
+
+			Rebuild r = { changed[n], glCreateProgram(), { 0, 0 }, false, frame };
+			for (int s = 0; s < 2; s++) {
+				std::map<uint64_t, Expansion>::const_iterator e = expansions.find(p.keys[s]);
+				if (p.files[s].empty() || e == expansions.end()) { continue; }
+
+				r.shaders[s] = glCreateShader(s == 0 ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER);
+				glShaderSource(r.shaders[s], (GLsizei)e->second.strings.size(),
+				               e->second.strings.data(), e->second.lengths.data());
+				glCompileShader(r.shaders[s]);
+				glAttachShader(r.scratch, r.shaders[s]);
+			}
+			building.push_back(r);
+		}
+		changed.clear();
+	}
+
+	// One step per rebuild and frame, and never in the frame that issued
+	//   the step before: the compiles, then the link, then the swap
+	for (size_t b = 0; b < building.size(); ) {
+		Rebuild& r = building[b];
+		bool done = r.issued != frame;
+		if (done && r.linking) {
+			done = ready(r.scratch, true);
+		}
+		for (int s = 0; done && !r.linking && s < 2; s++) {
+			if (r.shaders[s] != 0 && !ready(r.shaders[s], false)) { done = false; }
+		}
+		if (!done) {
+			b++;
+			continue;
+		}
+
+		if (!r.linking) {
+			if (startLink(r)) {
+				r.linking = true;
+				r.issued = frame;
+				b++;
+				continue;
+			}
+		}
+		else if (finishRebuild(r)) {
+			generation++;
+			building.erase(building.begin() + b);
+			continue;
+		}
+		std::cerr << "Keeping the previous code of shader program " << programs[r.index].program << std::endl;
+		cancelRebuild(r);
+		building.erase(building.begin() + b);
+	}
+
+	return !building.empty() || shadersPending();
+}
+
+bool
+shadersPending()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return !changed.empty();
+}
+
+unsigned
+shaderGeneration()
+{
+	return generation;
+}
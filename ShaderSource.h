@@ -0,0 +1,74 @@
+#ifndef __SHADERSOURCE_H__
+#define __SHADERSOURCE_H__
+
+#include "Angel.h"
+
+#include <string>
+
+//----------------------------------------------------------------------------
+//
+//  Shader files for InitShader(), with includes and hot reload.
+//
+//  Files are memory-mapped and never copied on our side: a shader's source
+//    is a list of pieces of the mapped files, handed to glShaderSource()
+//    as separate strings.  A line  #include "file"  stands for the pieces
+//    of that file, looked up next to the including file.  Every file has a
+//    source string number of its own, set with #line directives around
+//    its pieces, so compile logs point into the right file.
+//
+//  Each file is mapped and hashed once.  Expansions are cached by content:
+//    the key of a file covers its bytes and the keys of what it includes,
+//    so a chunk shared by many shaders is expanded once, and a file saved
+//    without changes leaves every key as it was.
+//
+//  watchShaders() starts a thread that follows the directories of the
+//    loaded files (inotify on Linux; elsewhere it hashes every file a few
+//    times a second).  When a file's content changes, the programs whose
+//    keys changed, through any include, are queued.  updateShaders()
+//    rebuilds them on the GL thread into a new program, one step per
+//    frame: the compiles, the link with the attribute locations of the
+//    old program, and the swap.  Where the driver has
+//    KHR_parallel_shader_compile a step waits until the driver's threads
+//    are done with the one before, so no frame waits for a compile.  The
+//    new program takes the old one's uniform values and its place; the
+//    old program is deleted and shaderGeneration() moves on.  One that
+//    fails prints its log and the old program keeps running.
+//
+
+// Maps path and what it includes and passes the pieces to glShaderSource()
+//   for shader.  False, with a message on std::cerr, when a file is
+//   missing or includes itself.
+bool         setShaderSource(GLuint shader, const char* path);
+
+// Which file each source string number in a compile log of path stands for
+std::string  shaderSourceFiles(const char* path);
+
+// Lets hot reload rebuild program from its files; fShaderFile may be NULL
+void         registerShaderProgram(GLuint program, const char* vShaderFile, const char* fShaderFile,
+                                   const char** feedbackVaryings, int numVaryings);
+
+// A variable that holds a program name from InitShader().  When a reload
+//   replaces that program, updateShaders() stores the new name in it.
+//   GL thread only.
+void         followShaderProgram(GLuint* program);
+
+// Starts the watcher thread.  stopWatchingShaders() is registered with
+//   atexit().
+void         watchShaders();
+void         stopWatchingShaders();
+
+// GL thread, once per frame: starts the compiles of changed programs and
+//   swaps in the finished ones.  True while work is left, so the caller
+//   keeps drawing frames until it is done.
+bool         updateShaders();
+
+// Whether changed programs are waiting for updateShaders(); any thread
+bool         shadersPending();
+
+// Counts the reloads.  Uniform locations looked up before a change are
+//   those of a deleted program, so every cache of them keeps the
+//   generation it was filled at and looks them up again when this has
+//   moved on.
+unsigned     shaderGeneration();
+
+#endif // __SHADERSOURCE_H__
@@ -0,0 +1,919 @@
+#include "SoftwareRaster.h"
+#include "CommandBuffer.h"
+#include "FrameArena.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "Parallel.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFTWARE_SSE2
+#endif
+
+namespace {
+
+const int    TileSize = 64;
+const float  SubPixel = 256.0f;    // vertex snapping, in steps per pixel
+
+enum { AttrZ, AttrInvW, AttrR, AttrG, AttrB, NumAttributes };
+
+enum { OutLeft = 1, OutRight = 2, OutBottom = 4, OutTop = 8, OutNear = 16, OutFar = 32 };
+
+// A lit vertex before the perspective divide
+struct ClipVertex {
+	float  p[4];
+	float  c[3];
+};
+
+// Window coordinates; the colors are divided by w for perspective
+//   correct interpolation
+struct WindowVertex {
+	float  x, y;
+	float  attr[NumAttributes];
+};
+
+struct RasterTriangle {
+	float  ea[3], eb[3], ec[3];     // edge k: ea*x + eb*y + ec, inside when > 0,
+	int    topLeft[3];              //   or == 0 on a top-left edge (~0 here)
+	float  ox, oy;                  // first vertex
+	float  d0[NumAttributes];       // attribute: d0 + da*(x - ox) + db*(y - oy)
+	float  da[NumAttributes];
+	float  db[NumAttributes];
+	int    minX, maxX, minY, maxY;  // pixels whose centers can be inside
+};
+
+struct RasterLine {
+	WindowVertex  v[2];
+};
+
+// What one block of commands produced; the bins hold primitive << 1,
+//   with the low bit set for lines
+struct Block {
+	std::vector<RasterTriangle>        triangles;
+	std::vector<RasterLine>            lines;
+	std::vector<std::vector<GLuint> >  bins;
+
+	// The vertices of the command at hand, lit, and in window coordinates
+	//   unless outside the near or far plane
+	std::vector<ClipVertex>            vertices;
+	std::vector<WindowVertex>          window;
+	std::vector<GLubyte>               outcodes;
+};
+
+std::vector<Block>   blocks;
+std::vector<GLuint>  colorBuffer;    // tilesX * TileSize wide, bottom row first
+std::vector<float>   depthBuffer;
+int                  width = 0, height = 0;
+int                  tilesX = 0, tilesY = 0, stride = 0;
+
+GLuint  presentTexture = 0, presentFramebuffer = 0;
+int     presentWidth = 0, presentHeight = 0;
+
+//----------------------------------------------------------------------------
+// Geometry
+
+inline float
+dot3(const GLfloat* a, const float* b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline void
+normalize3(float* v)
+{
+	float s = 1.0f / sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	v[0] *= s; v[1] *= s; v[2] *= s;
+}
+
+#ifdef SOFTWARE_SSE2
+// x^y for x in [0, 1] and y > 0, through log2 and exp2 polynomials good
+//   to about 2e-5 relative; 0 where x is 0
+inline __m128
+powLanes(__m128 x, __m128 y)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	// x = m * 2^e with m in [sqrt(1/2), sqrt(2))
+	__m128i bits = _mm_castps_si128(x);
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x7fffff)),
+		_mm_set1_epi32(0x3f800000)));
+	__m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+	m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))), _mm_andnot_ps(big, m));
+	e = _mm_add_ps(e, _mm_and_ps(big, one));
+
+	// ln(1 + t), the Cephes logf polynomial
+	static const float logCoefficients[] = { 7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f,
+		-1.2420140846e-1f, 1.4249322787e-1f, -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f,
+		3.3333331174e-1f };
+	__m128 t = _mm_sub_ps(m, one), z = _mm_mul_ps(t, t);
+	__m128 poly = _mm_set1_ps(logCoefficients[0]);
+	for (int k = 1; k < 9; k++) {
+		poly = _mm_add_ps(_mm_mul_ps(poly, t), _mm_set1_ps(logCoefficients[k]));
+	}
+	__m128 ln = _mm_add_ps(t, _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(t, z), poly), _mm_mul_ps(_mm_set1_ps(0.5f), z)));
+	__m128 v = _mm_mul_ps(y, _mm_add_ps(_mm_mul_ps(ln, _mm_set1_ps(1.44269504f)), e));
+	v = _mm_max_ps(v, _mm_set1_ps(-126.0f));
+
+	// 2^v = 2^n * 2^f with f in [0, 1)
+	__m128i n = _mm_cvttps_epi32(v);
+	__m128 fn = _mm_cvtepi32_ps(n);
+	__m128 above = _mm_cmpgt_ps(fn, v);
+	fn = _mm_sub_ps(fn, _mm_and_ps(above, one));
+	n = _mm_add_epi32(n, _mm_castps_si128(above));      // -1 where rounded up
+	__m128 f = _mm_sub_ps(v, fn);
+
+	static const float expCoefficients[] = { 1.540353039e-4f, 1.333355815e-3f, 9.618129108e-3f,
+		5.550410866e-2f, 2.402265070e-1f, 6.931471806e-1f, 1.0f };
+	__m128 p = _mm_set1_ps(expCoefficients[0]);
+	for (int k = 1; k < 7; k++) {
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(expCoefficients[k]));
+	}
+	__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+	return _mm_and_ps(_mm_mul_ps(p, scale), _mm_cmpgt_ps(x, _mm_setzero_ps()));
+}
+#endif
+
+// vshader53.glsl, on the CPU
+void
+lightVertices(const Mesh& m, const mat4& mv, const mat4& mvp, const DrawCommand& cmd,
+	const Light& light, ClipVertex* out)
+{
+	const GLfloat* r = (const GLfloat*)mv;      // rows of four
+	const GLfloat* q = (const GLfloat*)mvp;
+	GLuint i = 0;
+
+#ifdef SOFTWARE_SSE2
+	// Four vertices at a time
+	struct Lanes {
+		__m128 v;
+		Lanes() {}
+		Lanes(__m128 a) : v(a) {}
+		explicit Lanes(float a) : v(_mm_set1_ps(a)) {}
+		Lanes operator+(Lanes b) const { return _mm_add_ps(v, b.v); }
+		Lanes operator-(Lanes b) const { return _mm_sub_ps(v, b.v); }
+		Lanes operator*(Lanes b) const { return _mm_mul_ps(v, b.v); }
+	};
+	struct Vec3Lanes {
+		Lanes x, y, z;
+		void normalize() {
+			Lanes s = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps((x * x + y * y + z * z).v));
+			x = x * s; y = y * s; z = z * s;
+		}
+	};
+
+	for (; i + 4 <= m.numVertices; i += 4) {
+		__m128 p0 = _mm_loadu_ps(m.points[i]), p1 = _mm_loadu_ps(m.points[i + 1]);
+		__m128 p2 = _mm_loadu_ps(m.points[i + 2]), p3 = _mm_loadu_ps(m.points[i + 3]);
+		_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+		Lanes px(p0), py(p1), pz(p2), pw(p3);
+
+		const GLfloat* n[4] = { m.normals[i], m.normals[i + 1], m.normals[i + 2], m.normals[i + 3] };
+		Lanes nx(_mm_set_ps(n[3][0], n[2][0], n[1][0], n[0][0]));
+		Lanes ny(_mm_set_ps(n[3][1], n[2][1], n[1][1], n[0][1]));
+		Lanes nz(_mm_set_ps(n[3][2], n[2][2], n[1][2], n[0][2]));
+
+		Lanes pos[3];
+		Vec3Lanes N, L, E, H;
+		Lanes* nk[3] = { &N.x, &N.y, &N.z };
+		for (int k = 0; k < 3; k++) {
+			const GLfloat* row = r + 4 * k;
+			pos[k] = Lanes(row[0]) * px + Lanes(row[1]) * py + Lanes(row[2]) * pz + Lanes(row[3]) * pw;
+			*nk[k] = Lanes(row[0]) * nx + Lanes(row[1]) * ny + Lanes(row[2]) * nz;
+		}
+		L.x = Lanes(light.position.x) - pos[0];
+		L.y = Lanes(light.position.y) - pos[1];
+		L.z = Lanes(light.position.z) - pos[2];
+		E.x = Lanes(0.0f) - pos[0];
+		E.y = Lanes(0.0f) - pos[1];
+		E.z = Lanes(0.0f) - pos[2];
+		L.normalize();
+		E.normalize();
+		N.normalize();
+		H.x = L.x + E.x;
+		H.y = L.y + E.y;
+		H.z = L.z + E.z;
+		H.normalize();
+
+		__m128 LN = (L.x * N.x + L.y * N.y + L.z * N.z).v;
+		__m128 NH = (N.x * H.x + N.y * H.y + N.z * H.z).v;
+		Lanes kd(_mm_max_ps(LN, _mm_setzero_ps()));
+		Lanes ks(_mm_andnot_ps(_mm_cmplt_ps(LN, _mm_setzero_ps()),
+			powLanes(_mm_max_ps(NH, _mm_setzero_ps()), _mm_set1_ps(cmd.shininess))));
+
+		float c[3][4], clip[4][4];
+		for (int k = 0; k < 3; k++) {
+			_mm_storeu_ps(c[k], (Lanes(cmd.ambient[k]) + kd * Lanes(cmd.diffuse[k]) + ks * Lanes(cmd.specular[k])).v);
+		}
+		for (int k = 0; k < 4; k++) {
+			const GLfloat* row = q + 4 * k;
+			_mm_storeu_ps(clip[k], (Lanes(row[0]) * px + Lanes(row[1]) * py + Lanes(row[2]) * pz + Lanes(row[3]) * pw).v);
+		}
+		for (int j = 0; j < 4; j++) {
+			ClipVertex& v = out[i + j];
+			for (int k = 0; k < 3; k++) { v.c[k] = c[k][j]; }
+			for (int k = 0; k < 4; k++) { v.p[k] = clip[k][j]; }
+		}
+	}
+#endif
+
+	for (; i < m.numVertices; i++) {
+		const GLfloat* p = m.points[i];
+		const GLfloat* n = m.normals[i];
+		float pos[3], L[3], E[3], H[3], N[3];
+		for (int k = 0; k < 3; k++) {
+			pos[k] = dot3(r + 4 * k, p) + r[4 * k + 3] * p[3];
+			N[k] = dot3(r + 4 * k, n);
+			L[k] = light.position[k] - pos[k];
+			E[k] = -pos[k];
+		}
+		normalize3(L);
+		normalize3(E);
+		normalize3(N);
+		for (int k = 0; k < 3; k++) {
+			H[k] = L[k] + E[k];
+		}
+		normalize3(H);
+
+		float LN = L[0] * N[0] + L[1] * N[1] + L[2] * N[2];
+		float NH = N[0] * H[0] + N[1] * H[1] + N[2] * H[2];
+		float Kd = std::max(LN, 0.0f);
+		float Ks = (LN < 0.0f) ? 0.0f : powf(std::max(NH, 0.0f), cmd.shininess);
+
+		ClipVertex& v = out[i];
+		for (int k = 0; k < 3; k++) {
+			v.c[k] = cmd.ambient[k] + Kd * cmd.diffuse[k] + Ks * cmd.specular[k];
+		}
+		for (int k = 0; k < 4; k++) {
+			v.p[k] = dot3(q + 4 * k, p) + q[4 * k + 3] * p[3];
+		}
+	}
+}
+
+// Signed distance to the near (z + w >= 0) or far (w - z >= 0) plane
+inline float
+planeDistance(const ClipVertex& v, int plane)
+{
+	return (plane == 0) ? v.p[2] + v.p[3] : v.p[3] - v.p[2];
+}
+
+inline void
+lerpVertex(const ClipVertex& a, const ClipVertex& b, float t, ClipVertex* out)
+{
+	for (int k = 0; k < 4; k++) { out->p[k] = a.p[k] + t * (b.p[k] - a.p[k]); }
+	for (int k = 0; k < 3; k++) { out->c[k] = a.c[k] + t * (b.c[k] - a.c[k]); }
+}
+
+// The planes of the view volume a vertex lies outside of.  Behind the
+//   eye counts as outside the near plane.
+inline int
+outcode(const ClipVertex& v)
+{
+	float w = v.p[3];
+	return ((v.p[0] < -w) ? OutLeft : 0) | ((v.p[0] > w) ? OutRight : 0) |
+		((v.p[1] < -w) ? OutBottom : 0) | ((v.p[1] > w) ? OutTop : 0) |
+		((v.p[2] < -w || !(w > 0.0f)) ? OutNear : 0) | ((v.p[2] > w) ? OutFar : 0);
+}
+
+// Rounds to the subpixel grid, within a guard band of a million pixels
+inline float
+snap(float x)
+{
+	float s = std::min(std::max(x * SubPixel + 0.5f, -(float)(1 << 28)), (float)(1 << 28));
+	int i = (int)s;
+	return (i - ((float)i > s)) * (1.0f / SubPixel);
+}
+
+void
+toWindow(const ClipVertex& v, WindowVertex* out)
+{
+	float invW = 1.0f / v.p[3];
+	out->x = snap((0.5f * v.p[0] * invW + 0.5f) * width);
+	out->y = snap((0.5f * v.p[1] * invW + 0.5f) * height);
+	out->attr[AttrZ] = 0.5f * v.p[2] * invW + 0.5f;
+	out->attr[AttrInvW] = invW;
+	out->attr[AttrR] = v.c[0] * invW;
+	out->attr[AttrG] = v.c[1] * invW;
+	out->attr[AttrB] = v.c[2] * invW;
+}
+
+// Conservative: false only when no pixel center of the tile can be inside
+bool
+touchesTile(const RasterTriangle& t, int tx, int ty)
+{
+	float x0 = tx * TileSize + 0.5f, x1 = x0 + TileSize - 1;
+	float y0 = ty * TileSize + 0.5f, y1 = y0 + TileSize - 1;
+	for (int k = 0; k < 3; k++) {
+		float e = t.ea[k] * ((t.ea[k] > 0.0f) ? x1 : x0) + t.eb[k] * ((t.eb[k] > 0.0f) ? y1 : y0) + t.ec[k];
+		if (e < -(fabs(t.ea[k]) + fabs(t.eb[k]))) { return false; }
+	}
+	return true;
+}
+
+void
+binPrimitive(Block* b, GLuint entry, int minX, int maxX, int minY, int maxY, const RasterTriangle* t)
+{
+	int tx0 = minX / TileSize, tx1 = maxX / TileSize;
+	int ty0 = minY / TileSize, ty1 = maxY / TileSize;
+	bool single = tx0 == tx1 && ty0 == ty1;
+
+	for (int ty = ty0; ty <= ty1; ty++) {
+		for (int tx = tx0; tx <= tx1; tx++) {
+			if (t != NULL && !single && !touchesTile(*t, tx, ty)) { continue; }
+			b->bins[ty * tilesX + tx].push_back(entry);
+		}
+	}
+}
+
+void
+setupTriangle(const WindowVertex& v0, const WindowVertex& v1, const WindowVertex& v2, Block* b)
+{
+	const WindowVertex* v[3] = { &v0, &v1, &v2 };
+	float x[3] = { v0.x, v1.x, v2.x }, y[3] = { v0.y, v1.y, v2.y };
+
+	// Counter-clockwise triangles face the viewer, as with GL_CULL_FACE
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (!(area > 0.0f)) { return; }
+
+	float lox = std::min(x[0], std::min(x[1], x[2])), hix = std::max(x[0], std::max(x[1], x[2]));
+	float loy = std::min(y[0], std::min(y[1], y[2])), hiy = std::max(y[0], std::max(y[1], y[2]));
+	RasterTriangle t;
+	t.minX = std::max((int)ceilf(lox - 0.5f), 0);
+	t.maxX = std::min((int)floorf(hix - 0.5f), width - 1);
+	t.minY = std::max((int)ceilf(loy - 0.5f), 0);
+	t.maxY = std::min((int)floorf(hiy - 0.5f), height - 1);
+	if (t.minX > t.maxX || t.minY > t.maxY) { return; }
+
+	for (int k = 0; k < 3; k++) {
+		int j = (k + 1) % 3;
+		t.ea[k] = y[k] - y[j];
+		t.eb[k] = x[j] - x[k];
+
+		// The constant comes from the same endpoint whichever way the edge
+		//   runs, so the triangle on the other side of a shared edge gets
+		//   exactly the negated function
+		int o = (x[k] < x[j] || (x[k] == x[j] && y[k] < y[j])) ? k : j;
+		t.ec[k] = -(t.ea[k] * x[o] + t.eb[k] * y[o]);
+		t.topLeft[k] = (t.ea[k] > 0.0f || (t.ea[k] == 0.0f && t.eb[k] < 0.0f)) ? ~0 : 0;
+	}
+
+	t.ox = x[0];
+	t.oy = y[0];
+	for (int a = 0; a < NumAttributes; a++) {
+		float f0 = v[0]->attr[a], f1 = v[1]->attr[a], f2 = v[2]->attr[a];
+		t.d0[a] = f0;
+		t.da[a] = ((f1 - f0) * (y[2] - y[0]) - (f2 - f0) * (y[1] - y[0])) / area;
+		t.db[a] = ((x[1] - x[0]) * (f2 - f0) - (x[2] - x[0]) * (f1 - f0)) / area;
+	}
+
+	b->triangles.push_back(t);
+	binPrimitive(b, (GLuint)(b->triangles.size() - 1) << 1, t.minX, t.maxX, t.minY, t.maxY,
+		&b->triangles.back());
+}
+
+void
+addTriangle(GLuint i0, GLuint i1, GLuint i2, Block* b)
+{
+	const GLubyte* code = b->outcodes.data();
+	if (code[i0] & code[i1] & code[i2]) { return; }
+	if (!((code[i0] | code[i1] | code[i2]) & (OutNear | OutFar))) {
+		setupTriangle(b->window[i0], b->window[i1], b->window[i2], b);
+		return;
+	}
+
+	// Clip against the near and far planes; the sides are left to the
+	//   guard band and the pixel bounds
+	ClipVertex poly[8], next[8];
+	int n = 3;
+	poly[0] = b->vertices[i0]; poly[1] = b->vertices[i1]; poly[2] = b->vertices[i2];
+	for (int plane = 0; plane < 2; plane++) {
+		int m = 0;
+		for (int i = 0; i < n; i++) {
+			const ClipVertex& a = poly[i];
+			const ClipVertex& c = poly[(i + 1) % n];
+			float da = planeDistance(a, plane), dc = planeDistance(c, plane);
+			if (da >= 0.0f) { next[m++] = a; }
+			if ((da >= 0.0f) != (dc >= 0.0f)) { lerpVertex(a, c, da / (da - dc), &next[m++]); }
+		}
+		if (m < 3) { return; }
+		std::copy(next, next + m, poly);
+		n = m;
+	}
+
+	WindowVertex w[8];
+	for (int i = 0; i < n; i++) {
+		if (!(poly[i].p[3] > 0.0f)) { return; }
+		toWindow(poly[i], &w[i]);
+	}
+	for (int i = 1; i + 1 < n; i++) {
+		setupTriangle(w[0], w[i], w[i + 1], b);
+	}
+}
+
+void
+addLine(GLuint i0, GLuint i1, Block* b)
+{
+	const GLubyte* code = b->outcodes.data();
+	if (code[i0] & code[i1]) { return; }
+
+	RasterLine l;
+	if (!((code[i0] | code[i1]) & (OutNear | OutFar))) {
+		l.v[0] = b->window[i0];
+		l.v[1] = b->window[i1];
+	}
+	else {
+		const ClipVertex& v0 = b->vertices[i0];
+		const ClipVertex& v1 = b->vertices[i1];
+		float t0 = 0.0f, t1 = 1.0f;
+		for (int plane = 0; plane < 2; plane++) {
+			float d0 = planeDistance(v0, plane), d1 = planeDistance(v1, plane);
+			if (d0 < 0.0f && d1 < 0.0f) { return; }
+			if (d0 < 0.0f) { t0 = std::max(t0, d0 / (d0 - d1)); }
+			if (d1 < 0.0f) { t1 = std::min(t1, d0 / (d0 - d1)); }
+		}
+		if (t0 > t1) { return; }
+
+		ClipVertex c[2];
+		lerpVertex(v0, v1, t0, &c[0]);
+		lerpVertex(v0, v1, t1, &c[1]);
+		if (!(c[0].p[3] > 0.0f) || !(c[1].p[3] > 0.0f)) { return; }
+		toWindow(c[0], &l.v[0]);
+		toWindow(c[1], &l.v[1]);
+	}
+
+	int minX = std::max((int)floorf(std::min(l.v[0].x, l.v[1].x)) - 1, 0);
+	int maxX = std::min((int)floorf(std::max(l.v[0].x, l.v[1].x)) + 1, width - 1);
+	int minY = std::max((int)floorf(std::min(l.v[0].y, l.v[1].y)) - 1, 0);
+	int maxY = std::min((int)floorf(std::max(l.v[0].y, l.v[1].y)) + 1, height - 1);
+	if (minX > maxX || minY > maxY) { return; }
+
+	b->lines.push_back(l);
+	binPrimitive(b, ((GLuint)(b->lines.size() - 1) << 1) | 1, minX, maxX, minY, maxY, NULL);
+}
+
+void
+drawCommand(const DrawCommand& cmd, const mat4& projection, const Light& light, Block* b)
+{
+	const Mesh& m = meshes[cmd.mesh];
+	mat4 mv;
+	memcpy(&mv, cmd.modelView, sizeof(mv));
+
+	b->vertices.resize(m.numVertices);
+	b->window.resize(m.numVertices);
+	b->outcodes.resize(m.numVertices);
+	lightVertices(m, mv, projection * mv, cmd, light, b->vertices.data());
+
+	for (GLuint i = 0; i < m.numVertices; i++) {
+		int code = outcode(b->vertices[i]);
+		b->outcodes[i] = (GLubyte)code;
+		if (!(code & (OutNear | OutFar))) { toWindow(b->vertices[i], &b->window[i]); }
+	}
+
+	// The same primitives drawMesh() sends to GL
+	if (cmd.mode == GL_LINES && m.numEdgeIndices > 0) {
+		for (GLuint i = 0; i + 1 < m.numEdgeIndices; i += 2) {
+			addLine(m.edges[i], m.edges[i + 1], b);
+		}
+	}
+	else if (cmd.mode == GL_LINES) {
+		for (GLuint i = 0; i + 1 < m.numVertices; i += 2) {
+			addLine(i, i + 1, b);
+		}
+	}
+	else if (m.lods[cmd.lod].numIndices > 0) {
+		const GLuint* indices = m.indices + m.lods[cmd.lod].firstIndex;
+		for (GLuint i = 0; i + 2 < m.lods[cmd.lod].numIndices; i += 3) {
+			addTriangle(indices[i], indices[i + 1], indices[i + 2], b);
+		}
+	}
+	else {
+		for (GLuint i = 0; i + 2 < m.numVertices; i += 3) {
+			addTriangle(i, i + 1, i + 2, b);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// Tiles
+
+inline GLuint
+packColor(float r, float g, float b, float a)
+{
+	r = std::min(std::max(r, 0.0f), 1.0f);
+	g = std::min(std::max(g, 0.0f), 1.0f);
+	b = std::min(std::max(b, 0.0f), 1.0f);
+	a = std::min(std::max(a, 0.0f), 1.0f);
+	return (GLuint)(r * 255.0f + 0.5f) | (GLuint)(g * 255.0f + 0.5f) << 8 |
+		(GLuint)(b * 255.0f + 0.5f) << 16 | (GLuint)(a * 255.0f + 0.5f) << 24;
+}
+
+// Depth test and write of one pixel; the colors are still divided by w
+inline void
+shadePixel(int x, int y, const float* attr)
+{
+	float* z = &depthBuffer[y * stride + x];
+	if (!(attr[AttrZ] < *z)) { return; }
+
+	float w = 1.0f / attr[AttrInvW];
+	*z = attr[AttrZ];
+	colorBuffer[y * stride + x] = packColor(attr[AttrR] * w, attr[AttrG] * w, attr[AttrB] * w, 1.0f);
+}
+
+// The part of triangle t in pixels [x0, x1] x [y0, y1] of one tile
+void
+rasterTriangle(const RasterTriangle& t, int x0, int x1, int y0, int y1)
+{
+	x0 = std::max(x0, t.minX) & ~3;
+	x1 = std::min(x1, t.maxX);
+	y0 = std::max(y0, t.minY);
+	y1 = std::min(y1, t.maxY);
+
+#ifdef SOFTWARE_SSE2
+	const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+	const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+
+	__m128 ea[3], tl[3], da[NumAttributes];
+	for (int k = 0; k < 3; k++) {
+		ea[k] = _mm_set1_ps(t.ea[k]);
+		tl[k] = _mm_castsi128_ps(_mm_set1_epi32(t.topLeft[k]));
+	}
+	for (int a = 0; a < NumAttributes; a++) {
+		da[a] = _mm_set1_ps(t.da[a]);
+	}
+
+	for (int y = y0; y <= y1; y++) {
+		float py = y + 0.5f;
+		__m128 er[3], ar[NumAttributes];
+		for (int k = 0; k < 3; k++) {
+			er[k] = _mm_set1_ps(t.eb[k] * py + t.ec[k]);
+		}
+		for (int a = 0; a < NumAttributes; a++) {
+			ar[a] = _mm_set1_ps(t.d0[a] + t.db[a] * (py - t.oy));
+		}
+		float* zrow = &depthBuffer[y * stride];
+		GLuint* crow = &colorBuffer[y * stride];
+
+		for (int x = x0; x <= x1; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int k = 0; k < 3; k++) {
+				__m128 e = _mm_add_ps(_mm_mul_ps(ea[k], px), er[k]);
+				inside = _mm_and_ps(inside, _mm_or_ps(_mm_cmpgt_ps(e, zero),
+					_mm_and_ps(tl[k], _mm_cmpeq_ps(e, zero))));
+			}
+			if (_mm_movemask_ps(inside) == 0) { continue; }
+
+			__m128 dx = _mm_sub_ps(px, _mm_set1_ps(t.ox));
+			__m128 z = _mm_add_ps(_mm_mul_ps(da[AttrZ], dx), ar[AttrZ]);
+			__m128 old = _mm_loadu_ps(zrow + x);
+			__m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(z, old));
+			if (_mm_movemask_ps(pass) == 0) { continue; }
+
+			__m128 w = _mm_div_ps(one, _mm_add_ps(_mm_mul_ps(da[AttrInvW], dx), ar[AttrInvW]));
+			__m128i rgb = alpha;
+			for (int a = AttrR; a <= AttrB; a++) {
+				__m128 c = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(da[a], dx), ar[a]), w);
+				c = _mm_min_ps(_mm_max_ps(c, zero), one);
+				__m128i byte = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+				rgb = _mm_or_si128(rgb, _mm_slli_epi32(byte, 8 * (a - AttrR)));
+			}
+
+			_mm_storeu_ps(zrow + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old)));
+			__m128i mask = _mm_castps_si128(pass);
+			__m128i before = _mm_loadu_si128((const __m128i*)(crow + x));
+			_mm_storeu_si128((__m128i*)(crow + x),
+				_mm_or_si128(_mm_and_si128(mask, rgb), _mm_andnot_si128(mask, before)));
+		}
+	}
+#else
+	for (int y = y0; y <= y1; y++) {
+		float py = y + 0.5f;
+		float er[3];
+		for (int k = 0; k < 3; k++) {
+			er[k] = t.eb[k] * py + t.ec[k];
+		}
+
+		for (int x = x0; x <= x1; x++) {
+			float px = x + 0.5f;
+			bool inside = true;
+			for (int k = 0; k < 3 && inside; k++) {
+				float e = t.ea[k] * px + er[k];
+				inside = e > 0.0f || (e == 0.0f && t.topLeft[k] != 0);
+			}
+			if (!inside) { continue; }
+
+			float attr[NumAttributes];
+			for (int a = 0; a < NumAttributes; a++) {
+				attr[a] = t.d0[a] + t.db[a] * (py - t.oy) + t.da[a] * (px - t.ox);
+			}
+			shadePixel(x, y, attr);
+		}
+	}
+#endif
+}
+
+// Pixel centers along the major axis in [start, end), one pixel across
+void
+rasterLine(const RasterLine& l, int x0, int x1, int y0, int y1)
+{
+	float dx = l.v[1].x - l.v[0].x, dy = l.v[1].y - l.v[0].y;
+	bool xMajor = fabs(dx) >= fabs(dy);
+	int s = ((xMajor ? dx : dy) < 0.0f) ? 1 : 0;
+	const WindowVertex& a = l.v[s];
+	const WindowVertex& b = l.v[1 - s];
+
+	float major0 = xMajor ? a.x : a.y, major1 = xMajor ? b.x : b.y;
+	float minor0 = xMajor ? a.y : a.x, minor1 = xMajor ? b.y : b.x;
+	if (major1 <= major0) { return; }
+
+	int lo = std::max((int)ceilf(major0 - 0.5f), xMajor ? x0 : y0);
+	int hi = std::min((int)ceilf(major1 - 0.5f) - 1, xMajor ? x1 : y1);
+	int minorLo = xMajor ? y0 : x0, minorHi = xMajor ? y1 : x1;
+
+	for (int i = lo; i <= hi; i++) {
+		float t = (i + 0.5f - major0) / (major1 - major0);
+		int j = (int)floorf(minor0 + t * (minor1 - minor0));
+		if (j < minorLo || j > minorHi) { continue; }
+
+		float attr[NumAttributes];
+		for (int k = 0; k < NumAttributes; k++) {
+			attr[k] = a.attr[k] + t * (b.attr[k] - a.attr[k]);
+		}
+		if (xMajor) { shadePixel(i, j, attr); }
+		else        { shadePixel(j, i, attr); }
+	}
+}
+
+void
+rasterTile(int tile, int numBlocks, GLuint clear)
+{
+	int tx = tile % tilesX, ty = tile / tilesX;
+	int x0 = tx * TileSize, x1 = std::min(x0 + TileSize, width) - 1;
+	int y0 = ty * TileSize, y1 = std::min(y0 + TileSize, height) - 1;
+
+	for (int y = y0; y < y0 + TileSize; y++) {
+		std::fill(&colorBuffer[y * stride + x0], &colorBuffer[y * stride + x0] + TileSize, clear);
+		std::fill(&depthBuffer[y * stride + x0], &depthBuffer[y * stride + x0] + TileSize, 1.0f);
+	}
+
+	// Blocks in command order, so equal depths resolve as they do in GL
+	for (int b = 0; b < numBlocks; b++) {
+		const Block& block = blocks[b];
+		const std::vector<GLuint>& bin = block.bins[tile];
+		for (size_t i = 0; i < bin.size(); i++) {
+			if (bin[i] & 1) { rasterLine(block.lines[bin[i] >> 1], x0, x1, y0, y1); }
+			else            { rasterTriangle(block.triangles[bin[i] >> 1], x0, x1, y0, y1); }
+		}
+	}
+}
+
+// One chunk per pass when not parallel
+void
+renderFrame(const mat4& projection, const Light& light, const color4& clear, bool parallel)
+{
+	int numBuffers;
+	const CommandBuffer* buffers = recordedCommands(&numBuffers);
+	if ((int)blocks.size() < numBuffers) { blocks.resize(numBuffers); }
+	int numTiles = tilesX * tilesY;
+
+	double t = timeNow();
+	parallelFor(numBuffers, parallel ? 1 : std::max(numBuffers, 1), [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			Block& b = blocks[i];
+			b.triangles.clear();
+			b.lines.clear();
+			b.bins.resize(numTiles);
+			for (int k = 0; k < numTiles; k++) { b.bins[k].clear(); }
+
+			for (int c = 0; c < buffers[i].count; c++) {
+				drawCommand(buffers[i].commands[c], projection, light, &b);
+			}
+		}
+	});
+	for (int i = 0; i < numBuffers; i++) {
+		frameStats.rasterTriangles += (int)blocks[i].triangles.size();
+		frameStats.rasterLines += (int)blocks[i].lines.size();
+	}
+	double geometry = timeNow();
+	frameStats.rasterGeometryMs += (geometry - t) * 1000.0;
+
+	GLuint clearPixel = packColor(clear.x, clear.y, clear.z, clear.w);
+	parallelFor(numTiles, parallel ? 1 : std::max(numTiles, 1), [&](int begin, int end, int) {
+		for (int tile = begin; tile < end; tile++) {
+			rasterTile(tile, numBuffers, clearPixel);
+		}
+	});
+	frameStats.rasterTilesMs += (timeNow() - geometry) * 1000.0;
+}
+
+}  // namespace
+
+//----------------------------------------------------------------------------
+
+void
+resizeSoftwareTarget(int w, int h)
+{
+	width = std::max(w, 1);
+	height = std::max(h, 1);
+	tilesX = (width + TileSize - 1) / TileSize;
+	tilesY = (height + TileSize - 1) / TileSize;
+	stride = tilesX * TileSize;
+
+	// Whole tiles, so the rasterizer never checks the image edges
+	colorBuffer.assign((size_t)stride * tilesY * TileSize, 0);
+	depthBuffer.assign((size_t)stride * tilesY * TileSize, 1.0f);
+}
+
+int softwareWidth() { return width; }
+int softwareHeight() { return height; }
+
+void
+renderSoftware(const mat4& projection, const Light& light, const color4& clear)
+{
+	renderFrame(projection, light, clear, true);
+}
+
+const GLubyte*
+softwarePixels()
+{
+	return (const GLubyte*)colorBuffer.data();
+}
+
+int
+softwareStride()
+{
+	return stride;
+}
+
+bool
+writeSoftwareImage(const char* path)
+{
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL) {
+		std::cerr << "Failed to write image " << path << std::endl;
+		return false;
+	}
+
+	fprintf(fp, "P6\n%d %d\n255\n", width, height);
+	std::vector<GLubyte> row(3 * width);
+	for (int y = height - 1; y >= 0; y--) {
+		const GLubyte* src = softwarePixels() + (size_t)y * stride * 4;
+		for (int x = 0; x < width; x++) {
+			row[3 * x] = src[4 * x];
+			row[3 * x + 1] = src[4 * x + 1];
+			row[3 * x + 2] = src[4 * x + 2];
+		}
+		fwrite(row.data(), 1, row.size(), fp);
+	}
+
+	bool ok = !ferror(fp);
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		std::cerr << "Failed to write image " << path << std::endl;
+	}
+	return ok;
+}
+
+void
+presentSoftwareFrame(int windowWidth, int windowHeight)
+{
+	if (presentTexture == 0) {
+		glGenTextures(1, &presentTexture);
+		glGenFramebuffers(1, &presentFramebuffer);
+	}
+
+	stateBindTexture(0, GL_TEXTURE_2D, presentTexture);
+	if (presentWidth != width || presentHeight != height) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		presentWidth = width;
+		presentHeight = height;
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, softwarePixels());
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	GLuint target = stateCurrentFramebuffer();
+	stateBindReadFramebuffer(presentFramebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, presentTexture, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+		(width == windowWidth && height == windowHeight) ? GL_NEAREST : GL_LINEAR);
+	stateBindReadFramebuffer(target);
+}
+
+//----------------------------------------------------------------------------
+
+void
+rasterBenchmark(GLuint program, int nodes, int frames, int w, int h)
+{
+	Scene s;
+	initScene(&s, nodes, 16);
+	addRandomNodes(&s, nodes, 5.0, 1);
+	for (int i = 0; i < nodes; i += 4) {
+		s.mode[i] = GL_LINES;
+	}
+
+	Light light;
+	light.position = point4(2.0, 4.0, 6.0, 1.0);
+	light.ambient = color4(0.2, 0.2, 0.2, 1.0);
+	light.diffuse = light.specular = color4(1.0, 1.0, 1.0, 1.0);
+	color4 clear(0.75, 0.75, 0.75, 1.0);
+	mat4 view = Translate(0.0, 0.0, -8.0) * RotateX(20.0);
+	mat4 projection = Perspective(70.0, GLfloat(w) / h, 1.0, 20.0);
+
+	resetFrameArena();
+	recordScene(s, view, light);
+	resizeSoftwareTarget(w, h);
+
+	double t = timeNow();
+	for (int f = 0; f < frames; f++) {
+		renderFrame(projection, light, clear, false);
+	}
+	double serial = (timeNow() - t) * 1000.0 / frames;
+
+	beginFrameStats();
+	t = timeNow();
+	for (int f = 0; f < frames; f++) {
+		renderFrame(projection, light, clear, true);
+	}
+	double parallel = (timeNow() - t) * 1000.0 / frames;
+	double geometryMs = frameStats.rasterGeometryMs / frames, tilesMs = frameStats.rasterTilesMs / frames;
+	int triangles = frameStats.rasterTriangles / frames, lines = frameStats.rasterLines / frames;
+
+	// The same commands through GL, into a framebuffer of the same size
+	GLuint fbo, buffers[2];
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(2, buffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, buffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, buffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+
+	GLuint previous = stateCurrentFramebuffer();
+	stateBindFramebuffer(fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, buffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, buffers[1]);
+	stateViewport(0, 0, w, h);
+	stateEnable(GL_DEPTH_TEST);
+	stateDepthFunc(GL_LESS);
+	stateEnable(GL_CULL_FACE);
+	stateCullFace(GL_BACK);
+	glClearColor(clear.x, clear.y, clear.z, clear.w);
+	stateUseProgram(program);
+	glUniformMatrix4fv(glGetUniformLocation(program, "Projection"), 1, GL_TRUE, projection);
+
+	double gl = 0.0;
+	for (int f = 0; f <= frames; f++) {
+		// The first frame warms up the driver and is not timed
+		t = timeNow();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		submitCommands(program, light);
+		glFinish();
+		gl += (f > 0) ? timeNow() - t : 0.0;
+	}
+	gl = gl * 1000.0 / frames;
+
+	// Pixels differing by more than rounding
+	std::vector<GLubyte> pixels(4 * w * h);
+	glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	int differ = 0, maxDiff = 0;
+	for (int y = 0; y < h; y++) {
+		const GLubyte* a = softwarePixels() + (size_t)y * stride * 4;
+		const GLubyte* b = &pixels[(size_t)y * w * 4];
+		for (int x = 0; x < w; x++) {
+			int worst = 0;
+			for (int k = 0; k < 3; k++) {
+				worst = std::max(worst, abs(a[4 * x + k] - b[4 * x + k]));
+			}
+			differ += worst > 2;
+			maxDiff = std::max(maxDiff, worst);
+		}
+	}
+
+	stateBindFramebuffer(previous);
+	stateDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(2, buffers);
+
+	std::cout << "raster: " << nodes << " nodes at " << w << "x" << h << ", "
+	          << triangles << " triangles and " << lines << " lines after clipping" << std::endl
+	          << "  software, 1 thread    " << serial << " ms/frame" << std::endl
+	          << "  software, " << workerCount() << " workers   " << parallel << " ms/frame ("
+	          << serial / parallel << "x): geometry " << geometryMs << " ms, tiles "
+	          << tilesMs << " ms" << std::endl
+	          << "  GL " << (const char*)glGetString(GL_RENDERER) << "  " << gl << " ms/frame" << std::endl
+	          << "  " << differ << " of " << w * h << " pixels differ by more than 2 (at most "
+	          << maxDiff << ")" << std::endl;
+
+	freeScene(&s);
+}
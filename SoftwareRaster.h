@@ -0,0 +1,59 @@
+#ifndef __SOFTWARERASTER_H__
+#define __SOFTWARERASTER_H__
+
+#include "Angel.h"
+#include "Scene.h"
+
+//----------------------------------------------------------------------------
+//
+//  Software rendering backend.
+//
+//  renderSoftware() draws the commands of the last recordScene()
+//    (CommandBuffer.h) into a CPU image, with the lighting of vshader53.glsl
+//    evaluated per vertex and interpolated with perspective correction, a
+//    GL_LESS depth test and back faces culled, as the GL path draws them.
+//    Nothing in it calls GL, so it also runs where no driver exists.
+//
+//  A frame is two passes over the worker pool:
+//
+//    geometry  each block of commands lights and transforms the vertices
+//              of its meshes, clips against the near and far planes and
+//              bins the surviving triangles and lines into the 64x64
+//              tiles they touch.  Every block has bins of its own.
+//    raster    each tile is cleared and filled by a single worker, which
+//              walks the bins of all blocks in command order, four pixels
+//              at a time with SSE2 where it is available.
+//
+//  Triangles follow the top-left fill rule at pixel centers, with vertices
+//    snapped to 1/256 pixel, so edges shared by two triangles are covered
+//    exactly once.  Lines are one pixel wide and drawn along their major
+//    axis.  Only the scene nodes are drawn: robot arms, GPU particles and
+//    point lights need GL.
+//
+
+// Sets the image size; the contents are undefined until the next render
+void resizeSoftwareTarget(int width, int height);
+int  softwareWidth();
+int  softwareHeight();
+
+void renderSoftware(const mat4& projection, const Light& light, const color4& clear);
+
+// RGBA8 pixels, bottom row first as glReadPixels returns them.  Row y
+//   starts at softwarePixels() + y * softwareStride() * 4.
+const GLubyte* softwarePixels();
+int            softwareStride();
+
+// Binary PPM of the image, top row first
+bool writeSoftwareImage(const char* path);
+
+// Stretches the image over the bound framebuffer of a width x height
+//   window (GL thread only)
+void presentSoftwareFrame(int width, int height);
+
+// Renders `nodes` random objects at the window size with the software
+//   backend on one thread and on the whole pool, then with `program` in
+//   GL, and compares the images.  Needs a GL context; run with
+//   LIBGL_ALWAYS_SOFTWARE=1 to measure against Mesa llvmpipe.
+void rasterBenchmark(GLuint program, int nodes, int frames, int width, int height);
+
+#endif // __SOFTWARERASTER_H__
@@ -0,0 +1,70 @@
+#include "Stats.h"
+
+#include <chrono>
+#include <cstring>
+
+FrameStats  frameStats;
+
+//----------------------------------------------------------------------------
+
+double
+timeNow()
+{
+	using namespace std::chrono;
+	static const steady_clock::time_point start = steady_clock::now();
+	return duration<double>(steady_clock::now() - start).count();
+}
+
+//----------------------------------------------------------------------------
+
+void
+beginFrameStats()
+{
+	static double lastFrame = timeNow();
+	double now = timeNow();
+
+	unsigned long frame = frameStats.frame;
+	memset(&frameStats, 0, sizeof(frameStats));
+	frameStats.frame = frame + 1;
+	frameStats.frameMs = (now - lastFrame) * 1000.0;
+	lastFrame = now;
+}
+
+//----------------------------------------------------------------------------
+
+void
+printFrameStats(std::ostream& os)
+{
+	const FrameStats& s = frameStats;
+	os << "frame " << s.frame << ": " << s.frameMs << " ms, started "
+	   << s.paceLateMs << " ms late" << std::endl
+	   << "  memory: " << s.heapAllocations << " heap allocations, "
+	   << s.arenaBytes << " bytes from the frame arena" << std::endl
+	   << "  physics: " << s.numBodies << " bodies, "
+	   << s.broadPhasePairs << " candidate pairs, "
+	   << s.contactPairs << " contacts, "
+	   << s.staticContacts << " static contacts" << std::endl
+	   << "  integrate " << s.integrateMs << " ms, broad phase "
+	   << s.broadPhaseMs << " ms, narrow phase " << s.narrowPhaseMs << " ms" << std::endl
+	   << "  render: " << s.drawCalls << " draw calls, "
+	   << s.verticesShaded << " vertices, record "
+	   << s.recordMs << " ms, submit " << s.submitMs << " ms" << std::endl
+	   << "  resolution: scale " << s.resolutionScale << ", gpu "
+	   << s.gpuMs << " ms" << std::endl
+	   << "  gl state: " << s.glCalls << " calls issued, "
+	   << s.glCallsFiltered << " filtered" << std::endl
+	   << "  culling: " << s.occluders << " occluders (" << s.occluderTriangles
+	   << " triangles), " << s.culledOutside << " outside the view, "
+	   << s.culledOccluded << " occluded, raster " << s.occlusionRasterMs
+	   << " ms, tests " << s.occlusionTestMs << " ms" << std::endl
+	   << "  lights: " << s.numLights << " point lights, "
+	   << s.lightIndices << " cluster entries (at most " << s.maxClusterLights
+	   << " per cluster), binning " << s.clusterMs << " ms" << std::endl
+	   << "  robots: " << s.robotArms << " arms, kinematics "
+	   << s.kinematicsMs << " ms" << std::endl
+	   << "  software: " << s.rasterTriangles << " triangles, "
+	   << s.rasterLines << " lines, geometry " << s.rasterGeometryMs
+	   << " ms, tiles " << s.rasterTilesMs << " ms" << std::endl
+	   << "  capture: " << s.captureFrames << " frames, " << s.captureDropped
+	   << " dropped, " << s.captureMs << " ms" << std::endl;
+}
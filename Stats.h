@@ -0,0 +1,77 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <iostream>
+
+//----------------------------------------------------------------------------
+//
+//  Per-frame counters.  Each subsystem fills in its own fields while the
+//    frame is built; beginFrameStats() clears them at the start of
+//    display().  Times are in milliseconds.
+//
+
+struct FrameStats {
+	unsigned long  frame;
+	double         frameMs;
+	double         paceLateMs;        // start of the frame past its deadline
+	int            heapAllocations;   // operator new calls during display()
+	int            arenaBytes;        // frame arena used (FrameArena.h)
+
+	// physics
+	int            numBodies;
+	int            broadPhasePairs;   // candidate pairs from the spatial hash
+	int            contactPairs;      // candidates that actually overlap
+	int            staticContacts;    // body against static scene pieces
+	double         integrateMs;
+	double         broadPhaseMs;
+	double         narrowPhaseMs;
+
+	// rendering
+	int            drawCalls;
+	int            verticesShaded;    // distinct vertices per draw (ideal vertex cache)
+	int            glCalls;           // state changes sent to GL (GLState.h)
+	int            glCallsFiltered;   // redundant or invalid ones dropped
+	double         recordMs;          // building draw commands (all workers)
+	double         submitMs;          // replaying them on the GL thread
+	double         resolutionScale;   // of the window size (DynamicResolution.h)
+	double         gpuMs;             // smoothed GPU time of the scaled scene
+
+	// occlusion culling
+	int            occluders;
+	int            occluderTriangles;
+	int            culledOutside;     // bounds outside the view volume
+	int            culledOccluded;    // bounds behind the occluders
+	double         occlusionRasterMs; // occluder depth buffer and pyramid
+	double         occlusionTestMs;
+
+	// clustered lighting
+	int            numLights;
+	int            lightIndices;      // entries in all cluster light lists
+	int            maxClusterLights;  // longest list of a single cluster
+	double         clusterMs;         // binning and upload
+
+	// instanced robot arms
+	int            robotArms;
+	double         kinematicsMs;      // joint palette for all arms
+
+	// software rasterizer
+	int            rasterTriangles;   // binned after clipping and culling
+	int            rasterLines;
+	double         rasterGeometryMs;  // vertices, clipping and binning
+	double         rasterTilesMs;
+
+	// frame capture
+	int            captureFrames;     // handed to the encoder
+	int            captureDropped;    // ring or encoder queue full
+	double         captureMs;         // readback and copies on this thread
+};
+
+extern FrameStats  frameStats;
+
+// Seconds from an arbitrary, monotonic origin
+double timeNow();
+
+void beginFrameStats();
+void printFrameStats(std::ostream& os);
+
+#endif // __STATS_H__
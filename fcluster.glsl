@@ -0,0 +1,71 @@
+#version 150
+
+// The main light of vshader53.glsl, per fragment, plus every point light
+//   binned into this fragment's cluster
+
+in  vec3 fPosition;
+in  vec3 fNormal;
+out vec4 fColor;
+
+uniform vec4 AmbientProduct, DiffuseProduct, SpecularProduct;
+uniform vec4 LightPosition;
+uniform float Shininess;
+
+uniform samplerBuffer  Lights;        // per light: (position, radius), (color, 0)
+uniform usamplerBuffer Clusters;      // per cluster: first index, light count
+uniform usamplerBuffer LightIndices;
+
+uniform ivec3 ClusterDims;
+uniform vec2  ViewportSize;
+uniform vec2  ClusterDepth;           // near plane, slices per log unit of depth
+
+void main()
+{
+    vec3 N = normalize( fNormal );
+    vec3 E = normalize( -fPosition );
+
+    vec3 L = normalize( LightPosition.xyz - fPosition );
+    vec3 H = normalize( L + E );
+
+    float Kd = max( dot(L, N), 0.0 );
+    float Ks = pow( max(dot(N, H), 0.0), Shininess );
+    if ( dot(L, N) < 0.0 ) {
+	Ks = 0.0;
+    }
+
+    vec3 color = AmbientProduct.rgb + Kd*DiffuseProduct.rgb + Ks*SpecularProduct.rgb;
+
+    ivec2 tile = ivec2( gl_FragCoord.xy / ViewportSize * vec2(ClusterDims.xy) );
+    tile = clamp( tile, ivec2(0), ClusterDims.xy - 1 );
+    int slice = int( log(max(-fPosition.z, ClusterDepth.x) / ClusterDepth.x) * ClusterDepth.y );
+    slice = clamp( slice, 0, ClusterDims.z - 1 );
+
+    uvec2 cluster = texelFetch( Clusters,
+        (slice*ClusterDims.y + tile.y)*ClusterDims.x + tile.x ).xy;
+
+    for ( uint i = 0u; i < cluster.y; i++ ) {
+        int light = int( texelFetch(LightIndices, int(cluster.x + i)).x );
+        vec4 sphere = texelFetch( Lights, 2*light );
+        vec3 lightColor = texelFetch( Lights, 2*light + 1 ).rgb;
+
+        vec3  d = sphere.xyz - fPosition;
+        float dist2 = dot( d, d );
+        float radius2 = sphere.w * sphere.w;
+        if ( dist2 >= radius2 ) {
+            continue;
+        }
+
+        // Smooth falloff that reaches zero at the radius
+        float falloff = 1.0 - dist2 / radius2;
+        falloff *= falloff;
+
+        vec3 Lp = d * inversesqrt( max(dist2, 1e-8) );
+        vec3 Hp = normalize( Lp + E );
+        float Kdp = max( dot(Lp, N), 0.0 );
+        float Ksp = (Kdp > 0.0) ? pow( max(dot(N, Hp), 0.0), Shininess ) : 0.0;
+
+        color += falloff * lightColor * (Kdp*DiffuseProduct.rgb + Ksp*SpecularProduct.rgb);
+    }
+
+    fColor = vec4( color, 1.0 );
+}
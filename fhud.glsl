@@ -0,0 +1,12 @@
+#version 150
+
+in  vec2 texel;
+in  vec4 color;
+out vec4 fColor;
+
+uniform sampler2D Glyphs;          // coverage, one texel per glyph pixel
+
+void main()
+{
+    fColor = color * texelFetch( Glyphs, ivec2(texel), 0 ).r;
+}
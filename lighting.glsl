@@ -0,0 +1,37 @@
+// The per-vertex light of vshader53.glsl, for the vertex shaders that
+//   #include it.  pos and N are in eye space, N of unit length.
+
+uniform vec4 AmbientProduct, DiffuseProduct, SpecularProduct;
+uniform vec4 LightPosition;
+uniform float Shininess;
+
+// With the products of a material other than the uniforms'
+vec4 shade( vec3 pos, vec3 N, vec4 AmbientProduct, vec4 DiffuseProduct,
+            vec4 SpecularProduct, float Shininess )
+{
+    vec3 L = normalize( LightPosition.xyz - pos );
+    vec3 E = normalize( -pos );
+    vec3 H = normalize( L + E );
+
+    // Compute terms in the illumination equation
+    vec4 ambient = AmbientProduct;
+
+    float Kd = max( dot(L, N), 0.0 );
+    vec4  diffuse = Kd*DiffuseProduct;
+
+    float Ks = pow( max(dot(N, H), 0.0), Shininess );
+    vec4  specular = Ks * SpecularProduct;
+
+    if ( dot(L, N) < 0.0 ) {
+	specular = vec4(0.0, 0.0, 0.0, 1.0);
+    }
+
+    vec4 color = ambient + diffuse + specular;
+    color.a = 1.0;
+    return color;
+}
+
+vec4 shade( vec3 pos, vec3 N )
+{
+    return shade( pos, N, AmbientProduct, DiffuseProduct, SpecularProduct, Shininess );
+}
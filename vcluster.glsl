@@ -0,0 +1,20 @@
+#version 150
+
+// Eye space position and normal for the per-fragment lighting in
+//   fcluster.glsl
+
+in  vec4 vPosition;
+in  vec3 vNormal;
+out vec3 fPosition;
+out vec3 fNormal;
+
+uniform mat4 ModelView;
+uniform mat4 Projection;
+
+void main()
+{
+    fPosition = (ModelView * vPosition).xyz;
+    fNormal = (ModelView * vec4(vNormal, 0.0)).xyz;
+
+    gl_Position = Projection * ModelView * vPosition;
+}
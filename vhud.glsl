@@ -0,0 +1,20 @@
+#version 150
+
+// Overlay quads in window pixels from the top left corner.  Text samples
+//   its glyph from the glyph texture; solid quads sample its last column,
+//   which is fully set.
+
+in  vec2 vPixel;
+in  vec2 vTexel;
+in  vec4 vColor;
+out vec2 texel;
+out vec4 color;
+
+uniform vec2 WindowSize;
+
+void main()
+{
+    texel = vTexel;
+    color = vColor;
+    gl_Position = vec4( vPixel / WindowSize * vec2(2.0, -2.0) + vec2(-1.0, 1.0), 0.0, 1.0 );
+}
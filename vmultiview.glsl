@@ -0,0 +1,61 @@
+#version 150
+
+// One instance per view.  The vertex is lit once in the eye space of the
+//   recorded camera, so every view shows the same shading, and then
+//   projected into the view of its instance.  With viewport arrays in the
+//   vertex shader the instance picks its viewport; otherwise the view is
+//   squeezed into its tile of the target and the clip distances cut it off
+//   at the tile's edges.
+
+#ifdef GL_ARB_shader_viewport_layer_array
+#extension GL_ARB_shader_viewport_layer_array : enable
+#define VIEWPORT_INDEX
+#endif
+
+in  vec4 vPosition;
+in  vec3 vNormal;
+out vec4 color;
+
+const int MaxViews = 8;            // MultiView.h
+
+uniform mat4 ViewProjection[MaxViews];  // projection * eye of each view
+uniform int ViewMask;              // bit v: view v sees this node
+
+#ifndef VIEWPORT_INDEX
+out float gl_ClipDistance[4];
+uniform vec4 ViewRect[MaxViews];   // xy: scale, zw: offset of the tile
+#endif
+
+uniform mat4 ModelView;
+
+#include "lighting.glsl"
+
+void main()
+{
+    int view = gl_InstanceID;
+
+    // Transform vertex  position into eye coordinates
+    vec3 pos = (ModelView * vPosition).xyz;
+
+    // Transform vertex normal into eye coordinates
+    vec3 N = normalize( ModelView*vec4(vNormal, 0.0) ).xyz;
+    color = shade( pos, N );
+
+    vec4 clip = ViewProjection[view] * vec4(pos, 1.0);
+
+    // Views that cannot see the node get it beyond their far plane
+    if ( ((ViewMask >> view) & 1) == 0 ) {
+        clip = vec4(0.0, 0.0, 2.0, 1.0);
+    }
+
+#ifdef VIEWPORT_INDEX
+    gl_ViewportIndex = view;
+    gl_Position = clip;
+#else
+    gl_ClipDistance[0] = clip.w + clip.x;
+    gl_ClipDistance[1] = clip.w - clip.x;
+    gl_ClipDistance[2] = clip.w + clip.y;
+    gl_ClipDistance[3] = clip.w - clip.y;
+    gl_Position = vec4(clip.xy * ViewRect[view].xy + clip.w * ViewRect[view].zw, clip.zw);
+#endif
+}
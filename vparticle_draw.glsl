@@ -0,0 +1,40 @@
+#version 150
+
+// Unit sphere instanced once per particle.  Each instance reads its
+//   center and radius straight from the particle buffer, and its material
+//   through the particle's index into the material palette.
+
+in  vec4 vPosition;
+in  vec3 vNormal;
+out vec4 color;
+
+uniform samplerBuffer Particles;   // xyz: position, w: radius
+uniform usamplerBuffer ParticleMaterials;  // palette index of each particle
+uniform samplerBuffer Materials;   // ambient, diffuse, specular (shininess in w)
+
+uniform vec4 LightAmbient, LightDiffuse, LightSpecular;
+
+uniform mat4 ModelView;
+uniform mat4 Projection;
+
+#include "lighting.glsl"
+
+void main()
+{
+    vec4 body = texelFetch( Particles, gl_InstanceID );
+    vec4 world = vec4( vPosition.xyz*body.w + body.xyz, 1.0 );
+
+    // Transform vertex  position into eye coordinates
+    vec3 pos = (ModelView * world).xyz;
+
+    // Transform vertex normal into eye coordinates
+    vec3 N = normalize( ModelView*vec4(vNormal, 0.0) ).xyz;
+
+    int material = 3 * int( texelFetch( ParticleMaterials, gl_InstanceID ).r );
+    vec4 specular = texelFetch( Materials, material + 2 );
+    color = shade( pos, N, LightAmbient * texelFetch( Materials, material ),
+                   LightDiffuse * texelFetch( Materials, material + 1 ),
+                   LightSpecular * vec4( specular.rgb, 1.0 ), specular.w );
+
+    gl_Position = Projection * ModelView * world;
+}
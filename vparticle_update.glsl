@@ -0,0 +1,22 @@
+#version 150
+
+// One explicit step of every particle:  vel += acc*dt; pos += vel*dt
+//   The results are captured with transform feedback into the other
+//   half of the ping-pong buffers.
+
+in  vec4 vPosRadius;
+in  vec4 vVelDt;
+in  vec3 vAcc;
+
+out vec4 outPosRadius;
+out vec4 outVelDt;
+
+void main()
+{
+    float dt = vVelDt.w;
+    vec3 vel = vVelDt.xyz + vAcc*dt;
+    vec3 pos = vPosRadius.xyz + vel*dt;
+
+    outPosRadius = vec4( pos, vPosRadius.w );
+    outVelDt = vec4( vel, dt );
+}
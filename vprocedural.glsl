@@ -0,0 +1,141 @@
+#version 150
+
+// Unit primitives pulled from gl_VertexID alone: no vertex buffers are
+//   bound.  Vertex n recomputes the triangle that cube(), cone() and
+//   sphere() in Primitives.cpp store at n / 3, so the surfaces match the
+//   buffered meshes at any tessellation.  For GL_LINES every triangle
+//   emits its three edges as six vertices.
+
+out vec4 color;
+
+uniform int Primitive;             // CubeMesh, ConeMesh or SphereMesh
+uniform int Slices;
+uniform int Stacks;
+uniform int Lines;                 // 1 when drawn as GL_LINES
+
+uniform mat4 ModelView;
+uniform mat4 Projection;
+
+#include "lighting.glsl"
+
+const float TwoPi = 6.28318531;
+
+const vec3 cubeCorners[8] = vec3[8](
+    vec3(-0.5, -0.5,  0.5), vec3(-0.5,  0.5,  0.5),
+    vec3( 0.5,  0.5,  0.5), vec3( 0.5, -0.5,  0.5),
+    vec3(-0.5, -0.5, -0.5), vec3(-0.5,  0.5, -0.5),
+    vec3( 0.5,  0.5, -0.5), vec3( 0.5, -0.5, -0.5) );
+
+// quad(a, b, c, d) for each face, split into (a, b, c) and (a, c, d)
+const int cubeFaces[24] = int[24]( 1, 0, 3, 2,  2, 3, 7, 6,  3, 0, 4, 7,
+                                   6, 5, 1, 2,  4, 5, 6, 7,  5, 4, 0, 1 );
+const int quadCorners[6] = int[6]( 0, 1, 2,  0, 2, 3 );
+
+vec3 evalCircle(float u)
+{
+    return vec3(cos(u), sin(u), 0.0);
+}
+
+vec3 evalSphere(float u, float v)
+{
+    return vec3(cos(u)*sin(v), sin(u)*sin(v), cos(v));
+}
+
+// Corners of triangle t.  rounded is set where the generator used the
+//   position as the normal, cleared where it used the face normal.
+void triangle(int t, out vec3 p[3], out bool rounded)
+{
+    rounded = false;
+
+    if ( Primitive == 0 ) {
+        int face = 4 * (t / 2), second = 3 * (t % 2);
+        for ( int c = 0; c < 3; c++ ) {
+            p[c] = cubeCorners[ cubeFaces[face + quadCorners[second + c]] ];
+        }
+        return;
+    }
+
+    float uRad = TwoPi / float(Slices);
+    int i = t % Slices;
+    int next = (i + 1 == Slices) ? 0 : i + 1;
+
+    if ( Primitive == 1 ) {
+        p[0] = vec3(0.0, 0.0, 1.0);
+        p[1] = evalCircle(float(i) * uRad);
+        p[2] = evalCircle(float(next) * uRad);
+        return;
+    }
+
+    float vRad = TwoPi / float(Stacks);
+    int middle = 2 * Slices * (Stacks - 3);
+
+    if ( t < Slices ) {
+        // first stack: a fan around the north pole
+        rounded = true;
+        p[0] = vec3(0.0, 0.0, 1.0);
+        p[1] = evalSphere(float(i) * uRad, vRad);
+        p[2] = evalSphere(float(next) * uRad, vRad);
+    }
+    else if ( t < Slices + middle ) {
+        // middle stacks: two triangles per quad
+        int q = (t - Slices) / 2;
+        float j = float(1 + q / Slices);
+        i = q % Slices;
+        next = (i + 1 == Slices) ? 0 : i + 1;
+
+        rounded = true;
+        vec3 p1 = evalSphere(float(i) * uRad, j * vRad);
+        vec3 p3 = evalSphere(float(next) * uRad, (j + 1.0) * vRad);
+        if ( (t - Slices) % 2 == 0 ) {
+            p[0] = p1; p[1] = evalSphere(float(i) * uRad, (j + 1.0) * vRad); p[2] = p3;
+        }
+        else {
+            p[0] = p1; p[1] = p3; p[2] = evalSphere(float(next) * uRad, j * vRad);
+        }
+    }
+    else {
+        // last stack: a fan around the south pole, the closing triangle
+        //   wound the other way as in sphere()
+        i = t - Slices - middle;
+        float v = float(Stacks - 1) * vRad;
+        p[0] = vec3(0.0, 0.0, -1.0);
+        if ( i + 1 < Slices ) {
+            p[1] = evalSphere(float(i + 1) * uRad, v);
+            p[2] = evalSphere(float(i) * uRad, v);
+        }
+        else {
+            p[1] = evalSphere(float(i) * uRad, v);
+            p[2] = evalSphere(0.0, v);
+        }
+    }
+}
+
+void main()
+{
+    int t, corner;
+    if ( Lines == 1 ) {
+        t = gl_VertexID / 6;
+        corner = ((gl_VertexID % 6) / 2 + gl_VertexID % 2) % 3;
+    }
+    else {
+        t = gl_VertexID / 3;
+        corner = gl_VertexID % 3;
+    }
+
+    vec3 p[3];
+    bool rounded;
+    triangle(t, p, rounded);
+
+    vec4 vPosition = vec4(p[corner], 1.0);
+    vec3 vNormal = rounded ? normalize(p[corner]) :
+        normalize(cross(p[1] - p[0], p[2] - p[1]));
+
+    // Transform vertex  position into eye coordinates
+    vec3 pos = (ModelView * vPosition).xyz;
+
+    // Transform vertex normal into eye coordinates
+    vec3 N = normalize( ModelView*vec4(vNormal, 0.0) ).xyz;
+    color = shade( pos, N );
+
+    gl_Position = Projection * ModelView * vPosition;
+}
@@ -0,0 +1,41 @@
+#version 150
+
+// Cube instanced once per robot arm for one of its parts.  Each instance
+//   reads the matrix of its joint from the palette: three rows of a 3x4
+//   matrix per joint, three joints per arm.
+
+in  vec4 vPosition;
+in  vec3 vNormal;
+out vec4 color;
+
+uniform samplerBuffer Joints;
+uniform int Joint;                 // the joint that carries this part
+uniform mat4 Part;                 // the box of the part in joint space
+
+uniform mat4 ModelView;
+uniform mat4 Projection;
+
+#include "lighting.glsl"
+
+void main()
+{
+    int row = 3 * (3 * gl_InstanceID + Joint);
+    vec4 r0 = texelFetch( Joints, row );
+    vec4 r1 = texelFetch( Joints, row + 1 );
+    vec4 r2 = texelFetch( Joints, row + 2 );
+
+    vec4 local = Part * vPosition;
+    vec4 world = vec4( dot(r0, local), dot(r1, local), dot(r2, local), 1.0 );
+
+    vec4 n = Part * vec4(vNormal, 0.0);
+    vec4 worldNormal = vec4( dot(r0, n), dot(r1, n), dot(r2, n), 0.0 );
+
+    // Transform vertex  position into eye coordinates
+    vec3 pos = (ModelView * world).xyz;
+
+    // Transform vertex normal into eye coordinates
+    vec3 N = normalize( ModelView*worldNormal ).xyz;
+    color = shade( pos, N );
+
+    gl_Position = Projection * ModelView * world;
+}